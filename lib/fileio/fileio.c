@@ -4,94 +4,257 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
 
-#include "include/common.h"
+int read_available(int fd, void *buf, size_t len) {
+    ssize_t ret;
+    int ret_final = -1;
+
+    do {
+        ret = read(fd, buf, len);
+    } while (ret < 0 && EINTR == errno);
 
-#define CHUNK_SIZE 4096
-#define BLOCK_LIMIT 5
-#define SLEEP_USECONDS 100
+    if (ret < 0) {
+        if (EAGAIN == errno || EWOULDBLOCK == errno) {
+            ret_final = 0;
+            goto out_would_block;
+        }
+        printf("ERRO: failed to read from fd %d\n", fd);
+        goto error_out_read_error;
+    } else if (0 == ret) {
+        printf("WARN: read zero bytes from %d\n", fd);
+        goto error_out_fd_closed;
+    }
 
-int reliable_read(int fd, void *buf, size_t len) {
+    ret_final = ret;
+out_would_block:
+error_out_fd_closed:
+error_out_read_error:
+    return ret_final;
+}
+
+int read_full(int fd, void *buf, size_t len) {
     uint8_t *buf_iter = (uint8_t *)buf;
     size_t bytes_read = 0;
-    size_t chunk;
     ssize_t ret;
-    int block_counter = 0;
-    int ret_final = -1;
+    int ret_final = EXIT_FAILURE;
 
     while (bytes_read < len) {
-        chunk = MIN((len - bytes_read), CHUNK_SIZE);
-        ret = read(fd, &buf_iter[bytes_read], chunk);
-
-        if (block_counter > BLOCK_LIMIT) {
-            printf("ERRO: fd %d blocked too many times on read\n", fd);
-            goto error_out_block;
+        ret = read(fd, &buf_iter[bytes_read], len - bytes_read);
+        if (ret < 0 && EINTR == errno) {
+            continue;
         }
-
         if (ret < 0) {
-            if (EAGAIN == errno) {
-                block_counter++;
-                usleep(SLEEP_USECONDS);
-                continue;
-            }
             printf("ERRO: failed to read from fd %d\n", fd);
             goto error_out_read_error;
         } else if (0 == ret) {
-            printf("WARN: read zero bytes from %d\n", fd);
+            printf("WARN: fd %d closed before %zu bytes were read\n",
+                   fd,
+                   len);
             goto error_out_fd_closed;
         }
         bytes_read += ret;
     }
 
-    ret_final = bytes_read;
-    return ret_final;
+    ret_final = EXIT_SUCCESS;
 error_out_fd_closed:
-    // closed during middle of read?
-    // notify calling function?
-    ret_final = 0;
 error_out_read_error:
-error_out_block:
     return ret_final;
 }
 
-int reliable_write(int fd, void *buf, size_t len) {
-    uint8_t *buf_iter = (uint8_t *)buf;
-    size_t bytes_sent = 0;
-    size_t chunk;
+int recv_fd(int sock, int *fd, void *buf, size_t len) {
+    union {
+        struct cmsghdr hdr;
+        uint8_t buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    ssize_t ret;
+    int ret_final = EXIT_FAILURE;
+
+    *fd = -1;
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    do {
+        ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (ret < 0 && EINTR == errno);
+
+    if (ret < 0) {
+        printf("ERRO: failed to receive from fd %d\n", sock);
+        goto error_out_recvmsg;
+    } else if (0 == ret) {
+        printf("WARN: fd %d closed\n", sock);
+        goto error_out_recvmsg;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (NULL != cmsg
+        && SOL_SOCKET == cmsg->cmsg_level
+        && SCM_RIGHTS == cmsg->cmsg_type) {
+        memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+
+    if (EXIT_FAILURE == read_full(sock,
+                                  (uint8_t *)buf + ret,
+                                  len - (size_t)ret)) {
+        goto error_out_read_full;
+    }
+
+    ret_final = EXIT_SUCCESS;
+    return ret_final;
+error_out_read_full:
+    if (-1 != *fd) {
+        close(*fd);
+        *fd = -1;
+    }
+error_out_recvmsg:
+    return ret_final;
+}
+
+int recv_zerocopy_completion(int fd, uint32_t *lo, uint32_t *hi, bool *copied) {
+    union {
+        struct cmsghdr hdr;
+        uint8_t buf[CMSG_SPACE(sizeof(struct sock_extended_err))];
+    } control;
+    struct sock_extended_err err;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
     ssize_t ret;
-    int block_counter = 0;
     int ret_final = -1;
 
-    while (bytes_sent < len) {
-        chunk = MIN((len - bytes_sent), CHUNK_SIZE);
-        ret = write(fd, &buf_iter[bytes_sent], chunk);
+    do {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
 
-        if (block_counter > BLOCK_LIMIT) {
-            printf("ERRO: fd %d blocked too many times on write\n", fd);
-            goto error_out_block;
-        }
+        do {
+            ret = recvmsg(fd, &msg, MSG_ERRQUEUE);
+        } while (ret < 0 && EINTR == errno);
 
         if (ret < 0) {
-            if (EAGAIN == errno) {
-                block_counter++;
-                usleep(SLEEP_USECONDS);
-                continue;
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                ret_final = 0;
+                goto out_empty;
             }
+            printf("ERRO: failed to read error queue of fd %d\n", fd);
+            goto error_out_recvmsg;
+        }
+
+        err.ee_origin = 0;
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if (NULL != cmsg
+            && ((SOL_IP == cmsg->cmsg_level && IP_RECVERR == cmsg->cmsg_type)
+                || (SOL_IPV6 == cmsg->cmsg_level
+                    && IPV6_RECVERR == cmsg->cmsg_type))) {
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+        }
+    } while (SO_EE_ORIGIN_ZEROCOPY != err.ee_origin);
+
+    *lo = err.ee_info;
+    *hi = err.ee_data;
+    *copied = (0 != (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED));
+
+    ret_final = 1;
+out_empty:
+error_out_recvmsg:
+    return ret_final;
+}
+
+int send_fd(int sock, int fd, const void *buf, size_t len) {
+    union {
+        struct cmsghdr hdr;
+        uint8_t buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    size_t sent = 0;
+    ssize_t ret;
+    int ret_final = EXIT_FAILURE;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (-1 != fd) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    while (sent < len) {
+        iov.iov_base = (uint8_t *)buf + sent;
+        iov.iov_len = len - sent;
 
-            printf("ERRO: failed to write to fd %d\n", fd);
-            goto error_out_write_error;
+        ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (ret < 0 && EINTR == errno) {
+            continue;
+        }
+        if (ret < 0) {
+            printf("ERRO: failed to send to fd %d\n", sock);
+            goto error_out_sendmsg;
         }
+        sent += ret;
 
-        bytes_sent += ret;
+        // the fd goes with the first bytes, the rest is plain data
+        msg.msg_control = NULL;
+        msg.msg_controllen = 0;
     }
 
-    ret_final = bytes_sent;
+    ret_final = EXIT_SUCCESS;
+error_out_sendmsg:
+    return ret_final;
+}
+
+int sendv_available(int fd, struct iovec *iov, int iovcnt, int flags) {
+    struct msghdr msg;
+    ssize_t ret;
+    int ret_final = -1;
+
+    // writev() can't suppress SIGPIPE, sendmsg() takes the same buffers
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    do {
+        ret = sendmsg(fd, &msg, MSG_NOSIGNAL | flags);
+    } while (ret < 0 && EINTR == errno);
+
+    if (ret < 0) {
+        if (EAGAIN == errno || EWOULDBLOCK == errno) {
+            ret_final = 0;
+            goto out_would_block;
+        }
+        if (ENOBUFS == errno && 0 != (flags & MSG_ZEROCOPY)) {
+            goto error_out_zerocopy;
+        }
+        printf("ERRO: failed to send to fd %d\n", fd);
+        goto error_out_send_error;
+    }
 
-error_out_write_error:
-error_out_block:
+    ret_final = ret;
+out_would_block:
+error_out_send_error:
+error_out_zerocopy:
     return ret_final;
 }
 
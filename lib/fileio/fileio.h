@@ -3,11 +3,106 @@
 #ifndef LIB_FILEIO_FILEIO_H_
 #define LIB_FILEIO_FILEIO_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
-int reliable_read(int fd, void *buf, size_t len);
+/**
+ * Read the bytes that are available on a nonblocking fd.
+ *
+ * Never waits for more bytes to arrive.
+ *
+ * @param fd (int) - Nonblocking file descriptor.
+ * @param buf (void *) - Buffer to store bytes.
+ * @param len (size_t) - Size of buffer.
+ * @fail - Fail to read from fd.
+ * @fail - fd closed on other end.
+ * @return (int) - Number of bytes read on success, 0 if no bytes are
+ *                 available, -1 on failure.
+ */
+int read_available(int fd, void *buf, size_t len);
+
+/**
+ * Read exactly len bytes from a blocking fd.
+ *
+ * @param fd (int) - Blocking file descriptor.
+ * @param buf (void *) - Buffer to store bytes.
+ * @param len (size_t) - Number of bytes to read.
+ * @fail - Fail to read from fd.
+ * @fail - fd closed on other end.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int read_full(int fd, void *buf, size_t len);
+
+/**
+ * Receive bytes and an optional file descriptor from a unix socket.
+ *
+ * Reads exactly len bytes, the file descriptor has to arrive with the
+ * first of them.
+ *
+ * @param sock (int) - Blocking unix socket.
+ * @param fd (int *) - Received file descriptor, -1 if none was sent.
+ * @param buf (void *) - Buffer to store bytes.
+ * @param len (size_t) - Number of bytes to receive.
+ * @open - Received file descriptor.
+ * @fail - Fail to receive from socket.
+ * @fail - Socket closed on other end.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int recv_fd(int sock, int *fd, void *buf, size_t len);
 
-int reliable_write(int fd, void *buf, size_t len);
+/**
+ * Receive the next zerocopy completion from a socket's error queue.
+ *
+ * Every MSG_ZEROCOPY send that accepted bytes gets the next id of the
+ * socket, a completion reports a range of ids whose buffers the kernel no
+ * longer reads. Other messages on the error queue are skipped. Never waits.
+ *
+ * @param fd (int) - Nonblocking socket with SO_ZEROCOPY enabled.
+ * @param lo (uint32_t *) - Id of first completed send.
+ * @param hi (uint32_t *) - Id of last completed send.
+ * @param copied (bool *) - true if the kernel copied the bytes after all.
+ * @fail - Fail to receive from error queue.
+ * @return (int) - 1 if a completion was received, 0 if the error queue is
+ *                 empty, -1 on failure.
+ */
+int recv_zerocopy_completion(int fd, uint32_t *lo, uint32_t *hi, bool *copied);
+
+/**
+ * Send bytes and an optional file descriptor over a unix socket.
+ *
+ * Waits until every byte has been sent. The file descriptor is passed with
+ * SCM_RIGHTS, the receiver gets its own copy that refers to the same open
+ * file. Does not raise SIGPIPE if the other end closed the socket.
+ *
+ * @param sock (int) - Blocking unix socket.
+ * @param fd (int) - File descriptor to pass, -1 to only send bytes.
+ * @param buf (const void *) - Bytes to send, at least one.
+ * @param len (size_t) - Number of bytes to send.
+ * @fail - Fail to send to socket.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int send_fd(int sock, int fd, const void *buf, size_t len);
+
+/**
+ * Send as many bytes of several buffers as a nonblocking socket accepts.
+ *
+ * The buffers are sent in order with one sendmsg(). Never waits for the
+ * socket to become writable. Does not raise SIGPIPE if the other end
+ * closed the connection. With MSG_ZEROCOPY the buffers must not change
+ * until recv_zerocopy_completion() reports the send, and ENOBUFS is left
+ * in errno without an error message so the caller can copy instead.
+ *
+ * @param fd (int) - Nonblocking socket.
+ * @param iov (struct iovec *) - Buffers to send.
+ * @param iovcnt (int) - Number of buffers, at most UIO_MAXIOV.
+ * @param flags (int) - 0 or MSG_ZEROCOPY.
+ * @fail - Fail to send to fd.
+ * @return (int) - Number of bytes sent on success, 0 if the socket buffer is
+ *                 full, -1 on failure.
+ */
+int sendv_available(int fd, struct iovec *iov, int iovcnt, int flags);
 
 /**
  * Set File descriptor to nonblocking.
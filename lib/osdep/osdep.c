@@ -1,12 +1,24 @@
 // Copyright 2020 author. All rights reserved.
 
+// accept4(), memfd_create()
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "lib/osdep/osdep.h"
 
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -14,6 +26,13 @@ int os_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
     return accept(sockfd, addr, addrlen);
 }
 
+int os_accept4(int sockfd,
+               struct sockaddr *addr,
+               socklen_t *addrlen,
+               int flags) {
+    return accept4(sockfd, addr, addrlen, flags);
+}
+
 int os_bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
     return bind(sockfd, addr, addrlen);
 }
@@ -22,26 +41,100 @@ int os_close(int fd) {
     return close(fd);
 }
 
-int os_fd_isset(int fd, fd_set *set) {
-    return FD_ISSET(fd, set);
+int os_dup(int oldfd) {
+    return dup(oldfd);
+}
+
+int os_epoll_create1(int flags) {
+    return epoll_create1(flags);
+}
+
+int os_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    return epoll_ctl(epfd, op, fd, event);
+}
+
+int os_epoll_wait(int epfd,
+                  struct epoll_event *events,
+                  int maxevents,
+                  int timeout) {
+    return epoll_wait(epfd, events, maxevents, timeout);
+}
+
+int os_eventfd(unsigned int initval, int flags) {
+    return eventfd(initval, flags);
+}
+
+int os_eventfd_read(int fd, uint64_t *value) {
+    return eventfd_read(fd, value);
+}
+
+int os_eventfd_write(int fd, uint64_t value) {
+    return eventfd_write(fd, value);
+}
+
+int os_execv(const char *path, char *const argv[]) {
+    return execv(path, argv);
 }
 
-void os_fd_set(int fd, fd_set *set) {
-    FD_SET(fd, set);
+void os_exit(int status) {
+    _exit(status);
 }
 
-void os_fd_zero(fd_set *set) {
-    FD_ZERO(set);
+pid_t os_fork(void) {
+    return fork();
 }
 
 void os_free(void *ptr) {
     free(ptr);
 }
 
+int os_ftruncate(int fd, off_t length) {
+    return ftruncate(fd, length);
+}
+
 int os_get_error(void) {
     return errno;
 }
 
+int os_get_num_cpus(void) {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return num_cpus > 0 ? (int)num_cpus : 1;
+}
+
+size_t os_get_page_size(void) {
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+int os_getsockopt(int sockfd,
+                  int level,
+                  int optname,
+                  void *optval,
+                  socklen_t *optlen) {
+    return getsockopt(sockfd, level, optname, optval, optlen);
+}
+
+int os_io_uring_enter(int fd,
+                      unsigned to_submit,
+                      unsigned min_complete,
+                      unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter,
+                        fd,
+                        to_submit,
+                        min_complete,
+                        flags,
+                        NULL,
+                        0);
+}
+
+int os_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int os_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
 int os_listen(int sockfd, int backlog) {
     return listen(sockfd, backlog);
 }
@@ -60,16 +153,67 @@ void *os_memcpy(void *dest, const void *src, size_t n) {
     return memcpy(dest, src, n);
 }
 
+int os_memfd_create(const char *name, unsigned int flags) {
+    return memfd_create(name, flags);
+}
+
 void *os_memset(void *s, int c, size_t n) {
     return memset(s, c, n);
 }
 
-int os_select(int nfds,
-              fd_set *readfds,
-              fd_set *writefds,
-              fd_set *exceptfds,
-              struct timeval *timeout) {
-    return select(nfds, readfds, writefds, exceptfds, timeout);
+void *os_mmap(void *addr,
+              size_t length,
+              int prot,
+              int flags,
+              int fd,
+              off_t offset) {
+    return mmap(addr, length, prot, flags, fd, offset);
+}
+
+uint64_t os_monotonic_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+int os_munmap(void *addr, size_t length) {
+    return munmap(addr, length);
+}
+
+int os_pthread_create(pthread_t *thread,
+                      os_thread_func start_routine,
+                      void *arg) {
+    return pthread_create(thread, NULL, start_routine, arg);
+}
+
+int os_pthread_join(pthread_t thread) {
+    return pthread_join(thread, NULL);
+}
+
+int os_pthread_mutex_destroy(pthread_mutex_t *mutex) {
+    return pthread_mutex_destroy(mutex);
+}
+
+int os_pthread_mutex_init(pthread_mutex_t *mutex) {
+    return pthread_mutex_init(mutex, NULL);
+}
+
+int os_pthread_mutex_lock(pthread_mutex_t *mutex) {
+    return pthread_mutex_lock(mutex);
+}
+
+int os_pthread_mutex_unlock(pthread_mutex_t *mutex) {
+    return pthread_mutex_unlock(mutex);
+}
+
+int os_pthread_sigmask(int how, const sigset_t *set, sigset_t *oldset) {
+    return pthread_sigmask(how, set, oldset);
+}
+
+void *os_realloc(void *ptr, size_t size) {
+    return realloc(ptr, size);
 }
 
 int os_setsockopt(int sockfd,
@@ -84,6 +228,14 @@ int os_socket(int domain, int type, int protocol) {
     return socket(domain, type, protocol);
 }
 
+int os_socketpair(int domain, int type, int protocol, int *sv) {
+    return socketpair(domain, type, protocol, sv);
+}
+
 uint32_t os_timestamp(void) {
     return (uint32_t)time(NULL);
 }
+
+pid_t os_waitpid(pid_t pid, int *status, int options) {
+    return waitpid(pid, status, options);
+}
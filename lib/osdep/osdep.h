@@ -3,9 +3,15 @@
 #ifndef LIB_OSDEP_OSDEP_H_
 #define LIB_OSDEP_OSDEP_H_
 
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/types.h>
+
+typedef void *(*os_thread_func)(void *arg);
 
 /**
  * Wrapper for accept().
@@ -17,6 +23,21 @@
  */
 int os_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 
+/**
+ * Wrapper for accept4().
+ *
+ * @param sockfd (int) - The listen socket.
+ * @param addr (struct sockaddr *) - Pointer to a sockaddr structure.
+ * @param addrlen (socklen_t *) - The size, in bytes, of the structure
+ *                                pointed to by addr.
+ * @param flags (int) - SOCK_NONBLOCK and SOCK_CLOEXEC for the new fd.
+ * @return (int) - File descriptor on success, -1 on failure.
+ */
+int os_accept4(int sockfd,
+               struct sockaddr *addr,
+               socklen_t *addrlen,
+               int flags);
+
 /**
  * Wrapper for bind().
  *
@@ -37,28 +58,99 @@ int os_bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
 int os_close(int fd);
 
 /**
- * Wrapper for FD_ISSET().
+ * Wrapper for dup().
+ *
+ * The duplicate does not have FD_CLOEXEC set.
+ *
+ * @param oldfd (int) - File descriptor to duplicate.
+ * @return (int) - New file descriptor on success, -1 on failure.
+ */
+int os_dup(int oldfd);
+
+/**
+ * Wrapper for epoll_create1().
+ *
+ * @param flags (int) - Flags for the epoll instance, 0 or EPOLL_CLOEXEC.
+ * @return (int) - File descriptor for epoll instance on success, -1 on failure.
+ */
+int os_epoll_create1(int flags);
+
+/**
+ * Wrapper for epoll_ctl().
+ *
+ * @param epfd (int) - File descriptor of epoll instance.
+ * @param op (int) - EPOLL_CTL_ADD, EPOLL_CTL_MOD or EPOLL_CTL_DEL.
+ * @param fd (int) - Target file descriptor.
+ * @param event (struct epoll_event *) - Events to monitor, ignored for EPOLL_CTL_DEL.
+ * @return (int) - 0 on success, -1 on failure.
+ */
+int os_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+
+/**
+ * Wrapper for epoll_wait().
+ *
+ * @param epfd (int) - File descriptor of epoll instance.
+ * @param events (struct epoll_event *) - Buffer to store ready events.
+ * @param maxevents (int) - Number of events the buffer can hold.
+ * @param timeout (int) - Timeout in milliseconds, -1 to block indefinitely.
+ * @errno - On failure, errno is set.
+ * @return (int) - The number of file descriptors ready on success, -1 on failure.
+ */
+int os_epoll_wait(int epfd,
+                  struct epoll_event *events,
+                  int maxevents,
+                  int timeout);
+
+/**
+ * Wrapper for eventfd().
+ *
+ * @param initval (unsigned int) - Initial value of the counter.
+ * @param flags (int) - EFD_* flags.
+ * @return (int) - File descriptor on success, -1 on failure.
+ */
+int os_eventfd(unsigned int initval, int flags);
+
+/**
+ * Wrapper for eventfd_read().
+ *
+ * @param fd (int) - File descriptor of eventfd.
+ * @param value (uint64_t *) - Counter value, the counter is reset to 0.
+ * @return (int) - 0 on success, -1 on failure.
+ */
+int os_eventfd_read(int fd, uint64_t *value);
+
+/**
+ * Wrapper for eventfd_write().
  *
- * @param fd (int) - File descriptor.
- * @param set (fd_set *) - File descriptor set.
- * @return (int) - 1 if fd is in set, 0 otherwise.
+ * @param fd (int) - File descriptor of eventfd.
+ * @param value (uint64_t) - Value to add to the counter.
+ * @return (int) - 0 on success, -1 on failure.
  */
-int os_fd_isset(int fd, fd_set *set);
+int os_eventfd_write(int fd, uint64_t value);
 
 /**
- * Wrapper for FD_SET().
+ * Wrapper for execv().
  *
- * @param fd (int) - File descriptor.
- * @param set (fd_set *) - File descriptor set.
+ * @param path (const char *) - Program to execute.
+ * @param argv (char *const []) - Arguments, terminated by NULL.
+ * @return (int) - Does not return on success, -1 on failure.
  */
-void os_fd_set(int fd, fd_set *set);
+int os_execv(const char *path, char *const argv[]);
 
 /**
- * Wrapper for FD_ZERO().
+ * Wrapper for _exit().
  *
- * @param set (fd_set *) - File descriptor set.
+ * @param status (int) - Exit status.
  */
-void os_fd_zero(fd_set *set);
+void os_exit(int status);
+
+/**
+ * Wrapper for fork().
+ *
+ * @return (pid_t) - 0 in the child, pid of the child in the parent, -1 on
+ *                   failure.
+ */
+pid_t os_fork(void);
 
 /**
  * Wrapper for free().
@@ -67,6 +159,15 @@ void os_fd_zero(fd_set *set);
  */
 void os_free(void * ptr);
 
+/**
+ * Wrapper for ftruncate().
+ *
+ * @param fd (int) - File descriptor opened for writing.
+ * @param length (off_t) - New size of the file.
+ * @return (int) - 0 on success, -1 on failure.
+ */
+int os_ftruncate(int fd, off_t length);
+
 /**
  * Get error number.
  *
@@ -74,6 +175,72 @@ void os_free(void * ptr);
  */
 int os_get_error(void);
 
+/**
+ * Wrapper for the io_uring_enter() system call.
+ *
+ * @param fd (int) - File descriptor of io_uring instance.
+ * @param to_submit (unsigned) - Number of submission queue entries to submit.
+ * @param min_complete (unsigned) - Number of completions to wait for.
+ * @param flags (unsigned) - IORING_ENTER_* flags.
+ * @errno - On failure, errno is set.
+ * @return (int) - Number of entries submitted on success, -1 on failure.
+ */
+int os_io_uring_enter(int fd,
+                      unsigned to_submit,
+                      unsigned min_complete,
+                      unsigned flags);
+
+/**
+ * Wrapper for the io_uring_register() system call.
+ *
+ * @param fd (int) - File descriptor of io_uring instance.
+ * @param opcode (unsigned) - IORING_REGISTER_* opcode.
+ * @param arg (void *) - Argument for opcode.
+ * @param nr_args (unsigned) - Number of arguments.
+ * @return (int) - 0 or positive value on success, -1 on failure.
+ */
+int os_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args);
+
+/**
+ * Wrapper for the io_uring_setup() system call.
+ *
+ * @param entries (unsigned) - Number of submission queue entries.
+ * @param params (struct io_uring_params *) - Setup parameters, filled in
+ *                                            with ring offsets on success.
+ * @return (int) - File descriptor of io_uring instance on success, -1 on failure.
+ */
+int os_io_uring_setup(unsigned entries, struct io_uring_params *params);
+
+/**
+ * Get the number of online processors.
+ *
+ * @return (int) - Number of online processors, at least 1.
+ */
+int os_get_num_cpus(void);
+
+/**
+ * Get the size of a memory page.
+ *
+ * @return (size_t) - Page size in bytes.
+ */
+size_t os_get_page_size(void);
+
+/**
+ * Wrapper for getsockopt().
+ *
+ * @param sockfd (int) - File descriptor of socket.
+ * @param level (int) - Protocol level of option.
+ * @param optname (int) - Option to get.
+ * @param optval (void *) - Buffer to store option value.
+ * @param optlen (socklen_t *) - Size of buffer, set to size of value.
+ * @return (int) - 0 on success, -1 on failure.
+ */
+int os_getsockopt(int sockfd,
+                  int level,
+                  int optname,
+                  void *optval,
+                  socklen_t *optlen);
+
 /**
  * Wrapper for listen().
  *
@@ -101,6 +268,15 @@ void *os_malloc(size_t size);
  */
 void *os_memcpy(void *dest, const void *src, size_t n);
 
+/**
+ * Wrapper for memfd_create().
+ *
+ * @param name (const char *) - Name of the file, only used for debugging.
+ * @param flags (unsigned int) - MFD_* flags.
+ * @return (int) - File descriptor on success, -1 on failure.
+ */
+int os_memfd_create(const char *name, unsigned int flags);
+
 /**
  * Wrapper for memset().
  *
@@ -112,21 +288,111 @@ void *os_memcpy(void *dest, const void *src, size_t n);
 void *os_memset(void *s, int c, size_t n);
 
 /**
- * Wrapper for select().
+ * Wrapper for mmap().
  *
- * @param nfds (int) - The highest-numbered file descriptor, plus 1.
- * @param readfds (fd_set *) - Read fd set.
- * @param writefds (fd_set *) - Write fd set.
- * @param exceptfds (fd_set *) - Except fd set.
- * @param timeout (struct timeval *) - Timeout for select blocking.
- * @errno - On failure, errno is set.
- * @return (int) - The number of file descriptors ready on success, -1 on failure.
+ * @param addr (void *) - Hint for the mapping address, usually NULL.
+ * @param length (size_t) - Length of the mapping.
+ * @param prot (int) - Memory protection of the mapping.
+ * @param flags (int) - Mapping flags.
+ * @param fd (int) - File descriptor to map, -1 for anonymous mappings.
+ * @param offset (off_t) - Offset into the file.
+ * @return (void *) - Pointer to mapping on success, MAP_FAILED on failure.
+ */
+void *os_mmap(void *addr,
+              size_t length,
+              int prot,
+              int flags,
+              int fd,
+              off_t offset);
+
+/**
+ * Get milliseconds from the monotonic clock.
+ *
+ * @return (uint64_t) - Milliseconds since an unspecified starting point.
+ */
+uint64_t os_monotonic_ms(void);
+
+/**
+ * Wrapper for munmap().
+ *
+ * @param addr (void *) - Start of the mapping.
+ * @param length (size_t) - Length of the mapping.
+ * @return (int) - 0 on success, -1 on failure.
+ */
+int os_munmap(void *addr, size_t length);
+
+/**
+ * Wrapper for pthread_create() with default attributes.
+ *
+ * @param thread (pthread_t *) - ID of new thread.
+ * @param start_routine (os_thread_func) - Function run by new thread.
+ * @param arg (void *) - Argument passed to start_routine.
+ * @return (int) - 0 on success, error number on failure.
+ */
+int os_pthread_create(pthread_t *thread,
+                      os_thread_func start_routine,
+                      void *arg);
+
+/**
+ * Wrapper for pthread_join().
+ *
+ * @param thread (pthread_t) - Thread to wait for.
+ * @return (int) - 0 on success, error number on failure.
+ */
+int os_pthread_join(pthread_t thread);
+
+/**
+ * Wrapper for pthread_mutex_destroy().
+ *
+ * @param mutex (pthread_mutex_t *) - Mutex to destroy.
+ * @return (int) - 0 on success, error number on failure.
+ */
+int os_pthread_mutex_destroy(pthread_mutex_t *mutex);
+
+/**
+ * Wrapper for pthread_mutex_init() with default attributes.
+ *
+ * @param mutex (pthread_mutex_t *) - Mutex to initialize.
+ * @return (int) - 0 on success, error number on failure.
+ */
+int os_pthread_mutex_init(pthread_mutex_t *mutex);
+
+/**
+ * Wrapper for pthread_mutex_lock().
+ *
+ * @param mutex (pthread_mutex_t *) - Mutex to lock.
+ * @return (int) - 0 on success, error number on failure.
  */
-int os_select(int nfds,
-              fd_set *readfds,
-              fd_set *writefds,
-              fd_set *exceptfds,
-              struct timeval *timeout);
+int os_pthread_mutex_lock(pthread_mutex_t *mutex);
+
+/**
+ * Wrapper for pthread_mutex_unlock().
+ *
+ * @param mutex (pthread_mutex_t *) - Mutex to unlock.
+ * @return (int) - 0 on success, error number on failure.
+ */
+int os_pthread_mutex_unlock(pthread_mutex_t *mutex);
+
+/**
+ * Wrapper for pthread_sigmask().
+ *
+ * @param how (int) - SIG_BLOCK, SIG_UNBLOCK or SIG_SETMASK.
+ * @param set (const sigset_t *) - Signals to change.
+ * @param oldset (sigset_t *) - Previous signal mask, can be NULL.
+ * @return (int) - 0 on success, error number on failure.
+ */
+int os_pthread_sigmask(int how, const sigset_t *set, sigset_t *oldset);
+
+/**
+ * Wrapper for realloc().
+ *
+ * Memory beyond the old size is not initialized.
+ *
+ * @param ptr (void *) - Pointer to memory allocated by malloc(), or NULL.
+ * @param size (size_t) - New size in bytes.
+ * @return (void *) - Pointer on success, NULL on failure.
+ */
+void *os_realloc(void *ptr, size_t size);
 
 /**
  * Wrapper for setsockopt().
@@ -154,6 +420,17 @@ int os_setsockopt(int sockfd,
  */
 int os_socket(int domain, int type, int protocol);
 
+/**
+ * Wrapper for socketpair().
+ *
+ * @param domain (int) - The socket domain.
+ * @param type (int) - The socket type.
+ * @param protocol (int) - The socket protocol.
+ * @param sv (int *) - Array of two file descriptors for the sockets.
+ * @return (int) - 0 on success, -1 on failure.
+ */
+int os_socketpair(int domain, int type, int protocol, int *sv);
+
 /**
  * Get current timestamp.
  *
@@ -161,4 +438,15 @@ int os_socket(int domain, int type, int protocol);
  */
 uint32_t os_timestamp(void);
 
+/**
+ * Wrapper for waitpid().
+ *
+ * @param pid (pid_t) - Child to wait for.
+ * @param status (int *) - Exit status of child, may be NULL.
+ * @param options (int) - WNOHANG and friends.
+ * @return (pid_t) - pid of the child on success, 0 if it is still running
+ *                   with WNOHANG, -1 on failure.
+ */
+pid_t os_waitpid(pid_t pid, int *status, int options);
+
 #endif  // LIB_OSDEP_OSDEP_H_
@@ -0,0 +1,154 @@
+// Copyright 2020 author. All rights reserved.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "lib/ring/ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "lib/osdep/osdep.h"
+
+static size_t get_ring_cap(size_t cap) {
+    size_t page_size = os_get_page_size();
+
+    return (cap + page_size - 1) / page_size * page_size;
+}
+
+void ring_consume(struct ring *ring, size_t len) {
+    ring->head += len;
+    if (ring->head >= ring->cap) {
+        ring->head -= ring->cap;
+    }
+    ring->len -= len;
+}
+
+void ring_exit(struct ring *ring) {
+    if (NULL == ring->buf) {
+        return;
+    }
+
+    os_munmap(ring->buf, 2 * ring->cap);
+    ring->buf = NULL;
+    ring->cap = 0;
+    ring->head = 0;
+    ring->len = 0;
+}
+
+int ring_grow(struct ring *ring, size_t cap) {
+    struct ring new_ring;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    ret = ring_init(&new_ring, cap);
+    if (EXIT_FAILURE == ret) {
+        goto error_out_ring_init;
+    }
+
+    // the bytes are contiguous from head even if they wrap around
+    os_memcpy(new_ring.buf, &ring->buf[ring->head], ring->len);
+    new_ring.len = ring->len;
+
+    ring_exit(ring);
+    *ring = new_ring;
+
+    ret_final = EXIT_SUCCESS;
+error_out_ring_init:
+    return ret_final;
+}
+
+int ring_init(struct ring *ring, size_t cap) {
+    uint8_t *buf;
+    void *half;
+    int fd;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    cap = get_ring_cap(cap);
+
+    fd = os_memfd_create("ring", MFD_CLOEXEC);
+    if (-1 == fd) {
+        printf("ERRO: failed to create memfd for ring\n");
+        goto error_out_memfd_create;
+    }
+
+    ret = os_ftruncate(fd, cap);
+    if (-1 == ret) {
+        printf("ERRO: failed to size memfd for ring\n");
+        goto error_out_ftruncate;
+    }
+
+    // reserve room for both halves so nothing else is mapped in between
+    buf = os_mmap(NULL, 2 * cap, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == buf) {
+        printf("ERRO: failed to reserve memory for ring\n");
+        goto error_out_mmap_reserve;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        half = os_mmap(&buf[i * cap],
+                       cap,
+                       PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_FIXED,
+                       fd,
+                       0);
+        if (MAP_FAILED == half) {
+            printf("ERRO: failed to map ring\n");
+            goto error_out_mmap_half;
+        }
+    }
+
+    // the mappings keep the memory alive
+    os_close(fd);
+
+    ring->buf = buf;
+    ring->cap = cap;
+    ring->head = 0;
+    ring->len = 0;
+
+    ret_final = EXIT_SUCCESS;
+    return ret_final;
+error_out_mmap_half:
+    os_munmap(buf, 2 * cap);
+error_out_mmap_reserve:
+error_out_ftruncate:
+    os_close(fd);
+error_out_memfd_create:
+    return ret_final;
+}
+
+int ring_pool_get(struct ring_pool *pool, struct ring *ring) {
+    if (0 == pool->num_rings) {
+        return ring_init(ring, pool->cap);
+    }
+
+    pool->num_rings--;
+    *ring = pool->rings[pool->num_rings];
+    return EXIT_SUCCESS;
+}
+
+void ring_pool_put(struct ring_pool *pool, struct ring *ring) {
+    if (NULL == ring->buf) {
+        return;
+    }
+
+    if (RING_POOL_MAX == pool->num_rings
+        || ring->cap != get_ring_cap(pool->cap)) {
+        ring_exit(ring);
+        return;
+    }
+
+    ring->head = 0;
+    ring->len = 0;
+    pool->rings[pool->num_rings] = *ring;
+    pool->num_rings++;
+    ring->buf = NULL;
+    ring->cap = 0;
+}
+
+void ring_produce(struct ring *ring, size_t len) {
+    ring->len += len;
+}
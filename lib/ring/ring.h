@@ -0,0 +1,105 @@
+// Copyright 2020 author. All rights reserved.
+
+#ifndef LIB_RING_RING_H_
+#define LIB_RING_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RING_POOL_MAX 64
+
+// byte ring backed by a memfd that is mapped twice back to back, so the
+// cap bytes that follow any offset are contiguous in memory and nothing
+// has to be moved when the data wraps around
+struct ring {
+    uint8_t *buf;       // cap bytes, mapped again at buf + cap
+    size_t cap;         // multiple of the page size
+    size_t head;        // offset of the first byte, below cap
+    size_t len;         // number of bytes in the ring
+};
+
+// empty rings kept mapped for reuse, so a ring that drains doesn't hold its
+// mappings and one that fills again doesn't cost a memfd and three mmaps
+struct ring_pool {
+    struct ring rings[RING_POOL_MAX];
+    int num_rings;
+    size_t cap;         // capacity of new rings, only those are kept
+};
+
+/**
+ * Drop bytes from the front of the ring.
+ *
+ * @param ring (struct ring *) - Ring.
+ * @param len (size_t) - Number of bytes, at most ring->len.
+ */
+void ring_consume(struct ring *ring, size_t len);
+
+/**
+ * Unmap a ring.
+ *
+ * Does nothing for a ring that was never mapped.
+ *
+ * @param ring (struct ring *) - Ring.
+ */
+void ring_exit(struct ring *ring);
+
+/**
+ * Move the bytes of a ring into a bigger one.
+ *
+ * The ring is left as it was on failure.
+ *
+ * @param ring (struct ring *) - Mapped ring.
+ * @param cap (size_t) - New capacity, rounded up to the page size.
+ * @fail - Fail to map new ring.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int ring_grow(struct ring *ring, size_t cap);
+
+/**
+ * Map an empty ring.
+ *
+ * @param ring (struct ring *) - Ring to initialize.
+ * @param cap (size_t) - Capacity, rounded up to the page size.
+ * @fail - Fail to create memfd.
+ * @fail - Fail to size memfd.
+ * @fail - Fail to reserve or map both halves of the ring.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int ring_init(struct ring *ring, size_t cap);
+
+/**
+ * Take an empty ring from a pool.
+ *
+ * Maps a new ring of pool->cap if the pool is empty.
+ *
+ * @param pool (struct ring_pool *) - Pool of the calling thread.
+ * @param ring (struct ring *) - Ring to initialize.
+ * @fail - Fail to map new ring.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int ring_pool_get(struct ring_pool *pool, struct ring *ring);
+
+/**
+ * Give a ring back to a pool.
+ *
+ * Its bytes are dropped. A ring that grew beyond pool->cap, or that
+ * doesn't fit the pool, is unmapped. Does nothing for a ring that was
+ * never mapped.
+ *
+ * @param pool (struct ring_pool *) - Pool of the calling thread.
+ * @param ring (struct ring *) - Ring, left unmapped.
+ */
+void ring_pool_put(struct ring_pool *pool, struct ring *ring);
+
+/**
+ * Add bytes written behind the last byte of the ring.
+ *
+ * The caller writes up to ring->cap - ring->len bytes at
+ * &ring->buf[ring->head + ring->len] first.
+ *
+ * @param ring (struct ring *) - Ring.
+ * @param len (size_t) - Number of bytes written.
+ */
+void ring_produce(struct ring *ring, size_t len);
+
+#endif  // LIB_RING_RING_H_
@@ -0,0 +1,321 @@
+// Copyright 2020 author. All rights reserved.
+
+#include "lib/uring/uring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "lib/osdep/osdep.h"
+
+#define SQ_THREAD_IDLE_MS 1000
+#define CQ_ENTRIES_PER_SQ_ENTRY 4
+
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+int uring_init(struct uring *ring, unsigned entries, unsigned flags) {
+    struct io_uring_params params;
+    uint8_t *sq_ptr;
+    uint8_t *cq_ptr;
+    size_t sqes_sz;
+    int ret_final = EXIT_FAILURE;
+
+    os_memset(ring, 0, sizeof(struct uring));
+    os_memset(&params, 0, sizeof(params));
+    params.flags = flags | IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * CQ_ENTRIES_PER_SQ_ENTRY;
+    if (flags & IORING_SETUP_SQPOLL) {
+        params.sq_thread_idle = SQ_THREAD_IDLE_MS;
+    }
+
+    ring->ring_fd = os_io_uring_setup(entries, &params);
+    if (-1 == ring->ring_fd) {
+        printf("ERRO: failed to set up io_uring instance\n");
+        goto error_out_setup;
+    }
+    ring->flags = params.flags;
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        printf("ERRO: io_uring does not support single mmap\n");
+        goto error_out_features;
+    }
+
+    ring->sq.ring_sz = params.sq_off.array
+                       + params.sq_entries * sizeof(unsigned);
+    ring->cq.ring_sz = params.cq_off.cqes
+                       + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (ring->cq.ring_sz > ring->sq.ring_sz) {
+        ring->sq.ring_sz = ring->cq.ring_sz;
+    }
+    ring->cq.ring_sz = ring->sq.ring_sz;
+
+    ring->sq.ring_ptr = os_mmap(NULL,
+                                ring->sq.ring_sz,
+                                PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE,
+                                ring->ring_fd,
+                                IORING_OFF_SQ_RING);
+    if (MAP_FAILED == ring->sq.ring_ptr) {
+        printf("ERRO: failed to map io_uring rings\n");
+        goto error_out_mmap_rings;
+    }
+    ring->cq.ring_ptr = ring->sq.ring_ptr;
+
+    sqes_sz = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq.sqes = os_mmap(NULL,
+                            sqes_sz,
+                            PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE,
+                            ring->ring_fd,
+                            IORING_OFF_SQES);
+    if (MAP_FAILED == ring->sq.sqes) {
+        printf("ERRO: failed to map io_uring submission entries\n");
+        goto error_out_mmap_sqes;
+    }
+
+    sq_ptr = ring->sq.ring_ptr;
+    ring->sq.khead = (unsigned *)(sq_ptr + params.sq_off.head);
+    ring->sq.ktail = (unsigned *)(sq_ptr + params.sq_off.tail);
+    ring->sq.kring_mask = (unsigned *)(sq_ptr + params.sq_off.ring_mask);
+    ring->sq.kring_entries =
+        (unsigned *)(sq_ptr + params.sq_off.ring_entries);
+    ring->sq.kflags = (unsigned *)(sq_ptr + params.sq_off.flags);
+    ring->sq.array = (unsigned *)(sq_ptr + params.sq_off.array);
+
+    cq_ptr = ring->cq.ring_ptr;
+    ring->cq.khead = (unsigned *)(cq_ptr + params.cq_off.head);
+    ring->cq.ktail = (unsigned *)(cq_ptr + params.cq_off.tail);
+    ring->cq.kring_mask = (unsigned *)(cq_ptr + params.cq_off.ring_mask);
+    ring->cq.cqes = (struct io_uring_cqe *)(cq_ptr + params.cq_off.cqes);
+
+    ret_final = EXIT_SUCCESS;
+    return ret_final;
+error_out_mmap_sqes:
+    os_munmap(ring->sq.ring_ptr, ring->sq.ring_sz);
+error_out_mmap_rings:
+error_out_features:
+    os_close(ring->ring_fd);
+error_out_setup:
+    return ret_final;
+}
+
+void uring_exit(struct uring *ring) {
+    os_munmap(ring->sq.sqes,
+              *ring->sq.kring_entries * sizeof(struct io_uring_sqe));
+    os_munmap(ring->sq.ring_ptr, ring->sq.ring_sz);
+    os_close(ring->ring_fd);
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring) {
+    struct uring_sq *sq = &ring->sq;
+    struct io_uring_sqe *sqe;
+    unsigned head;
+
+    head = load_acquire(sq->khead);
+    if (sq->sqe_tail - head >= *sq->kring_entries) {
+        return NULL;
+    }
+
+    sqe = &sq->sqes[sq->sqe_tail & *sq->kring_mask];
+    sq->sqe_tail++;
+    os_memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    return sqe;
+}
+
+int uring_submit(struct uring *ring, unsigned wait_nr) {
+    struct uring_sq *sq = &ring->sq;
+    unsigned tail = *sq->ktail;
+    unsigned to_submit = sq->sqe_tail - sq->sqe_head;
+    unsigned enter_flags = 0;
+
+    while (sq->sqe_head != sq->sqe_tail) {
+        sq->array[tail & *sq->kring_mask] = sq->sqe_head & *sq->kring_mask;
+        tail++;
+        sq->sqe_head++;
+    }
+    store_release(sq->ktail, tail);
+
+    if (ring->flags & IORING_SETUP_SQPOLL) {
+        // make sure the tail update is visible before reading the flags
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (load_acquire(sq->kflags) & IORING_SQ_NEED_WAKEUP) {
+            enter_flags |= IORING_ENTER_SQ_WAKEUP;
+        } else if (0 == wait_nr) {
+            return to_submit;
+        }
+    }
+
+    if (wait_nr > 0) {
+        enter_flags |= IORING_ENTER_GETEVENTS;
+    }
+
+    return os_io_uring_enter(ring->ring_fd, to_submit, wait_nr, enter_flags);
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring) {
+    struct uring_cq *cq = &ring->cq;
+    unsigned head = *cq->khead;
+
+    if (head == load_acquire(cq->ktail)) {
+        return NULL;
+    }
+
+    return &cq->cqes[head & *cq->kring_mask];
+}
+
+void uring_cqe_seen(struct uring *ring) {
+    store_release(ring->cq.khead, *ring->cq.khead + 1);
+}
+
+int uring_init_buf_ring(struct uring *ring,
+                        struct uring_buf_ring *br,
+                        uint16_t bgid,
+                        unsigned nr_bufs,
+                        unsigned buf_size) {
+    struct io_uring_buf_reg reg;
+    size_t ring_sz = nr_bufs * sizeof(struct io_uring_buf);
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    br->br = os_mmap(NULL,
+                     ring_sz,
+                     PROT_READ | PROT_WRITE,
+                     MAP_ANONYMOUS | MAP_PRIVATE,
+                     -1,
+                     0);
+    if (MAP_FAILED == br->br) {
+        printf("ERRO: failed to map provided buffer ring\n");
+        goto error_out_mmap;
+    }
+
+    br->bufs = os_malloc(nr_bufs * buf_size);
+    if (NULL == br->bufs) {
+        printf("ERRO: failed to allocate provided buffers\n");
+        goto error_out_malloc;
+    }
+
+    os_memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)br->br;
+    reg.ring_entries = nr_bufs;
+    reg.bgid = bgid;
+    ret = os_io_uring_register(ring->ring_fd,
+                               IORING_REGISTER_PBUF_RING,
+                               &reg,
+                               1);
+    if (-1 == ret) {
+        printf("ERRO: failed to register provided buffer ring\n");
+        goto error_out_register;
+    }
+
+    br->buf_size = buf_size;
+    br->nr_bufs = nr_bufs;
+    br->bgid = bgid;
+    br->tail = 0;
+    for (unsigned i = 0; i < nr_bufs; i++) {
+        uring_recycle_buf(br, i);
+    }
+
+    ret_final = EXIT_SUCCESS;
+    return ret_final;
+error_out_register:
+    os_free(br->bufs);
+error_out_malloc:
+    os_munmap(br->br, ring_sz);
+error_out_mmap:
+    return ret_final;
+}
+
+void uring_exit_buf_ring(struct uring *ring, struct uring_buf_ring *br) {
+    struct io_uring_buf_reg reg;
+
+    os_memset(&reg, 0, sizeof(reg));
+    reg.bgid = br->bgid;
+    os_io_uring_register(ring->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    os_munmap(br->br, br->nr_bufs * sizeof(struct io_uring_buf));
+    os_free(br->bufs);
+}
+
+uint8_t *uring_get_buf(struct uring_buf_ring *br, uint16_t bid) {
+    return &br->bufs[(size_t)bid * br->buf_size];
+}
+
+void uring_recycle_buf(struct uring_buf_ring *br, uint16_t bid) {
+    struct io_uring_buf *buf = &br->br->bufs[br->tail & (br->nr_bufs - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)uring_get_buf(br, bid);
+    buf->len = br->buf_size;
+    buf->bid = bid;
+    br->tail++;
+    store_release(&br->br->tail, br->tail);
+}
+
+void uring_prep_multishot_accept(struct io_uring_sqe *sqe,
+                                 int fd,
+                                 uint64_t user_data) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_poll_add(struct io_uring_sqe *sqe,
+                         int fd,
+                         unsigned poll_mask,
+                         uint64_t user_data) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = poll_mask;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe,
+                               int fd,
+                               uint16_t bgid,
+                               uint64_t user_data) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bgid;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_send(struct io_uring_sqe *sqe,
+                     int fd,
+                     const void *buf,
+                     size_t len,
+                     int flags,
+                     uint64_t user_data) {
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->msg_flags = (uint32_t)flags;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_cancel(struct io_uring_sqe *sqe,
+                       uint64_t target,
+                       uint64_t user_data) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_timeout(struct io_uring_sqe *sqe,
+                        struct __kernel_timespec *ts,
+                        unsigned count,
+                        uint64_t user_data) {
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->off = count;
+    sqe->addr = (uint64_t)(uintptr_t)ts;
+    sqe->len = 1;
+    sqe->user_data = user_data;
+}
@@ -0,0 +1,238 @@
+// Copyright 2020 author. All rights reserved.
+
+#ifndef LIB_URING_URING_H_
+#define LIB_URING_URING_H_
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct uring_sq {
+    unsigned *khead;
+    unsigned *ktail;
+    unsigned *kring_mask;
+    unsigned *kring_entries;
+    unsigned *kflags;
+    unsigned *array;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_head;
+    unsigned sqe_tail;
+    size_t ring_sz;
+    void *ring_ptr;
+};
+
+struct uring_cq {
+    unsigned *khead;
+    unsigned *ktail;
+    unsigned *kring_mask;
+    struct io_uring_cqe *cqes;
+    size_t ring_sz;
+    void *ring_ptr;
+};
+
+struct uring {
+    struct uring_sq sq;
+    struct uring_cq cq;
+    unsigned flags;
+    int ring_fd;
+};
+
+struct uring_buf_ring {
+    struct io_uring_buf_ring *br;
+    uint8_t *bufs;
+    unsigned buf_size;
+    unsigned nr_bufs;
+    uint16_t bgid;
+    uint16_t tail;
+};
+
+/**
+ * Set up an io_uring instance and map its rings.
+ *
+ * @param ring (struct uring *) - Ring to initialize.
+ * @param entries (unsigned) - Number of submission queue entries.
+ * @param flags (unsigned) - IORING_SETUP_* flags, e.g. IORING_SETUP_SQPOLL.
+ * @open - File descriptor for io_uring instance.
+ * @fail - Fail to create io_uring instance.
+ * @fail - Kernel does not support a single mmap for both rings.
+ * @fail - Fail to map rings.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int uring_init(struct uring *ring, unsigned entries, unsigned flags);
+
+/**
+ * Unmap rings and close io_uring instance.
+ *
+ * @param ring (struct uring *) - Ring set up by uring_init().
+ * @close - File descriptor for io_uring instance.
+ */
+void uring_exit(struct uring *ring);
+
+/**
+ * Get a free submission queue entry.
+ *
+ * The entry is zeroed. It is handed to the kernel by the next call to
+ * uring_submit().
+ *
+ * @param ring (struct uring *) - Ring to get entry from.
+ * @return (struct io_uring_sqe *) - Entry on success, NULL if queue is full.
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+/**
+ * Submit queued entries and optionally wait for completions.
+ *
+ * In SQPOLL mode the kernel thread is only woken up when it has gone idle,
+ * so most submissions cost no system call.
+ *
+ * @param ring (struct uring *) - Ring to submit.
+ * @param wait_nr (unsigned) - Number of completions to wait for.
+ * @errno - On failure, errno is set.
+ * @return (int) - Number of entries submitted on success, -1 on failure.
+ */
+int uring_submit(struct uring *ring, unsigned wait_nr);
+
+/**
+ * Get the next completion queue entry without waiting.
+ *
+ * @param ring (struct uring *) - Ring to check.
+ * @return (struct io_uring_cqe *) - Entry if available, NULL otherwise.
+ */
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+
+/**
+ * Mark the entry returned by uring_peek_cqe() as consumed.
+ *
+ * @param ring (struct uring *) - Ring the entry belongs to.
+ */
+void uring_cqe_seen(struct uring *ring);
+
+/**
+ * Set up a ring of provided buffers for buffer select receives.
+ *
+ * @param ring (struct uring *) - Ring to register buffers with.
+ * @param br (struct uring_buf_ring *) - Buffer ring to initialize.
+ * @param bgid (uint16_t) - Buffer group ID.
+ * @param nr_bufs (unsigned) - Number of buffers, must be a power of 2.
+ * @param buf_size (unsigned) - Size of each buffer.
+ * @malloc br->bufs (uint8_t *) - Memory backing the buffers.
+ * @fail - Fail to map buffer ring.
+ * @fail - Fail to allocate buffers.
+ * @fail - Fail to register buffer ring.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int uring_init_buf_ring(struct uring *ring,
+                        struct uring_buf_ring *br,
+                        uint16_t bgid,
+                        unsigned nr_bufs,
+                        unsigned buf_size);
+
+/**
+ * Unregister and free a ring of provided buffers.
+ *
+ * @param ring (struct uring *) - Ring buffers are registered with.
+ * @param br (struct uring_buf_ring *) - Buffer ring to release.
+ * @free br->bufs (uint8_t *) - Memory backing the buffers.
+ */
+void uring_exit_buf_ring(struct uring *ring, struct uring_buf_ring *br);
+
+/**
+ * Get the address of a provided buffer.
+ *
+ * @param br (struct uring_buf_ring *) - Buffer ring.
+ * @param bid (uint16_t) - Buffer ID reported in the completion flags.
+ * @return (uint8_t *) - Start of the buffer.
+ */
+uint8_t *uring_get_buf(struct uring_buf_ring *br, uint16_t bid);
+
+/**
+ * Hand a provided buffer back to the kernel.
+ *
+ * @param br (struct uring_buf_ring *) - Buffer ring.
+ * @param bid (uint16_t) - Buffer ID to recycle.
+ */
+void uring_recycle_buf(struct uring_buf_ring *br, uint16_t bid);
+
+/**
+ * Prepare a multishot accept.
+ *
+ * @param sqe (struct io_uring_sqe *) - Entry to prepare.
+ * @param fd (int) - Listen socket.
+ * @param user_data (uint64_t) - Value returned in each completion.
+ */
+void uring_prep_multishot_accept(struct io_uring_sqe *sqe,
+                                 int fd,
+                                 uint64_t user_data);
+
+/**
+ * Prepare a one-shot poll for readiness of a file descriptor.
+ *
+ * @param sqe (struct io_uring_sqe *) - Entry to prepare.
+ * @param fd (int) - File descriptor to poll.
+ * @param poll_mask (unsigned) - POLL* events to wait for.
+ * @param user_data (uint64_t) - Value returned in the completion.
+ */
+void uring_prep_poll_add(struct io_uring_sqe *sqe,
+                         int fd,
+                         unsigned poll_mask,
+                         uint64_t user_data);
+
+/**
+ * Prepare a multishot receive into provided buffers.
+ *
+ * @param sqe (struct io_uring_sqe *) - Entry to prepare.
+ * @param fd (int) - Socket to receive from.
+ * @param bgid (uint16_t) - Buffer group to select buffers from.
+ * @param user_data (uint64_t) - Value returned in each completion.
+ */
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe,
+                               int fd,
+                               uint16_t bgid,
+                               uint64_t user_data);
+
+/**
+ * Prepare a send.
+ *
+ * @param sqe (struct io_uring_sqe *) - Entry to prepare.
+ * @param fd (int) - Socket to send to.
+ * @param buf (const void *) - Data to send, must stay valid until completion.
+ * @param len (size_t) - Number of bytes to send.
+ * @param flags (int) - MSG_* flags.
+ * @param user_data (uint64_t) - Value returned in the completion.
+ */
+void uring_prep_send(struct io_uring_sqe *sqe,
+                     int fd,
+                     const void *buf,
+                     size_t len,
+                     int flags,
+                     uint64_t user_data);
+
+/**
+ * Prepare cancellation of a request.
+ *
+ * @param sqe (struct io_uring_sqe *) - Entry to prepare.
+ * @param target (uint64_t) - user_data of the request to cancel.
+ * @param user_data (uint64_t) - Value returned in the completion.
+ */
+void uring_prep_cancel(struct io_uring_sqe *sqe,
+                       uint64_t target,
+                       uint64_t user_data);
+
+/**
+ * Prepare a timeout that completes after a relative time.
+ *
+ * With a count, the timeout also completes once count other completions
+ * were posted, whichever comes first.
+ *
+ * @param sqe (struct io_uring_sqe *) - Entry to prepare.
+ * @param ts (struct __kernel_timespec *) - Relative timeout, must stay valid
+ *                                         until the entry is submitted.
+ * @param count (unsigned) - Completions to wait for, 0 for none.
+ * @param user_data (uint64_t) - Value returned in the completion.
+ */
+void uring_prep_timeout(struct io_uring_sqe *sqe,
+                        struct __kernel_timespec *ts,
+                        unsigned count,
+                        uint64_t user_data);
+
+#endif  // LIB_URING_URING_H_
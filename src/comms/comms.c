@@ -5,23 +5,173 @@
 #include <endian.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/select.h>
+#include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 
+#include "include/common.h"
+#include "lib/fileio/fileio.h"
 #include "lib/osdep/osdep.h"
 #include "src/comms/comms_internal.h"
+#include "src/stats/stats.h"
+#include "src/timer/timer.h"
 #include "src/user/user.h"
 
-int init_listen_sock() {
+#define MAX_EVENTS 256
+
+static int listen_backlog = SOMAXCONN;
+
+static struct sock_profile sock_profiles[] = {
+    {
+        .name = "default",
+    },
+    {
+        // push every flush right away and keep little unsent data in the
+        // kernel, where the slow-consumer policy can't reach it
+        .name = "low-latency",
+        .nodelay = true,
+        .cork = true,
+        .notsent_lowat = 16 * 1024,
+    },
+    {
+        // fill segments and let the kernel buffer bursts
+        .name = "throughput",
+        .cork = true,
+        .sndbuf = 1024 * 1024,
+        .rcvbuf = 256 * 1024,
+    },
+};
+
+// set before the event loops start
+static struct sock_profile *sock_profile = &sock_profiles[0];
+
+static __thread bool drain_expired;
+
+static void expire_drain(struct timer *timer) {
+    UNUSED_PARAMETER(timer);
+
+    drain_expired = true;
+}
+
+// sleep until the next timer or batch of broadcasts is due, don't sleep
+// while users have unread messages
+static int get_loop_timeout(void) {
+    int timer_timeout;
+    int batch_timeout;
+
+    if (true == has_unread_users()) {
+        return 0;
+    }
+
+    timer_timeout = get_timer_timeout();
+    batch_timeout = get_batch_timeout();
+    if (-1 == timer_timeout
+        || (-1 != batch_timeout && batch_timeout < timer_timeout)) {
+        return batch_timeout;
+    }
+    return timer_timeout;
+}
+
+int add_event_handler(int epollfd, int fd, event_handler handler) {
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    ret = register_event_handler(fd, handler);
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to register handler for fd %d\n", fd);
+        goto error_out_register_event_handler;
+    }
+
+    ret = add_fd_to_event_loop(epollfd, fd, EPOLLIN);
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to add fd %d to event loop\n", fd);
+        goto error_out_add_fd;
+    }
+
+    ret_final = EXIT_SUCCESS;
+    return ret_final;
+error_out_add_fd:
+    unregister_event_handler(fd);
+error_out_register_event_handler:
+    return ret_final;
+}
+
+int add_user_to_event_loop(int epollfd, struct user_state *state) {
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    ret = add_fd_to_event_loop(epollfd, state->fd, USER_EVENTS);
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to add fd %d to event loop\n", state->fd);
+        os_close(state->fd);
+        os_free(state->name);
+        goto error_out_add_fd;
+    }
+
+    ret_final = import_user(state);
+error_out_add_fd:
+    return ret_final;
+}
+
+int drain_event_loop(int epollfd, int listenfd) {
+    struct timer drain_timer;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    ret = os_epoll_ctl(epollfd, EPOLL_CTL_DEL, listenfd, NULL);
+    if (-1 == ret) {
+        printf("ERRO: failed to stop accepting new users\n");
+        goto error_out_epoll_ctl;
+    }
+
+    drain_expired = false;
+    init_timer(&drain_timer, &expire_drain);
+    mod_timer(&drain_timer, DRAIN_TIMEOUT_MS);
+
+    while (0 < get_num_queued_bytes() && false == drain_expired) {
+        ret = monitor_socks(epollfd, listenfd);
+        if (EXIT_FAILURE == ret) {
+            printf("ERRO: failed to monitor sockets\n");
+            goto error_out_monitor_socks;
+        }
+    }
+
+    if (true == drain_expired) {
+        printf("WARN: dropping %zu queued bytes\n", get_num_queued_bytes());
+    }
+
+    ret_final = EXIT_SUCCESS;
+error_out_monitor_socks:
+    del_timer(&drain_timer);
+    drop_all_users();
+    update_user_list(epollfd);
+error_out_epoll_ctl:
+    return ret_final;
+}
+
+struct sock_profile *get_sock_profile(const char *name) {
+    size_t i;
+
+    for (i = 0; i < sizeof(sock_profiles) / sizeof(sock_profiles[0]); i++) {
+        if (0 == strcmp(name, sock_profiles[i].name)) {
+            return &sock_profiles[i];
+        }
+    }
+
+    return NULL;
+}
+
+int init_listen_sock(bool reuse_port) {
     int listenfd;
     int reuse = 1;
     struct sockaddr_in servaddr;
     int ret;
 
     // listen on localhost:1234 for TCP connections
-    listenfd = os_socket(AF_INET, SOCK_STREAM, 0);
+    listenfd = os_socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (-1 == listenfd) {
         printf("ERRO: failed to crate socket\n");
         goto error_out_socket;
@@ -37,6 +187,18 @@ int init_listen_sock() {
         goto error_out_setsockopt;
     }
 
+    if (true == reuse_port) {
+        ret = os_setsockopt(listenfd,
+                            SOL_SOCKET,
+                            SO_REUSEPORT,
+                            &reuse,
+                            sizeof(reuse));
+        if (-1 == ret) {
+            printf("ERRO: failed to set SO_REUSEPORT\n");
+            goto error_out_setsockopt;
+        }
+    }
+
     os_memset(&servaddr, 0, sizeof(servaddr));
     servaddr.sin_family = AF_INET;
     servaddr.sin_addr.s_addr = htobe32(INADDR_LOOPBACK);
@@ -48,7 +210,7 @@ int init_listen_sock() {
         goto error_out_bind;
     }
 
-    if (-1 == os_listen(listenfd, 5)) {
+    if (-1 == os_listen(listenfd, listen_backlog)) {
         printf("ERRO: failed to listen on socket\n");
         goto error_out_listen;
     }
@@ -61,34 +223,133 @@ error_out_socket:
     return -1;
 }
 
-int monitor_socks(int listenfd) {
-    fd_set rfds;
-    int max_fd;
+int init_event_loop(int listenfd) {
+    int epollfd;
     int ret;
-    int ret_final = EXIT_FAILURE;
 
-    max_fd = set_fds(listenfd, &rfds);
+    ret = set_fd_nonblocking(listenfd);
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to make listen socket non-blocking\n");
+        goto error_out_set_fd_nonblocking;
+    }
+
+    epollfd = os_epoll_create1(EPOLL_CLOEXEC);
+    if (-1 == epollfd) {
+        printf("ERRO: failed to create epoll instance\n");
+        goto error_out_epoll_create;
+    }
 
-    ret = os_select(max_fd + 1, &rfds, NULL, NULL, NULL);
+    ret = add_fd_to_event_loop(epollfd, listenfd, EPOLLIN);
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to add listen socket to event loop\n");
+        goto error_out_add_fd;
+    }
 
-    if (-1 == ret) {
+    return epollfd;
+error_out_add_fd:
+    os_close(epollfd);
+error_out_epoll_create:
+error_out_set_fd_nonblocking:
+    return -1;
+}
+
+int monitor_socks(int epollfd, int listenfd) {
+    struct epoll_event events[MAX_EVENTS];
+    int num_events;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    num_events = os_epoll_wait(epollfd,
+                               events,
+                               MAX_EVENTS,
+                               get_loop_timeout());
+
+    if (-1 == num_events) {
         if (EINTR == os_get_error()) {
-            goto error_out_select_eintr;
+            goto error_out_epoll_wait_eintr;
         }
-        goto error_out_select;
+        goto error_out_epoll_wait;
     }
 
-    ret = process_fds(listenfd, max_fd, &rfds);
+    // expire timers before handling events so new deadlines start from
+    // the time the loop woke up
+    run_timers();
+
+    // users that used up their read budget last time go before the users
+    // that became readable
+    continue_user_reads();
+
+    ret = process_fds(epollfd, listenfd, events, num_events);
     if (EXIT_FAILURE == ret) {
         printf("Failed to process file descriptors\n");
         goto error_out_process_fds;
     }
 
-    update_user_list();
+    flush_batched_msgs();
+    update_user_list(epollfd);
 
-error_out_select_eintr:
+error_out_epoll_wait_eintr:
     ret_final = EXIT_SUCCESS;
 error_out_process_fds:
-error_out_select:
+error_out_epoll_wait:
+    return ret_final;
+}
+
+void set_listen_backlog(int backlog) {
+    listen_backlog = backlog;
+}
+
+void set_sock_profile(struct sock_profile *profile) {
+    sock_profile = profile;
+    set_stat_sock_profile(profile->name);
+}
+
+int tune_sock(int fd) {
+    int on = 1;
+    int val;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    if (true == sock_profile->nodelay) {
+        ret = os_setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if (-1 == ret) {
+            printf("WARN: failed to set TCP_NODELAY on fd %d\n", fd);
+            goto error_out_setsockopt;
+        }
+    }
+
+    if (sock_profile->sndbuf > 0) {
+        val = sock_profile->sndbuf;
+        ret = os_setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val));
+        if (-1 == ret) {
+            printf("WARN: failed to set SO_SNDBUF on fd %d\n", fd);
+            goto error_out_setsockopt;
+        }
+    }
+
+    if (sock_profile->rcvbuf > 0) {
+        val = sock_profile->rcvbuf;
+        ret = os_setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+        if (-1 == ret) {
+            printf("WARN: failed to set SO_RCVBUF on fd %d\n", fd);
+            goto error_out_setsockopt;
+        }
+    }
+
+    if (sock_profile->notsent_lowat > 0) {
+        val = sock_profile->notsent_lowat;
+        ret = os_setsockopt(fd,
+                            IPPROTO_TCP,
+                            TCP_NOTSENT_LOWAT,
+                            &val,
+                            sizeof(val));
+        if (-1 == ret) {
+            printf("WARN: failed to set TCP_NOTSENT_LOWAT on fd %d\n", fd);
+            goto error_out_setsockopt;
+        }
+    }
+
+    ret_final = EXIT_SUCCESS;
+error_out_setsockopt:
     return ret_final;
 }
@@ -3,20 +3,145 @@
 #ifndef SRC_COMMS_COMMS_H_
 #define SRC_COMMS_COMMS_H_
 
+#include <stdbool.h>
+
+#include "src/user/user.h"
+
+#define DRAIN_TIMEOUT_MS (5 * 1000)
+
+typedef int (*event_handler)(int fd);
+
+// socket options applied to every accepted user, 0 keeps the kernel default
+struct sock_profile {
+    const char *name;
+    bool nodelay;           // TCP_NODELAY
+    bool cork;              // MSG_MORE on all but the last send of a flush
+    int sndbuf;             // SO_SNDBUF
+    int rcvbuf;             // SO_RCVBUF
+    int notsent_lowat;      // TCP_NOTSENT_LOWAT
+};
+
+/**
+ * Add file descriptor with its own handler to event loop.
+ *
+ * The handler is called instead of the user handlers whenever the fd is
+ * readable. Handlers are per thread, like the event loop itself.
+ *
+ * @param epollfd (int) - epoll fd returned by init_event_loop().
+ * @param fd (int) - File descriptor to monitor.
+ * @param handler (event_handler) - Function called when fd is readable.
+ * @fail - Too many handlers registered.
+ * @fail - Fail to add fd to epoll instance.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int add_event_handler(int epollfd, int fd, event_handler handler);
+
+/**
+ * Add user exported by another server process to event loop.
+ *
+ * @param epollfd (int) - epoll fd returned by init_event_loop().
+ * @param state (struct user_state *) - Exported state of user.
+ * @fail - Fail to add fd to epoll instance, fd is closed and name freed.
+ * @fail - Fail to import user.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int add_user_to_event_loop(int epollfd, struct user_state *state);
+
+/**
+ * Drain event loop before shutting down.
+ *
+ * Stops accepting new users and keeps running the event loop until every
+ * queued message has been sent or DRAIN_TIMEOUT_MS has passed. All users
+ * are closed afterwards, messages that could not be sent are dropped.
+ *
+ * @param epollfd (int) - epoll fd returned by init_event_loop().
+ * @param listenfd (int) - Listen socket fd.
+ * @fail - Fail to remove listen socket from event loop.
+ * @fail - Fail to monitor sockets.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int drain_event_loop(int epollfd, int listenfd);
+
+/**
+ * Find socket profile by name.
+ *
+ * Profiles are "default", which leaves every option alone, "low-latency"
+ * and "throughput".
+ *
+ * @param name (const char *) - Name of profile.
+ * @return (struct sock_profile *) - Profile on success, NULL if there is no
+ *                                   profile with that name.
+ */
+struct sock_profile *get_sock_profile(const char *name);
+
 /**
  * Create listen socket on localhost:1234
  *
+ * With SO_REUSEPORT several sockets can listen on the same port and the
+ * kernel spreads new connections across them. The backlog is set with
+ * set_listen_backlog().
+ *
+ * @param reuse_port (bool) - Set SO_REUSEPORT on the socket.
  * @open - File descriptor for listen socket.
  * @return (int) - listen socket fd on success, -1 on failure.
  */
-int init_listen_sock(void);
+int init_listen_sock(bool reuse_port);
+
+/**
+ * Create event loop and register the listen socket with it.
+ *
+ * The listen socket is made non-blocking so each wakeup can drain the
+ * accept queue.
+ *
+ * @param listenfd (int) - Listen socket fd.
+ * @open - File descriptor for epoll instance.
+ * @fail - Fail to make listen socket non-blocking.
+ * @fail - Fail to create epoll instance.
+ * @fail - Fail to register listen socket.
+ * @return (int) - epoll fd on success, -1 on failure.
+ */
+int init_event_loop(int listenfd);
 
 /**
  * Monitor listen sock and user file descriptors.
  *
+ * Waits for events on the epoll instance and only visits the file
+ * descriptors that are ready. The wait ends in time for the next timer
+ * tick while timers are armed, and expired timers run once per call.
+ *
+ * @param epollfd (int) - epoll fd returned by init_event_loop().
  * @param listenfd (int) - Listen socket fd.
  * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
  */
-int monitor_socks(int listenfd);
+int monitor_socks(int epollfd, int listenfd);
+
+/**
+ * Set the backlog of listen sockets created afterwards.
+ *
+ * Defaults to SOMAXCONN. The kernel caps the backlog at
+ * net.core.somaxconn.
+ *
+ * @param backlog (int) - Maximum length of the queue of pending connections.
+ */
+void set_listen_backlog(int backlog);
+
+/**
+ * Set the socket profile applied to users accepted afterwards.
+ *
+ * Defaults to the "default" profile. Set it before any event loop starts,
+ * the cork option is passed on with set_cork_flushes().
+ *
+ * @param profile (struct sock_profile *) - Profile from get_sock_profile().
+ */
+void set_sock_profile(struct sock_profile *profile);
+
+/**
+ * Apply the socket profile to an accepted user.
+ *
+ * @param fd (int) - Socket of new user.
+ * @fail - Fail to set a socket option, the options before it are set.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int tune_sock(int fd);
 
 #endif  // SRC_COMMS_COMMS_H_
@@ -2,41 +2,153 @@
 
 #include "src/comms/comms_internal.h"
 
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/socket.h>
 
-#include "lib/fileio/fileio.h"
 #include "lib/osdep/osdep.h"
+#include "src/stats/stats.h"
 #include "src/user/user.h"
 
-int process_fds(int listenfd, int max_fd, fd_set *rfds) {
+static __thread struct event_source event_sources[MAX_EVENT_HANDLERS];
+static __thread int num_event_sources;
+
+int accept_users(int epollfd, int listenfd) {
+    int num_accepted = 0;
+    int connfd;
+    int err;
+    int ret;
     int ret_final = EXIT_FAILURE;
+
+    while (num_accepted < ACCEPT_BUDGET) {
+        connfd = os_accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (-1 == connfd) {
+            err = os_get_error();
+            if (EAGAIN == err || EWOULDBLOCK == err) {
+                break;
+            } else if (ECONNABORTED == err || EINTR == err || EPROTO == err) {
+                continue;
+            } else if (EMFILE == err || ENFILE == err
+                       || ENOBUFS == err || ENOMEM == err) {
+                // leave the connections queued until resources are freed
+                printf("WARN: out of resources to accept new users\n");
+                break;
+            }
+            printf("ERRO: failed to accept new user\n");
+            goto error_out_accept;
+        }
+        num_accepted++;
+
+        // a user without its options still works, just not as tuned
+        ret = tune_sock(connfd);
+        if (EXIT_FAILURE == ret) {
+            add_stat(STAT_SOCK_TUNE_FAILED, 1);
+        }
+
+        ret = add_fd_to_event_loop(epollfd, connfd, USER_EVENTS);
+        if (EXIT_FAILURE == ret) {
+            printf("WARN: failed to add new user to event loop\n");
+            os_close(connfd);
+            continue;
+        }
+        ret = handle_new_user(connfd);
+        if (EXIT_FAILURE == ret) {
+            printf("WARN: failed to handle new user\n");
+            os_close(connfd);
+        } else {
+            printf("INFO: new user connected\n");
+        }
+    }
+
+    if (ACCEPT_BUDGET == num_accepted) {
+        add_stat(STAT_ACCEPT_BUDGET_HIT, 1);
+        sample_listen_queue(listenfd);
+    }
+
+    ret_final = EXIT_SUCCESS;
+error_out_accept:
+    add_stat(STAT_ACCEPT_WAKEUPS, 1);
+    add_stat(STAT_ACCEPTS, num_accepted);
+    max_stat(STAT_ACCEPTS_MAX, num_accepted);
+    return ret_final;
+}
+
+int add_fd_to_event_loop(int epollfd, int fd, uint32_t events) {
+    struct epoll_event event;
     int ret;
+    int ret_final = EXIT_FAILURE;
 
-    for (int i = 0; i < max_fd + 1; i++) {
-        if (os_fd_isset(i, rfds)) {
-            if (i == listenfd) {
-                int connfd = os_accept(listenfd, NULL, NULL);
-                if (-1 == connfd) {
-                    printf("WARN: " \
-                            "failed to accept connection from new user\n");
-                    goto error_out_accept;
-                }
-                ret = set_fd_nonblocking(connfd);
+    os_memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+
+    ret = os_epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    if (-1 == ret) {
+        printf("ERRO: failed to add fd %d to epoll instance\n", fd);
+        goto error_out_epoll_ctl;
+    }
+
+    ret_final = EXIT_SUCCESS;
+error_out_epoll_ctl:
+    return ret_final;
+}
+
+event_handler get_event_handler(int fd) {
+    for (int i = 0; i < num_event_sources; i++) {
+        if (fd == event_sources[i].fd) {
+            return event_sources[i].handler;
+        }
+    }
+
+    return NULL;
+}
+
+int process_fds(int epollfd,
+                int listenfd,
+                struct epoll_event *events,
+                int num_events) {
+    event_handler handler;
+    int ret_final = EXIT_FAILURE;
+    int ret;
+
+    for (int i = 0; i < num_events; i++) {
+        int fd = events[i].data.fd;
+
+        handler = get_event_handler(fd);
+        if (NULL != handler) {
+            ret = handler(fd);
+            if (EXIT_FAILURE == ret) {
+                printf("WARN: failed to handle event on fd %d\n", fd);
+            }
+            continue;
+        }
+
+        if (fd == listenfd) {
+            ret = accept_users(epollfd, listenfd);
+            if (EXIT_FAILURE == ret) {
+                printf("WARN: " \
+                        "failed to accept connection from new user\n");
+                goto error_out_accept;
+            }
+        } else {
+            // zerocopy completions are reported through the error queue
+            if (events[i].events & EPOLLERR) {
+                ret = handle_zerocopy_completions(fd);
                 if (EXIT_FAILURE == ret) {
-                    printf("ERRO: failed to set user fd to nonblocking\n");
-                    os_close(connfd);
-                    goto error_out_set_fd_nonblocking;
+                    printf("WARN: failed to handle zerocopy completions\n");
                 }
-                ret = handle_new_user(connfd);
+            }
+            if (events[i].events & EPOLLOUT) {
+                ret = handle_writable_user(fd);
                 if (EXIT_FAILURE == ret) {
-                    printf("WARN: failed to handle new user\n");
-                    os_close(connfd);
-                } else {
-                    printf("INFO: new user connected\n");
+                    printf("WARN: failed to flush registered user\n");
                 }
-            } else {
-                ret = handle_registered_user(i);
+            }
+            if (events[i].events & ~EPOLLOUT) {
+                ret = handle_registered_user(fd);
                 if (EXIT_FAILURE == ret) {
                     printf("WARN: failed to handle registered user\n");
                 }
@@ -45,38 +157,51 @@ int process_fds(int listenfd, int max_fd, fd_set *rfds) {
     }
 
     ret_final = EXIT_SUCCESS;
-error_out_set_fd_nonblocking:
 error_out_accept:
     return ret_final;
 }
 
-int set_fds(int listenfd, fd_set *rfds) {
-    int num_users;
-    int *user_fds;
-    int max_fd = listenfd;
+int register_event_handler(int fd, event_handler handler) {
+    int ret_final = EXIT_FAILURE;
 
-    os_fd_zero(rfds);
-    os_fd_set(listenfd, rfds);
+    if (num_event_sources >= MAX_EVENT_HANDLERS) {
+        printf("ERRO: too many event handlers\n");
+        goto error_out_full;
+    }
 
-    num_users = get_num_users();
-    if (num_users > 0) {
-        user_fds = os_malloc(sizeof(int) * num_users);
-        if (NULL == user_fds) {
-            printf("ERRO: failed to allocate buffer for user fds\n");
-            goto error_out_malloc;
-        }
+    event_sources[num_event_sources].fd = fd;
+    event_sources[num_event_sources].handler = handler;
+    num_event_sources++;
 
-        get_user_fds(user_fds);
-        for (int i = 0; i < num_users; i++) {
-            os_fd_set(user_fds[i], rfds);
-            if (user_fds[i] > max_fd) {
-                max_fd = user_fds[i];
-            }
-        }
+    ret_final = EXIT_SUCCESS;
+error_out_full:
+    return ret_final;
+}
 
-        os_free(user_fds);
+void sample_listen_queue(int listenfd) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    int ret;
+
+    // for listen sockets the kernel reports the accept queue length in
+    // tcpi_unacked and the backlog in tcpi_sacked
+    ret = os_getsockopt(listenfd, IPPROTO_TCP, TCP_INFO, &info, &len);
+    if (-1 == ret) {
+        printf("WARN: failed to get accept queue length\n");
+        return;
     }
 
-error_out_malloc:
-    return max_fd;
+    if (info.tcpi_unacked >= info.tcpi_sacked) {
+        add_stat(STAT_LISTEN_QUEUE_FULL, 1);
+    }
+}
+
+void unregister_event_handler(int fd) {
+    for (int i = 0; i < num_event_sources; i++) {
+        if (fd == event_sources[i].fd) {
+            num_event_sources--;
+            event_sources[i] = event_sources[num_event_sources];
+            return;
+        }
+    }
 }
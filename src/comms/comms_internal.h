@@ -3,26 +3,96 @@
 #ifndef SRC_COMMS_COMMS_INTERNAL_H_
 #define SRC_COMMS_COMMS_INTERNAL_H_
 
-#include <sys/select.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#include "src/comms/comms.h"
+
+#define MAX_EVENT_HANDLERS 8
+#define ACCEPT_BUDGET 64
+
+// user sockets are edge triggered, readers and writers run until EAGAIN
+#define USER_EVENTS (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)
+
+struct event_source {
+    int fd;
+    event_handler handler;
+};
+
+/**
+ * Accept pending connections on the listen socket.
+ *
+ * Accepts until the accept queue is empty or ACCEPT_BUDGET connections
+ * were accepted. Connections left in the queue are accepted on the next
+ * wakeup. When the budget runs out the accept queue is sampled to count
+ * listen queue overflows.
+ *
+ * @param epollfd (int) - File descriptor for epoll instance.
+ * @param listenfd (int) - File descriptor for listen socket.
+ * @open - File descriptors for new user connections.
+ * @fail - accept4() fails with an error that is not transient.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int accept_users(int epollfd, int listenfd);
+
+/**
+ * Add file descriptor to event loop.
+ *
+ * The file descriptor is monitored until it is closed or removed with
+ * EPOLL_CTL_DEL.
+ *
+ * @param epollfd (int) - File descriptor for epoll instance.
+ * @param fd (int) - File descriptor to monitor.
+ * @param events (uint32_t) - epoll events to monitor.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int add_fd_to_event_loop(int epollfd, int fd, uint32_t events);
+
+/**
+ * Get handler registered for file descriptor.
+ *
+ * @param fd (int) - File descriptor.
+ * @return (event_handler) - Handler on success, NULL if fd has no handler.
+ */
+event_handler get_event_handler(int fd);
 
 /**
  * Process file descriptors.
  *
+ * @param epollfd (int) - File descriptor for epoll instance.
  * @param listenfd (int) - File descriptor for listen socket.
- * @param max_fd (int) - The max file descriptor.
- * @param rfds (fd_set *) - File descriptor set.
+ * @param events (struct epoll_event *) - Ready events from epoll_wait().
+ * @param num_events (int) - Number of ready events.
  * @open - Open file descriptor for new user connection.
  * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
  */
-int process_fds(int listenfd, int max_fd, fd_set *rfds);
+int process_fds(int epollfd,
+                int listenfd,
+                struct epoll_event *events,
+                int num_events);
 
 /**
- * Add File descritors to fd set.
+ * Register handler for file descriptor in this thread's handler table.
+ *
+ * @param fd (int) - File descriptor.
+ * @param handler (event_handler) - Function called when fd is readable.
+ * @fail - Handler table is full.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int register_event_handler(int fd, event_handler handler);
+
+/**
+ * Count a listen queue overflow if the accept queue is full.
  *
  * @param listenfd (int) - File descriptor for listen socket.
- * @param rfds (fd_set *) - File descriptor set.
- * @return (int) - Max file descriptor.
  */
-int set_fds(int listenfd, fd_set *rfds);
+void sample_listen_queue(int listenfd);
+
+/**
+ * Remove handler for file descriptor from this thread's handler table.
+ *
+ * @param fd (int) - File descriptor.
+ */
+void unregister_event_handler(int fd);
 
 #endif  // SRC_COMMS_COMMS_INTERNAL_H_
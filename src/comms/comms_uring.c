@@ -0,0 +1,218 @@
+// Copyright 2020 author. All rights reserved.
+
+#include "src/comms/comms_uring.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lib/osdep/osdep.h"
+#include "lib/uring/uring.h"
+#include "src/comms/comms_uring_internal.h"
+#include "src/timer/timer.h"
+#include "src/user/user.h"
+
+#define URING_ENTRIES 256
+#define URING_BUF_GROUP 0
+#define URING_NR_BUFS 256
+#define URING_BUF_SIZE 4096
+
+static struct uring_loop loop;
+
+int add_uring_event_handler(int fd, event_handler handler) {
+    loop.handler_fd = fd;
+    loop.handler = handler;
+
+    return arm_poll(&loop);
+}
+
+int drain_uring_event_loop(void) {
+    struct io_uring_sqe *sqe;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    loop.draining = true;
+
+    sqe = get_sqe(&loop);
+    if (NULL == sqe) {
+        printf("ERRO: no submission entry to stop accepting new users\n");
+        goto error_out_get_sqe;
+    }
+    uring_prep_cancel(sqe,
+                      URING_USER_DATA(NULL, URING_OP_ACCEPT),
+                      URING_USER_DATA(NULL, URING_OP_CANCEL));
+
+    sqe = get_sqe(&loop);
+    if (NULL == sqe) {
+        printf("ERRO: no submission entry for drain timeout\n");
+        goto error_out_get_sqe;
+    }
+    loop.drain_expired = false;
+    loop.drain_ts.tv_sec = DRAIN_TIMEOUT_MS / 1000;
+    loop.drain_ts.tv_nsec = (DRAIN_TIMEOUT_MS % 1000) * 1000000;
+    uring_prep_timeout(sqe,
+                       &loop.drain_ts,
+                       0,
+                       URING_USER_DATA(NULL, URING_OP_TIMEOUT));
+
+    while (true == has_queued_sends(&loop) && false == loop.drain_expired) {
+        ret = monitor_socks_uring();
+        if (EXIT_FAILURE == ret) {
+            printf("ERRO: failed to monitor sockets\n");
+            goto error_out_monitor_socks;
+        }
+    }
+
+    if (true == loop.drain_expired) {
+        printf("WARN: dropping queued messages\n");
+    }
+
+    ret_final = EXIT_SUCCESS;
+error_out_monitor_socks:
+error_out_get_sqe:
+    // the connections left are freed by exit_uring_event_loop()
+    set_user_closer(NULL);
+    drop_all_users();
+    update_user_list(-1);
+    return ret_final;
+}
+
+void exit_uring_event_loop(void) {
+    struct uring_conn *conn;
+
+    for (int fd = 0; fd < loop.num_conns; fd++) {
+        conn = loop.conns[fd];
+        if (NULL != conn) {
+            del_timer(&conn->register_timer);
+            del_timer(&conn->stall_timer);
+            conn->closing = true;
+            conn->recv_armed = false;
+            conn->send_in_flight = false;
+            release_conn(conn);
+        }
+    }
+    os_free(loop.conns);
+
+    uring_exit_buf_ring(&loop.ring, &loop.buf_ring);
+    uring_exit(&loop.ring);
+}
+
+int init_uring_event_loop(int listenfd, bool sqpoll) {
+    unsigned flags = 0;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    os_memset(&loop, 0, sizeof(loop));
+    loop.listenfd = listenfd;
+
+    if (true == sqpoll) {
+        flags |= IORING_SETUP_SQPOLL;
+    }
+
+    ret = uring_init(&loop.ring, URING_ENTRIES, flags);
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to create io_uring instance\n");
+        goto error_out_uring_init;
+    }
+
+    ret = uring_init_buf_ring(&loop.ring,
+                              &loop.buf_ring,
+                              URING_BUF_GROUP,
+                              URING_NR_BUFS,
+                              URING_BUF_SIZE);
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to register receive buffers\n");
+        goto error_out_init_buf_ring;
+    }
+
+    ret = arm_accept(&loop);
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to accept on listen socket\n");
+        goto error_out_arm_accept;
+    }
+
+    set_msg_sender(&uring_send_broadcast_msg);
+    set_user_closer(&uring_close_user);
+
+    ret_final = EXIT_SUCCESS;
+    return ret_final;
+error_out_arm_accept:
+    uring_exit_buf_ring(&loop.ring, &loop.buf_ring);
+error_out_init_buf_ring:
+    uring_exit(&loop.ring);
+error_out_uring_init:
+    return ret_final;
+}
+
+int monitor_socks_uring(void) {
+    struct io_uring_cqe *cqe;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    // a timer deadline ends the wait even if no request completes
+    ret = arm_timer_timeout(&loop);
+    if (EXIT_FAILURE == ret) {
+        printf("WARN: failed to queue timeout for timers\n");
+    }
+
+    ret = uring_submit(&loop.ring, 1);
+    if (-1 == ret) {
+        if (EINTR == os_get_error()) {
+            goto error_out_submit_eintr;
+        }
+        printf("ERRO: failed to submit io_uring requests\n");
+        goto error_out_submit;
+    }
+
+    cqe = uring_peek_cqe(&loop.ring);
+    while (NULL != cqe) {
+        process_cqe(&loop, cqe);
+        uring_cqe_seen(&loop.ring);
+        cqe = uring_peek_cqe(&loop.ring);
+    }
+
+    run_timers();
+    update_user_list(-1);
+
+error_out_submit_eintr:
+    ret_final = EXIT_SUCCESS;
+error_out_submit:
+    return ret_final;
+}
+
+void uring_close_user(int fd) {
+    struct uring_conn *conn;
+
+    // gone already if the connection failed first
+    conn = get_conn(&loop, fd);
+    if (NULL == conn) {
+        return;
+    }
+
+    close_conn(&loop, conn);
+    release_conn(conn);
+}
+
+int uring_send_broadcast_msg(int fd, struct msg_frame *frame) {
+    struct uring_conn *conn;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    conn = get_conn(&loop, fd);
+    if (NULL == conn) {
+        printf("ERRO: no connection for fd %d\n", fd);
+        goto error_out_get_conn;
+    }
+
+    // the user module flags the user, so only the connection is closed here
+    ret = queue_broadcast_msg(&loop, conn, frame);
+    if (EXIT_FAILURE == ret) {
+        close_conn(&loop, conn);
+        goto error_out_queue_broadcast_msg;
+    }
+
+    ret_final = EXIT_SUCCESS;
+error_out_queue_broadcast_msg:
+error_out_get_conn:
+    return ret_final;
+}
@@ -0,0 +1,101 @@
+// Copyright 2020 author. All rights reserved.
+
+#ifndef SRC_COMMS_COMMS_URING_H_
+#define SRC_COMMS_COMMS_URING_H_
+
+#include <stdbool.h>
+
+#include "src/comms/comms.h"
+#include "src/message/message.h"
+
+/**
+ * Add file descriptor with its own handler to io_uring event loop.
+ *
+ * The handler is called whenever the fd is readable. Only one such fd is
+ * supported.
+ *
+ * @param fd (int) - File descriptor to monitor.
+ * @param handler (event_handler) - Function called when fd is readable.
+ * @fail - Fail to queue poll on fd.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int add_uring_event_handler(int fd, event_handler handler);
+
+/**
+ * Drain io_uring event loop before shutting down.
+ *
+ * Cancels the accept and keeps running the event loop until every queued
+ * message has been sent or DRAIN_TIMEOUT_MS has passed. All users are
+ * closed afterwards, messages that could not be sent are dropped.
+ *
+ * @fail - Fail to queue cancel or timeout.
+ * @fail - Fail to monitor sockets.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int drain_uring_event_loop(void);
+
+/**
+ * Release io_uring event loop.
+ *
+ * Frees every connection that is still open. Pending requests are cancelled
+ * when the io_uring instance is closed.
+ *
+ * @free (struct uring_conn *) - Connection state.
+ * @close - File descriptor for io_uring instance.
+ */
+void exit_uring_event_loop(void);
+
+/**
+ * Create io_uring event loop and queue a multishot accept on the listen
+ * socket.
+ *
+ * Replaces the user module's message sender so broadcasts are queued on the
+ * ring instead of written directly, and sets its user closer so removed
+ * users lose their connection.
+ *
+ * @param listenfd (int) - Listen socket fd.
+ * @param sqpoll (bool) - Let a kernel thread poll the submission queue.
+ * @open - File descriptor for io_uring instance.
+ * @malloc (uint8_t *) - Provided receive buffers.
+ * @fail - Fail to create io_uring instance.
+ * @fail - Fail to register provided buffers.
+ * @fail - Fail to queue accept.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int init_uring_event_loop(int listenfd, bool sqpoll);
+
+/**
+ * Monitor listen sock and user file descriptors.
+ *
+ * Submits queued requests, waits for at least one completion or the next
+ * timer deadline, handles every completion that is ready and then runs the
+ * expired timers.
+ *
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int monitor_socks_uring(void);
+
+/**
+ * Close the connection of a user the user module removes.
+ *
+ * Installed as the user module's user closer by init_uring_event_loop().
+ * Cancels the receive, which holds the socket open after its fd is closed.
+ *
+ * @param fd (int) - File descriptor of user.
+ */
+void uring_close_user(int fd);
+
+/**
+ * Queue broadcast message on a user's connection.
+ *
+ * Installed as the user module's message sender by init_uring_event_loop().
+ *
+ * @param fd (int) - File descriptor of user.
+ * @param frame (struct msg_frame *) - Encoded broadcast message.
+ * @fail - No open connection for fd.
+ * @fail - Fail to queue message, connection is closed.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int uring_send_broadcast_msg(int fd, struct msg_frame *frame);
+
+#endif  // SRC_COMMS_COMMS_URING_H_
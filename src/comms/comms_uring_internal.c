@@ -0,0 +1,581 @@
+// Copyright 2020 author. All rights reserved.
+
+#include "src/comms/comms_uring_internal.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "include/list.h"
+#include "lib/osdep/osdep.h"
+#include "lib/uring/uring.h"
+#include "src/message/message.h"
+#include "src/stats/stats.h"
+#include "src/timer/timer.h"
+#include "src/user/user.h"
+
+#define MIN_CONNS 64
+
+static void expire_pending_conn(struct timer *timer) {
+    struct uring_conn *conn = container_of(timer,
+                                           struct uring_conn,
+                                           register_timer);
+
+    printf("INFO: fd %d did not register in time\n", conn->fd);
+    close_conn(conn->loop, conn);
+    release_conn(conn);
+}
+
+// a registered user is dropped the same way a failed send drops it
+static void expire_stalled_conn(struct timer *timer) {
+    struct uring_conn *conn = container_of(timer,
+                                           struct uring_conn,
+                                           stall_timer);
+
+    printf("INFO: fd %d stopped reading messages\n", conn->fd);
+    if (true == conn->registered) {
+        drop_user(conn->fd);
+    }
+    close_conn(conn->loop, conn);
+    release_conn(conn);
+}
+
+struct uring_conn *add_conn(struct uring_loop *loop, int fd) {
+    struct uring_conn *conn = NULL;
+    struct uring_conn **conns;
+    int num_conns;
+
+    if (fd >= loop->num_conns) {
+        num_conns = loop->num_conns > 0 ? loop->num_conns : MIN_CONNS;
+        while (num_conns <= fd) {
+            num_conns *= 2;
+        }
+
+        conns = os_realloc(loop->conns,
+                           num_conns * sizeof(struct uring_conn *));
+        if (NULL == conns) {
+            printf("ERRO: failed to grow connection table\n");
+            goto error_out_realloc;
+        }
+
+        os_memset(&conns[loop->num_conns],
+                  0,
+                  (num_conns - loop->num_conns) * sizeof(struct uring_conn *));
+        loop->conns = conns;
+        loop->num_conns = num_conns;
+    }
+
+    conn = os_malloc(sizeof(struct uring_conn));
+    if (NULL == conn) {
+        printf("ERRO: failed to allocate memory for connection\n");
+        goto error_out_malloc;
+    }
+
+    conn->loop = loop;
+    conn->fd = fd;
+    conn->registered = false;
+    conn->closing = false;
+    conn->recv_armed = false;
+    conn->send_in_flight = false;
+    conn->in_buf = NULL;
+    conn->in_len = 0;
+    conn->in_cap = 0;
+    INIT_LIST_HEAD(&conn->send_queue);
+    init_timer(&conn->register_timer, &expire_pending_conn);
+    init_timer(&conn->stall_timer, &expire_stalled_conn);
+    loop->conns[fd] = conn;
+
+error_out_malloc:
+error_out_realloc:
+    return conn;
+}
+
+int arm_accept(struct uring_loop *loop) {
+    struct io_uring_sqe *sqe;
+    int ret_final = EXIT_FAILURE;
+
+    sqe = get_sqe(loop);
+    if (NULL == sqe) {
+        printf("ERRO: no submission entry for accept\n");
+        goto error_out_get_sqe;
+    }
+
+    uring_prep_multishot_accept(sqe,
+                                loop->listenfd,
+                                URING_USER_DATA(NULL, URING_OP_ACCEPT));
+
+    ret_final = EXIT_SUCCESS;
+error_out_get_sqe:
+    return ret_final;
+}
+
+int arm_poll(struct uring_loop *loop) {
+    struct io_uring_sqe *sqe;
+    int ret_final = EXIT_FAILURE;
+
+    sqe = get_sqe(loop);
+    if (NULL == sqe) {
+        printf("ERRO: no submission entry for poll on fd %d\n",
+               loop->handler_fd);
+        goto error_out_get_sqe;
+    }
+
+    uring_prep_poll_add(sqe,
+                        loop->handler_fd,
+                        POLLIN,
+                        URING_USER_DATA(NULL, URING_OP_POLL));
+
+    ret_final = EXIT_SUCCESS;
+error_out_get_sqe:
+    return ret_final;
+}
+
+int arm_recv(struct uring_loop *loop, struct uring_conn *conn) {
+    struct io_uring_sqe *sqe;
+    int ret_final = EXIT_FAILURE;
+
+    sqe = get_sqe(loop);
+    if (NULL == sqe) {
+        printf("ERRO: no submission entry for recv on fd %d\n", conn->fd);
+        goto error_out_get_sqe;
+    }
+
+    uring_prep_recv_multishot(sqe,
+                              conn->fd,
+                              loop->buf_ring.bgid,
+                              URING_USER_DATA(conn, URING_OP_RECV));
+    conn->recv_armed = true;
+
+    ret_final = EXIT_SUCCESS;
+error_out_get_sqe:
+    return ret_final;
+}
+
+int arm_timer_timeout(struct uring_loop *loop) {
+    struct io_uring_sqe *sqe;
+    int timeout;
+    int ret_final = EXIT_FAILURE;
+
+    timeout = get_timer_timeout();
+    if (true == loop->timer_armed || -1 == timeout) {
+        ret_final = EXIT_SUCCESS;
+        goto out_no_timeout;
+    }
+
+    sqe = get_sqe(loop);
+    if (NULL == sqe) {
+        printf("ERRO: no submission entry for timer timeout\n");
+        goto error_out_get_sqe;
+    }
+
+    loop->timer_ts.tv_sec = timeout / 1000;
+    loop->timer_ts.tv_nsec = (timeout % 1000) * 1000000;
+    uring_prep_timeout(sqe,
+                       &loop->timer_ts,
+                       1,
+                       URING_USER_DATA(NULL, URING_OP_TIMER));
+    loop->timer_armed = true;
+
+    ret_final = EXIT_SUCCESS;
+error_out_get_sqe:
+out_no_timeout:
+    return ret_final;
+}
+
+void close_conn(struct uring_loop *loop, struct uring_conn *conn) {
+    struct io_uring_sqe *sqe;
+
+    if (true == conn->closing) {
+        return;
+    }
+    conn->closing = true;
+    del_timer(&conn->register_timer);
+    del_timer(&conn->stall_timer);
+
+    if (true == conn->recv_armed) {
+        sqe = get_sqe(loop);
+        if (NULL != sqe) {
+            uring_prep_cancel(sqe,
+                              URING_USER_DATA(conn, URING_OP_RECV),
+                              URING_USER_DATA(NULL, URING_OP_CANCEL));
+        }
+    }
+
+    if (conn == get_conn(loop, conn->fd)) {
+        loop->conns[conn->fd] = NULL;
+    }
+
+    if (false == conn->registered) {
+        os_close(conn->fd);
+    }
+}
+
+int consume_input(struct uring_conn *conn,
+                  uint8_t *buf,
+                  size_t len) {
+    struct msg_new_user new_user_msg;
+    struct msg_registered_user user_msg;
+    uint8_t *iter = buf;
+    size_t remaining = len;
+    uint8_t *in_buf;
+    int frame_len;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    // finish a partial frame from an earlier receive first
+    if (conn->in_len > 0) {
+        if (conn->in_len + len > conn->in_cap) {
+            in_buf = os_realloc(conn->in_buf, conn->in_len + len);
+            if (NULL == in_buf) {
+                printf("ERRO: failed to grow receive buffer\n");
+                goto error_out_realloc;
+            }
+            conn->in_buf = in_buf;
+            conn->in_cap = conn->in_len + len;
+        }
+        os_memcpy(&conn->in_buf[conn->in_len], buf, len);
+        conn->in_len += len;
+        iter = conn->in_buf;
+        remaining = conn->in_len;
+    }
+
+    while (remaining > 0 && false == conn->closing) {
+        if (false == conn->registered) {
+            frame_len = decode_msg_new_user(iter, remaining, &new_user_msg);
+        } else {
+            frame_len = decode_msg_registered_user(iter, remaining, &user_msg);
+        }
+
+        if (-1 == frame_len) {
+            printf("ERRO: failed to decode message from fd %d\n", conn->fd);
+            goto error_out_decode_msg;
+        } else if (0 == frame_len) {
+            break;
+        }
+
+        if (false == conn->registered) {
+            ret = register_new_user(conn->fd, &new_user_msg);
+            if (EXIT_FAILURE == ret) {
+                printf("ERRO: failed to register user on fd %d\n", conn->fd);
+                goto error_out_register_new_user;
+            }
+            conn->registered = true;
+            del_timer(&conn->register_timer);
+        } else {
+            broadcast_user_msg(conn->fd, &user_msg);
+        }
+
+        iter += frame_len;
+        remaining -= frame_len;
+    }
+
+    // keep the partial frame for the next receive
+    if (remaining > conn->in_cap) {
+        in_buf = os_realloc(conn->in_buf, remaining);
+        if (NULL == in_buf) {
+            printf("ERRO: failed to grow receive buffer\n");
+            goto error_out_realloc;
+        }
+        conn->in_buf = in_buf;
+        conn->in_cap = remaining;
+    }
+    if (remaining > 0 && iter != conn->in_buf) {
+        memmove(conn->in_buf, iter, remaining);
+    }
+    conn->in_len = remaining;
+
+    ret_final = EXIT_SUCCESS;
+error_out_register_new_user:
+error_out_decode_msg:
+error_out_realloc:
+    return ret_final;
+}
+
+struct uring_conn *get_conn(struct uring_loop *loop, int fd) {
+    if (fd < 0 || fd >= loop->num_conns) {
+        return NULL;
+    }
+
+    return loop->conns[fd];
+}
+
+struct io_uring_sqe *get_sqe(struct uring_loop *loop) {
+    struct io_uring_sqe *sqe;
+
+    sqe = uring_get_sqe(&loop->ring);
+    if (NULL == sqe) {
+        uring_submit(&loop->ring, 0);
+        sqe = uring_get_sqe(&loop->ring);
+    }
+
+    return sqe;
+}
+
+void handle_accept_cqe(struct uring_loop *loop, int res, uint32_t flags) {
+    struct uring_conn *conn;
+    int ret;
+
+    if (res < 0) {
+        printf("WARN: failed to accept connection from new user\n");
+    } else {
+        ret = tune_sock(res);
+        if (EXIT_FAILURE == ret) {
+            add_stat(STAT_SOCK_TUNE_FAILED, 1);
+        }
+
+        conn = add_conn(loop, res);
+        if (NULL == conn) {
+            printf("WARN: failed to add connection for new user\n");
+            os_close(res);
+        } else {
+            ret = arm_recv(loop, conn);
+            if (EXIT_FAILURE == ret) {
+                printf("WARN: failed to receive from new user\n");
+                close_conn(loop, conn);
+                release_conn(conn);
+            } else {
+                mod_timer(&conn->register_timer, USER_REGISTER_TIMEOUT_MS);
+                printf("INFO: new user connected\n");
+            }
+        }
+    }
+
+    if (!(flags & IORING_CQE_F_MORE) && false == loop->draining) {
+        arm_accept(loop);
+    }
+}
+
+void handle_poll_cqe(struct uring_loop *loop, int res) {
+    int ret;
+
+    if (res < 0) {
+        printf("WARN: failed to poll fd %d\n", loop->handler_fd);
+    } else {
+        ret = loop->handler(loop->handler_fd);
+        if (EXIT_FAILURE == ret) {
+            printf("WARN: failed to handle fd %d\n", loop->handler_fd);
+        }
+    }
+
+    arm_poll(loop);
+}
+
+void handle_recv_cqe(struct uring_loop *loop,
+                     struct uring_conn *conn,
+                     int res,
+                     uint32_t flags) {
+    uint16_t bid;
+    int ret;
+
+    if (!(flags & IORING_CQE_F_MORE)) {
+        conn->recv_armed = false;
+    }
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (res > 0 && false == conn->closing) {
+            ret = consume_input(conn,
+                                uring_get_buf(&loop->buf_ring, bid),
+                                res);
+            if (EXIT_FAILURE == ret) {
+                if (true == conn->registered) {
+                    drop_user(conn->fd);
+                }
+                close_conn(loop, conn);
+            }
+        }
+        uring_recycle_buf(&loop->buf_ring, bid);
+    } else if (-ENOBUFS != res && false == conn->closing) {
+        // end of file, or the connection failed
+        if (true == conn->registered) {
+            drop_user(conn->fd);
+        }
+        close_conn(loop, conn);
+    }
+
+    if (false == conn->recv_armed && false == conn->closing) {
+        ret = arm_recv(loop, conn);
+        if (EXIT_FAILURE == ret) {
+            if (true == conn->registered) {
+                drop_user(conn->fd);
+            }
+            close_conn(loop, conn);
+        }
+    }
+
+    release_conn(conn);
+}
+
+void handle_send_cqe(struct uring_loop *loop,
+                     struct uring_conn *conn,
+                     int res) {
+    struct uring_send *send;
+    int ret;
+
+    conn->send_in_flight = false;
+
+    if (res < 0) {
+        if (false == conn->closing) {
+            printf("WARN: failed to send message to fd %d\n", conn->fd);
+            if (true == conn->registered) {
+                drop_user(conn->fd);
+            }
+            close_conn(loop, conn);
+        }
+    } else {
+        send = list_first_entry(&conn->send_queue, struct uring_send, list);
+        send->off += res;
+        if (send->off == send->frame->len) {
+            list_del(&send->list);
+            put_msg_frame(send->frame);
+            os_free(send);
+        }
+
+        if (list_empty(&conn->send_queue)) {
+            del_timer(&conn->stall_timer);
+        } else {
+            mod_timer(&conn->stall_timer, USER_STALL_TIMEOUT_MS);
+        }
+    }
+
+    if (false == conn->closing && !list_empty(&conn->send_queue)) {
+        ret = submit_send(loop, conn);
+        if (EXIT_FAILURE == ret) {
+            if (true == conn->registered) {
+                drop_user(conn->fd);
+            }
+            close_conn(loop, conn);
+        }
+    }
+
+    release_conn(conn);
+}
+
+bool has_queued_sends(struct uring_loop *loop) {
+    for (int fd = 0; fd < loop->num_conns; fd++) {
+        if (NULL != loop->conns[fd]
+            && !list_empty(&loop->conns[fd]->send_queue)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void process_cqe(struct uring_loop *loop, struct io_uring_cqe *cqe) {
+    uint64_t user_data = cqe->user_data;
+    struct uring_conn *conn = URING_USER_DATA_CONN(user_data);
+
+    switch (URING_USER_DATA_OP(user_data)) {
+    case URING_OP_ACCEPT:
+        handle_accept_cqe(loop, cqe->res, cqe->flags);
+        break;
+    case URING_OP_RECV:
+        handle_recv_cqe(loop, conn, cqe->res, cqe->flags);
+        break;
+    case URING_OP_SEND:
+        handle_send_cqe(loop, conn, cqe->res);
+        break;
+    case URING_OP_CANCEL:
+        break;
+    case URING_OP_POLL:
+        handle_poll_cqe(loop, cqe->res);
+        break;
+    case URING_OP_TIMEOUT:
+        loop->drain_expired = true;
+        break;
+    case URING_OP_TIMER:
+        loop->timer_armed = false;
+        break;
+    default:
+        printf("WARN: unknown completion 0x%llx\n",
+               (unsigned long long)user_data);
+        break;
+    }
+}
+
+int queue_broadcast_msg(struct uring_loop *loop,
+                        struct uring_conn *conn,
+                        struct msg_frame *frame) {
+    struct uring_send *send;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    send = os_malloc(sizeof(struct uring_send));
+    if (NULL == send) {
+        printf("ERRO: failed to allocate memory for send\n");
+        goto error_out_malloc;
+    }
+
+    send->frame = get_msg_frame(frame);
+    send->off = 0;
+    list_add_tail(&send->list, &conn->send_queue);
+
+    if (false == conn->send_in_flight) {
+        ret = submit_send(loop, conn);
+        if (EXIT_FAILURE == ret) {
+            goto error_out_submit_send;
+        }
+    }
+
+    if (false == timer_pending(&conn->stall_timer)) {
+        mod_timer(&conn->stall_timer, USER_STALL_TIMEOUT_MS);
+    }
+
+    ret_final = EXIT_SUCCESS;
+    return ret_final;
+error_out_submit_send:
+    list_del(&send->list);
+    put_msg_frame(send->frame);
+    os_free(send);
+error_out_malloc:
+    return ret_final;
+}
+
+void release_conn(struct uring_conn *conn) {
+    struct uring_send *cur_send = NULL;
+    struct uring_send *n = NULL;
+
+    if (false == conn->closing
+        || true == conn->recv_armed
+        || true == conn->send_in_flight) {
+        return;
+    }
+
+    list_for_each_entry_safe(cur_send, n, &conn->send_queue, list) {
+        list_del(&cur_send->list);
+        put_msg_frame(cur_send->frame);
+        os_free(cur_send);
+    }
+
+    os_free(conn->in_buf);
+    os_free(conn);
+}
+
+int submit_send(struct uring_loop *loop, struct uring_conn *conn) {
+    struct io_uring_sqe *sqe;
+    struct uring_send *send;
+    int ret_final = EXIT_FAILURE;
+
+    sqe = get_sqe(loop);
+    if (NULL == sqe) {
+        printf("ERRO: no submission entry for send to fd %d\n", conn->fd);
+        goto error_out_get_sqe;
+    }
+
+    send = list_first_entry(&conn->send_queue, struct uring_send, list);
+    uring_prep_send(sqe,
+                    conn->fd,
+                    &send->frame->buf[send->off],
+                    send->frame->len - send->off,
+                    MSG_NOSIGNAL,
+                    URING_USER_DATA(conn, URING_OP_SEND));
+    conn->send_in_flight = true;
+
+    ret_final = EXIT_SUCCESS;
+error_out_get_sqe:
+    return ret_final;
+}
@@ -0,0 +1,266 @@
+// Copyright 2020 author. All rights reserved.
+
+#ifndef SRC_COMMS_COMMS_URING_INTERNAL_H_
+#define SRC_COMMS_COMMS_URING_INTERNAL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "include/list.h"
+#include "lib/uring/uring.h"
+#include "src/comms/comms.h"
+#include "src/message/message.h"
+#include "src/timer/timer.h"
+
+#define URING_OP_ACCEPT 1
+#define URING_OP_RECV 2
+#define URING_OP_SEND 3
+#define URING_OP_CANCEL 4
+#define URING_OP_POLL 5
+#define URING_OP_TIMEOUT 6
+#define URING_OP_TIMER 7
+#define URING_OP_MASK 0x7
+
+#define URING_USER_DATA(conn, op) ((uint64_t)(uintptr_t)(conn) | (op))
+#define URING_USER_DATA_OP(user_data) ((int)((user_data) & URING_OP_MASK))
+#define URING_USER_DATA_CONN(user_data) \
+    ((struct uring_conn *)(uintptr_t)((user_data) & ~(uint64_t)URING_OP_MASK))
+
+struct uring_send {
+    struct list_head list;
+    struct msg_frame *frame;
+    size_t off;
+};
+
+struct uring_loop;
+
+struct uring_conn {
+    struct uring_loop *loop;
+    int fd;
+    bool registered;
+    bool closing;
+    bool recv_armed;
+    bool send_in_flight;
+    uint8_t *in_buf;
+    size_t in_len;
+    size_t in_cap;
+    struct list_head send_queue;
+    struct timer register_timer;    // armed until the user registers
+    struct timer stall_timer;       // armed while sends are queued
+};
+
+struct uring_loop {
+    struct uring ring;
+    struct uring_buf_ring buf_ring;
+    struct uring_conn **conns;
+    int num_conns;
+    int listenfd;
+    int handler_fd;
+    event_handler handler;
+    bool draining;
+    bool drain_expired;
+    struct __kernel_timespec drain_ts;
+    bool timer_armed;
+    struct __kernel_timespec timer_ts;
+};
+
+/**
+ * Add connection for accepted fd.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @param fd (int) - File descriptor of new connection.
+ * @malloc (struct uring_conn *) - Connection state.
+ * @fail - Fail to grow connection table.
+ * @fail - Fail to allocate connection.
+ * @return (struct uring_conn *) - Connection on success, NULL on failure.
+ */
+struct uring_conn *add_conn(struct uring_loop *loop, int fd);
+
+/**
+ * Queue a multishot accept on the listen socket.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int arm_accept(struct uring_loop *loop);
+
+/**
+ * Queue a poll for the fd with its own handler.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int arm_poll(struct uring_loop *loop);
+
+/**
+ * Queue a multishot receive on a connection.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @param conn (struct uring_conn *) - Connection to receive from.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int arm_recv(struct uring_loop *loop, struct uring_conn *conn);
+
+/**
+ * Queue a timeout for the next timer deadline.
+ *
+ * The timeout also completes with the next completion, so the loop wakes
+ * up for the timers and computes the deadline again on every iteration.
+ * Nothing is queued while no timer is armed or a timeout is still pending.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int arm_timer_timeout(struct uring_loop *loop);
+
+/**
+ * Close connection.
+ *
+ * Cancels the pending receive, disarms the connection's timers and
+ * detaches the connection from the fd table. The fd of an unregistered
+ * connection is closed here, a registered user's fd is closed by the user
+ * module. The connection is freed by release_conn() once no requests
+ * reference it.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @param conn (struct uring_conn *) - Connection to close.
+ */
+void close_conn(struct uring_loop *loop, struct uring_conn *conn);
+
+/**
+ * Consume received bytes.
+ *
+ * Decodes every complete frame and keeps a trailing partial frame until
+ * more bytes arrive. The first frame must register the user, which
+ * disarms the registration deadline.
+ *
+ * @param conn (struct uring_conn *) - Connection bytes were received on.
+ * @param buf (uint8_t *) - Received bytes, modified by this function.
+ * @param len (size_t) - Number of received bytes.
+ * @fail - Fail to decode or handle a frame.
+ * @fail - Fail to store partial frame.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int consume_input(struct uring_conn *conn, uint8_t *buf, size_t len);
+
+/**
+ * Get connection for fd.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @param fd (int) - File descriptor of connection.
+ * @return (struct uring_conn *) - Connection on success, NULL otherwise.
+ */
+struct uring_conn *get_conn(struct uring_loop *loop, int fd);
+
+/**
+ * Get a free submission queue entry, submitting queued entries if full.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @return (struct io_uring_sqe *) - Entry on success, NULL on failure.
+ */
+struct io_uring_sqe *get_sqe(struct uring_loop *loop);
+
+/**
+ * Handle completion of the multishot accept.
+ *
+ * A new connection is closed if it does not register within
+ * USER_REGISTER_TIMEOUT_MS. The accept is queued again unless the loop is
+ * draining.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @param res (int) - Accepted fd or negative errno.
+ * @param flags (uint32_t) - Completion flags.
+ */
+void handle_accept_cqe(struct uring_loop *loop, int res, uint32_t flags);
+
+/**
+ * Handle completion of the poll for the fd with its own handler.
+ *
+ * Calls the handler and polls the fd again.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @param res (int) - Ready events or negative errno.
+ */
+void handle_poll_cqe(struct uring_loop *loop, int res);
+
+/**
+ * Handle completion of a multishot receive.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @param conn (struct uring_conn *) - Connection the receive belongs to.
+ * @param res (int) - Number of received bytes or negative errno.
+ * @param flags (uint32_t) - Completion flags.
+ */
+void handle_recv_cqe(struct uring_loop *loop,
+                     struct uring_conn *conn,
+                     int res,
+                     uint32_t flags);
+
+/**
+ * Handle completion of a send.
+ *
+ * Restarts the stall timer while messages are left, disarms it otherwise.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @param conn (struct uring_conn *) - Connection the send belongs to.
+ * @param res (int) - Number of sent bytes or negative errno.
+ */
+void handle_send_cqe(struct uring_loop *loop,
+                     struct uring_conn *conn,
+                     int res);
+
+/**
+ * Check whether any open connection has messages left to send.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @return (bool) - true if messages are queued, false otherwise.
+ */
+bool has_queued_sends(struct uring_loop *loop);
+
+/**
+ * Process a completion queue entry.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @param cqe (struct io_uring_cqe *) - Completion to process.
+ */
+void process_cqe(struct uring_loop *loop, struct io_uring_cqe *cqe);
+
+/**
+ * Queue broadcast message on a connection.
+ *
+ * The frame is sent once every message queued before it has been sent.
+ * The connection is closed if its queue makes no progress for
+ * USER_STALL_TIMEOUT_MS.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @param conn (struct uring_conn *) - Connection to send to.
+ * @param frame (struct msg_frame *) - Encoded broadcast message, the queue
+ *                                     takes its own reference.
+ * @malloc (struct uring_send *) - Queue entry.
+ * @fail - Fail to allocate queue entry.
+ * @fail - Fail to queue send.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int queue_broadcast_msg(struct uring_loop *loop,
+                        struct uring_conn *conn,
+                        struct msg_frame *frame);
+
+/**
+ * Free connection once no requests reference it.
+ *
+ * @param conn (struct uring_conn *) - Closed connection.
+ * @free (struct uring_conn *) - Connection state and queued sends.
+ */
+void release_conn(struct uring_conn *conn);
+
+/**
+ * Queue a send for the first message in the connection's send queue.
+ *
+ * @param loop (struct uring_loop *) - io_uring event loop.
+ * @param conn (struct uring_conn *) - Connection to send to.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int submit_send(struct uring_loop *loop, struct uring_conn *conn);
+
+#endif  // SRC_COMMS_COMMS_URING_INTERNAL_H_
@@ -0,0 +1,175 @@
+// Copyright 2020 author. All rights reserved.
+
+#include "src/fanout/fanout.h"
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+
+#include "lib/osdep/osdep.h"
+#include "src/fanout/fanout_internal.h"
+#include "src/stats/stats.h"
+
+static struct fanout_pool pool;
+
+// the last thread to finish a job wakes up the thread that posted it
+static void finish_fanout_job(void) {
+    if (1 == __atomic_fetch_sub(&pool.pending, 1, __ATOMIC_ACQ_REL)) {
+        os_eventfd_write(pool.donefd, 1);
+    }
+}
+
+static void *fanout_thread(void *arg) {
+    struct fanout_worker *worker = (struct fanout_worker *)arg;
+    uint64_t value;
+
+    while (true) {
+        os_eventfd_read(worker->wakefd, &value);
+        if (false == __atomic_load_n(&pool.running, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        run_fanout_chunks(&pool, worker->id);
+        finish_fanout_job();
+    }
+
+    return NULL;
+}
+
+static void join_fanout_workers(int num_started) {
+    __atomic_store_n(&pool.running, false, __ATOMIC_RELEASE);
+    for (int i = 0; i < num_started; i++) {
+        os_eventfd_write(pool.workers[i].wakefd, 1);
+    }
+
+    for (int i = 0; i < num_started; i++) {
+        os_pthread_join(pool.workers[i].thread);
+    }
+}
+
+int get_num_fanout_workers(void) {
+    return pool.num_workers;
+}
+
+void run_fanout(void **items, int num_items, fanout_func func, void *arg) {
+    uint64_t value;
+
+    if (0 == pool.num_workers ||
+            num_items <= FANOUT_CHUNK_LEN ||
+            true == __atomic_exchange_n(&pool.busy, true, __ATOMIC_ACQUIRE)) {
+        for (int i = 0; i < num_items; i++) {
+            func(items[i], arg);
+        }
+        return;
+    }
+
+    init_fanout_job(&pool, items, num_items, func, arg);
+    for (int i = 0; i < pool.num_workers; i++) {
+        os_eventfd_write(pool.workers[i].wakefd, 1);
+    }
+
+    run_fanout_chunks(&pool, 0);
+    if (1 != __atomic_fetch_sub(&pool.pending, 1, __ATOMIC_ACQ_REL)) {
+        os_eventfd_read(pool.donefd, &value);
+    }
+
+    add_stat(STAT_FANOUT_JOBS, 1);
+    __atomic_store_n(&pool.busy, false, __ATOMIC_RELEASE);
+}
+
+int start_fanout_workers(int num) {
+    sigset_t mask;
+    sigset_t oldmask;
+    int num_init = 0;
+    int num_started = 0;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    pool.donefd = os_eventfd(0, EFD_CLOEXEC);
+    if (-1 == pool.donefd) {
+        printf("ERRO: failed to create eventfd for fanout\n");
+        goto error_out_eventfd;
+    }
+
+    pool.workers = os_malloc(num * sizeof(struct fanout_worker));
+    if (NULL == pool.workers) {
+        printf("ERRO: failed to allocate memory for fanout workers\n");
+        goto error_out_malloc_workers;
+    }
+
+    pool.shares = os_malloc((num + 1) * sizeof(struct fanout_share));
+    if (NULL == pool.shares) {
+        printf("ERRO: failed to allocate memory for fanout shares\n");
+        goto error_out_malloc_shares;
+    }
+    pool.num_shares = num + 1;
+
+    for (num_init = 0; num_init < num; num_init++) {
+        ret = init_fanout_worker(&pool.workers[num_init], num_init + 1);
+        if (EXIT_FAILURE == ret) {
+            goto error_out_init_fanout_worker;
+        }
+    }
+    pool.running = true;
+
+    // worker threads inherit the mask, signals go to the calling thread
+    sigfillset(&mask);
+    os_pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+    for (num_started = 0; num_started < num; num_started++) {
+        ret = os_pthread_create(&pool.workers[num_started].thread,
+                                &fanout_thread,
+                                &pool.workers[num_started]);
+        if (0 != ret) {
+            printf("ERRO: failed to start fanout worker %d\n", num_started);
+            break;
+        }
+    }
+    os_pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+
+    if (num_started < num) {
+        goto error_out_pthread_create;
+    }
+
+    pool.num_workers = num;
+    printf("INFO: started %d fanout workers\n", num);
+    ret_final = EXIT_SUCCESS;
+    return ret_final;
+error_out_pthread_create:
+    join_fanout_workers(num_started);
+error_out_init_fanout_worker:
+    for (int i = 0; i < num_init; i++) {
+        exit_fanout_worker(&pool.workers[i]);
+    }
+    os_free(pool.shares);
+    pool.shares = NULL;
+    pool.num_shares = 0;
+error_out_malloc_shares:
+    os_free(pool.workers);
+    pool.workers = NULL;
+error_out_malloc_workers:
+    os_close(pool.donefd);
+error_out_eventfd:
+    return ret_final;
+}
+
+void stop_fanout_workers(void) {
+    if (0 == pool.num_workers) {
+        return;
+    }
+
+    join_fanout_workers(pool.num_workers);
+
+    for (int i = 0; i < pool.num_workers; i++) {
+        exit_fanout_worker(&pool.workers[i]);
+    }
+
+    os_free(pool.shares);
+    pool.shares = NULL;
+    pool.num_shares = 0;
+    os_free(pool.workers);
+    pool.workers = NULL;
+    pool.num_workers = 0;
+    os_close(pool.donefd);
+}
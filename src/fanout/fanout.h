@@ -0,0 +1,60 @@
+// Copyright 2020 author. All rights reserved.
+
+#ifndef SRC_FANOUT_FANOUT_H_
+#define SRC_FANOUT_FANOUT_H_
+
+#define FANOUT_CHUNK_LEN 128
+
+typedef void (*fanout_func)(void *item, void *arg);
+
+/**
+ * Get number of fanout worker threads.
+ *
+ * @return (int) - Number of workers, 0 if the pool is not started.
+ */
+int get_num_fanout_workers(void);
+
+/**
+ * Call a function for every item, in parallel on the fanout workers.
+ *
+ * The items are split into chunks of FANOUT_CHUNK_LEN and every worker and
+ * the calling thread start on their own share of the chunks. A thread that
+ * runs out of chunks takes the next chunk from the share of another thread.
+ * Returns once the function returned for every item, so each item is only
+ * touched by one thread at a time. Runs on the calling thread alone if the
+ * pool is not started, another thread is using it or there are too few
+ * items to split.
+ *
+ * @param items (void **) - Items to call function for.
+ * @param num_items (int) - Number of items.
+ * @param func (fanout_func) - Function to call, must be thread safe.
+ * @param arg (void *) - Argument passed to every call.
+ */
+void run_fanout(void **items, int num_items, fanout_func func, void *arg);
+
+/**
+ * Start fanout worker threads.
+ *
+ * The worker threads block all signals, so signals are handled by the
+ * calling thread.
+ *
+ * @param num (int) - Number of worker threads.
+ * @malloc (struct fanout_worker *) - Worker table.
+ * @malloc (struct fanout_share *) - Chunk shares of workers and caller.
+ * @fail - Fail to create eventfd.
+ * @fail - Fail to allocate worker table.
+ * @fail - Fail to initialize a worker.
+ * @fail - Fail to start a worker thread.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int start_fanout_workers(int num);
+
+/**
+ * Stop fanout worker threads and wait for them to exit.
+ *
+ * @free (struct fanout_worker *) - Worker table.
+ * @free (struct fanout_share *) - Chunk shares of workers and caller.
+ */
+void stop_fanout_workers(void);
+
+#endif  // SRC_FANOUT_FANOUT_H_
@@ -0,0 +1,96 @@
+// Copyright 2020 author. All rights reserved.
+
+#include "src/fanout/fanout_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+
+#include "lib/osdep/osdep.h"
+#include "src/stats/stats.h"
+
+void exit_fanout_worker(struct fanout_worker *worker) {
+    os_close(worker->wakefd);
+}
+
+int init_fanout_worker(struct fanout_worker *worker, int id) {
+    int ret_final = EXIT_FAILURE;
+
+    worker->id = id;
+
+    // the worker sleeps in read() until a job is posted
+    worker->wakefd = os_eventfd(0, EFD_CLOEXEC);
+    if (-1 == worker->wakefd) {
+        printf("ERRO: failed to create eventfd for fanout worker %d\n", id);
+        goto error_out_eventfd;
+    }
+
+    ret_final = EXIT_SUCCESS;
+error_out_eventfd:
+    return ret_final;
+}
+
+void init_fanout_job(struct fanout_pool *pool,
+                     void **items,
+                     int num_items,
+                     fanout_func func,
+                     void *arg) {
+    int num_chunks = (num_items + FANOUT_CHUNK_LEN - 1) / FANOUT_CHUNK_LEN;
+
+    pool->items = items;
+    pool->num_items = num_items;
+    pool->func = func;
+    pool->arg = arg;
+
+    for (int i = 0; i < pool->num_shares; i++) {
+        pool->shares[i].next = i * num_chunks / pool->num_shares;
+        pool->shares[i].end = (i + 1) * num_chunks / pool->num_shares;
+    }
+
+    pool->pending = pool->num_shares;
+}
+
+void run_fanout_chunks(struct fanout_pool *pool, int self) {
+    int chunk;
+    int first;
+    int last;
+
+    chunk = take_fanout_chunk(pool, self);
+    while (-1 != chunk) {
+        first = chunk * FANOUT_CHUNK_LEN;
+        last = first + FANOUT_CHUNK_LEN;
+        if (last > pool->num_items) {
+            last = pool->num_items;
+        }
+
+        for (int i = first; i < last; i++) {
+            pool->func(pool->items[i], pool->arg);
+        }
+
+        chunk = take_fanout_chunk(pool, self);
+    }
+}
+
+int take_fanout_chunk(struct fanout_pool *pool, int self) {
+    struct fanout_share *share;
+    int chunk;
+
+    for (int i = 0; i < pool->num_shares; i++) {
+        share = &pool->shares[(self + i) % pool->num_shares];
+
+        // don't bump a drained share, its owner is looking at it too
+        if (__atomic_load_n(&share->next, __ATOMIC_RELAXED) >= share->end) {
+            continue;
+        }
+
+        chunk = __atomic_fetch_add(&share->next, 1, __ATOMIC_RELAXED);
+        if (chunk < share->end) {
+            if (0 != i) {
+                add_stat(STAT_FANOUT_STEALS, 1);
+            }
+            return chunk;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,98 @@
+// Copyright 2020 author. All rights reserved.
+
+#ifndef SRC_FANOUT_FANOUT_INTERNAL_H_
+#define SRC_FANOUT_FANOUT_INTERNAL_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "src/fanout/fanout.h"
+
+#define FANOUT_CACHE_LINE 64
+
+// chunks [next, end) of a job, taken by the owner and by idle threads
+struct fanout_share {
+    int next;
+    int end;
+    char pad[FANOUT_CACHE_LINE - 2 * sizeof(int)];
+};
+
+struct fanout_worker {
+    pthread_t thread;
+    int id;
+    int wakefd;
+};
+
+struct fanout_pool {
+    struct fanout_worker *workers;
+    int num_workers;
+    // share 0 belongs to the calling thread, share i + 1 to worker i
+    struct fanout_share *shares;
+    int num_shares;
+    bool running;
+    bool busy;
+    int donefd;
+    int pending;
+    void **items;
+    int num_items;
+    fanout_func func;
+    void *arg;
+};
+
+/**
+ * Release fanout worker once its thread has stopped.
+ *
+ * @param worker (struct fanout_worker *) - Worker to release.
+ * @close - File descriptor for eventfd.
+ */
+void exit_fanout_worker(struct fanout_worker *worker);
+
+/**
+ * Initialize fanout worker.
+ *
+ * Creates the blocking eventfd the worker waits on for jobs.
+ *
+ * @param worker (struct fanout_worker *) - Worker to initialize.
+ * @param id (int) - Index of worker's share.
+ * @open - File descriptor for eventfd.
+ * @fail - Fail to create eventfd.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int init_fanout_worker(struct fanout_worker *worker, int id);
+
+/**
+ * Set up a job and split its chunks evenly between the shares.
+ *
+ * @param pool (struct fanout_pool *) - Worker pool.
+ * @param items (void **) - Items to call function for.
+ * @param num_items (int) - Number of items.
+ * @param func (fanout_func) - Function to call.
+ * @param arg (void *) - Argument passed to every call.
+ */
+void init_fanout_job(struct fanout_pool *pool,
+                     void **items,
+                     int num_items,
+                     fanout_func func,
+                     void *arg);
+
+/**
+ * Run chunks of the current job until none are left.
+ *
+ * @param pool (struct fanout_pool *) - Worker pool.
+ * @param self (int) - Index of calling thread's share.
+ */
+void run_fanout_chunks(struct fanout_pool *pool, int self);
+
+/**
+ * Take the next chunk of the current job.
+ *
+ * Chunks are taken from the calling thread's own share first, then from
+ * the shares of the other threads.
+ *
+ * @param pool (struct fanout_pool *) - Worker pool.
+ * @param self (int) - Index of calling thread's share.
+ * @return (int) - Index of chunk, -1 if every chunk has been taken.
+ */
+int take_fanout_chunk(struct fanout_pool *pool, int self);
+
+#endif  // SRC_FANOUT_FANOUT_INTERNAL_H_
@@ -5,57 +5,500 @@
 #endif
 
 #include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
 #include <unistd.h>
 
+#include "lib/osdep/osdep.h"
 #include "src/comms/comms.h"
+#include "src/comms/comms_uring.h"
+#include "src/fanout/fanout.h"
+#include "src/reactor/reactor.h"
+#include "src/stats/stats.h"
+#include "src/timer/timer.h"
+#include "src/upgrade/upgrade.h"
 #include "src/user/user.h"
 
-static volatile int run;
+static bool run;
+static bool upgrade;
+static bool upgrade_allowed;
 
-static void sighandler(int signum) {
-    run = 0;
-    printf("INFO: received signal %d\n", signum);
+static int handle_signal(int fd) {
+    struct signalfd_siginfo info;
+    int ret_final = EXIT_FAILURE;
+
+    if ((ssize_t)sizeof(info) != read(fd, &info, sizeof(info))) {
+        printf("ERRO: failed to read signal\n");
+        goto error_out_read;
+    }
+
+    if (SIGUSR2 == info.ssi_signo) {
+        if (false == upgrade_allowed) {
+            printf("WARN: upgrade is only supported by a single epoll loop\n");
+            goto out_ignore;
+        }
+        printf("INFO: received signal %u, upgrading\n", info.ssi_signo);
+        upgrade = true;
+    } else {
+        printf("INFO: received signal %u, shutting down\n", info.ssi_signo);
+    }
+    run = false;
+
+out_ignore:
+
+    ret_final = EXIT_SUCCESS;
+error_out_read:
+    return ret_final;
+}
+
+static int init_signals(void) {
+    sigset_t mask;
+    int sigfd;
+
+    // the signals are only delivered through the signalfd, reactor threads
+    // inherit the mask
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR2);
+    if (-1 == sigprocmask(SIG_BLOCK, &mask, NULL)) {
+        printf("ERRO: failed to block signals\n");
+        goto error_out_sigprocmask;
+    }
+
+    sigfd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (-1 == sigfd) {
+        printf("ERRO: failed to create signalfd\n");
+        goto error_out_signalfd;
+    }
+
+    return sigfd;
+error_out_signalfd:
+error_out_sigprocmask:
+    return -1;
+}
+
+static int parse_send_policy(const char *name) {
+    if (0 == strcmp(name, "disconnect")) {
+        return SEND_POLICY_DISCONNECT;
+    } else if (0 == strcmp(name, "drop-oldest")) {
+        return SEND_POLICY_DROP_OLDEST;
+    } else if (0 == strcmp(name, "drop-newest")) {
+        return SEND_POLICY_DROP_NEWEST;
+    } else if (0 == strcmp(name, "collapse")) {
+        return SEND_POLICY_COLLAPSE;
+    }
+
+    return -1;
+}
+
+static void usage(const char *prog) {
+    printf("usage: %s [-b epoll|uring] [-f frames] [-j workers] "
+           "[-l backlog]\n       [-o profile] [-p policy] [-q bytes] "
+           "[-r frames] [-R bytes] [-s]\n       [-t threads] [-u fd] "
+           "[-w ms] [-W bytes] [-z bytes]\n",
+           prog);
+    printf("  -b  event loop backend, defaults to epoll\n");
+    printf("  -f  messages queued per user, defaults to %d\n",
+           USER_SEND_QUEUE_MAX_FRAMES);
+    printf("  -j  send broadcasts to users from worker threads, 0 for one "
+           "per core\n");
+    printf("  -l  listen backlog, defaults to SOMAXCONN\n");
+    printf("  -o  default, low-latency or throughput socket options for "
+           "users, defaults to\n      default\n");
+    printf("  -p  disconnect, drop-oldest, drop-newest or collapse once a "
+           "user's queue is\n      full, defaults to disconnect\n");
+    printf("  -q  bytes queued per user, defaults to %d\n",
+           USER_SEND_QUEUE_MAX);
+    printf("  -r  messages read from a user per loop iteration, defaults "
+           "to %d\n",
+           USER_READ_BUDGET_FRAMES);
+    printf("  -R  message bytes read from a user per loop iteration, "
+           "defaults to %d\n",
+           USER_READ_BUDGET_BYTES);
+    printf("  -s  poll the io_uring submission queue from a kernel thread\n");
+    printf("  -t  run an epoll event loop per thread, 0 for one per core\n");
+    printf("  -u  take over from the server on the other end of socket fd\n");
+    printf("  -w  batch broadcasts for up to ms for users that read batches\n");
+    printf("  -W  bytes of broadcasts a batch holds, defaults to %d\n",
+           USER_BATCH_MAX_LEN);
+    printf("  -z  send at least bytes at once with MSG_ZEROCOPY\n");
 }
 
-int main() {
+static int run_event_loop(char *const argv[],
+                          bool use_uring,
+                          bool sqpoll,
+                          int sigfd,
+                          int upgrade_sock) {
     int listenfd;
+    int epollfd = -1;
     int ret;
     int ret_final = EXIT_FAILURE;
-    struct sigaction action;
 
-    listenfd = init_listen_sock();
+    if (-1 == upgrade_sock) {
+        listenfd = init_listen_sock(false);
+    } else {
+        listenfd = receive_listen_sock(upgrade_sock);
+    }
     if (-1 == listenfd) {
         printf("ERRO: failed to setup listen sock\n");
         goto error_out_listen;
     }
 
+    if (true == use_uring) {
+        ret = init_uring_event_loop(listenfd, sqpoll);
+        if (EXIT_FAILURE == ret) {
+            printf("ERRO: failed to setup io_uring event loop\n");
+            goto error_out_event_loop;
+        }
+        ret = add_uring_event_handler(sigfd, &handle_signal);
+    } else {
+        epollfd = init_event_loop(listenfd);
+        if (-1 == epollfd) {
+            printf("ERRO: failed to setup event loop\n");
+            goto error_out_event_loop;
+        }
+        ret = add_event_handler(epollfd, sigfd, &handle_signal);
+    }
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to add signalfd to event loop\n");
+        goto error_out_add_event_handler;
+    }
+
+    init_timers();
     init_user();
 
-    action.sa_flags = 0;
-    action.sa_handler = &sighandler;
-    sigemptyset(&action.sa_mask);
-    if (-1 == sigaction(SIGINT, &action, NULL)) {
-        printf("ERRO: failed to handle SIGINT\n");
-        goto error_out_sigaction;
+    if (-1 != upgrade_sock) {
+        ret = receive_users(upgrade_sock, epollfd);
+        close(upgrade_sock);
+        upgrade_sock = -1;
+        if (EXIT_FAILURE == ret) {
+            printf("ERRO: failed to take over users\n");
+            goto error_out_receive_users;
+        }
     }
 
-    run = 1;
     while (run) {
-        ret = monitor_socks(listenfd);
+        if (true == use_uring) {
+            ret = monitor_socks_uring();
+        } else {
+            ret = monitor_socks(epollfd, listenfd);
+        }
         if (EXIT_FAILURE == ret) {
             printf("ERRO: failed to monitor sockets\n");
             goto error_out_monitor_socks;
         }
+
+        if (true == upgrade) {
+            ret = start_upgrade(argv, listenfd);
+            if (EXIT_SUCCESS == ret) {
+                break;
+            }
+            printf("WARN: upgrade failed, still serving\n");
+            upgrade = false;
+            run = true;
+        }
+    }
+
+    // the users of a completed upgrade belong to the new process
+    if (true == upgrade) {
+        ret = EXIT_SUCCESS;
+    } else if (true == use_uring) {
+        ret = drain_uring_event_loop();
+    } else {
+        ret = drain_event_loop(epollfd, listenfd);
+    }
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to drain event loop\n");
+        goto error_out_drain_event_loop;
     }
 
     ret_final = EXIT_SUCCESS;
+error_out_drain_event_loop:
 error_out_monitor_socks:
-error_out_sigaction:
+error_out_receive_users:
+error_out_add_event_handler:
+    if (true == use_uring) {
+        exit_uring_event_loop();
+    } else {
+        close(epollfd);
+    }
+error_out_event_loop:
+    close(listenfd);
 error_out_listen:
-    if (-1 != listenfd) {
-        close(listenfd);
+    if (-1 != upgrade_sock) {
+        close(upgrade_sock);
+    }
+    return ret_final;
+}
+
+static int run_reactors(int num_reactors, int sigfd) {
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    ret = start_reactors(num_reactors);
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to start reactors\n");
+        goto error_out_start_reactors;
+    }
+
+    // the reactors wait on their own event loops, this thread only waits
+    // for signals
+    while (run) {
+        handle_signal(sigfd);
+    }
+
+    stop_reactors();
+
+    ret_final = EXIT_SUCCESS;
+error_out_start_reactors:
+    return ret_final;
+}
+
+int main(int argc, char *argv[]) {
+    bool use_uring = false;
+    bool sqpoll = false;
+    int num_reactors = -1;
+    int num_workers = -1;
+    int upgrade_sock = -1;
+    long zerocopy = 0;
+    struct send_budget budget = {
+        .policy = SEND_POLICY_DISCONNECT,
+        .max_bytes = USER_SEND_QUEUE_MAX,
+        .max_frames = USER_SEND_QUEUE_MAX_FRAMES,
+    };
+    bool budget_set = false;
+    struct read_budget read_budget = {
+        .max_frames = USER_READ_BUDGET_FRAMES,
+        .max_bytes = USER_READ_BUDGET_BYTES,
+    };
+    bool read_budget_set = false;
+    long batch_window = -1;
+    long batch_len = USER_BATCH_MAX_LEN;
+    bool batch_len_set = false;
+    struct sock_profile *profile = NULL;
+    long limit;
+    int backlog;
+    char *end;
+    int opt;
+    int sigfd;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    while (-1 != (opt = getopt(argc, argv, "b:f:j:l:o:p:q:r:R:st:u:w:W:z:"))) {
+        switch (opt) {
+        case 'b':
+            if (0 == strcmp(optarg, "uring")) {
+                use_uring = true;
+            } else if (0 != strcmp(optarg, "epoll")) {
+                usage(argv[0]);
+                goto error_out_args;
+            }
+            break;
+        case 'f':
+            limit = strtol(optarg, &end, 10);
+            if ('\0' != *end || limit <= 0) {
+                usage(argv[0]);
+                goto error_out_args;
+            }
+            budget.max_frames = (size_t)limit;
+            budget_set = true;
+            break;
+        case 'j':
+            num_workers = (int)strtol(optarg, &end, 10);
+            if ('\0' != *end || num_workers < 0) {
+                usage(argv[0]);
+                goto error_out_args;
+            }
+            if (0 == num_workers) {
+                num_workers = os_get_num_cpus();
+            }
+            break;
+        case 'l':
+            backlog = (int)strtol(optarg, &end, 10);
+            if ('\0' != *end || backlog <= 0) {
+                usage(argv[0]);
+                goto error_out_args;
+            }
+            set_listen_backlog(backlog);
+            break;
+        case 'o':
+            profile = get_sock_profile(optarg);
+            if (NULL == profile) {
+                usage(argv[0]);
+                goto error_out_args;
+            }
+            break;
+        case 'p':
+            budget.policy = parse_send_policy(optarg);
+            if (-1 == budget.policy) {
+                usage(argv[0]);
+                goto error_out_args;
+            }
+            budget_set = true;
+            break;
+        case 'q':
+            limit = strtol(optarg, &end, 10);
+            if ('\0' != *end || limit <= 0) {
+                usage(argv[0]);
+                goto error_out_args;
+            }
+            budget.max_bytes = (size_t)limit;
+            budget_set = true;
+            break;
+        case 'r':
+            limit = strtol(optarg, &end, 10);
+            if ('\0' != *end || limit <= 0) {
+                usage(argv[0]);
+                goto error_out_args;
+            }
+            read_budget.max_frames = (size_t)limit;
+            read_budget_set = true;
+            break;
+        case 'R':
+            limit = strtol(optarg, &end, 10);
+            if ('\0' != *end || limit <= 0) {
+                usage(argv[0]);
+                goto error_out_args;
+            }
+            read_budget.max_bytes = (size_t)limit;
+            read_budget_set = true;
+            break;
+        case 's':
+            sqpoll = true;
+            break;
+        case 't':
+            num_reactors = (int)strtol(optarg, &end, 10);
+            if ('\0' != *end || num_reactors < 0) {
+                usage(argv[0]);
+                goto error_out_args;
+            }
+            if (0 == num_reactors) {
+                num_reactors = os_get_num_cpus();
+            }
+            break;
+        case 'u':
+            upgrade_sock = (int)strtol(optarg, &end, 10);
+            if ('\0' != *end || upgrade_sock < 0) {
+                usage(argv[0]);
+                goto error_out_args;
+            }
+            break;
+        case 'w':
+            batch_window = strtol(optarg, &end, 10);
+            if ('\0' != *end
+                || batch_window < 0
+                || batch_window > UINT32_MAX) {
+                usage(argv[0]);
+                goto error_out_args;
+            }
+            break;
+        case 'W':
+            batch_len = strtol(optarg, &end, 10);
+            if ('\0' != *end || batch_len <= 0 || batch_len > UINT16_MAX) {
+                usage(argv[0]);
+                goto error_out_args;
+            }
+            batch_len_set = true;
+            break;
+        case 'z':
+            zerocopy = strtol(optarg, &end, 10);
+            if ('\0' != *end || zerocopy <= 0) {
+                usage(argv[0]);
+                goto error_out_args;
+            }
+            set_zerocopy_threshold((size_t)zerocopy);
+            break;
+        default:
+            usage(argv[0]);
+            goto error_out_args;
+        }
+    }
+
+    if (true == use_uring && -1 != num_reactors) {
+        printf("ERRO: -t is only supported by the epoll backend\n");
+        goto error_out_args;
+    }
+
+    if (true == use_uring && true == budget_set) {
+        printf("ERRO: -f, -p and -q are only supported by the epoll "
+               "backend\n");
+        goto error_out_args;
+    }
+    set_send_budget(&budget);
+
+    // io_uring reads at most one buffer per completion
+    if (true == use_uring && true == read_budget_set) {
+        printf("ERRO: -r and -R are only supported by the epoll backend\n");
+        goto error_out_args;
     }
+    set_read_budget(&read_budget);
+
+    if (NULL != profile) {
+        set_sock_profile(profile);
+        set_cork_flushes(profile->cork);
+    }
+
+    if (-1 == batch_window && true == batch_len_set) {
+        printf("ERRO: -W needs -w\n");
+        goto error_out_args;
+    }
+
+    if (-1 != batch_window) {
+        if (true == use_uring) {
+            printf("ERRO: -w is only supported by the epoll backend\n");
+            goto error_out_args;
+        }
+        set_batch_window((uint32_t)batch_window, (size_t)batch_len);
+    }
+
+    if (true == use_uring && 0 != zerocopy) {
+        printf("ERRO: -z is only supported by the epoll backend\n");
+        goto error_out_args;
+    }
+
+    if (true == use_uring && -1 != num_workers) {
+        printf("ERRO: -j is only supported by the epoll backend\n");
+        goto error_out_args;
+    }
+
+    upgrade_allowed = (false == use_uring && -1 == num_reactors);
+    if (-1 != upgrade_sock && false == upgrade_allowed) {
+        printf("ERRO: -u is only supported by a single epoll loop\n");
+        goto error_out_args;
+    }
+
+    sigfd = init_signals();
+    if (-1 == sigfd) {
+        goto error_out_init_signals;
+    }
+
+    if (num_workers > 0) {
+        ret = start_fanout_workers(num_workers);
+        if (EXIT_FAILURE == ret) {
+            printf("ERRO: failed to start fanout workers\n");
+            goto error_out_start_fanout_workers;
+        }
+    }
+
+    run = true;
+    if (-1 != num_reactors) {
+        ret_final = run_reactors(num_reactors, sigfd);
+    } else {
+        ret_final = run_event_loop(argv, use_uring, sqpoll, sigfd,
+                                   upgrade_sock);
+    }
+    stop_fanout_workers();
+    print_stats();
+
+error_out_start_fanout_workers:
+    close(sigfd);
+error_out_init_signals:
+error_out_args:
     return ret_final;
 }
@@ -3,97 +3,378 @@
 #include "src/message/message.h"
 
 #include <endian.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "lib/osdep/osdep.h"
+#include "lib/ring/ring.h"
 #include "src/message/message_internal.h"
 
-int get_msg_new_user(int fd, void *data) {
-    return get_msg(fd, data, &parse_msg_new_user);
+// data length of each field type, strings are sent with their NUL
+static size_t get_field_len_bytes(struct msg_view value) {
+    return value.len;
 }
 
-int get_msg_registered_user(int fd, void *data) {
-    return get_msg(fd, data, &parse_msg_registered_user);
+static size_t get_field_len_string(char *value) {
+    return strlen(value) + 1;
 }
 
-int send_broadcast_msg(int fd, struct msg_broadcast *data) {
-    struct msg_hdr hdr;
-    struct msg_field field;
-    uint32_t timestamp;
-    int ret;
-    int ret_final = EXIT_FAILURE;
-
-    hdr.type = htobe16(MSG_TYPE_BROADCAST_MSG);
-    hdr.len = htobe16(sizeof(struct msg_field)      // timestamp
-                      + sizeof(data->timestamp)
-                      + sizeof(struct msg_field)    // name
-                      + strlen(data->name) + 1
-                      + sizeof(struct msg_field)    // msg
-                      + strlen(data->msg) + 1);
-
-    ret = send_data(fd, &hdr, sizeof(struct msg_hdr));
-    if (EXIT_FAILURE == ret) {
-        printf("ERRO: failed to send message header to fd %d\n", fd);
-        goto error_out_send_msg_hdr;
+static size_t get_field_len_uint32(uint32_t value) {
+    return sizeof(value);
+}
+
+// writes a v1 or v2 field header, returns where the data goes
+static uint8_t *put_field_hdr(uint8_t *iter,
+                              uint8_t flags,
+                              uint16_t type,
+                              uint16_t id,
+                              size_t len) {
+    struct msg_field *field = (struct msg_field *)iter;
+    struct msg_field_v2 *field_v2 = (struct msg_field_v2 *)iter;
+
+    if (0 != (flags & MSG_FLAG_V2)) {
+        field_v2->type = htobe16(type);
+        field_v2->id = htobe16(id);
+        field_v2->len = htobe32(len);
+        return field_v2->data;
     }
 
-    field.type = htobe16(FIELD_TYPE_UINT32);
-    field.id = htobe16(FIELD_ID_TIMESTAMP);
-    field.len = htobe16(sizeof(data->timestamp));
-    ret = send_data(fd, &field, sizeof(struct msg_field));
-    if (EXIT_FAILURE == ret) {
-        printf(
-            "ERRO: failed to send field header for timestamp to fd %d\n",
-            fd);
-        goto error_out_send_field_hdr_timestamp;
+    field->type = htobe16(type);
+    field->id = htobe16(id);
+    field->len = htobe16(len);
+    return field->data;
+}
+
+static uint8_t *put_field_bytes(uint8_t *iter,
+                                uint8_t flags,
+                                uint16_t id,
+                                struct msg_view value,
+                                size_t len) {
+    iter = put_field_hdr(iter, flags, FIELD_TYPE_BYTES, id, len);
+    memcpy(iter, value.str, len);
+    return &iter[len];
+}
+
+static uint8_t *put_field_string(uint8_t *iter,
+                                 uint8_t flags,
+                                 uint16_t id,
+                                 char *value,
+                                 size_t len) {
+    iter = put_field_hdr(iter, flags, FIELD_TYPE_STRING, id, len);
+    memcpy(iter, value, len);
+    return &iter[len];
+}
+
+static uint8_t *put_field_uint32(uint8_t *iter,
+                                 uint8_t flags,
+                                 uint16_t id,
+                                 uint32_t value,
+                                 size_t len) {
+    iter = put_field_hdr(iter, flags, FIELD_TYPE_UINT32, id, len);
+    value = htobe32(value);
+    memcpy(iter, &value, len);
+    return &iter[len];
+}
+
+// writes a v1 or v2 frame header, returns where the first field goes
+static uint8_t *put_msg_hdr(uint8_t *buf,
+                            uint16_t type,
+                            uint8_t flags,
+                            size_t frame_len) {
+    struct msg_hdr *hdr = (struct msg_hdr *)buf;
+    struct msg_hdr_v2 *hdr_v2 = (struct msg_hdr_v2 *)buf;
+
+    hdr->type = htobe16(type);
+    hdr->flags = flags;
+    hdr->ret = 0;
+    if (0 != (flags & MSG_FLAG_V2)) {
+        hdr_v2->len16 = 0;
+        hdr_v2->len = htobe32(frame_len - sizeof(struct msg_hdr_v2));
+        return hdr_v2->data;
     }
 
-    timestamp = htobe32(data->timestamp);
-    ret = send_data(fd, &timestamp, sizeof(timestamp));
-    if (EXIT_FAILURE == ret) {
-        printf("ERRO: failed to send timestamp to fd %d\n", fd);
-        goto error_out_send_timestamp;
+    hdr->len = htobe16(frame_len - sizeof(struct msg_hdr));
+    return hdr->data;
+}
+
+#define DECLARE_FIELD_LEN(name, id, type, value) \
+    size_t name##_len;
+#define MEASURE_FIELD(name, id, type, value) \
+    lens->name##_len = get_field_len_##type(value); \
+    frame_len += MSG_FIELD_HDR_LEN(hdr_flags) + lens->name##_len;
+#define PUT_FIELD(name, id, type, value) \
+    iter = put_field_##type(iter, hdr_flags, id, value, lens->name##_len);
+
+// Defines create_<codec>_frame() and encode_<codec>_frame() for a frame of
+// msg_type holding the fields of schema. Both measure each field once, keep
+// the lengths in a struct <codec>_lens and write the frame front to back
+// from them. The flags are constant, so the v1 or v2 branches fold away.
+#define DEFINE_ENCODER(codec, data_type, msg_type, flags, schema) \
+struct codec##_lens { \
+    schema(DECLARE_FIELD_LEN) \
+}; \
+\
+static size_t measure_##codec##_frame(data_type *data, \
+                                      struct codec##_lens *lens) { \
+    const uint8_t hdr_flags = (flags); \
+    size_t frame_len = MSG_HDR_LEN(hdr_flags); \
+\
+    schema(MEASURE_FIELD) \
+    if (0 == (hdr_flags & MSG_FLAG_V2) && frame_len > MSG_MAX_FRAME_LEN) { \
+        printf("ERRO: " #codec " frame too long\n"); \
+        return 0; \
+    } \
+\
+    return frame_len; \
+} \
+\
+static void put_##codec##_frame(data_type *data, \
+                                struct codec##_lens *lens, \
+                                uint8_t *buf, \
+                                size_t frame_len) { \
+    const uint8_t hdr_flags = (flags); \
+    uint8_t *iter; \
+\
+    iter = put_msg_hdr(buf, msg_type, hdr_flags, frame_len); \
+    schema(PUT_FIELD) \
+} \
+\
+static struct msg_frame *create_##codec##_frame(data_type *data) { \
+    struct codec##_lens lens; \
+    struct msg_frame *frame; \
+    size_t frame_len; \
+\
+    frame_len = measure_##codec##_frame(data, &lens); \
+    if (0 == frame_len) { \
+        return NULL; \
+    } \
+\
+    frame = create_msg_frame(frame_len); \
+    if (NULL == frame) { \
+        return NULL; \
+    } \
+\
+    put_##codec##_frame(data, &lens, frame->buf, frame_len); \
+    return frame; \
+} \
+\
+static int encode_##codec##_frame(data_type *data, \
+                                  uint8_t *buf, \
+                                  size_t len) { \
+    struct codec##_lens lens; \
+    size_t frame_len; \
+\
+    frame_len = measure_##codec##_frame(data, &lens); \
+    if (0 == frame_len) { \
+        return -1; \
+    } else if (len < frame_len) { \
+        printf("ERRO: buffer too small for " #codec " frame\n"); \
+        return -1; \
+    } \
+\
+    put_##codec##_frame(data, &lens, buf, frame_len); \
+    return frame_len; \
+}
+
+DEFINE_ENCODER(broadcast_msg,
+               struct msg_broadcast,
+               MSG_TYPE_BROADCAST_MSG,
+               0,
+               MSG_SCHEMA_BROADCAST_MSG)
+DEFINE_ENCODER(broadcast_part,
+               struct msg_broadcast,
+               MSG_TYPE_BROADCAST_PART,
+               MSG_FLAG_V2,
+               MSG_SCHEMA_BROADCAST_PART)
+
+char *copy_msg_view(struct msg_view *view) {
+    char *str;
+
+    str = os_malloc(view->len + 1);
+    if (NULL == str) {
+        printf("ERRO: failed to allocate memory for string\n");
+        goto error_out_malloc;
     }
+    memcpy(str, view->str, view->len);
+    str[view->len] = '\0';
+
+error_out_malloc:
+    return str;
+}
+
+struct msg_frame *create_batch_frame(struct msg_frame **frames,
+                                     int num_frames) {
+    struct msg_frame *batch;
+    struct msg_hdr *hdr;
+    size_t frame_len = sizeof(struct msg_hdr);
+    size_t len;
+    uint8_t *iter;
+    int i;
 
-    field.type = htobe16(FIELD_TYPE_STRING);
-    field.id = htobe16(FIELD_ID_NAME);
-    field.len = htobe16(strlen(data->name) + 1);
-    ret = send_data(fd, &field, sizeof(struct msg_field));
-    if (EXIT_FAILURE == ret) {
-        printf("ERRO: failed to send field header for name to fd %d\n", fd);
-        goto error_out_send_field_hdr_name;
+    for (i = 0; i < num_frames; i++) {
+        frame_len += frames[i]->len - sizeof(struct msg_hdr);
+    }
+    if (frame_len > MSG_MAX_FRAME_LEN) {
+        printf("ERRO: batch too long\n");
+        goto error_out_len;
     }
 
-    ret = send_data(fd, data->name, strlen(data->name) + 1);
-    if (EXIT_FAILURE == ret) {
-        printf("ERRO: failed to send name to fd %d\n", fd);
-        goto error_out_send_name;
+    batch = create_msg_frame(frame_len);
+    if (NULL == batch) {
+        goto error_out_create_msg_frame;
     }
 
-    field.type = htobe16(FIELD_TYPE_STRING);
-    field.id = htobe16(FIELD_ID_MSG);
-    field.len = htobe16(strlen(data->msg) + 1);
-    ret = send_data(fd, &field, sizeof(struct msg_field));
-    if (EXIT_FAILURE == ret) {
-        printf("ERRO: failed to send field header for message to fd %d\n", fd);
-        goto error_out_send_field_hdr_msg;
+    hdr = (struct msg_hdr *)batch->buf;
+    hdr->type = htobe16(MSG_TYPE_BATCH);
+    hdr->len = htobe16(frame_len - sizeof(struct msg_hdr));
+    hdr->flags = 0;
+    hdr->ret = 0;
+    iter = hdr->data;
+
+    // the fields of each broadcast follow each other without their header
+    for (i = 0; i < num_frames; i++) {
+        len = frames[i]->len - sizeof(struct msg_hdr);
+        memcpy(iter, &frames[i]->buf[sizeof(struct msg_hdr)], len);
+        iter += len;
     }
 
-    ret = send_data(fd, data->msg, strlen(data->msg) + 1);
-    if (EXIT_FAILURE == ret) {
-        printf("ERRO: failed to send message to fd %d\n", fd);
-        goto error_out_send_msg;
+    return batch;
+error_out_create_msg_frame:
+error_out_len:
+    return NULL;
+}
+
+struct msg_frame *create_broadcast_frame(struct msg_broadcast *data) {
+    struct msg_frame *frame;
+
+    if (NULL != data->stream) {
+        frame = create_broadcast_part_frame(data);
+    } else {
+        frame = create_broadcast_msg_frame(data);
+    }
+    if (NULL == frame) {
+        printf("ERRO: failed to create broadcast frame\n");
+        goto error_out_create_frame;
+    }
+    frame->prio = data->prio;
+
+error_out_create_frame:
+    return frame;
+}
+
+struct msg_frame *create_caps_frame(uint8_t caps) {
+    struct msg_frame *frame;
+    struct msg_hdr *hdr;
+
+    frame = create_msg_frame(sizeof(struct msg_hdr));
+    if (NULL == frame) {
+        goto error_out_create_msg_frame;
+    }
+
+    hdr = (struct msg_hdr *)frame->buf;
+    hdr->type = htobe16(MSG_TYPE_NEW_USER);
+    hdr->len = 0;
+    hdr->flags = caps;
+    hdr->ret = MSG_CAPS_SUPPORTED;
+    frame->prio = MSG_PRIO_SYSTEM;
+
+error_out_create_msg_frame:
+    return frame;
+}
+
+struct msg_frame *create_msg_frame(size_t len) {
+    struct msg_frame *frame;
+
+    frame = os_malloc(sizeof(struct msg_frame) + len);
+    if (NULL == frame) {
+        printf("ERRO: failed to allocate memory for frame\n");
+        goto error_out_malloc;
+    }
+
+    frame->refs = 1;
+    frame->prio = MSG_PRIO_CHAT;
+    frame->len = len;
+
+error_out_malloc:
+    return frame;
+}
+
+int decode_msg_new_user(uint8_t *buf, size_t len, void *data) {
+    return decode_msg(buf, len, data, &parse_msg_new_user);
+}
+
+int decode_msg_registered_user(uint8_t *buf, size_t len, void *data) {
+    struct msg_registered_user *msg_data = (struct msg_registered_user *)data;
+    int ret_final;
+
+    ret_final = decode_msg(buf, len, data, &parse_msg_registered_user);
+    if (ret_final > 0 && true == msg_data->streamed) {
+        printf("ERRO: stream frames need a message reader\n");
+        ret_final = -1;
     }
 
-    ret_final = EXIT_SUCCESS;
-error_out_send_msg:
-error_out_send_field_hdr_msg:
-error_out_send_name:
-error_out_send_field_hdr_name:
-error_out_send_timestamp:
-error_out_send_field_hdr_timestamp:
-error_out_send_msg_hdr:
     return ret_final;
 }
+
+int encode_broadcast_msg(struct msg_broadcast *data, uint8_t *buf, size_t len) {
+    if (NULL != data->stream) {
+        return encode_broadcast_part_frame(data, buf, len);
+    }
+    return encode_broadcast_msg_frame(data, buf, len);
+}
+
+void exit_msg_reader(struct msg_reader *reader) {
+    release_msg_ring(reader);
+}
+
+struct msg_frame *get_msg_frame(struct msg_frame *frame) {
+    __atomic_fetch_add(&frame->refs, 1, __ATOMIC_RELAXED);
+    return frame;
+}
+
+int get_msg_new_user(int fd, struct msg_reader *reader, void *data) {
+    return read_msg(fd, reader, data, &parse_msg_new_user);
+}
+
+int get_msg_registered_user(int fd, struct msg_reader *reader, void *data) {
+    struct msg_registered_user *msg_data = (struct msg_registered_user *)data;
+    int ret;
+
+    if (false == reader->streaming) {
+        ret = read_msg(fd, reader, data, &parse_msg_registered_user);
+        if (1 != ret || false == msg_data->streamed) {
+            return ret;
+        }
+
+        // the message follows the frame, hand it out as it arrives
+        reader->streaming = true;
+        reader->stream.id++;
+        reader->stream.len = msg_data->stream.len;
+        reader->stream_left = msg_data->stream.len;
+    }
+
+    return read_msg_part(fd, reader, msg_data);
+}
+
+void init_msg_reader(struct msg_reader *reader) {
+    reader->ring.buf = NULL;
+    reader->ring.cap = 0;
+    reader->ring.head = 0;
+    reader->ring.len = 0;
+    reader->streaming = false;
+    reader->stream.id = 0;
+    reader->stream.off = 0;
+    reader->stream.len = 0;
+    reader->stream.part.str = NULL;
+    reader->stream.part.len = 0;
+    reader->stream_left = 0;
+}
+
+void put_msg_frame(struct msg_frame *frame) {
+    if (1 == __atomic_fetch_sub(&frame->refs, 1, __ATOMIC_ACQ_REL)) {
+        os_free(frame);
+    }
+}
@@ -3,54 +3,264 @@
 #ifndef SRC_MESSAGE_MESSAGE_H_
 #define SRC_MESSAGE_MESSAGE_H_
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "lib/ring/ring.h"
+
+#define MSG_FLAG_BATCH 0x01     // new user reads batch frames
+#define MSG_FLAG_V2 0x02        // 32-bit lengths, new user reads v2 frames
+#define MSG_FLAG_STREAM 0x04    // message follows the frame
+#define MSG_FLAG_COMPRESS 0x08      // new user reads compressed frames
+#define MSG_FLAG_COMPACT_IDS 0x10   // new user reads IDs instead of names
+#define MSG_FLAG_FLOW_CONTROL 0x20  // new user grants send credits
+#define MSG_FLAG_NEGOTIATE 0x80     // new user wants the granted flags back
+
+// capabilities a new user can ask for in the flags of its header, and the
+// ones this server grants
+#define MSG_CAPS (MSG_FLAG_BATCH | MSG_FLAG_V2 | MSG_FLAG_COMPRESS \
+                  | MSG_FLAG_COMPACT_IDS | MSG_FLAG_FLOW_CONTROL)
+#define MSG_CAPS_SUPPORTED (MSG_FLAG_BATCH | MSG_FLAG_V2)
+
+// send queue lane of a broadcast, system messages go ahead of chat
+#define MSG_PRIO_SYSTEM 0
+#define MSG_PRIO_CHAT 1
+
+// string field of a decoded frame, points into the receive buffer and is
+// valid until the next frame is read into that buffer
+struct msg_view {
+    char *str;          // NUL-terminated
+    size_t len;         // without the NUL
+};
+
 struct msg_new_user {
-    char *name;
+    uint8_t flags;      // MSG_FLAG_* set in the header of the frame
+    struct msg_view name;
+};
+
+// part of a message that is forwarded as it arrives instead of being
+// buffered whole
+struct msg_stream {
+    uint32_t id;        // counts the streams of a sender
+    uint32_t off;       // offset of the part in the message
+    uint32_t len;       // length of the whole message
+    struct msg_view part;   // not NUL-terminated
 };
 
 struct msg_registered_user {
-    char *msg;
+    struct msg_view msg;    // empty if streamed
+    bool streamed;
+    struct msg_stream stream;
 };
 
 struct msg_broadcast {
     uint32_t timestamp;
     char *name;
     char *msg;
+    int prio;           // MSG_PRIO_*, not sent
+    struct msg_stream *stream;  // sent as a v2 part instead of msg if set
 };
 
+// encoded frame shared by every user it is queued for, immutable once
+// created and freed when the last reference is put, fanout workers take and
+// put references concurrently
+struct msg_frame {
+    int refs;
+    int prio;           // MSG_PRIO_* of the broadcast
+    size_t len;
+    uint8_t buf[0];
+};
+
+// frames are decoded in place, a frame that wraps around the end of the
+// ring is still contiguous
+struct msg_reader {
+    struct ring ring;   // mapped while it holds bytes
+    bool streaming;     // the ring holds the message of a stream frame
+    struct msg_stream stream;
+    uint32_t stream_left;
+};
+
+typedef int (*msg_sender)(int fd, struct msg_frame *frame);
+
+/**
+ * Copy the string of a view out of the receive buffer.
+ *
+ * Only needed for strings that outlive the frame, like the name of a user.
+ *
+ * @param view (struct msg_view *) - View into a receive buffer.
+ * @malloc (char *) - NUL-terminated copy of the string.
+ * @return (char *) - String on success, NULL on failure.
+ */
+char *copy_msg_view(struct msg_view *view);
+
+/**
+ * Create a frame holding several broadcast messages.
+ *
+ * Copies the fields of each encoded broadcast frame, in order, into one
+ * MSG_TYPE_BATCH frame.
+ *
+ * @param frames (struct msg_frame **) - Encoded broadcast messages.
+ * @param num_frames (int) - Number of frames.
+ * @malloc (struct msg_frame *) - Frame with one reference.
+ * @fail - Batch is longer than MSG_MAX_FRAME_LEN.
+ * @fail - Fail to allocate frame.
+ * @return (struct msg_frame *) - Frame on success, NULL on failure.
+ */
+struct msg_frame *create_batch_frame(struct msg_frame **frames,
+                                     int num_frames);
+
+/**
+ * Create a frame holding an encoded broadcast message.
+ *
+ * Measures each field once, allocates a frame of the measured length and
+ * encodes into it. A stream part is encoded as a v2 MSG_TYPE_BROADCAST_PART
+ * frame.
+ *
+ * @param data (struct msg_broadcast *) - Struct containing broadcast message.
+ * @malloc (struct msg_frame *) - Frame with one reference.
+ * @fail - Frame is longer than MSG_MAX_FRAME_LEN.
+ * @fail - Fail to allocate frame.
+ * @return (struct msg_frame *) - Frame on success, NULL on failure.
+ */
+struct msg_frame *create_broadcast_frame(struct msg_broadcast *data);
+
+/**
+ * Create a frame that answers the capabilities a new user asked for.
+ *
+ * The frame is a MSG_TYPE_NEW_USER header without body. Its flags hold the
+ * granted capabilities and its ret byte the ones the server supports. The
+ * frame is sent as a system message.
+ *
+ * @param caps (uint8_t) - Granted capabilities, MSG_FLAG_*.
+ * @malloc (struct msg_frame *) - Frame with one reference.
+ * @return (struct msg_frame *) - Frame on success, NULL on failure.
+ */
+struct msg_frame *create_caps_frame(uint8_t caps);
+
+/**
+ * Create a frame for len bytes that the caller fills in.
+ *
+ * The frame is sent as chat.
+ *
+ * @param len (size_t) - Number of bytes in frame.
+ * @malloc (struct msg_frame *) - Frame with one reference.
+ * @return (struct msg_frame *) - Frame on success, NULL on failure.
+ */
+struct msg_frame *create_msg_frame(size_t len);
+
+/**
+ * Decode message from new user.
+ *
+ * Decodes the frame at the start of a receive buffer. The buffer is not
+ * modified, the decoded strings are views into it.
+ *
+ * @param buf (uint8_t *) - Bytes received from new user.
+ * @param len (size_t) - Number of bytes in buffer.
+ * @param data (void *) - Struct to store info of new user.
+ * @return (int) - Frame length on success, 0 if the frame is incomplete,
+ *                 -1 on failure.
+ */
+int decode_msg_new_user(uint8_t *buf, size_t len, void *data);
+
+/**
+ * Decode message from registered user.
+ *
+ * Decodes the frame at the start of a receive buffer. The buffer is not
+ * modified, the decoded strings are views into it. Stream frames need a
+ * message reader and are rejected.
+ *
+ * @param buf (uint8_t *) - Bytes received from registered user.
+ * @param len (size_t) - Number of bytes in buffer.
+ * @param data (void *) - Struct to store message from registered user.
+ * @fail - Frame is a stream frame.
+ * @return (int) - Frame length on success, 0 if the frame is incomplete,
+ *                 -1 on failure.
+ */
+int decode_msg_registered_user(uint8_t *buf, size_t len, void *data);
+
+/**
+ * Encode a broadcast message.
+ *
+ * Serializes a complete broadcast frame in network byte order. A stream part
+ * is encoded as a v2 MSG_TYPE_BROADCAST_PART frame.
+ *
+ * @param data (struct msg_broadcast *) - Struct containing broadcast message.
+ * @param buf (uint8_t *) - Buffer to store frame.
+ * @param len (size_t) - Size of buffer.
+ * @fail - Frame is longer than MSG_MAX_FRAME_LEN.
+ * @fail - Buffer is too small for frame.
+ * @return (int) - Frame length on success, -1 on failure.
+ */
+int encode_broadcast_msg(struct msg_broadcast *data, uint8_t *buf, size_t len);
+
+/**
+ * Release receive buffer of a message reader.
+ *
+ * The receive ring goes back to the calling thread's pool.
+ *
+ * @param reader (struct msg_reader *) - Message reader.
+ */
+void exit_msg_reader(struct msg_reader *reader);
+
+/**
+ * Take a reference to a frame.
+ *
+ * @param frame (struct msg_frame *) - Frame.
+ * @return (struct msg_frame *) - The same frame.
+ */
+struct msg_frame *get_msg_frame(struct msg_frame *frame);
+
 /**
  * Get message from new user.
  *
- * Get the name of a new user.
+ * Reads the bytes available on the fd into the user's message reader and
+ * decodes the name of the new user once its frame is complete. Bytes that
+ * follow the frame are kept in the reader. The name is a view into the
+ * reader and is only valid until the next call.
  *
- * @param fd (int) - File descriptor of new user.
+ * @param fd (int) - Nonblocking file descriptor of new user.
+ * @param reader (struct msg_reader *) - Message reader of new user.
  * @param data (void *) - Struct to store info of new user.
- * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ * @return (int) - 1 if the name was decoded, 0 if more bytes are needed,
+ *                 -1 on failure or if the fd was closed.
  */
-int get_msg_new_user(int fd, void *data);
+int get_msg_new_user(int fd, struct msg_reader *reader, void *data);
 
 /**
  * Get message from registered user.
  *
- * Get a message from a registered user.
+ * Reads the bytes available on the fd into the user's message reader and
+ * decodes the next complete frame. A partial frame is kept in the reader
+ * until more bytes arrive, so this never waits for the user. Call it until
+ * it stops returning 1 to consume every frame that has arrived. The message
+ * is a view into the reader and is only valid until the next call. The
+ * message of a stream frame is handed out in parts as it arrives, so it
+ * needs no more than the reader's buffer however long it is.
  *
- * @param fd (int) - File descriptor of registered user.
+ * @param fd (int) - Nonblocking file descriptor of registered user.
+ * @param reader (struct msg_reader *) - Message reader of registered user.
  * @param data (void *) - Struct to store message from registered user.
- * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ * @return (int) - 1 if a message was decoded, 0 if more bytes are needed,
+ *                 -1 on failure or if the fd was closed.
  */
-int get_msg_registered_user(int fd, void *data);
+int get_msg_registered_user(int fd, struct msg_reader *reader, void *data);
 
 /**
- * Send a boradcast message to a registered user.
+ * Initialize message reader.
  *
- * @param fd (int) - File descriptor of registered user.
- * @param data (struct msg_broadcast *) - Struct containing broadcast message.
- * @fail - Fail to send message header.
- * @fail - Fail to send field header.
- * @fail - Fail to send timestamp, name or message.
- * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ * The receive ring is mapped on the first read.
+ *
+ * @param reader (struct msg_reader *) - Message reader.
+ */
+void init_msg_reader(struct msg_reader *reader);
+
+/**
+ * Drop a reference to a frame.
+ *
+ * @param frame (struct msg_frame *) - Frame.
+ * @free (struct msg_frame *) - Frame once the last reference is dropped.
  */
-int send_broadcast_msg(int fd, struct msg_broadcast *data);
+void put_msg_frame(struct msg_frame *frame);
 
 #endif  // SRC_MESSAGE_MESSAGE_H_
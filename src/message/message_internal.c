@@ -3,96 +3,276 @@
 #include "src/message/message_internal.h"
 
 #include <endian.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "lib/fileio/fileio.h"
 #include "lib/osdep/osdep.h"
+#include "lib/ring/ring.h"
 #include "src/message/message.h"
 
-char *get_field_string(struct msg_field *field) {
-    char *field_string = NULL;
-    size_t field_string_len;
-
-    if (FIELD_TYPE_STRING != field->type) {
-        printf("WARN: wrong field type, expected %d, got %d\n",
-               FIELD_TYPE_STRING,
-               field->type);
-        goto error_out_field_type;
+// rings of drained readers, mapped again by the next reader that fills
+static __thread struct ring_pool ring_pool = {.cap = MSG_READER_MIN_CAP};
+
+// copies the v1 or v2 field header at the start of buf out in host byte
+// order, returns the length of the header or 0 if it doesn't fit
+static size_t get_field_hdr(uint8_t *buf,
+                            size_t len,
+                            uint8_t flags,
+                            struct msg_field_v2 *field) {
+    struct msg_field field_v1;
+
+    if (0 != (flags & MSG_FLAG_V2)) {
+        if (len < sizeof(struct msg_field_v2)) {
+            return 0;
+        }
+        memcpy(field, buf, sizeof(struct msg_field_v2));
+        field->type = be16toh(field->type);
+        field->id = be16toh(field->id);
+        field->len = be32toh(field->len);
+        return sizeof(struct msg_field_v2);
     }
 
-    field_string = (char *)(field + 1);
-
-    field_string_len = strnlen(field_string, field->len);
-
-    if (field_string_len != field->len - 1) {
-        printf("WARN: wrong field length, expected %d, got %zu\n",
-               field->len - 1,
-               field_string_len);
-        field_string = NULL;
-        goto error_out_field_len;
+    if (len < sizeof(struct msg_field)) {
+        return 0;
     }
+    memcpy(&field_v1, buf, sizeof(struct msg_field));
+    field->type = be16toh(field_v1.type);
+    field->id = be16toh(field_v1.id);
+    field->len = be16toh(field_v1.len);
+    return sizeof(struct msg_field);
+}
 
-error_out_field_len:
-error_out_field_type:
-    return field_string;
+// data length of a decoded string field, it was sent with its NUL
+static size_t get_view_len_string(struct msg_view *view) {
+    return view->len + 1;
 }
 
-int get_msg(int fd, void *data, msg_parser parser) {
+#define GET_FIELD(name, id, type, value) \
+    ret = get_field_##type(&buf[off], hdr->len - off, hdr->flags, id, &value); \
+    if (EXIT_FAILURE == ret) { \
+        goto error_out_get_field; \
+    } \
+    off += MSG_FIELD_HDR_LEN(hdr->flags) + get_view_len_##type(&value);
+
+// Defines get_<codec>_fields() that decodes the fields of schema in order
+// from the body of a frame. Each field starts where the previous one ended.
+#define DEFINE_DECODER(codec, data_type, schema) \
+static int get_##codec##_fields(uint8_t *buf, \
+                                struct msg_info *hdr, \
+                                data_type *data) { \
+    size_t off = 0; \
+    int ret; \
+    int ret_final = EXIT_FAILURE; \
+\
+    schema(GET_FIELD) \
+\
+    ret_final = EXIT_SUCCESS; \
+error_out_get_field: \
+    return ret_final; \
+}
+
+DEFINE_DECODER(new_user, struct msg_new_user, MSG_SCHEMA_NEW_USER)
+DEFINE_DECODER(registered_user,
+               struct msg_registered_user,
+               MSG_SCHEMA_REGISTERED_USER)
+
+int decode_msg(uint8_t *buf, size_t len, void *data, msg_parser parser) {
     struct msg_hdr hdr;
-    uint8_t *buf;
+    struct msg_hdr_v2 hdr_v2;
+    struct msg_info info;
+    size_t hdr_len = sizeof(struct msg_hdr);
+    size_t frame_len;
     int ret;
-    int ret_final = EXIT_FAILURE;
+    int ret_final = -1;
 
-    ret = reliable_read(fd, &hdr, sizeof(struct msg_hdr));
-    if (-1 == ret) {
-        printf("ERRO: failed to read message header from fd %d\n", fd);
-        goto error_out_get_msg_hdr;
-    } else if (0 == ret) {
-        printf("ERRO: failed to read message header, " \
-               "fd %d closed on other end\n", fd);
-        goto error_out_get_msg_hdr;
+    if (len < sizeof(struct msg_hdr)) {
+        ret_final = 0;
+        goto error_out_incomplete;
     }
 
-    hdr.type = be16toh(hdr.type);
-    hdr.len = be16toh(hdr.len);
+    memcpy(&hdr, buf, sizeof(struct msg_hdr));
+    info.type = be16toh(hdr.type);
+    info.flags = hdr.flags;
+    info.len = be16toh(hdr.len);
+
+    if (0 != (info.flags & MSG_FLAG_V2)) {
+        hdr_len = sizeof(struct msg_hdr_v2);
+        if (len < hdr_len) {
+            ret_final = 0;
+            goto error_out_incomplete;
+        }
+        memcpy(&hdr_v2, buf, sizeof(struct msg_hdr_v2));
+        info.len = be32toh(hdr_v2.len);
+    } else if (0 != (info.flags & MSG_FLAG_STREAM)) {
+        printf("ERRO: only v2 messages can be streamed\n");
+        goto error_out_stream;
+    }
 
-    buf = os_malloc(hdr.len);
-    if (NULL == buf) {
-        printf("ERRO: failed to allocate memory for message buffer\n");
-        goto error_out_os_malloc;
+    frame_len = hdr_len + info.len;
+    if (frame_len > MSG_READER_MAX_CAP) {
+        printf("ERRO: message of %zu bytes is too long to buffer\n",
+               frame_len);
+        goto error_out_frame_len;
     }
 
-    ret = reliable_read(fd, buf, hdr.len);
-    if (-1 == ret) {
-        printf("ERRO: failed to read message from fd %d\n", fd);
-        goto error_out_reliable_read;
-    } else if (0 == ret) {
-        printf("ERRO: failed to read message, " \
-               "fd %d closed on other end\n", fd);
-        goto error_out_reliable_read;
+    if (len < frame_len) {
+        ret_final = 0;
+        goto error_out_incomplete;
     }
 
-    ret = parser(buf, &hdr, data);
+    ret = parser(&buf[hdr_len], &info, data);
     if (EXIT_FAILURE == ret) {
         printf("ERRO: failed to parse message buffer\n");
         goto error_out_parser;
     }
 
-    ret_final = EXIT_SUCCESS;
+    ret_final = frame_len;
 error_out_parser:
-error_out_reliable_read:
-    os_free(buf);
-error_out_os_malloc:
-error_out_get_msg_hdr:
+error_out_frame_len:
+error_out_stream:
+error_out_incomplete:
     return ret_final;
 }
 
-int parse_msg_new_user(uint8_t *buf, struct msg_hdr *hdr, void *data) {
-    struct msg_field *field = (struct msg_field *)buf;
+int fill_msg_reader(int fd, struct msg_reader *reader) {
+    struct ring *ring = &reader->ring;
+    size_t cap;
+    int ret;
+    int ret_final = -1;
+
+    if (NULL == ring->buf) {
+        ret = ring_pool_get(&ring_pool, ring);
+        if (EXIT_FAILURE == ret) {
+            printf("ERRO: failed to map receive ring of fd %d\n", fd);
+            goto error_out_ring_pool_get;
+        }
+    } else if (ring->len == ring->cap) {
+        if (ring->cap >= MSG_READER_MAX_CAP) {
+            printf("ERRO: receive buffer of fd %d is full\n", fd);
+            goto error_out_full;
+        }
+        cap = 2 * ring->cap;
+        if (cap > MSG_READER_MAX_CAP) {
+            cap = MSG_READER_MAX_CAP;
+        }
+        ret = ring_grow(ring, cap);
+        if (EXIT_FAILURE == ret) {
+            printf("ERRO: failed to grow receive ring of fd %d\n", fd);
+            goto error_out_ring_grow;
+        }
+    }
+
+    // the free space behind the last byte is contiguous too
+    ret_final = read_available(fd,
+                               &ring->buf[ring->head + ring->len],
+                               ring->cap - ring->len);
+    if (ret_final > 0) {
+        ring_produce(ring, ret_final);
+    }
+
+error_out_ring_grow:
+error_out_full:
+error_out_ring_pool_get:
+    return ret_final;
+}
+
+int get_field_stream(uint8_t *buf,
+                     size_t len,
+                     uint16_t id,
+                     uint32_t *stream_len) {
+    struct msg_field_v2 field;
+    size_t hdr_len;
+    int ret_final = EXIT_FAILURE;
+
+    hdr_len = get_field_hdr(buf, len, MSG_FLAG_V2, &field);
+    if (0 == hdr_len || len != hdr_len) {
+        printf("WARN: streamed field header must end the message\n");
+        goto error_out_len;
+    }
+
+    if (id != field.id) {
+        printf("WARN: wrong field ID, expected %d, got %d\n", id, field.id);
+        goto error_out_field_id;
+    }
+
+    if (FIELD_TYPE_BYTES != field.type) {
+        printf("WARN: wrong field type, expected %d, got %d\n",
+               FIELD_TYPE_BYTES,
+               field.type);
+        goto error_out_field_type;
+    }
+
+    *stream_len = field.len;
+
+    ret_final = EXIT_SUCCESS;
+error_out_field_type:
+error_out_field_id:
+error_out_len:
+    return ret_final;
+}
+
+int get_field_string(uint8_t *buf,
+                     size_t len,
+                     uint8_t flags,
+                     uint16_t id,
+                     struct msg_view *view) {
+    struct msg_field_v2 field;
+    size_t hdr_len;
+    char *field_string;
+    size_t field_string_len;
+    int ret_final = EXIT_FAILURE;
+
+    // copy the header out, the receive buffer is left as it is
+    hdr_len = get_field_hdr(buf, len, flags, &field);
+    if (0 == hdr_len) {
+        printf("WARN: message too short for field header\n");
+        goto error_out_len;
+    }
+
+    if (id != field.id) {
+        printf("WARN: wrong field ID, expected %d, got %d\n", id, field.id);
+        goto error_out_field_id;
+    }
+
+    if (FIELD_TYPE_STRING != field.type) {
+        printf("WARN: wrong field type, expected %d, got %d\n",
+               FIELD_TYPE_STRING,
+               field.type);
+        goto error_out_field_type;
+    }
+
+    if (0 == field.len || len - hdr_len < field.len) {
+        printf("WARN: field length %u doesn't fit the message\n", field.len);
+        goto error_out_field_len;
+    }
+
+    field_string = (char *)&buf[hdr_len];
+    field_string_len = strnlen(field_string, field.len);
+
+    if (field_string_len != (size_t)field.len - 1) {
+        printf("WARN: wrong field length, expected %u, got %zu\n",
+               field.len - 1,
+               field_string_len);
+        goto error_out_field_len;
+    }
+
+    view->str = field_string;
+    view->len = field_string_len;
+
+    ret_final = EXIT_SUCCESS;
+error_out_field_len:
+error_out_field_type:
+error_out_field_id:
+error_out_len:
+    return ret_final;
+}
+
+int parse_msg_new_user(uint8_t *buf, struct msg_info *hdr, void *data) {
     struct msg_new_user *msg_data = (struct msg_new_user *)data;
-    char *name;
+    int ret;
     int ret_final = EXIT_FAILURE;
 
     if (MSG_TYPE_NEW_USER != hdr->type) {
@@ -102,42 +282,30 @@ int parse_msg_new_user(uint8_t *buf, struct msg_hdr *hdr, void *data) {
         goto error_out_msg_type;
     }
 
-    field->type = be16toh(field->type);
-    field->id = be16toh(field->id);
-    field->len = be16toh(field->len);
-    if (FIELD_ID_NAME != field->id) {
-        printf("ERRO: wrong field ID: expected %d, got %d\n",
-               FIELD_ID_NAME,
-               field->id);
-        goto error_out_field_id;
+    if (0 != (hdr->flags & MSG_FLAG_STREAM)) {
+        printf("ERRO: new user can't stream its name\n");
+        goto error_out_stream;
     }
 
-    name = get_field_string(field);
-    if (NULL == name) {
+    ret = get_new_user_fields(buf, hdr, msg_data);
+    if (EXIT_FAILURE == ret) {
         printf("ERRO: failed to get name from new user\n");
-        goto error_out_get_field_string;
+        goto error_out_get_new_user_fields;
     }
-
-    msg_data->name = os_malloc(field->len);
-    if (NULL == msg_data->name) {
-        printf("ERRO: failed to allocate memory for msg_data:name\n");
-        goto error_out_malloc;
-    }
-
-    strncpy(msg_data->name, get_field_string(field), field->len);
+    msg_data->flags = hdr->flags;
 
     ret_final = EXIT_SUCCESS;
-error_out_malloc:
-error_out_get_field_string:
-error_out_field_id:
+error_out_get_new_user_fields:
+error_out_stream:
 error_out_msg_type:
     return ret_final;
 }
 
-int parse_msg_registered_user(uint8_t *buf, struct msg_hdr *hdr, void *data) {
-    struct msg_field *field = (struct msg_field *)buf;
+int parse_msg_registered_user(uint8_t *buf,
+                              struct msg_info *hdr,
+                              void *data) {
     struct msg_registered_user *msg_data = (struct msg_registered_user *)data;
-    char *msg;
+    int ret;
     int ret_final = EXIT_FAILURE;
 
     if (MSG_TYPE_REGISTERED_USER != hdr->type) {
@@ -147,49 +315,120 @@ int parse_msg_registered_user(uint8_t *buf, struct msg_hdr *hdr, void *data) {
         goto error_out_msg_type;
     }
 
-    field->type = be16toh(field->type);
-    field->id = be16toh(field->id);
-    field->len = be16toh(field->len);
-    if (FIELD_ID_MSG != field->id) {
-        printf("ERRO: wrong field ID: expected %d, got %d\n",
-               FIELD_ID_MSG,
-               field->id);
-        goto error_out_field_id;
+    if (0 != (hdr->flags & MSG_FLAG_STREAM)) {
+        ret = get_field_stream(buf,
+                               hdr->len,
+                               FIELD_ID_MSG,
+                               &msg_data->stream.len);
+        if (EXIT_FAILURE == ret) {
+            printf("ERRO: failed to get stream from registered user\n");
+            goto error_out_get_field_stream;
+        }
+        msg_data->msg.str = NULL;
+        msg_data->msg.len = 0;
+        msg_data->streamed = true;
+    } else {
+        ret = get_registered_user_fields(buf, hdr, msg_data);
+        if (EXIT_FAILURE == ret) {
+            printf("ERRO: failed to get msg from registered user\n");
+            goto error_out_get_registered_user_fields;
+        }
+        msg_data->streamed = false;
     }
 
-    msg = get_field_string(field);
-    if (NULL == msg) {
-        printf("ERRO: failed to get msg from registered user\n");
-        goto error_out_get_field_string;
+    ret_final = EXIT_SUCCESS;
+error_out_get_registered_user_fields:
+error_out_get_field_stream:
+error_out_msg_type:
+    return ret_final;
+}
+
+int read_msg_part(int fd,
+                  struct msg_reader *reader,
+                  struct msg_registered_user *data) {
+    struct ring *ring = &reader->ring;
+    size_t part_len;
+    int ret;
+    int ret_final = -1;
+
+    while (0 == ring->len && reader->stream_left > 0) {
+        ret = fill_msg_reader(fd, reader);
+        if (-1 == ret) {
+            goto error_out_fill_msg_reader;
+        } else if (0 == ret) {
+            // the fd is drained, an idle user holds no ring
+            release_msg_ring(reader);
+            ret_final = 0;
+            goto out_incomplete;
+        }
     }
 
-    msg_data->msg = os_malloc(field->len);
-    if (NULL == msg_data->msg) {
-        printf("ERRO: failed to allocate memory for msg_data:msg\n");
-        goto error_out_malloc;
+    part_len = ring->len;
+    if (part_len > reader->stream_left) {
+        part_len = reader->stream_left;
     }
 
-    strncpy(msg_data->msg, msg, field->len);
+    data->msg.str = NULL;
+    data->msg.len = 0;
+    data->streamed = true;
+    data->stream = reader->stream;
+    data->stream.off = reader->stream.len - reader->stream_left;
+    data->stream.part.str = (char *)&ring->buf[ring->head];
+    data->stream.part.len = part_len;
+
+    ring_consume(ring, part_len);
+    reader->stream_left -= part_len;
+    if (0 == reader->stream_left) {
+        reader->streaming = false;
+    }
 
-    ret_final = EXIT_SUCCESS;
-error_out_malloc:
-error_out_get_field_string:
-error_out_field_id:
-error_out_msg_type:
+    ret_final = 1;
+out_incomplete:
+error_out_fill_msg_reader:
     return ret_final;
 }
 
-int send_data(int fd, void *buf, int len) {
+int read_msg(int fd,
+             struct msg_reader *reader,
+             void *data,
+             msg_parser parser) {
+    int frame_len;
     int ret;
-    int ret_final = EXIT_FAILURE;
-
-    ret = reliable_write(fd, buf, len);
-    if (-1 == ret) {
-        printf("ERRO: failed to send data to fd %d\n", fd);
-        goto error_out_reliable_write;
+    int ret_final = -1;
+
+    while (true) {
+        frame_len = decode_msg(&reader->ring.buf[reader->ring.head],
+                               reader->ring.len,
+                               data,
+                               parser);
+        if (-1 == frame_len) {
+            printf("ERRO: failed to decode message from fd %d\n", fd);
+            goto error_out_decode_msg;
+        } else if (frame_len > 0) {
+            ring_consume(&reader->ring, frame_len);
+            break;
+        }
+
+        ret = fill_msg_reader(fd, reader);
+        if (-1 == ret) {
+            goto error_out_fill_msg_reader;
+        } else if (0 == ret) {
+            // the fd is drained, an idle user holds no ring
+            if (0 == reader->ring.len) {
+                release_msg_ring(reader);
+            }
+            ret_final = 0;
+            goto out_incomplete;
+        }
     }
 
-    ret_final = EXIT_SUCCESS;
-error_out_reliable_write:
+    ret_final = 1;
+out_incomplete:
+error_out_fill_msg_reader:
+error_out_decode_msg:
     return ret_final;
 }
+
+void release_msg_ring(struct msg_reader *reader) {
+    ring_pool_put(&ring_pool, &reader->ring);
+}
@@ -3,16 +3,61 @@
 #ifndef SRC_MESSAGE_MESSAGE_INTERNAL_H_
 #define SRC_MESSAGE_MESSAGE_INTERNAL_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "src/message/message.h"
+
 #define MSG_TYPE_NEW_USER 1
 #define MSG_TYPE_REGISTERED_USER 2
 #define MSG_TYPE_BROADCAST_MSG 3
+#define MSG_TYPE_BATCH 4
+#define MSG_TYPE_BROADCAST_PART 5
 #define FIELD_TYPE_STRING 1
 #define FIELD_TYPE_UINT32 2
+#define FIELD_TYPE_BYTES 3
 #define FIELD_ID_TIMESTAMP 1
 #define FIELD_ID_NAME 2
 #define FIELD_ID_MSG 3
+#define FIELD_ID_STREAM 4
+#define FIELD_ID_OFFSET 5
+#define FIELD_ID_LEN 6
+#define MSG_READER_MIN_CAP 4096
+#define MSG_MAX_FRAME_LEN (sizeof(struct msg_hdr) + UINT16_MAX)
+// longest frame that is buffered whole, longer messages are streamed
+#define MSG_READER_MAX_CAP (sizeof(struct msg_hdr_v2) + UINT16_MAX)
+
+// length of a v1 or v2 frame header and field header
+#define MSG_HDR_LEN(flags) (0 != ((flags) & MSG_FLAG_V2) \
+                            ? sizeof(struct msg_hdr_v2) \
+                            : sizeof(struct msg_hdr))
+#define MSG_FIELD_HDR_LEN(flags) (0 != ((flags) & MSG_FLAG_V2) \
+                                  ? sizeof(struct msg_field_v2) \
+                                  : sizeof(struct msg_field))
+
+// Fields of each frame in the order they are sent, X(name, id, type, value).
+// type is uint32, string or bytes and picks the get_field_<type>() decoder
+// and put_field_<type>() encoder. value is where the field's data lives in
+// the message struct the codec is passed as data. The codecs are expanded
+// from these lists, a new frame only needs a list and a codec definition.
+#define MSG_SCHEMA_NEW_USER(X) \
+    X(name, FIELD_ID_NAME, string, data->name)
+
+#define MSG_SCHEMA_REGISTERED_USER(X) \
+    X(msg, FIELD_ID_MSG, string, data->msg)
+
+#define MSG_SCHEMA_BROADCAST_MSG(X) \
+    X(timestamp, FIELD_ID_TIMESTAMP, uint32, data->timestamp) \
+    X(name, FIELD_ID_NAME, string, data->name) \
+    X(msg, FIELD_ID_MSG, string, data->msg)
+
+#define MSG_SCHEMA_BROADCAST_PART(X) \
+    X(timestamp, FIELD_ID_TIMESTAMP, uint32, data->timestamp) \
+    X(name, FIELD_ID_NAME, string, data->name) \
+    X(stream, FIELD_ID_STREAM, uint32, data->stream->id) \
+    X(offset, FIELD_ID_OFFSET, uint32, data->stream->off) \
+    X(len, FIELD_ID_LEN, uint32, data->stream->len) \
+    X(part, FIELD_ID_MSG, bytes, data->stream->part)
 
 struct msg_hdr {
     uint16_t type;
@@ -22,6 +67,16 @@ struct msg_hdr {
     uint8_t data[0];
 }__attribute__((packed));
 
+// v1 header with MSG_FLAG_V2 set, len16 is 0 and the length follows
+struct msg_hdr_v2 {
+    uint16_t type;
+    uint16_t len16;
+    uint8_t flags;
+    uint8_t ret;
+    uint32_t len;
+    uint8_t data[0];
+}__attribute__((packed));
+
 struct msg_field {
     uint16_t type;
     uint16_t id;
@@ -29,86 +84,199 @@ struct msg_field {
     uint8_t data[0];
 }__attribute__((packed));
 
-typedef int (*msg_parser)(uint8_t *buf, struct msg_hdr *hdr, void *data);
+// field of a v2 frame
+struct msg_field_v2 {
+    uint16_t type;
+    uint16_t id;
+    uint32_t len;
+    uint8_t data[0];
+}__attribute__((packed));
+
+// header of a v1 or v2 frame in host byte order
+struct msg_info {
+    uint16_t type;
+    uint8_t flags;
+    uint32_t len;       // length of the body
+};
+
+typedef int (*msg_parser)(uint8_t *buf, struct msg_info *hdr, void *data);
 
 /**
- * Get a string from a field.
+ * Decode message.
  *
- * Confirms that field type is FIELD_TYPE_STRING. Confirms string length.
- * Field header needs to be in host byte order.
+ * Decodes one message from the start of a buffer. Passes the data to the
+ * caller using the data argument. The header is either v1 or, with
+ * MSG_FLAG_V2, v2. The body of a frame with MSG_FLAG_STREAM ends with the
+ * header of a field whose data follows the frame and is not counted in its
+ * length.
  *
- * @param field (struct msg_field *) - Field header for string field.
- * @warn - The field string is not checked for NULL.
- * @fail - Field type is not FIELD_TYPE_STRING.
- * @fail - Field length does not equal string length + NULL byte.
- * @return (char *) - String described by field header, NULL otherwise.
+ * @param buf (uint8_t *) - Buffer holding received bytes.
+ * @param len (size_t) - Number of bytes in buffer.
+ * @param data (void *) - Struct to store message data.
+ * @param parser (msg_parser) - Function to parse message.
+ * @warn - The buffer and message data are not checked for NULL.
+ * @fail - MSG_FLAG_STREAM is set without MSG_FLAG_V2.
+ * @fail - Frame is longer than MSG_READER_MAX_CAP.
+ * @fail - Fail to parse message data.
+ * @return (int) - Frame length on success, 0 if the frame is incomplete,
+ *                 -1 on failure.
  */
-char *get_field_string(struct msg_field *field);
+int decode_msg(uint8_t *buf, size_t len, void *data, msg_parser parser);
 
 /**
- * Get message.
+ * Read available bytes into a message reader.
  *
- * Reads a message from the file descriptor. Passes the data to the caller
- * using the data argument.
+ * Takes a receive ring from the thread's pool if the reader has none and
+ * grows it, up to the largest possible frame, if it is full. A partial
+ * frame stays where it is.
  *
- * @param fd (int) - File descriptor to read message from.
- * @param data (void *) - Struct to store message data.
- * @param parser (msg_parser) - Function to parse message.
- * @warn - The message data is not checked for NULL.
- * @fail - Fail to read message header.
- * @fail - Fail to allocate buffer for message data.
- * @fail - Fail to read message data.
- * @fail - Fail to parse message data.
+ * @param fd (int) - Nonblocking file descriptor to read from.
+ * @param reader (struct msg_reader *) - Message reader.
+ * @malloc reader->ring (struct ring) - Receive ring, taken on demand.
+ * @fail - Receive ring is full and can't grow.
+ * @fail - Fail to map or grow receive ring.
+ * @fail - Fail to read from fd.
+ * @return (int) - Number of bytes read on success, 0 if no bytes are
+ *                 available, -1 on failure.
+ */
+int fill_msg_reader(int fd, struct msg_reader *reader);
+
+/**
+ * Get the length of a streamed field.
+ *
+ * Reads the v2 field header at the start of buf without modifying it. The
+ * header must end the message, the data of the field follows the frame.
+ *
+ * @param buf (uint8_t *) - Field header in network byte order.
+ * @param len (size_t) - Number of bytes left in the message.
+ * @param id (uint16_t) - Expected field ID.
+ * @param stream_len (uint32_t *) - Length of the field data.
+ * @fail - Field header doesn't end the message.
+ * @fail - Field ID is not id.
+ * @fail - Field type is not FIELD_TYPE_BYTES.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int get_field_stream(uint8_t *buf,
+                     size_t len,
+                     uint16_t id,
+                     uint32_t *stream_len);
+
+/**
+ * Get a string from a field.
+ *
+ * Reads the field header at the start of buf without modifying it, a v2
+ * header if flags has MSG_FLAG_V2. Confirms the field ID and that the
+ * field type is FIELD_TYPE_STRING. Confirms that the field fits the buffer
+ * and holds exactly one NUL-terminated string. The view points into buf.
+ *
+ * @param buf (uint8_t *) - Field in network byte order.
+ * @param len (size_t) - Number of bytes left in the message.
+ * @param flags (uint8_t) - Flags of the message header.
+ * @param id (uint16_t) - Expected field ID.
+ * @param view (struct msg_view *) - View to store the string.
+ * @fail - Field header or string doesn't fit the message.
+ * @fail - Field ID is not id.
+ * @fail - Field type is not FIELD_TYPE_STRING.
+ * @fail - Field length does not equal string length + NUL byte.
  * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
  */
-int get_msg(int fd, void *data, msg_parser parser);
+int get_field_string(uint8_t *buf,
+                     size_t len,
+                     uint8_t flags,
+                     uint16_t id,
+                     struct msg_view *view);
 
 /**
  * Parse message from new user.
  *
  * Assumes the message header is in host byte order. Assumes the message
- * buffer is in network byte order. The message buffer is modified by this
- * function.
+ * buffer is in network byte order. The message buffer is not modified, the
+ * name is a view into it.
  *
  * @param buf (uint8_t *) - Buffer containing message from new user.
- * @param hdr (struct msg_hdr *) - Message header.
+ * @param hdr (struct msg_info *) - Message header.
  * @param data (void *) - Struct to store message data.
  * @cast data (void *) -> (struct msg_new_user *)
- * @warn - The message buffer length is not validated.
  * @warn - The message buffer, header and data are not checked for NULL.
- * @malloc data->name (char *) - Allocate buffer to store name of new user.
+ * @fail - Message type is not MSG_TYPE_NEW_USER.
+ * @fail - Message is streamed.
+ * @fail - Fail to get name field.
  * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
  */
-int parse_msg_new_user(uint8_t *buf, struct msg_hdr *hdr, void *data);
+int parse_msg_new_user(uint8_t *buf, struct msg_info *hdr, void *data);
 
 /**
  * Parse message from registered user.
  *
  * Assumes the message header is in host byte order. Assumes the message
- * buffer is in network byte order. The message buffer is modified by this
- * function.
+ * buffer is in network byte order. The message buffer is not modified, the
+ * message is a view into it. For a streamed message only its length is
+ * parsed, the message follows the frame.
  *
  * @param buf (uint8_t *) - Buffer containing message from registered user.
- * @param hdr (struct msg_hdr *) - Message header.
+ * @param hdr (struct msg_info *) - Message header.
  * @param data (void *) - Struct to store message data.
  * @cast data (void *) -> (struct msg_registered_user *)
- * @warn - The message buffer length is not validated.
  * @warn - The message buffer, header and data are not checked for NULL.
- * @malloc data->msg (char *) - Allocate buffer to store msg from user.
+ * @fail - Message type is not MSG_TYPE_REGISTERED_USER.
+ * @fail - Fail to get message field.
  * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
  */
-int parse_msg_registered_user(uint8_t *buf, struct msg_hdr *hdr, void *data);
+int parse_msg_registered_user(uint8_t *buf,
+                              struct msg_info *hdr,
+                              void *data);
 
 /**
- * Send data to fd.
+ * Read the next part of a streamed message.
  *
- * @param fd (int) - File descriptor to send data to.
- * @param buf (void *) - Data to send to fd.
- * @param len (int) - Number of bytes to send to fd
- * @warn - The buffer is not check for NULL.
- * @fail - Fail to write to fd.
- * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ * Hands out the bytes of the message that are in the message reader,
+ * reading more from the fd if there are none. The receive ring goes back
+ * to the thread's pool if the fd has none either. The part is a view into
+ * the reader and is only valid until the next read.
+ *
+ * @param fd (int) - Nonblocking file descriptor to read message from.
+ * @param reader (struct msg_reader *) - Message reader of fd, streaming.
+ * @param data (struct msg_registered_user *) - Struct to store the part.
+ * @fail - Fail to read from fd.
+ * @return (int) - 1 if a part was read, 0 if more bytes are needed,
+ *                 -1 on failure.
+ */
+int read_msg_part(int fd,
+                  struct msg_reader *reader,
+                  struct msg_registered_user *data);
+
+/**
+ * Read message.
+ *
+ * Decodes the next frame buffered in the message reader, reading more
+ * bytes from the fd while the frame is incomplete. Returns as soon as the
+ * fd has no more bytes available, an empty receive ring goes back to the
+ * thread's pool then. Passes the data to the caller using the
+ * data argument.
+ *
+ * @param fd (int) - Nonblocking file descriptor to read message from.
+ * @param reader (struct msg_reader *) - Message reader of fd.
+ * @param data (void *) - Struct to store message data.
+ * @param parser (msg_parser) - Function to parse message.
+ * @fail - Fail to read from fd.
+ * @fail - Fail to decode message.
+ * @return (int) - 1 if a message was decoded, 0 if more bytes are needed,
+ *                 -1 on failure.
+ */
+int read_msg(int fd,
+             struct msg_reader *reader,
+             void *data,
+             msg_parser parser);
+
+/**
+ * Give the receive ring of a reader back to the thread's pool.
+ *
+ * Any bytes in the ring are dropped. A ring that grew for a large frame is
+ * unmapped instead, so is one that doesn't fit the pool.
+ *
+ * @param reader (struct msg_reader *) - Message reader.
+ * @free reader->ring (struct ring) - Receive ring.
  */
-int send_data(int fd, void *buf, int len);
+void release_msg_ring(struct msg_reader *reader);
 
 #endif  // SRC_MESSAGE_MESSAGE_INTERNAL_H_
@@ -0,0 +1,133 @@
+// Copyright 2020 author. All rights reserved.
+
+#include "src/reactor/reactor.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "include/common.h"
+#include "lib/osdep/osdep.h"
+#include "src/reactor/reactor_internal.h"
+#include "src/user/user.h"
+
+static struct reactor *reactors;
+static int num_reactors;
+
+static __thread struct reactor *self;
+
+static void forward_msg(struct msg_broadcast *data) {
+    struct reactor_msg *msg;
+
+    for (int i = 0; i < num_reactors; i++) {
+        if (&reactors[i] == self) {
+            continue;
+        }
+
+        msg = copy_broadcast_msg(data);
+        if (NULL == msg) {
+            printf("WARN: failed to forward message to reactor %d\n", i);
+            continue;
+        }
+        post_reactor_msg(&reactors[i], msg);
+    }
+}
+
+static int handle_wakeup(int fd) {
+    UNUSED_PARAMETER(fd);
+
+    return drain_inbox(self);
+}
+
+static void join_reactors(int num_started) {
+    for (int i = 0; i < num_started; i++) {
+        __atomic_store_n(&reactors[i].running, false, __ATOMIC_RELEASE);
+        os_eventfd_write(reactors[i].wakefd, 1);
+    }
+
+    for (int i = 0; i < num_started; i++) {
+        os_pthread_join(reactors[i].thread);
+    }
+}
+
+static void *reactor_thread(void *arg) {
+    int ret;
+
+    self = (struct reactor *)arg;
+    set_msg_forwarder(&forward_msg);
+
+    ret = run_reactor_loop(self, &handle_wakeup);
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: reactor %d stopped\n", self->id);
+    }
+
+    return NULL;
+}
+
+int start_reactors(int num) {
+    sigset_t mask;
+    sigset_t oldmask;
+    int num_init = 0;
+    int num_started = 0;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    reactors = os_malloc(num * sizeof(struct reactor));
+    if (NULL == reactors) {
+        printf("ERRO: failed to allocate memory for reactors\n");
+        goto error_out_malloc;
+    }
+
+    for (num_init = 0; num_init < num; num_init++) {
+        ret = init_reactor(&reactors[num_init], num_init);
+        if (EXIT_FAILURE == ret) {
+            goto error_out_init_reactor;
+        }
+    }
+    num_reactors = num;
+
+    // reactor threads inherit the mask, signals go to the calling thread
+    sigfillset(&mask);
+    os_pthread_sigmask(SIG_BLOCK, &mask, &oldmask);
+    for (num_started = 0; num_started < num; num_started++) {
+        ret = os_pthread_create(&reactors[num_started].thread,
+                                &reactor_thread,
+                                &reactors[num_started]);
+        if (0 != ret) {
+            printf("ERRO: failed to start reactor %d\n", num_started);
+            break;
+        }
+    }
+    os_pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+
+    if (num_started < num) {
+        goto error_out_pthread_create;
+    }
+
+    printf("INFO: started %d reactors\n", num);
+    ret_final = EXIT_SUCCESS;
+    return ret_final;
+error_out_pthread_create:
+    join_reactors(num_started);
+    num_reactors = 0;
+error_out_init_reactor:
+    for (int i = 0; i < num_init; i++) {
+        exit_reactor(&reactors[i]);
+    }
+    os_free(reactors);
+    reactors = NULL;
+error_out_malloc:
+    return ret_final;
+}
+
+void stop_reactors(void) {
+    join_reactors(num_reactors);
+
+    for (int i = 0; i < num_reactors; i++) {
+        exit_reactor(&reactors[i]);
+    }
+
+    os_free(reactors);
+    reactors = NULL;
+    num_reactors = 0;
+}
@@ -0,0 +1,33 @@
+// Copyright 2020 author. All rights reserved.
+
+#ifndef SRC_REACTOR_REACTOR_H_
+#define SRC_REACTOR_REACTOR_H_
+
+/**
+ * Start reactor threads.
+ *
+ * Every reactor owns a SO_REUSEPORT listen socket, an event loop and the
+ * users that connect to it. Broadcasts are forwarded to the other reactors
+ * through their inboxes. The reactor threads block all signals, so signals
+ * are handled by the calling thread.
+ *
+ * @param num (int) - Number of reactor threads.
+ * @malloc (struct reactor *) - Reactor table.
+ * @fail - Fail to allocate reactor table.
+ * @fail - Fail to initialize a reactor.
+ * @fail - Fail to start a reactor thread.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int start_reactors(int num);
+
+/**
+ * Stop reactor threads and wait for them to exit.
+ *
+ * Every reactor is woken up through its eventfd and drains its users' send
+ * queues before it exits.
+ *
+ * @free (struct reactor *) - Reactor table.
+ */
+void stop_reactors(void);
+
+#endif  // SRC_REACTOR_REACTOR_H_
@@ -0,0 +1,185 @@
+// Copyright 2020 author. All rights reserved.
+
+#include "src/reactor/reactor_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+#include "include/list.h"
+#include "lib/osdep/osdep.h"
+#include "src/comms/comms.h"
+#include "src/timer/timer.h"
+#include "src/user/user.h"
+
+struct reactor_msg *copy_broadcast_msg(struct msg_broadcast *data) {
+    struct reactor_msg *msg;
+    size_t name_len = strlen(data->name) + 1;
+    size_t msg_len;
+    char *msg_str;
+
+    // the part of a stream takes the place of the message
+    if (NULL != data->stream) {
+        msg_str = data->stream->part.str;
+        msg_len = data->stream->part.len;
+    } else {
+        msg_str = data->msg;
+        msg_len = strlen(data->msg) + 1;
+    }
+
+    msg = os_malloc(sizeof(struct reactor_msg) + name_len + msg_len);
+    if (NULL == msg) {
+        printf("ERRO: failed to allocate memory for forwarded message\n");
+        goto error_out_malloc;
+    }
+
+    msg->data.timestamp = data->timestamp;
+    msg->data.prio = data->prio;
+    msg->data.name = msg->buf;
+    msg->data.msg = &msg->buf[name_len];
+    msg->data.stream = NULL;
+    os_memcpy(msg->data.name, data->name, name_len);
+    os_memcpy(msg->data.msg, msg_str, msg_len);
+
+    if (NULL != data->stream) {
+        msg->stream = *data->stream;
+        msg->stream.part.str = msg->data.msg;
+        msg->data.stream = &msg->stream;
+        msg->data.msg = NULL;
+    }
+
+error_out_malloc:
+    return msg;
+}
+
+int drain_inbox(struct reactor *reactor) {
+    struct reactor_msg *cur_msg = NULL;
+    struct reactor_msg *n = NULL;
+    struct list_head msgs;
+    uint64_t value;
+
+    // reset the counter before taking the messages, so a message posted
+    // after the splice wakes the reactor up again
+    os_eventfd_read(reactor->wakefd, &value);
+
+    INIT_LIST_HEAD(&msgs);
+    os_pthread_mutex_lock(&reactor->inbox_lock);
+    list_splice_init(&reactor->inbox, &msgs);
+    os_pthread_mutex_unlock(&reactor->inbox_lock);
+
+    list_for_each_entry_safe(cur_msg, n, &msgs, list) {
+        list_del(&cur_msg->list);
+        deliver_forwarded_msg(&cur_msg->data);
+        os_free(cur_msg);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+void exit_reactor(struct reactor *reactor) {
+    struct reactor_msg *cur_msg = NULL;
+    struct reactor_msg *n = NULL;
+
+    list_for_each_entry_safe(cur_msg, n, &reactor->inbox, list) {
+        list_del(&cur_msg->list);
+        os_free(cur_msg);
+    }
+
+    os_close(reactor->epollfd);
+    os_close(reactor->listenfd);
+    os_pthread_mutex_destroy(&reactor->inbox_lock);
+    os_close(reactor->wakefd);
+}
+
+int init_reactor(struct reactor *reactor, int id) {
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    reactor->id = id;
+    reactor->running = true;
+    INIT_LIST_HEAD(&reactor->inbox);
+
+    reactor->wakefd = os_eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (-1 == reactor->wakefd) {
+        printf("ERRO: failed to create eventfd for reactor %d\n", id);
+        goto error_out_eventfd;
+    }
+
+    ret = os_pthread_mutex_init(&reactor->inbox_lock);
+    if (0 != ret) {
+        printf("ERRO: failed to create inbox lock for reactor %d\n", id);
+        goto error_out_mutex_init;
+    }
+
+    reactor->listenfd = init_listen_sock(true);
+    if (-1 == reactor->listenfd) {
+        printf("ERRO: failed to setup listen sock for reactor %d\n", id);
+        goto error_out_listen;
+    }
+
+    reactor->epollfd = init_event_loop(reactor->listenfd);
+    if (-1 == reactor->epollfd) {
+        printf("ERRO: failed to setup event loop for reactor %d\n", id);
+        goto error_out_event_loop;
+    }
+
+    ret_final = EXIT_SUCCESS;
+    return ret_final;
+error_out_event_loop:
+    os_close(reactor->listenfd);
+error_out_listen:
+    os_pthread_mutex_destroy(&reactor->inbox_lock);
+error_out_mutex_init:
+    os_close(reactor->wakefd);
+error_out_eventfd:
+    return ret_final;
+}
+
+void post_reactor_msg(struct reactor *reactor, struct reactor_msg *msg) {
+    bool was_empty;
+
+    os_pthread_mutex_lock(&reactor->inbox_lock);
+    was_empty = list_empty(&reactor->inbox);
+    list_add_tail(&msg->list, &reactor->inbox);
+    os_pthread_mutex_unlock(&reactor->inbox_lock);
+
+    if (true == was_empty) {
+        os_eventfd_write(reactor->wakefd, 1);
+    }
+}
+
+int run_reactor_loop(struct reactor *reactor, event_handler wake_handler) {
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    ret = add_event_handler(reactor->epollfd, reactor->wakefd, wake_handler);
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to add eventfd to reactor %d\n", reactor->id);
+        goto error_out_add_event_handler;
+    }
+
+    init_timers();
+    init_user();
+
+    while (__atomic_load_n(&reactor->running, __ATOMIC_ACQUIRE)) {
+        ret = monitor_socks(reactor->epollfd, reactor->listenfd);
+        if (EXIT_FAILURE == ret) {
+            printf("ERRO: failed to monitor sockets of reactor %d\n",
+                   reactor->id);
+            goto error_out_monitor_socks;
+        }
+    }
+
+    ret = drain_event_loop(reactor->epollfd, reactor->listenfd);
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to drain reactor %d\n", reactor->id);
+        goto error_out_drain_event_loop;
+    }
+
+    ret_final = EXIT_SUCCESS;
+error_out_drain_event_loop:
+error_out_monitor_socks:
+error_out_add_event_handler:
+    return ret_final;
+}
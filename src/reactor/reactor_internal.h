@@ -0,0 +1,103 @@
+// Copyright 2020 author. All rights reserved.
+
+#ifndef SRC_REACTOR_REACTOR_INTERNAL_H_
+#define SRC_REACTOR_REACTOR_INTERNAL_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "include/list.h"
+#include "src/comms/comms.h"
+#include "src/message/message.h"
+
+struct reactor_msg {
+    struct list_head list;
+    struct msg_broadcast data;
+    struct msg_stream stream;   // copy of data.stream if set
+    char buf[0];
+};
+
+struct reactor {
+    pthread_t thread;
+    int id;
+    int listenfd;
+    int epollfd;
+    int wakefd;
+    bool running;
+    pthread_mutex_t inbox_lock;
+    struct list_head inbox;
+};
+
+/**
+ * Copy broadcast message so it can be handed to another reactor.
+ *
+ * @param data (struct msg_broadcast *) - Broadcast message.
+ * @malloc (struct reactor_msg *) - Copy of message, including strings.
+ * @return (struct reactor_msg *) - Copy on success, NULL on failure.
+ */
+struct reactor_msg *copy_broadcast_msg(struct msg_broadcast *data);
+
+/**
+ * Deliver every message in a reactor's inbox to its users.
+ *
+ * Must be called from the reactor's own thread.
+ *
+ * @param reactor (struct reactor *) - Reactor of calling thread.
+ * @free (struct reactor_msg *) - Delivered messages.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int drain_inbox(struct reactor *reactor);
+
+/**
+ * Release reactor once its thread has stopped.
+ *
+ * @param reactor (struct reactor *) - Reactor to release.
+ * @close - File descriptors for listen socket, epoll instance and eventfd.
+ * @free (struct reactor_msg *) - Undelivered messages.
+ */
+void exit_reactor(struct reactor *reactor);
+
+/**
+ * Initialize reactor.
+ *
+ * Creates the reactor's SO_REUSEPORT listen socket, its event loop and the
+ * eventfd other reactors use to wake it up.
+ *
+ * @param reactor (struct reactor *) - Reactor to initialize.
+ * @param id (int) - Index of reactor.
+ * @open - File descriptors for listen socket, epoll instance and eventfd.
+ * @fail - Fail to create eventfd.
+ * @fail - Fail to initialize inbox lock.
+ * @fail - Fail to create listen socket.
+ * @fail - Fail to create event loop.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int init_reactor(struct reactor *reactor, int id);
+
+/**
+ * Add message to a reactor's inbox.
+ *
+ * The reactor is only woken up when its inbox was empty, it drains every
+ * queued message at once.
+ *
+ * @param reactor (struct reactor *) - Reactor to deliver message to.
+ * @param msg (struct reactor_msg *) - Message, owned by reactor afterwards.
+ */
+void post_reactor_msg(struct reactor *reactor, struct reactor_msg *msg);
+
+/**
+ * Run reactor's event loop until it is stopped.
+ *
+ * Must be called from the reactor's own thread. Once stopped, the reactor
+ * drains its users' send queues before closing them.
+ *
+ * @param reactor (struct reactor *) - Reactor of calling thread.
+ * @param wake_handler (event_handler) - Handler for reactor's eventfd.
+ * @fail - Fail to add eventfd to event loop.
+ * @fail - Fail to monitor sockets.
+ * @fail - Fail to drain event loop.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int run_reactor_loop(struct reactor *reactor, event_handler wake_handler);
+
+#endif  // SRC_REACTOR_REACTOR_INTERNAL_H_
@@ -0,0 +1,70 @@
+// Copyright 2020 author. All rights reserved.
+
+#include "src/stats/stats.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+static const char *stat_names[NUM_STATS] = {
+    "accept_wakeups",
+    "accepts",
+    "accepts_max_per_wakeup",
+    "accept_budget_hit",
+    "listen_queue_full",
+    "zerocopy_sends",
+    "zerocopy_copied",
+    "slow_disconnects",
+    "slow_dropped_oldest",
+    "slow_dropped_newest",
+    "slow_collapsed",
+    "batches",
+    "sock_tune_failed",
+    "fanout_jobs",
+    "fanout_steals",
+    "read_budget_hit",
+};
+
+static uint64_t stats[NUM_STATS];
+
+static const char *sock_profile = "default";
+
+void add_stat(int stat, uint64_t value) {
+    __atomic_fetch_add(&stats[stat], value, __ATOMIC_RELAXED);
+}
+
+uint64_t get_stat(int stat) {
+    return __atomic_load_n(&stats[stat], __ATOMIC_RELAXED);
+}
+
+void max_stat(int stat, uint64_t value) {
+    uint64_t cur = __atomic_load_n(&stats[stat], __ATOMIC_RELAXED);
+
+    while (value > cur) {
+        if (__atomic_compare_exchange_n(&stats[stat],
+                                        &cur,
+                                        value,
+                                        true,
+                                        __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+}
+
+void print_stats(void) {
+    printf("STAT: sock_profile %s\n", sock_profile);
+    for (int i = 0; i < NUM_STATS; i++) {
+        printf("STAT: %s %" PRIu64 "\n", stat_names[i], get_stat(i));
+    }
+}
+
+void reset_stats(void) {
+    for (int i = 0; i < NUM_STATS; i++) {
+        __atomic_store_n(&stats[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+void set_stat_sock_profile(const char *name) {
+    sock_profile = name;
+}
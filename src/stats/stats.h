@@ -0,0 +1,69 @@
+// Copyright 2020 author. All rights reserved.
+
+#ifndef SRC_STATS_STATS_H_
+#define SRC_STATS_STATS_H_
+
+#include <stdint.h>
+
+#define STAT_ACCEPT_WAKEUPS 0
+#define STAT_ACCEPTS 1
+#define STAT_ACCEPTS_MAX 2
+#define STAT_ACCEPT_BUDGET_HIT 3
+#define STAT_LISTEN_QUEUE_FULL 4
+#define STAT_ZEROCOPY_SENDS 5
+#define STAT_ZEROCOPY_COPIED 6
+#define STAT_SLOW_DISCONNECTS 7
+#define STAT_SLOW_DROPPED_OLDEST 8
+#define STAT_SLOW_DROPPED_NEWEST 9
+#define STAT_SLOW_COLLAPSED 10
+#define STAT_BATCHES 11
+#define STAT_SOCK_TUNE_FAILED 12
+#define STAT_FANOUT_JOBS 13
+#define STAT_FANOUT_STEALS 14
+#define STAT_READ_BUDGET_HIT 15
+#define NUM_STATS 16
+
+/**
+ * Add to a counter.
+ *
+ * Counters are shared by all event loop threads.
+ *
+ * @param stat (int) - Counter, one of the STAT_* values.
+ * @param value (uint64_t) - Amount to add.
+ */
+void add_stat(int stat, uint64_t value);
+
+/**
+ * Get the value of a counter.
+ *
+ * @param stat (int) - Counter, one of the STAT_* values.
+ * @return (uint64_t) - Value of counter.
+ */
+uint64_t get_stat(int stat);
+
+/**
+ * Raise a counter that tracks a maximum.
+ *
+ * @param stat (int) - Counter, one of the STAT_* values.
+ * @param value (uint64_t) - New value, ignored if below the current one.
+ */
+void max_stat(int stat, uint64_t value);
+
+/**
+ * Print all counters.
+ */
+void print_stats(void);
+
+/**
+ * Reset all counters to zero.
+ */
+void reset_stats(void);
+
+/**
+ * Set the name of the socket profile printed with the counters.
+ *
+ * @param name (const char *) - Name of profile, not copied.
+ */
+void set_stat_sock_profile(const char *name);
+
+#endif  // SRC_STATS_STATS_H_
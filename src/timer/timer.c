@@ -0,0 +1,60 @@
+// Copyright 2020 author. All rights reserved.
+
+#include "src/timer/timer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "include/list.h"
+#include "lib/osdep/osdep.h"
+#include "src/timer/timer_internal.h"
+
+// each event loop thread runs its own timers
+static __thread struct timer_wheel wheel;
+
+void del_timer(struct timer *timer) {
+    if (true == timer_pending(timer)) {
+        list_del_init(&timer->list);
+        wheel.num_timers--;
+    }
+}
+
+int get_timer_timeout(void) {
+    uint64_t next;
+    int timeout = -1;
+
+    if (0 == wheel.num_timers) {
+        goto out_no_timers;
+    }
+
+    next = wheel.tick * TIMER_TICK_MS;
+    timeout = next > wheel.now ? (int)(next - wheel.now) : 0;
+out_no_timers:
+    return timeout;
+}
+
+void init_timer(struct timer *timer, timer_callback callback) {
+    INIT_LIST_HEAD(&timer->list);
+    timer->expires = 0;
+    timer->callback = callback;
+}
+
+void init_timers(void) {
+    init_timer_wheel(&wheel, os_monotonic_ms());
+}
+
+void mod_timer(struct timer *timer, uint64_t timeout) {
+    del_timer(timer);
+
+    timer->expires = (wheel.now + timeout + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    queue_timer(&wheel, timer);
+    wheel.num_timers++;
+}
+
+int run_timers(void) {
+    return expire_timers(&wheel, os_monotonic_ms());
+}
+
+bool timer_pending(struct timer *timer) {
+    return !list_empty(&timer->list);
+}
@@ -0,0 +1,85 @@
+// Copyright 2020 author. All rights reserved.
+
+#ifndef SRC_TIMER_TIMER_H_
+#define SRC_TIMER_TIMER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "include/list.h"
+
+#define TIMER_TICK_MS 100
+
+struct timer;
+
+typedef void (*timer_callback)(struct timer *timer);
+
+struct timer {
+    struct list_head list;
+    uint64_t expires;
+    timer_callback callback;
+};
+
+/**
+ * Disarm timer.
+ *
+ * Does nothing if the timer is not armed.
+ *
+ * @param timer (struct timer *) - Timer to disarm.
+ */
+void del_timer(struct timer *timer);
+
+/**
+ * Get how long the event loop may sleep before timers need to run.
+ *
+ * @return (int) - Timeout in milliseconds, -1 if no timer is armed.
+ */
+int get_timer_timeout(void);
+
+/**
+ * Initialize a disarmed timer.
+ *
+ * The callback is run by run_timers() once the timer expires. It may arm
+ * or disarm any timer, including the one that expired.
+ *
+ * @param timer (struct timer *) - Timer to initialize.
+ * @param callback (timer_callback) - Function called when timer expires.
+ */
+void init_timer(struct timer *timer, timer_callback callback);
+
+/**
+ * Initialize the timer wheel of the calling thread.
+ *
+ * Timers are per thread, like the event loop itself.
+ */
+void init_timers(void);
+
+/**
+ * Arm timer, or move its deadline if it is already armed.
+ *
+ * Deadlines are rounded up to the next TIMER_TICK_MS. Arming and disarming
+ * are O(1) no matter how many timers are armed.
+ *
+ * @param timer (struct timer *) - Initialized timer.
+ * @param timeout (uint64_t) - Milliseconds from the last run_timers().
+ */
+void mod_timer(struct timer *timer, uint64_t timeout);
+
+/**
+ * Run the callbacks of all timers that have expired.
+ *
+ * Meant to be called once per event loop iteration.
+ *
+ * @return (int) - Number of expired timers.
+ */
+int run_timers(void);
+
+/**
+ * Check if timer is armed.
+ *
+ * @param timer (struct timer *) - Initialized timer.
+ * @return (bool) - true if armed, false otherwise.
+ */
+bool timer_pending(struct timer *timer);
+
+#endif  // SRC_TIMER_TIMER_H_
@@ -0,0 +1,107 @@
+// Copyright 2020 author. All rights reserved.
+
+#include "src/timer/timer_internal.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "include/list.h"
+#include "src/timer/timer.h"
+
+void cascade_timers(struct timer_wheel *wheel, int level) {
+    struct timer *timer = NULL;
+    struct timer *n = NULL;
+    struct list_head tmp;
+    int index;
+
+    index = (wheel->tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    if (0 == index && level + 1 < TIMER_WHEEL_LEVELS) {
+        cascade_timers(wheel, level + 1);
+    }
+
+    INIT_LIST_HEAD(&tmp);
+    list_splice_init(&wheel->slots[level][index], &tmp);
+
+    list_for_each_entry_safe(timer, n, &tmp, list) {
+        queue_timer(wheel, timer);
+    }
+}
+
+int expire_timers(struct timer_wheel *wheel, uint64_t now) {
+    uint64_t target = now / TIMER_TICK_MS;
+    struct timer *timer;
+    struct list_head expired;
+    int index;
+    int num_expired = 0;
+
+    wheel->now = now;
+
+    if (0 == wheel->num_timers) {
+        if (target >= wheel->tick) {
+            wheel->tick = target + 1;
+        }
+        goto out_no_timers;
+    }
+
+    INIT_LIST_HEAD(&expired);
+    while (wheel->tick <= target) {
+        index = wheel->tick & TIMER_WHEEL_MASK;
+        if (0 == index) {
+            cascade_timers(wheel, 1);
+        }
+
+        list_splice_init(&wheel->slots[0][index], &expired);
+        wheel->tick++;
+
+        // callbacks may disarm other timers in the batch, so take them
+        // off the list one at a time
+        while (false == list_empty(&expired)) {
+            timer = list_first_entry(&expired, struct timer, list);
+            list_del_init(&timer->list);
+            wheel->num_timers--;
+            timer->callback(timer);
+            num_expired++;
+        }
+    }
+
+out_no_timers:
+    return num_expired;
+}
+
+void init_timer_wheel(struct timer_wheel *wheel, uint64_t now) {
+    wheel->now = now;
+    wheel->tick = now / TIMER_TICK_MS + 1;
+    wheel->num_timers = 0;
+
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+            INIT_LIST_HEAD(&wheel->slots[level][i]);
+        }
+    }
+}
+
+void queue_timer(struct timer_wheel *wheel, struct timer *timer) {
+    uint64_t expires = timer->expires;
+    uint64_t delta;
+    int level;
+    int index;
+
+    if (expires < wheel->tick) {
+        expires = wheel->tick;
+    }
+
+    delta = expires - wheel->tick;
+    if (delta >= TIMER_WHEEL_MAX_TICKS) {
+        delta = TIMER_WHEEL_MAX_TICKS - 1;
+        expires = wheel->tick + delta;
+    }
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+        if (delta < ((uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1)))) {
+            break;
+        }
+    }
+
+    index = (expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    list_add_tail(&timer->list, &wheel->slots[level][index]);
+}
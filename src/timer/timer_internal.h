@@ -0,0 +1,70 @@
+// Copyright 2020 author. All rights reserved.
+
+#ifndef SRC_TIMER_TIMER_INTERNAL_H_
+#define SRC_TIMER_TIMER_INTERNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "include/list.h"
+#include "src/timer/timer.h"
+
+#define TIMER_WHEEL_BITS 8
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_MAX_TICKS \
+    ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+// level 0 has a slot per tick for the next TIMER_WHEEL_SLOTS ticks, each
+// level above covers TIMER_WHEEL_SLOTS times the range of the one below
+// and is moved down a level whenever the level below wraps around
+struct timer_wheel {
+    uint64_t now;
+    uint64_t tick;
+    size_t num_timers;
+    struct list_head slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+/**
+ * Move the timers of the current slot of a level to the levels below.
+ *
+ * The level above is cascaded first when this level wraps around.
+ *
+ * @param wheel (struct timer_wheel *) - Timer wheel.
+ * @param level (int) - Level to cascade, at least 1.
+ */
+void cascade_timers(struct timer_wheel *wheel, int level);
+
+/**
+ * Run the callbacks of all timers that expire up to now.
+ *
+ * Every tick between the last call and now is processed in order, the
+ * wheel skips ahead when no timer is armed.
+ *
+ * @param wheel (struct timer_wheel *) - Timer wheel.
+ * @param now (uint64_t) - Current time in milliseconds.
+ * @return (int) - Number of expired timers.
+ */
+int expire_timers(struct timer_wheel *wheel, uint64_t now);
+
+/**
+ * Initialize timer wheel with no timers armed.
+ *
+ * @param wheel (struct timer_wheel *) - Timer wheel.
+ * @param now (uint64_t) - Current time in milliseconds.
+ */
+void init_timer_wheel(struct timer_wheel *wheel, uint64_t now);
+
+/**
+ * Put timer in the slot for its expiry tick.
+ *
+ * Timers that are already due go in the slot processed next, deadlines
+ * beyond the range of the wheel are clamped to its last tick.
+ *
+ * @param wheel (struct timer_wheel *) - Timer wheel.
+ * @param timer (struct timer *) - Timer with expiry tick set.
+ */
+void queue_timer(struct timer_wheel *wheel, struct timer *timer);
+
+#endif  // SRC_TIMER_TIMER_INTERNAL_H_
@@ -0,0 +1,148 @@
+// Copyright 2020 author. All rights reserved.
+
+#include "src/upgrade/upgrade.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "lib/fileio/fileio.h"
+#include "lib/osdep/osdep.h"
+#include "src/upgrade/upgrade_internal.h"
+#include "src/user/user.h"
+
+int receive_listen_sock(int sock) {
+    struct upgrade_hdr hdr;
+    int listenfd;
+    int ret;
+
+    ret = recv_fd(sock, &listenfd, &hdr, sizeof(hdr));
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to receive listen socket\n");
+        goto error_out_recv_fd;
+    }
+
+    if (UPGRADE_LISTEN_SOCK != hdr.type || -1 == listenfd) {
+        printf("ERRO: expected listen socket, got type %u\n", hdr.type);
+        goto error_out_type;
+    }
+
+    return listenfd;
+error_out_type:
+    if (-1 != listenfd) {
+        os_close(listenfd);
+    }
+error_out_recv_fd:
+    return -1;
+}
+
+int receive_users(int sock, int epollfd) {
+    struct upgrade_hdr hdr;
+    uint8_t ack = 1;
+    int num_users = 0;
+    int fd;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    while (true) {
+        ret = recv_fd(sock, &fd, &hdr, sizeof(hdr));
+        if (EXIT_FAILURE == ret) {
+            printf("ERRO: failed to receive user\n");
+            goto error_out_recv_fd;
+        }
+
+        if (UPGRADE_END == hdr.type && -1 == fd) {
+            break;
+        } else if (UPGRADE_USER != hdr.type || -1 == fd) {
+            printf("ERRO: expected user, got type %u\n", hdr.type);
+            if (-1 != fd) {
+                os_close(fd);
+            }
+            goto error_out_type;
+        }
+
+        ret = receive_user(sock, fd, &hdr, epollfd);
+        if (EXIT_FAILURE == ret) {
+            goto error_out_receive_user;
+        }
+        num_users++;
+    }
+
+    ret = send_fd(sock, -1, &ack, sizeof(ack));
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to confirm take over\n");
+        goto error_out_send_fd;
+    }
+
+    printf("INFO: took over %d users\n", num_users);
+    ret_final = EXIT_SUCCESS;
+error_out_send_fd:
+error_out_receive_user:
+error_out_type:
+error_out_recv_fd:
+    return ret_final;
+}
+
+int start_upgrade(char *const argv[], int listenfd) {
+    struct upgrade_hdr hdr;
+    uint8_t ack;
+    int sv[2];
+    pid_t pid;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    ret = os_socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv);
+    if (-1 == ret) {
+        printf("ERRO: failed to create upgrade socket\n");
+        goto error_out_socketpair;
+    }
+
+    pid = spawn_server(argv, sv[1]);
+    os_close(sv[1]);
+    if (-1 == pid) {
+        goto error_out_spawn_server;
+    }
+
+    os_memset(&hdr, 0, sizeof(hdr));
+    hdr.type = UPGRADE_LISTEN_SOCK;
+    ret = send_fd(sv[0], listenfd, &hdr, sizeof(hdr));
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to send listen socket\n");
+        goto error_out_send;
+    }
+
+    ret = export_users(&send_user, &sv[0]);
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to send users\n");
+        goto error_out_send;
+    }
+
+    hdr.type = UPGRADE_END;
+    ret = send_fd(sv[0], -1, &hdr, sizeof(hdr));
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: failed to finish sending users\n");
+        goto error_out_send;
+    }
+
+    ret = read_full(sv[0], &ack, sizeof(ack));
+    if (EXIT_FAILURE == ret) {
+        printf("ERRO: new server process did not take over\n");
+        goto error_out_send;
+    }
+
+    printf("INFO: handed users over to process %d\n", (int)pid);
+    os_close(sv[0]);
+    ret_final = EXIT_SUCCESS;
+    return ret_final;
+error_out_send:
+    // the new process gives up once its end of the socket is closed
+    os_close(sv[0]);
+    os_waitpid(pid, NULL, 0);
+    return ret_final;
+error_out_spawn_server:
+    os_close(sv[0]);
+error_out_socketpair:
+    return ret_final;
+}
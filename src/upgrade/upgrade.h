@@ -0,0 +1,51 @@
+// Copyright 2020 author. All rights reserved.
+
+#ifndef SRC_UPGRADE_UPGRADE_H_
+#define SRC_UPGRADE_UPGRADE_H_
+
+/**
+ * Take over the listen socket from the previous server process.
+ *
+ * @param sock (int) - Unix socket passed with -u.
+ * @open - Listen socket.
+ * @fail - Fail to receive listen socket.
+ * @return (int) - Listen socket fd on success, -1 on failure.
+ */
+int receive_listen_sock(int sock);
+
+/**
+ * Take over the users of the previous server process.
+ *
+ * Adds every user to the event loop without telling the other users, and
+ * confirms to the previous process that it can exit. A user that can't be
+ * added is dropped, the others are still taken over.
+ *
+ * @param sock (int) - Unix socket passed with -u.
+ * @param epollfd (int) - epoll fd returned by init_event_loop().
+ * @open - File descriptors of users.
+ * @fail - Fail to receive users.
+ * @fail - Fail to confirm take over.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int receive_users(int sock, int epollfd);
+
+/**
+ * Hand the listen socket and users over to a new server process.
+ *
+ * Starts the server binary again with the same arguments plus -u, and
+ * passes the listen socket and every user to it over a unix socket. The
+ * users keep their connections, partial frames and queued messages. This
+ * process must exit without closing users once the new process took over,
+ * and keeps serving if it failed to.
+ *
+ * @param argv (char *const []) - Arguments this process was started with.
+ * @param listenfd (int) - Listen socket fd.
+ * @fail - Fail to create unix socket.
+ * @fail - Fail to start new server process.
+ * @fail - Fail to send listen socket or users.
+ * @fail - New server process did not take over.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int start_upgrade(char *const argv[], int listenfd);
+
+#endif  // SRC_UPGRADE_UPGRADE_H_
@@ -0,0 +1,200 @@
+// Copyright 2020 author. All rights reserved.
+
+#include "src/upgrade/upgrade_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/fileio/fileio.h"
+#include "lib/osdep/osdep.h"
+#include "src/comms/comms.h"
+#include "src/user/user.h"
+
+#define UPGRADE_FD_STR_LEN 12
+
+char **build_upgrade_argv(char *const argv[], int sock) {
+    char **new_argv;
+    char *fd_str;
+    int argc = 0;
+    int n = 0;
+
+    while (NULL != argv[argc]) {
+        argc++;
+    }
+
+    // room for -u, the fd and NULL, followed by the fd string
+    new_argv = os_malloc((argc + 3) * sizeof(char *) + UPGRADE_FD_STR_LEN);
+    if (NULL == new_argv) {
+        printf("ERRO: failed to allocate memory for arguments\n");
+        goto error_out_malloc;
+    }
+    fd_str = (char *)&new_argv[argc + 3];
+
+    for (int i = 0; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-u") && i + 1 < argc) {
+            i++;
+            continue;
+        }
+        new_argv[n++] = argv[i];
+    }
+
+    snprintf(fd_str, UPGRADE_FD_STR_LEN, "%d", sock);
+    new_argv[n++] = (char *)"-u";
+    new_argv[n++] = fd_str;
+    new_argv[n] = NULL;
+
+error_out_malloc:
+    return new_argv;
+}
+
+int receive_user(int sock, int fd, struct upgrade_hdr *hdr, int epollfd) {
+    struct user_state state;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    state.fd = fd;
+    state.name = NULL;
+    state.in_buf = NULL;
+    state.in_len = hdr->in_len;
+    state.out_buf = NULL;
+    state.out_len = hdr->out_len;
+    state.streaming = (0 != hdr->streaming);
+    state.stream_id = hdr->stream_id;
+    state.stream_len = hdr->stream_len;
+    state.stream_left = hdr->stream_left;
+    state.caps = hdr->caps;
+
+    if (hdr->name_len > 0) {
+        state.name = os_malloc(hdr->name_len);
+        if (NULL == state.name) {
+            goto error_out_malloc;
+        }
+        ret = read_full(sock, state.name, hdr->name_len);
+        if (EXIT_FAILURE == ret) {
+            goto error_out_read_full;
+        }
+        state.name[hdr->name_len - 1] = '\0';
+    }
+
+    if (state.in_len > 0) {
+        state.in_buf = os_malloc(state.in_len);
+        if (NULL == state.in_buf) {
+            goto error_out_malloc;
+        }
+        ret = read_full(sock, state.in_buf, state.in_len);
+        if (EXIT_FAILURE == ret) {
+            goto error_out_read_full;
+        }
+    }
+
+    if (state.out_len > 0) {
+        state.out_buf = os_malloc(state.out_len);
+        if (NULL == state.out_buf) {
+            goto error_out_malloc;
+        }
+        ret = read_full(sock, state.out_buf, state.out_len);
+        if (EXIT_FAILURE == ret) {
+            goto error_out_read_full;
+        }
+    }
+
+    // the name and fd belong to the event loop from here on
+    ret = add_user_to_event_loop(epollfd, &state);
+    if (EXIT_FAILURE == ret) {
+        printf("WARN: failed to take over fd %d\n", fd);
+    }
+
+    os_free(state.in_buf);
+    os_free(state.out_buf);
+    ret_final = EXIT_SUCCESS;
+    return ret_final;
+error_out_read_full:
+error_out_malloc:
+    printf("ERRO: failed to receive user on fd %d\n", fd);
+    os_free(state.name);
+    os_free(state.in_buf);
+    os_free(state.out_buf);
+    os_close(fd);
+    return ret_final;
+}
+
+int send_user(struct user_state *state, void *arg) {
+    struct upgrade_hdr hdr;
+    int sock = *(int *)arg;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    hdr.type = UPGRADE_USER;
+    hdr.name_len = (NULL == state->name) ? 0 : strlen(state->name) + 1;
+    hdr.in_len = state->in_len;
+    hdr.out_len = state->out_len;
+    hdr.streaming = state->streaming;
+    hdr.stream_id = state->stream_id;
+    hdr.stream_len = state->stream_len;
+    hdr.stream_left = state->stream_left;
+    hdr.caps = state->caps;
+
+    ret = send_fd(sock, state->fd, &hdr, sizeof(hdr));
+    if (EXIT_FAILURE == ret) {
+        goto error_out_send_fd;
+    }
+
+    if (hdr.name_len > 0) {
+        ret = send_fd(sock, -1, state->name, hdr.name_len);
+        if (EXIT_FAILURE == ret) {
+            goto error_out_send_fd;
+        }
+    }
+
+    if (hdr.in_len > 0) {
+        ret = send_fd(sock, -1, state->in_buf, hdr.in_len);
+        if (EXIT_FAILURE == ret) {
+            goto error_out_send_fd;
+        }
+    }
+
+    if (hdr.out_len > 0) {
+        ret = send_fd(sock, -1, state->out_buf, hdr.out_len);
+        if (EXIT_FAILURE == ret) {
+            goto error_out_send_fd;
+        }
+    }
+
+    ret_final = EXIT_SUCCESS;
+error_out_send_fd:
+    return ret_final;
+}
+
+pid_t spawn_server(char *const argv[], int sock) {
+    char **new_argv;
+    int fd;
+    pid_t pid;
+
+    pid = os_fork();
+    if (-1 == pid) {
+        printf("ERRO: failed to fork new server process\n");
+        goto error_out_fork;
+    } else if (0 != pid) {
+        goto out_parent;
+    }
+
+    // every other inherited fd is closed on exec
+    fd = os_dup(sock);
+    if (-1 == fd) {
+        goto error_out_child;
+    }
+
+    new_argv = build_upgrade_argv(argv, fd);
+    if (NULL == new_argv) {
+        goto error_out_child;
+    }
+
+    os_execv(argv[0], new_argv);
+error_out_child:
+    printf("ERRO: failed to start %s\n", argv[0]);
+    os_exit(EXIT_FAILURE);
+out_parent:
+error_out_fork:
+    return pid;
+}
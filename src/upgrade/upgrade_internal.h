@@ -0,0 +1,81 @@
+// Copyright 2020 author. All rights reserved.
+
+#ifndef SRC_UPGRADE_UPGRADE_INTERNAL_H_
+#define SRC_UPGRADE_UPGRADE_INTERNAL_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "src/user/user.h"
+
+#define UPGRADE_LISTEN_SOCK 1
+#define UPGRADE_USER 2
+#define UPGRADE_END 3
+
+// both processes run on the same host, so the header uses host byte order
+struct upgrade_hdr {
+    uint32_t type;
+    uint32_t name_len;
+    uint32_t in_len;
+    uint32_t out_len;
+    uint32_t streaming;
+    uint32_t stream_id;
+    uint32_t stream_len;
+    uint32_t stream_left;
+    uint32_t caps;
+};
+
+/**
+ * Build arguments for the new server process.
+ *
+ * Copies argv without an earlier -u option and appends -u with sock.
+ *
+ * @param argv (char *const []) - Arguments this process was started with.
+ * @param sock (int) - Unix socket the new process inherits.
+ * @malloc (char **) - Arguments and fd string, freed at once.
+ * @return (char **) - Arguments on success, NULL on failure.
+ */
+char **build_upgrade_argv(char *const argv[], int sock);
+
+/**
+ * Receive the buffers of a user and add it to the event loop.
+ *
+ * @param sock (int) - Unix socket.
+ * @param fd (int) - File descriptor of user, closed on failure.
+ * @param hdr (struct upgrade_hdr *) - Header received with fd.
+ * @param epollfd (int) - epoll fd returned by init_event_loop().
+ * @malloc (char *) - Name of user, owned by the user module.
+ * @malloc (uint8_t *) - Receive buffer and queued bytes.
+ * @free (uint8_t *) - Receive buffer and queued bytes.
+ * @fail - Fail to allocate or receive buffers.
+ * @return (int) - EXIT_SUCCESS unless the unix socket failed, a user that
+ *                 can't be added is dropped.
+ */
+int receive_user(int sock, int fd, struct upgrade_hdr *hdr, int epollfd);
+
+/**
+ * Send a user to the new server process.
+ *
+ * Passed to export_users().
+ *
+ * @param state (struct user_state *) - Exported state of user.
+ * @param arg (void *) - Pointer to the unix socket fd.
+ * @fail - Fail to send to unix socket.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int send_user(struct user_state *state, void *arg);
+
+/**
+ * Start the new server process.
+ *
+ * The child gets a copy of sock without FD_CLOEXEC and executes argv[0]
+ * with the arguments from build_upgrade_argv().
+ *
+ * @param argv (char *const []) - Arguments this process was started with.
+ * @param sock (int) - Unix socket end of the new process.
+ * @fail - Fail to fork.
+ * @return (pid_t) - pid of new process on success, -1 on failure.
+ */
+pid_t spawn_server(char *const argv[], int sock);
+
+#endif  // SRC_UPGRADE_UPGRADE_INTERNAL_H_
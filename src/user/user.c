@@ -2,42 +2,194 @@
 
 #include "src/user/user.h"
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "include/list.h"
+#include "lib/fileio/fileio.h"
 #include "lib/osdep/osdep.h"
+#include "lib/ring/ring.h"
+#include "src/fanout/fanout.h"
 #include "src/message/message.h"
+#include "src/stats/stats.h"
+#include "src/timer/timer.h"
 #include "src/user/user_internal.h"
 
-struct list_head users;
+// each event loop thread owns the users connected to it
+static __thread struct list_head users;
 
-int get_num_users(void) {
-    return count_num_users(&users);
+// connections that have not sent their name yet
+static __thread struct list_head pending_users;
+
+// both kinds of users by fd, events are handled without walking the lists
+static __thread struct user_table user_table;
+
+// NULL queues messages on the users' send queues
+static __thread msg_sender sender;
+
+static __thread msg_forwarder forwarder;
+
+static __thread user_closer closer;
+
+// set before the event loops start, 0 if MSG_ZEROCOPY is off
+static size_t zerocopy_threshold;
+
+// set before the event loops start
+static bool cork_flushes;
+
+static struct send_budget send_budget = {
+    .policy = SEND_POLICY_DISCONNECT,
+    .max_bytes = USER_SEND_QUEUE_MAX,
+    .max_frames = USER_SEND_QUEUE_MAX_FRAMES,
+};
+
+// set before the event loops start, batch_max_len is 0 if batching is off
+static uint32_t batch_window_ms;
+static size_t batch_max_len;
+
+// set before the event loops start
+static struct read_budget read_budget = {
+    .max_frames = USER_READ_BUDGET_FRAMES,
+    .max_bytes = USER_READ_BUDGET_BYTES,
+};
+
+// registered users that used up their read budget, oldest first
+static __thread struct list_head read_backlog;
+
+static __thread struct broadcast_batch batch;
+
+static __thread struct user_fanout fanout;
+
+// only queued messages are batched
+static struct broadcast_batch *get_batch(void) {
+    if (0 == batch_max_len || NULL != sender) {
+        return NULL;
+    }
+    return &batch;
 }
 
-void get_user_fds(int *user_fds) {
-    copy_user_fds(user_fds, &users);
+// only queued messages are sent by the fanout workers
+static struct user_fanout *get_fanout(void) {
+    if (0 == get_num_fanout_workers() || NULL != sender) {
+        return NULL;
+    }
+    return &fanout;
 }
 
-int handle_new_user(int connfd) {
-    struct user_info *user;
-    struct msg_new_user user_msg;
+static void send_broadcast(struct msg_broadcast *data) {
+    send_broadcast_msg_to_users(data,
+                                sender,
+                                &send_budget,
+                                get_batch(),
+                                get_fanout(),
+                                &users);
+
+    if (NULL != forwarder) {
+        forwarder(data);
+    }
+}
+
+static int send_user_left(struct user_info *user) {
     struct msg_broadcast broadcast_msg;
     int ret;
     int ret_final = EXIT_FAILURE;
 
-    ret = get_msg_new_user(connfd, &user_msg);
+    printf("INFO: removing user %s\n", user->name);
+    user->remove_user = true;
+    ret = create_broadcast_msg_user_left(user, &broadcast_msg);
     if (EXIT_FAILURE == ret) {
-        printf("ERRO: Failed to get message from new user\n");
-        goto error_out_get_msg_new_user;
+        printf("ERRO: failed to create broadcast message\n");
+        goto error_out_create_broadcast_msg;
     }
 
-    user = add_new_user(connfd, &user_msg, &users);
-    if (NULL == user) {
-        printf("ERRO: failed to add new user to list\n");
-        goto error_out_add_new_user;
+    send_broadcast(&broadcast_msg);
+
+    os_free(broadcast_msg.msg);
+
+    ret_final = EXIT_SUCCESS;
+error_out_create_broadcast_msg:
+    return ret_final;
+}
+
+static void send_user_msg(struct user_info *user,
+                          struct msg_registered_user *msg) {
+    struct msg_broadcast broadcast_msg;
+
+    broadcast_msg.name = user->name;
+    broadcast_msg.msg = msg->msg.str;
+    broadcast_msg.timestamp = os_timestamp();
+    broadcast_msg.prio = MSG_PRIO_CHAT;
+    broadcast_msg.stream = NULL;
+    if (true == msg->streamed) {
+        broadcast_msg.stream = &msg->stream;
+    }
+
+    send_broadcast(&broadcast_msg);
+}
+
+static void expire_pending_user(struct timer *timer) {
+    struct user_info *user = container_of(timer, struct user_info, idle_timer);
+
+    if (false == user->remove_user) {
+        printf("INFO: fd %d did not register in time\n", user->fd);
+        user->remove_user = true;
+    }
+}
+
+static void expire_idle_user(struct timer *timer) {
+    struct user_info *user = container_of(timer, struct user_info, idle_timer);
+
+    if (false == user->remove_user) {
+        printf("INFO: user %s has been idle for too long\n", user->name);
+        send_user_left(user);
+    }
+}
+
+static void expire_stalled_user(struct timer *timer) {
+    struct user_info *user = container_of(timer,
+                                          struct user_info,
+                                          stall_timer);
+
+    if (false == user->remove_user) {
+        printf("INFO: user %s stopped reading messages\n", user->name);
+        send_user_left(user);
+    }
+}
+
+static void send_user_caps(struct user_info *user) {
+    struct msg_frame *frame;
+    int ret;
+
+    frame = create_caps_frame(user->caps);
+    if (NULL == frame) {
+        printf("WARN: failed to create capability frame for fd %d\n",
+               user->fd);
+        user->remove_user = true;
+        return;
+    }
+
+    if (NULL == sender) {
+        ret = queue_user_msg(user, frame, &send_budget);
+    } else {
+        ret = sender(user->fd, frame);
     }
+    if (EXIT_FAILURE == ret) {
+        printf("WARN: failed to send capabilities to fd %d\n", user->fd);
+        user->remove_user = true;
+    }
+
+    put_msg_frame(frame);
+}
+
+static void join_user(struct user_info *user) {
+    struct msg_broadcast broadcast_msg;
+    int ret;
+
+    init_timer(&user->idle_timer, &expire_idle_user);
+    init_timer(&user->stall_timer, &expire_stalled_user);
+    mod_timer(&user->idle_timer, USER_IDLE_TIMEOUT_MS);
 
     ret = create_broadcast_msg_user_joined(user, &broadcast_msg);
     if (EXIT_FAILURE == ret) {
@@ -45,63 +197,525 @@ int handle_new_user(int connfd) {
         goto error_out_create_broadcast_msg;
     }
 
-    send_broadcast_msg_to_users(&broadcast_msg, &users);
+    send_broadcast(&broadcast_msg);
 
     os_free(broadcast_msg.msg);
 error_out_create_broadcast_msg:
     printf("INFO: registered new user %s\n", user->name);
+}
+
+static int receive_user_msgs(struct user_info *user) {
+    size_t num_frames = 0;
+    size_t num_bytes = 0;
+    int ret;
+    struct msg_registered_user user_msg;
+    int ret_final = EXIT_FAILURE;
+
+    // handle the frames that have arrived up to the read budget, keep a
+    // partial one for later
+    do {
+        ret = get_msg_registered_user(user->fd, &user->reader, &user_msg);
+        if (1 == ret) {
+            num_frames++;
+            if (true == user_msg.streamed) {
+                num_bytes += user_msg.stream.part.len;
+            } else {
+                num_bytes += user_msg.msg.len;
+            }
+            send_user_msg(user, &user_msg);
+        }
+    } while (1 == ret &&
+             false == user->remove_user &&
+             num_frames < read_budget.max_frames &&
+             num_bytes < read_budget.max_bytes);
+
+    if (num_frames > 0) {
+        mod_timer(&user->idle_timer, USER_IDLE_TIMEOUT_MS);
+    }
+
+    // the socket may not signal again, read the rest on a later iteration
+    if (1 == ret && false == user->remove_user) {
+        add_stat(STAT_READ_BUDGET_HIT, 1);
+        list_add_tail(&user->read_list, &read_backlog);
+    }
+
+    if (-1 == ret) {
+        printf("WARN: failed to get message from fd %d\n", user->fd);
+        ret = send_user_left(user);
+        if (EXIT_FAILURE == ret) {
+            goto error_out_send_user_left;
+        }
+    }
+
     ret_final = EXIT_SUCCESS;
-    return ret_final;   // don't free user or name
-error_out_add_new_user:
-    os_free(user_msg.name);
-error_out_get_msg_new_user:
+error_out_send_user_left:
     return ret_final;
 }
 
-int handle_registered_user(int fd) {
+static int handle_pending_user(struct user_info *user) {
+    struct msg_new_user user_msg;
     int ret;
-    struct msg_registered_user user_msg;
-    struct msg_broadcast broadcast_msg;
+    int ret_final = EXIT_FAILURE;
+
+    ret = get_msg_new_user(user->fd, &user->reader, &user_msg);
+    if (0 == ret) {
+        ret_final = EXIT_SUCCESS;
+        goto out_incomplete;
+    }
+
+    if (-1 == ret) {
+        printf("WARN: failed to get message from new user on fd %d\n",
+               user->fd);
+        user->remove_user = true;
+        ret_final = EXIT_SUCCESS;
+        goto out_failed;
+    }
+
+    // the name outlives the receive buffer
+    user->name = copy_msg_view(&user_msg.name);
+    if (NULL == user->name) {
+        printf("WARN: failed to copy name of new user on fd %d\n",
+               user->fd);
+        user->remove_user = true;
+        ret_final = EXIT_SUCCESS;
+        goto out_failed;
+    }
+
+    del_timer(&user->idle_timer);
+    user->caps = user_msg.flags & MSG_CAPS_SUPPORTED;
+    list_move(&user->list, &users);
+    if (0 != (user_msg.flags & MSG_FLAG_NEGOTIATE)) {
+        send_user_caps(user);
+    }
+    join_user(user);
+
+    // messages may have arrived right after the name
+    ret_final = receive_user_msgs(user);
+out_failed:
+out_incomplete:
+    return ret_final;
+}
+
+static int export_user_list(struct list_head *list,
+                            user_exporter exporter,
+                            void *arg) {
+    struct user_info *cur_user = NULL;
+    struct user_state state;
+    struct ring *ring;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    list_for_each_entry(cur_user, list, list) {
+        if (true == cur_user->remove_user) {
+            continue;
+        }
+
+        state.fd = cur_user->fd;
+        state.name = cur_user->name;
+        state.caps = cur_user->caps;
+        state.in_buf = NULL;
+        state.in_len = cur_user->reader.ring.len;
+        if (state.in_len > 0) {
+            ring = &cur_user->reader.ring;
+            state.in_buf = &ring->buf[ring->head];
+        }
+        state.out_buf = NULL;
+        state.out_len = cur_user->send_queue_len;
+        if (state.out_len > 0) {
+            state.out_buf = copy_user_sends(cur_user);
+            if (NULL == state.out_buf) {
+                goto error_out_copy_user_sends;
+            }
+        }
+        // the ID is carried without a stream so the next one follows it
+        state.streaming = cur_user->reader.streaming;
+        state.stream_id = cur_user->reader.stream.id;
+        state.stream_len = cur_user->reader.stream.len;
+        state.stream_left = cur_user->reader.stream_left;
+
+        ret = exporter(&state, arg);
+        os_free(state.out_buf);
+        if (EXIT_FAILURE == ret) {
+            printf("ERRO: failed to export fd %d\n", cur_user->fd);
+            goto error_out_exporter;
+        }
+    }
+
+    ret_final = EXIT_SUCCESS;
+error_out_exporter:
+error_out_copy_user_sends:
+    return ret_final;
+}
+
+int broadcast_user_msg(int fd, struct msg_registered_user *user_msg) {
+    struct user_info *user;
+    int ret_final = EXIT_FAILURE;
+
+    user = get_user_from_fd(fd, &user_table);
+    if (NULL == user || NULL == user->name) {
+        printf("ERRO: Cannot find user for fd %d\n", fd);
+        goto error_out_get_user_from_fd;
+    }
+
+    mod_timer(&user->idle_timer, USER_IDLE_TIMEOUT_MS);
+    send_user_msg(user, user_msg);
+
+    ret_final = EXIT_SUCCESS;
+error_out_get_user_from_fd:
+    return ret_final;
+}
+
+void continue_user_reads(void) {
+    struct user_info *user;
+    struct list_head tmp;
+    int ret;
+
+    // users that hit the budget again are queued behind the others
+    INIT_LIST_HEAD(&tmp);
+    list_splice_init(&read_backlog, &tmp);
+
+    while (false == list_empty(&tmp)) {
+        user = list_first_entry(&tmp, struct user_info, read_list);
+        list_del_init(&user->read_list);
+        if (true == user->remove_user) {
+            continue;
+        }
+
+        ret = receive_user_msgs(user);
+        if (EXIT_FAILURE == ret) {
+            printf("WARN: failed to continue reading from fd %d\n", user->fd);
+        }
+    }
+}
+
+void deliver_forwarded_msg(struct msg_broadcast *data) {
+    send_broadcast_msg_to_users(data,
+                                sender,
+                                &send_budget,
+                                get_batch(),
+                                get_fanout(),
+                                &users);
+}
+
+void drop_all_users(void) {
+    clear_broadcast_batch(&batch);
+    clear_user_fanout(&fanout);
+    flag_all_users(&pending_users);
+    flag_all_users(&users);
+}
+
+int drop_user(int fd) {
+    struct user_info *user;
+    int ret_final = EXIT_FAILURE;
+
+    user = get_user_from_fd(fd, &user_table);
+    if (NULL == user || NULL == user->name) {
+        printf("ERRO: Cannot find user for fd %d\n", fd);
+        goto error_out_get_user_from_fd;
+    }
+
+    if (true == user->remove_user) {
+        ret_final = EXIT_SUCCESS;
+        goto out_already_removed;
+    }
+
+    ret_final = send_user_left(user);
+out_already_removed:
+error_out_get_user_from_fd:
+    return ret_final;
+}
+
+int export_users(user_exporter exporter, void *arg) {
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    // batched broadcasts go out with the users' queued bytes
+    flush_broadcast_batch(&batch, &send_budget, &users);
+
+    ret = export_user_list(&pending_users, exporter, arg);
+    if (EXIT_FAILURE == ret) {
+        goto error_out_export_pending_users;
+    }
+
+    ret_final = export_user_list(&users, exporter, arg);
+error_out_export_pending_users:
+    return ret_final;
+}
+
+void flush_batched_msgs(void) {
+    if (batch.num_frames > 0 && os_monotonic_ms() >= batch.deadline) {
+        flush_broadcast_batch(&batch, &send_budget, &users);
+    }
+}
+
+int get_batch_timeout(void) {
+    uint64_t now;
+
+    if (0 == batch.num_frames) {
+        return -1;
+    }
+
+    now = os_monotonic_ms();
+    if (now >= batch.deadline) {
+        return 0;
+    }
+    return (int)(batch.deadline - now);
+}
+
+size_t get_num_queued_bytes(void) {
+    return count_queued_bytes(&users) + batch.len;
+}
+
+int get_num_users(void) {
+    return count_num_users(&users);
+}
+
+int handle_new_user(int connfd) {
+    struct user_info *user;
+    int ret_final = EXIT_FAILURE;
+
+    user = add_pending_user(connfd, &pending_users, &user_table);
+    if (NULL == user) {
+        printf("ERRO: failed to add pending user to list\n");
+        goto error_out_add_pending_user;
+    }
+
+    init_timer(&user->idle_timer, &expire_pending_user);
+    init_timer(&user->stall_timer, &expire_stalled_user);
+    mod_timer(&user->idle_timer, USER_REGISTER_TIMEOUT_MS);
+    user->cork = cork_flushes;
+
+    // the user is served with copies if zerocopy can't be enabled
+    if (zerocopy_threshold > 0) {
+        enable_user_zerocopy(user, zerocopy_threshold);
+    }
+
+    // the name may not have arrived yet, the user is listed either way
+    handle_pending_user(user);
+
+    ret_final = EXIT_SUCCESS;
+error_out_add_pending_user:
+    return ret_final;
+}
+
+int handle_registered_user(int fd) {
     struct user_info* user;
     int ret_final = EXIT_FAILURE;
 
-    user = get_user_from_fd(fd, &users);
+    user = get_user_from_fd(fd, &user_table);
+    if (NULL == user) {
+        printf("ERRO: Cannot find user for fd %d\n", fd);
+        goto error_out_get_user_from_fd;
+    }
+
+    // users that used up their read budget are read by continue_user_reads()
+    if (true == user->remove_user ||
+            false == list_empty(&user->read_list)) {
+        ret_final = EXIT_SUCCESS;
+        goto out_removed;
+    }
+
+    // users without a name are still registering
+    if (NULL == user->name) {
+        ret_final = handle_pending_user(user);
+    } else {
+        ret_final = receive_user_msgs(user);
+    }
+
+out_removed:
+error_out_get_user_from_fd:
+    return ret_final;
+}
+
+int handle_writable_user(int fd) {
+    struct user_info *user;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    user = get_user_from_fd(fd, &user_table);
     if (NULL == user) {
         printf("ERRO: Cannot find user for fd %d\n", fd);
         goto error_out_get_user_from_fd;
     }
 
-    ret = get_msg_registered_user(user->fd, &user_msg);
+    if (true == user->remove_user) {
+        ret_final = EXIT_SUCCESS;
+        goto out_removed;
+    }
+
+    ret = flush_user_sends(user);
     if (EXIT_FAILURE == ret) {
-        printf("WARN: failed to get message from fd %d\n", fd);
-        printf("INFO: removing user %s\n", user->name);
-        user->remove_user = true;
-        ret = create_broadcast_msg_user_left(user, &broadcast_msg);
+        printf("WARN: failed to send queued messages to fd %d\n", fd);
+        ret = send_user_left(user);
         if (EXIT_FAILURE == ret) {
-            printf("ERRO: failed to create broadcast message\n");
-            goto error_out_create_broadcast_msg;
+            goto error_out_send_user_left;
         }
-    } else {
-        broadcast_msg.name = user->name;
-        broadcast_msg.msg = user_msg.msg;
-        broadcast_msg.timestamp = os_timestamp();
     }
 
-    send_broadcast_msg_to_users(&broadcast_msg, &users);
+    ret_final = EXIT_SUCCESS;
+out_removed:
+error_out_send_user_left:
+error_out_get_user_from_fd:
+    return ret_final;
+}
 
-    // broadcast message and user message are the same
-    os_free(broadcast_msg.msg);
+int handle_zerocopy_completions(int fd) {
+    struct user_info *user;
+    uint32_t lo;
+    uint32_t hi;
+    bool copied;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    user = get_user_from_fd(fd, &user_table);
+    if (NULL == user) {
+        printf("ERRO: Cannot find user for fd %d\n", fd);
+        goto error_out_get_user_from_fd;
+    }
+
+    // edge triggered, read until the error queue is empty
+    do {
+        ret = recv_zerocopy_completion(fd, &lo, &hi, &copied);
+        if (1 == ret) {
+            complete_zerocopy_sends(user, lo, hi);
+            if (true == copied) {
+                add_stat(STAT_ZEROCOPY_COPIED, hi - lo + 1);
+            }
+        }
+    } while (1 == ret);
+    if (-1 == ret) {
+        printf("WARN: failed to read zerocopy completions of fd %d\n", fd);
+        goto error_out_recv_zerocopy_completion;
+    }
 
     ret_final = EXIT_SUCCESS;
-error_out_create_broadcast_msg:
+error_out_recv_zerocopy_completion:
 error_out_get_user_from_fd:
     return ret_final;
 }
 
+bool has_unread_users(void) {
+    return false == list_empty(&read_backlog);
+}
+
+int import_user(struct user_state *state) {
+    struct user_info *user;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    if (NULL == state->name) {
+        user = add_pending_user(state->fd, &pending_users, &user_table);
+    } else {
+        user = add_pending_user(state->fd, &users, &user_table);
+    }
+    if (NULL == user) {
+        printf("ERRO: failed to add imported user to list\n");
+        os_free(state->name);
+        goto error_out_add_pending_user;
+    }
+    user->name = state->name;
+    user->caps = state->caps;
+    user->cork = cork_flushes;
+
+    if (NULL == user->name) {
+        init_timer(&user->idle_timer, &expire_pending_user);
+        mod_timer(&user->idle_timer, USER_REGISTER_TIMEOUT_MS);
+    } else {
+        init_timer(&user->idle_timer, &expire_idle_user);
+        mod_timer(&user->idle_timer, USER_IDLE_TIMEOUT_MS);
+    }
+    init_timer(&user->stall_timer, &expire_stalled_user);
+
+    ret = restore_user_state(user, state);
+    if (EXIT_FAILURE == ret) {
+        user->remove_user = true;
+        goto error_out_restore_user_state;
+    }
+
+    if (user->send_queue_len > 0) {
+        mod_timer(&user->stall_timer, USER_STALL_TIMEOUT_MS);
+    }
+
+    // buffered parts of a stream are handed out without waiting for the
+    // socket
+    if (true == user->reader.streaming && user->reader.ring.len > 0) {
+        list_add_tail(&user->read_list, &read_backlog);
+    }
+
+    ret_final = EXIT_SUCCESS;
+error_out_restore_user_state:
+error_out_add_pending_user:
+    return ret_final;
+}
+
 void init_user(void) {
     init_user_list(&users);
+    init_user_list(&pending_users);
+    INIT_LIST_HEAD(&read_backlog);
+    batch.num_frames = 0;
+    batch.len = 0;
+    batch.max_len = batch_max_len;
+    batch.window_ms = batch_window_ms;
+}
+
+int register_new_user(int connfd, struct msg_new_user *user_msg) {
+    struct user_info *user;
+    int ret_final = EXIT_FAILURE;
+
+    user = add_new_user(connfd, user_msg, &users, &user_table);
+    if (NULL == user) {
+        printf("ERRO: failed to add new user to list\n");
+        goto error_out_add_new_user;
+    }
+
+    if (0 != (user_msg->flags & MSG_FLAG_NEGOTIATE)) {
+        send_user_caps(user);
+    }
+    join_user(user);
+
+    ret_final = EXIT_SUCCESS;
+error_out_add_new_user:
+    return ret_final;
 }
 
-void update_user_list(void) {
-    remove_flagged_users(&users);
+void set_batch_window(uint32_t window_ms, size_t max_len) {
+    batch_window_ms = window_ms;
+    batch_max_len = max_len;
+}
+
+void set_cork_flushes(bool cork) {
+    cork_flushes = cork;
+}
+
+void set_msg_forwarder(msg_forwarder new_forwarder) {
+    forwarder = new_forwarder;
+}
+
+void set_msg_sender(msg_sender new_sender) {
+    sender = new_sender;
+}
+
+void set_read_budget(struct read_budget *budget) {
+    read_budget = *budget;
+}
+
+void set_send_budget(struct send_budget *budget) {
+    send_budget = *budget;
+}
+
+void set_user_closer(user_closer new_closer) {
+    closer = new_closer;
+}
+
+void set_zerocopy_threshold(size_t threshold) {
+    zerocopy_threshold = threshold;
+}
+
+void update_user_list(int epollfd) {
+    remove_flagged_users(epollfd, &pending_users, &user_table, closer);
+    remove_flagged_users(epollfd, &users, &user_table, closer);
+
+    if (true == list_empty(&pending_users) && true == list_empty(&users)) {
+        clear_user_table(&user_table);
+    }
 }
@@ -3,26 +3,166 @@
 #ifndef SRC_USER_USER_H_
 #define SRC_USER_USER_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "src/message/message.h"
+
+#define USER_SEND_QUEUE_MAX (256 * 1024)
+#define USER_SEND_QUEUE_MAX_FRAMES 4096
+#define USER_BATCH_MAX_LEN (16 * 1024)
+#define USER_READ_BUDGET_FRAMES 32
+#define USER_READ_BUDGET_BYTES (64 * 1024)
+#define USER_REGISTER_TIMEOUT_MS (10 * 1000)
+#define USER_STALL_TIMEOUT_MS (30 * 1000)
+
+// what happens to a broadcast that doesn't fit a user's send budget
+#define SEND_POLICY_DISCONNECT 0    // drop the user
+#define SEND_POLICY_DROP_OLDEST 1   // drop unsent messages until it fits
+#define SEND_POLICY_DROP_NEWEST 2   // drop the broadcast
+#define SEND_POLICY_COLLAPSE 3      // replace unsent messages with a marker
+
+struct send_budget {
+    int policy;
+    size_t max_bytes;       // queued bytes per user
+    size_t max_frames;      // queued messages per user
+};
+
+struct read_budget {
+    size_t max_frames;      // messages handled per user per loop iteration
+    size_t max_bytes;       // message bytes handled per user per iteration
+};
+
+struct user_state {
+    int fd;
+    char *name;         // NULL while the user is registering
+    uint8_t *in_buf;    // received bytes of a partial frame
+    size_t in_len;
+    uint8_t *out_buf;   // queued bytes that were not sent yet
+    size_t out_len;
+    bool streaming;     // in_buf holds message bytes of a stream
+    uint32_t stream_id; // ID of the user's last stream
+    uint32_t stream_len;
+    uint32_t stream_left;   // message bytes not handed out yet
+    uint8_t caps;       // MSG_FLAG_* granted at registration
+};
+
+typedef void (*msg_forwarder)(struct msg_broadcast *data);
+
+typedef int (*user_exporter)(struct user_state *state, void *arg);
+
+typedef void (*user_closer)(int fd);
+
 /**
- * Get the number of users.
+ * Broadcast message from registered user.
  *
- * @return (int) - Number of users.
+ * The message is encoded into the broadcast frame before this returns, so
+ * it can be a view into the receive buffer. Restarts the user's idle timer.
+ *
+ * @param fd (int) - File descriptor of registered user.
+ * @param user_msg (struct msg_registered_user *) - Decoded message from user.
+ * @fail - Fail to find user for fd.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
  */
-int get_num_users(void);
+int broadcast_user_msg(int fd, struct msg_registered_user *user_msg);
 
 /**
- * Get file descriptor for each user.
+ * Continue reading from users that used up their read budget.
  *
- * @param user_fds (int *) - Buffer to copy user fds.
+ * Users are served in the order they hit the budget, each one gets a fresh
+ * budget. Users that hit it again are queued at the back.
  */
-void get_user_fds(int *user_fds);
+void continue_user_reads(void);
+
+/**
+ * Deliver broadcast message forwarded from another event loop.
+ *
+ * The message is only sent to the users of the calling thread and is not
+ * forwarded again.
+ *
+ * @param data (struct msg_broadcast *) - Broadcast message.
+ */
+void deliver_forwarded_msg(struct msg_broadcast *data);
+
+/**
+ * Drop every user of the calling thread.
+ *
+ * Flags registered and pending users for removal without telling anyone,
+ * they are closed by the next update_user_list().
+ */
+void drop_all_users(void);
+
+/**
+ * Drop registered user.
+ *
+ * Flags the user for removal and tells the other users that it left. Does
+ * nothing if the user is already flagged.
+ *
+ * @param fd (int) - File descriptor of registered user.
+ * @fail - Fail to find user for fd.
+ * @fail - Fail to create broadcast message.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int drop_user(int fd);
+
+/**
+ * Export the state of every user of the calling thread.
+ *
+ * Users flagged for removal are skipped. The state is only valid during
+ * the call to the exporter and the users are left untouched.
+ *
+ * @param exporter (user_exporter) - Function called for every user.
+ * @param arg (void *) - Passed to exporter.
+ * @malloc (uint8_t *) - Copy of the user's queued bytes.
+ * @free (uint8_t *) - Copy of the user's queued bytes.
+ * @fail - Fail to copy queued bytes.
+ * @fail - Exporter fails.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int export_users(user_exporter exporter, void *arg);
+
+/**
+ * Send the batched broadcasts of the calling thread once they are due.
+ *
+ * Meant to be called once per event loop iteration, does nothing unless
+ * the batch window of the first waiting broadcast has passed.
+ */
+void flush_batched_msgs(void);
+
+/**
+ * Get how long the event loop may sleep before batched broadcasts are due.
+ *
+ * @return (int) - Timeout in milliseconds, -1 if no broadcast waits.
+ */
+int get_batch_timeout(void);
+
+/**
+ * Get the number of bytes queued for the users of the calling thread.
+ *
+ * @return (size_t) - Number of bytes that wait to be sent.
+ */
+size_t get_num_queued_bytes(void);
+
+/**
+ * Get the number of users.
+ *
+ * @return (int) - Number of users.
+ */
+int get_num_users(void);
 
 /**
  * Handle new user.
  *
- * @param connfd (int) - File descriptor of new user.
- * @free (char *) - Buffer used to store broadcast message.
- * @fail - Fail to get message from fd.
+ * Adds the connection to the pending users without waiting for its name.
+ * The user is registered once a complete new user message has arrived,
+ * either right away or through later readiness events. Pending users are
+ * dropped if they don't register within USER_REGISTER_TIMEOUT_MS. A user
+ * that sets MSG_FLAG_NEGOTIATE gets its granted capabilities first.
+ *
+ * @param connfd (int) - Nonblocking file descriptor of new user.
+ * @malloc (struct user_info *) - Pending user.
+ * @fail - Fail to add pending user.
  * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
  */
 int handle_new_user(int connfd);
@@ -30,6 +170,11 @@ int handle_new_user(int connfd);
 /**
  * Handle registered user.
  *
+ * Broadcasts every complete message that has arrived from the user. A
+ * partial message is kept until more bytes arrive. Receiving a message
+ * restarts the user's idle timer. A pending user is registered once its
+ * name has arrived.
+ *
  * @param fd (int) - File descriptor of registered user.
  * @free (char *) - Buffer used to store message from user.
  * @fail - Fail to find user for fd.
@@ -38,14 +183,174 @@ int handle_new_user(int connfd);
  */
 int handle_registered_user(int fd);
 
+/**
+ * Handle writable user.
+ *
+ * Sends messages queued for the user. Drops the user if the fd failed.
+ *
+ * @param fd (int) - File descriptor of registered user.
+ * @fail - Fail to find user for fd.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int handle_writable_user(int fd);
+
+/**
+ * Handle zerocopy completions of user.
+ *
+ * Reads the completions from the fd's error queue and releases the
+ * messages the kernel no longer reads.
+ *
+ * @param fd (int) - File descriptor of user.
+ * @fail - Fail to find user for fd.
+ * @fail - Fail to read error queue.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int handle_zerocopy_completions(int fd);
+
+/**
+ * Check if users wait for continue_user_reads().
+ *
+ * @return (bool) - true if a user used up its read budget.
+ */
+bool has_unread_users(void);
+
+/**
+ * Import user exported by another server process.
+ *
+ * The user resumes where it left off without telling the other users. The
+ * name is owned by the user module afterwards, the buffers are copied.
+ *
+ * @param state (struct user_state *) - Exported state of user.
+ * @malloc (struct user_info *) - Imported user.
+ * @fail - Fail to add user, the name is freed.
+ * @fail - Fail to copy buffers, the user is flagged for removal.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int import_user(struct user_state *state);
+
 /**
  * Initialize user module.
+ *
+ * The user list is per thread, every event loop thread calls this once.
+ * The batch window must be set before.
  */
 void init_user(void);
 
+/**
+ * Register new user.
+ *
+ * Adds the user to the user list and tells the other users that it joined.
+ * A user that sets MSG_FLAG_NEGOTIATE gets its granted capabilities first.
+ * The user is removed once it has been idle for USER_IDLE_TIMEOUT_MS or its
+ * send queue has not drained for USER_STALL_TIMEOUT_MS.
+ *
+ * @param connfd (int) - File descriptor of new user.
+ * @param user_msg (struct msg_new_user *) - Decoded message from new user.
+ * @fail - Fail to add user to list.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int register_new_user(int connfd, struct msg_new_user *user_msg);
+
+/**
+ * Batch broadcasts for users that read batch frames.
+ *
+ * Broadcasts wait for up to window_ms, or until max_len bytes wait, and are
+ * then queued as one frame for every user that set MSG_FLAG_BATCH. Other
+ * users get every broadcast right away. Only applies while messages are
+ * queued on the users' send queues. Batching is off by default, set it
+ * before any event loop starts.
+ *
+ * @param window_ms (uint32_t) - Milliseconds the first broadcast may wait.
+ * @param max_len (size_t) - Bytes that may wait, at most UINT16_MAX.
+ */
+void set_batch_window(uint32_t window_ms, size_t max_len);
+
+/**
+ * Cork flushes of several sends.
+ *
+ * Every send of a flush but the last is passed MSG_MORE, so the kernel
+ * fills whole segments when the queue takes more than one send. Applies to
+ * users connected or imported afterwards. Off by default, set it before any
+ * event loop starts.
+ *
+ * @param cork (bool) - true to cork flushes.
+ */
+void set_cork_flushes(bool cork);
+
+/**
+ * Set the function used to pass broadcast messages to other event loops.
+ *
+ * The forwarder is called after every broadcast to the local users. There
+ * is no forwarder by default.
+ *
+ * @param new_forwarder (msg_forwarder) - Function to forward broadcasts.
+ */
+void set_msg_forwarder(msg_forwarder new_forwarder);
+
+/**
+ * Set the function used to send broadcast messages to users.
+ *
+ * By default messages are queued on the user's send queue, which is
+ * flushed whenever the user's fd is writable. NULL restores the default.
+ *
+ * @param new_sender (msg_sender) - Function to send broadcast messages.
+ */
+void set_msg_sender(msg_sender new_sender);
+
+/**
+ * Set the read budget of every user.
+ *
+ * A registered user is read from until max_frames messages or max_bytes
+ * message bytes were handled in one loop iteration, the rest is read by
+ * continue_user_reads(). The default is USER_READ_BUDGET_FRAMES messages
+ * and USER_READ_BUDGET_BYTES bytes. Set it before any event loop starts.
+ *
+ * @param budget (struct read_budget *) - Limits, copied.
+ */
+void set_read_budget(struct read_budget *budget);
+
+/**
+ * Set the send budget of every user.
+ *
+ * Users whose send queue would exceed max_bytes or max_frames are handled
+ * by the policy. The default is SEND_POLICY_DISCONNECT with
+ * USER_SEND_QUEUE_MAX bytes and USER_SEND_QUEUE_MAX_FRAMES messages. Set it
+ * before any event loop starts.
+ *
+ * @param budget (struct send_budget *) - Policy and limits, copied.
+ */
+void set_send_budget(struct send_budget *budget);
+
+/**
+ * Set the function called before the fd of a removed user is closed.
+ *
+ * Lets an event loop that holds requests on the fd cancel them, the user
+ * module still closes the fd. There is no closer by default.
+ *
+ * @param new_closer (user_closer) - Function called with the user's fd.
+ */
+void set_user_closer(user_closer new_closer);
+
+/**
+ * Set the smallest send that uses MSG_ZEROCOPY.
+ *
+ * Applies to users connected afterwards through handle_new_user(), imported
+ * users always copy. Zerocopy is off by default, set it before any event
+ * loop starts.
+ *
+ * @param threshold (size_t) - Smallest number of bytes sent without a copy,
+ *                             0 to always copy.
+ */
+void set_zerocopy_threshold(size_t threshold);
+
 /**
  * Update the user list.
+ *
+ * Removes flagged registered and pending users.
+ *
+ * @param epollfd (int) - epoll instance that flagged users are removed from,
+ *                        -1 if user fds are not registered with epoll.
  */
-void update_user_list(void);
+void update_user_list(int epollfd);
 
 #endif  // SRC_USER_USER_H_
@@ -2,14 +2,21 @@
 
 #include "src/user/user_internal.h"
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 
 #include "include/list.h"
+#include "lib/fileio/fileio.h"
 #include "lib/osdep/osdep.h"
+#include "lib/ring/ring.h"
+#include "src/fanout/fanout.h"
 #include "src/message/message.h"
+#include "src/stats/stats.h"
+#include "src/timer/timer.h"
 
 char broadcast_banner[10] = {
     0x42, 0x52, 0x4f, 0x41, 0x44, 0x43, 0x41, 0x53,
@@ -28,11 +35,402 @@ char user_left_msg[22] = {
     0x61, 0x6e, 0x6e, 0x65, 0x6c, 0x00
 };
 
-struct user_info *add_new_user(int fd,
-                          struct msg_new_user *msg,
-                          struct list_head *users) {
+// number of completed ids in lo..hi that sent bytes of the message
+static unsigned int count_completed_sends(struct user_send *send,
+                                          uint32_t lo,
+                                          uint32_t hi) {
+    // ids wrap around, only their distance to the first send matters
+    int32_t from = (int32_t)(lo - send->zc_first);
+    int32_t to = (int32_t)(hi - send->zc_first);
+    int32_t last = (int32_t)(send->zc_last - send->zc_first);
+
+    if (0 == send->zc_pending) {
+        return 0;
+    }
+    if (from < 0) {
+        from = 0;
+    }
+    if (to > last) {
+        to = last;
+    }
+    if (to < from) {
+        return 0;
+    }
+
+    return (unsigned int)(to - from) + 1;
+}
+
+static bool fits_send_budget(struct user_info *user,
+                             size_t len,
+                             const struct send_budget *budget) {
+    return user->send_queue_len + len <= budget->max_bytes
+           && user->send_queue_frames < budget->max_frames;
+}
+
+static int add_user_send(struct user_info *user,
+                         struct msg_frame *frame,
+                         size_t missed) {
+    struct user_send *send;
+    struct user_send *cur_send = NULL;
+    struct list_head *pos;
+    int ret_final = EXIT_FAILURE;
+
+    send = os_malloc(sizeof(struct user_send));
+    if (NULL == send) {
+        printf("ERRO: failed to allocate memory for queued message\n");
+        goto error_out_malloc;
+    }
+
+    send->frame = get_msg_frame(frame);
+    send->off = 0;
+    send->missed = missed;
+    send->zc_pending = 0;
+
+    // system messages pass the unsent chat until the oldest chat message
+    // was passed USER_PRIO_MAX_JUMPS times
+    pos = &user->send_queue;
+    if (MSG_PRIO_SYSTEM == frame->prio
+        && user->prio_jumps < USER_PRIO_MAX_JUMPS) {
+        list_for_each_entry(cur_send, &user->send_queue, list) {
+            if (MSG_PRIO_CHAT == cur_send->frame->prio && 0 == cur_send->off) {
+                pos = &cur_send->list;
+                user->prio_jumps++;
+                break;
+            }
+        }
+    }
+
+    list_add_tail(&send->list, pos);
+    user->send_queue_len += frame->len;
+    user->send_queue_frames++;
+
+    ret_final = EXIT_SUCCESS;
+error_out_malloc:
+    return ret_final;
+}
+
+// returns the number of broadcasts the dropped message stood for
+static size_t drop_user_send(struct user_info *user, struct user_send *send) {
+    size_t missed = (send->missed > 0) ? send->missed : 1;
+
+    list_del(&send->list);
+    user->send_queue_len -= send->frame->len;
+    user->send_queue_frames--;
+    if (MSG_PRIO_CHAT == send->frame->prio) {
+        user->prio_jumps = 0;
+    }
+    put_msg_frame(send->frame);
+    os_free(send);
+
+    return missed;
+}
+
+static size_t drop_oldest_user_sends(struct user_info *user,
+                                     int prio,
+                                     size_t len,
+                                     const struct send_budget *budget) {
+    struct user_send *send = NULL;
+    struct user_send *n = NULL;
+    size_t dropped = 0;
+
+    list_for_each_entry_safe(send, n, &user->send_queue, list) {
+        if (true == fits_send_budget(user, len, budget)) {
+            break;
+        }
+        if (send->off > 0 || prio != send->frame->prio) {
+            continue;   // partly sent or other lane
+        }
+        dropped += drop_user_send(user, send);
+    }
+
+    return dropped;
+}
+
+static size_t drop_newest_user_sends(struct user_info *user,
+                                     int prio,
+                                     size_t len,
+                                     const struct send_budget *budget) {
+    struct user_send *send = NULL;
+    struct user_send *n = NULL;
+    size_t dropped = 0;
+
+    list_for_each_entry_safe_reverse(send, n, &user->send_queue, list) {
+        if (true == fits_send_budget(user, len, budget)) {
+            break;
+        }
+        if (send->off > 0 || prio != send->frame->prio) {
+            continue;   // partly sent or other lane
+        }
+        dropped += drop_user_send(user, send);
+    }
+
+    return dropped;
+}
+
+static bool has_unsent_chat(struct user_info *user) {
+    struct user_send *send = NULL;
+
+    list_for_each_entry(send, &user->send_queue, list) {
+        if (0 == send->off && MSG_PRIO_CHAT == send->frame->prio) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// replaces every unsent chat message with one marker that counts them,
+// including the new message if it is chat
+static struct msg_frame *collapse_user_sends(struct user_info *user,
+                                             struct msg_frame *frame,
+                                             size_t *missed) {
+    struct user_send *send = NULL;
+    struct user_send *n = NULL;
+    struct msg_broadcast msg;
+    char text[48];
+    size_t collapsed = (MSG_PRIO_CHAT == frame->prio) ? 1 : 0;
+
+    *missed = collapsed;
+    list_for_each_entry_safe(send, n, &user->send_queue, list) {
+        if (send->off > 0 || MSG_PRIO_CHAT != send->frame->prio) {
+            continue;   // partly sent or system message
+        }
+        if (0 == send->missed) {
+            collapsed++;
+        }
+        *missed += drop_user_send(user, send);
+    }
+    add_stat(STAT_SLOW_COLLAPSED, collapsed);
+
+    snprintf(text, sizeof(text), "you missed %zu messages", *missed);
+    msg.timestamp = os_timestamp();
+    msg.name = broadcast_banner;
+    msg.msg = text;
+    msg.prio = MSG_PRIO_CHAT;     // stands in for the chat it replaces
+    msg.stream = NULL;
+
+    return create_broadcast_frame(&msg);
+}
+
+static void add_batch_frame(struct broadcast_batch *batch,
+                            struct msg_frame *frame,
+                            const struct send_budget *budget,
+                            struct list_head *users) {
+    if (BATCH_MAX_FRAMES == batch->num_frames
+        || batch->len + frame->len > batch->max_len) {
+        flush_broadcast_batch(batch, budget, users);
+    }
+
+    if (0 == batch->num_frames) {
+        batch->deadline = os_monotonic_ms() + batch->window_ms;
+    }
+    batch->frames[batch->num_frames++] = get_msg_frame(frame);
+    batch->len += frame->len;
+
+    if (batch->len >= batch->max_len) {
+        flush_broadcast_batch(batch, budget, users);
+    }
+}
+
+static void update_stall_timer(struct user_info *user, bool sent) {
+    if (list_empty(&user->send_queue)) {
+        del_timer(&user->stall_timer);
+    } else if (true == sent || false == timer_pending(&user->stall_timer)) {
+        mod_timer(&user->stall_timer, USER_STALL_TIMEOUT_MS);
+    }
+}
+
+static int get_frame_encoding(struct user_info *user,
+                              struct msg_broadcast *msg) {
+    // only stream parts depend on the capabilities so far
+    if (NULL != msg->stream && 0 != (user->caps & MSG_FLAG_V2)) {
+        return USER_FRAME_V2;
+    }
+    return USER_FRAME_PLAIN;
+}
+
+static int get_num_encodings(struct msg_broadcast *msg) {
+    if (NULL == msg->stream) {
+        return 1;
+    }
+    return USER_FRAME_ENCODINGS;
+}
+
+static struct msg_frame *create_encoded_frame(struct msg_broadcast *msg,
+                                              int encoding) {
+    struct msg_broadcast notice;
+    char text[64];
+
+    if (NULL == msg->stream || USER_FRAME_V2 == encoding) {
+        return create_broadcast_frame(msg);
+    }
+
+    // users that can't read the parts hear about the stream once
+    if (0 != msg->stream->off) {
+        return NULL;
+    }
+    snprintf(text,
+             sizeof(text),
+             "sent a message of %u bytes, it needs a v2 client",
+             msg->stream->len);
+    notice = *msg;
+    notice.msg = text;
+    notice.stream = NULL;
+    return create_broadcast_frame(&notice);
+}
+
+static struct msg_frame *get_encoded_frame(struct broadcast_frames *frames,
+                                           int encoding) {
+    if (false == frames->encoded[encoding]) {
+        frames->frames[encoding] = create_encoded_frame(frames->msg, encoding);
+        frames->encoded[encoding] = true;
+    }
+    return frames->frames[encoding];
+}
+
+static int collect_fanout_users(struct user_fanout *fanout,
+                                struct msg_broadcast *msg,
+                                int encoding,
+                                struct broadcast_batch *batch,
+                                struct list_head *users) {
+    struct user_info *cur_user = NULL;
+    void **grown;
+    int cap;
+    int ret_final = EXIT_FAILURE;
+
+    fanout->num_users = 0;
+    list_for_each_entry(cur_user, users, list) {
+        if (NULL != batch && 0 != (cur_user->caps & MSG_FLAG_BATCH)) {
+            continue;
+        }
+        if (true == cur_user->remove_user) {
+            continue;
+        }
+        if (encoding != get_frame_encoding(cur_user, msg)) {
+            continue;
+        }
+
+        if (fanout->num_users == fanout->cap) {
+            cap = 0 == fanout->cap ? FANOUT_CHUNK_LEN : 2 * fanout->cap;
+            grown = os_realloc(fanout->users, cap * sizeof(void *));
+            if (NULL == grown) {
+                printf("ERRO: failed to grow fanout recipient table\n");
+                goto error_out_realloc;
+            }
+            fanout->users = grown;
+            fanout->cap = cap;
+        }
+        fanout->users[fanout->num_users++] = cur_user;
+    }
+
+    ret_final = EXIT_SUCCESS;
+error_out_realloc:
+    return ret_final;
+}
+
+// runs on a fanout worker, which must not touch the user's timers
+static void fanout_user_msg(void *item, void *arg) {
+    struct user_info *user = (struct user_info *)item;
+    struct user_fanout *fanout = (struct user_fanout *)arg;
+    int ret;
+
+    user->defer_stall_timer = true;
+    ret = queue_user_msg(user, fanout->frame, fanout->budget);
+    user->defer_stall_timer = false;
+    if (EXIT_FAILURE == ret) {
+        printf("WARN: failed to send message to fd %d\n", user->fd);
+        user->remove_user = true;
+    }
+}
+
+static void fanout_frame(struct user_fanout *fanout,
+                         struct msg_frame *frame,
+                         const struct send_budget *budget) {
     struct user_info *user;
 
+    fanout->frame = frame;
+    fanout->budget = budget;
+    run_fanout(fanout->users, fanout->num_users, &fanout_user_msg, fanout);
+
+    for (int i = 0; i < fanout->num_users; i++) {
+        user = (struct user_info *)fanout->users[i];
+        if (true == user->stall_update) {
+            update_stall_timer(user, user->stall_sent);
+            user->stall_update = false;
+            user->stall_sent = false;
+        }
+    }
+}
+
+static bool has_zerocopy_in_flight(struct user_info *user) {
+    struct user_send *send;
+
+    if (false == list_empty(&user->zc_queue)) {
+        return true;
+    }
+    if (list_empty(&user->send_queue)) {
+        return false;
+    }
+
+    // only the first queued message can be partially sent
+    send = list_first_entry(&user->send_queue, struct user_send, list);
+    return send->zc_pending > 0;
+}
+
+struct user_info *add_new_user(int fd,
+                               struct msg_new_user *msg,
+                               struct list_head *users,
+                               struct user_table *table) {
+    struct user_info *user = NULL;
+    char *name;
+
+    // the name outlives the receive buffer
+    name = copy_msg_view(&msg->name);
+    if (NULL == name) {
+        goto error_out_copy_msg_view;
+    }
+
+    user = add_pending_user(fd, users, table);
+    if (NULL == user) {
+        goto error_out_add_pending_user;
+    }
+
+    user->name = name;
+    user->caps = msg->flags & MSG_CAPS_SUPPORTED;
+
+    return user;
+error_out_add_pending_user:
+    os_free(name);
+error_out_copy_msg_view:
+    return user;
+}
+
+struct user_info *add_pending_user(int fd,
+                                   struct list_head *users,
+                                   struct user_table *table) {
+    struct user_info **slots;
+    struct user_info *user = NULL;
+    int num_fds;
+
+    if (fd >= table->num_fds) {
+        num_fds = table->num_fds > 0 ? table->num_fds : USER_TABLE_MIN_FDS;
+        while (num_fds <= fd) {
+            num_fds *= 2;
+        }
+
+        slots = os_realloc(table->users, num_fds * sizeof(struct user_info *));
+        if (NULL == slots) {
+            printf("ERRO: failed to grow user table\n");
+            goto error_out_realloc;
+        }
+
+        os_memset(&slots[table->num_fds],
+                  0,
+                  (num_fds - table->num_fds) * sizeof(struct user_info *));
+        table->users = slots;
+        table->num_fds = num_fds;
+    }
+
     user = os_malloc(sizeof(struct user_info));
     if (NULL == user) {
         printf("ERRO: failed to allocate memory for new user\n");
@@ -41,28 +439,92 @@ struct user_info *add_new_user(int fd,
 
     user->fd = fd;
     user->remove_user = false;
-    user->name = msg->name;
+    user->caps = 0;
+    user->cork = false;
+    user->defer_stall_timer = false;
+    user->stall_update = false;
+    user->stall_sent = false;
+    user->name = NULL;
+    init_msg_reader(&user->reader);
+    INIT_LIST_HEAD(&user->send_queue);
+    user->send_queue_len = 0;
+    user->send_queue_frames = 0;
+    user->zc_threshold = 0;
+    user->zc_next_id = 0;
+    INIT_LIST_HEAD(&user->zc_queue);
+    user->zc_queue_len = 0;
+    user->prio_jumps = 0;
+    INIT_LIST_HEAD(&user->read_list);
     list_add(&user->list, users);
+    table->users[fd] = user;
 
 error_out_os_malloc_user:
+error_out_realloc:
     return user;
 }
 
-void copy_user_fds(int *user_fds, struct list_head *users) {
-    struct user_info *cur_user = NULL;
-    struct user_info *n = NULL;
-    struct list_head tmp;
-    int i = 0;
+void clear_broadcast_batch(struct broadcast_batch *batch) {
+    int i;
 
-    INIT_LIST_HEAD(&tmp);
-    list_splice_init(users, &tmp);
+    for (i = 0; i < batch->num_frames; i++) {
+        put_msg_frame(batch->frames[i]);
+    }
+    batch->num_frames = 0;
+    batch->len = 0;
+}
 
-    list_for_each_entry_safe(cur_user, n, &tmp, list) {
-        user_fds[i] = cur_user->fd;
-        i++;
+void clear_user_fanout(struct user_fanout *fanout) {
+    os_free(fanout->users);
+    fanout->users = NULL;
+    fanout->num_users = 0;
+    fanout->cap = 0;
+}
+
+void clear_user_table(struct user_table *table) {
+    os_free(table->users);
+    table->users = NULL;
+    table->num_fds = 0;
+}
+
+void complete_zerocopy_sends(struct user_info *user, uint32_t lo, uint32_t hi) {
+    struct user_send *send = NULL;
+    struct user_send *n = NULL;
+
+    list_for_each_entry(send, &user->send_queue, list) {
+        send->zc_pending -= count_completed_sends(send, lo, hi);
     }
 
-    list_splice(&tmp, users);
+    list_for_each_entry_safe(send, n, &user->zc_queue, list) {
+        send->zc_pending -= count_completed_sends(send, lo, hi);
+        if (0 == send->zc_pending) {
+            list_del(&send->list);
+            user->zc_queue_len -= send->frame->len;
+            put_msg_frame(send->frame);
+            os_free(send);
+        }
+    }
+}
+
+uint8_t *copy_user_sends(struct user_info *user) {
+    struct user_send *cur_send = NULL;
+    uint8_t *buf;
+    size_t off = 0;
+
+    buf = os_malloc(user->send_queue_len);
+    if (NULL == buf) {
+        printf("ERRO: failed to allocate memory for queued bytes\n");
+        goto error_out_malloc;
+    }
+
+    list_for_each_entry(cur_send, &user->send_queue, list) {
+        os_memcpy(&buf[off],
+                  &cur_send->frame->buf[cur_send->off],
+                  cur_send->frame->len - cur_send->off);
+        off += cur_send->frame->len - cur_send->off;
+    }
+
+error_out_malloc:
+    return buf;
 }
 
 int count_num_users(struct list_head *users) {
@@ -83,6 +545,17 @@ int count_num_users(struct list_head *users) {
     return count;
 }
 
+size_t count_queued_bytes(struct list_head *users) {
+    struct user_info *cur_user = NULL;
+    size_t count = 0;
+
+    list_for_each_entry(cur_user, users, list) {
+        count += cur_user->send_queue_len + cur_user->zc_queue_len;
+    }
+
+    return count;
+}
+
 int create_broadcast_msg_user_joined(struct user_info *user,
                                      struct msg_broadcast *msg) {
     int ret_final = EXIT_FAILURE;
@@ -101,6 +574,8 @@ int create_broadcast_msg_user_joined(struct user_info *user,
 
     msg->name = broadcast_banner;
     msg->timestamp = os_timestamp();
+    msg->prio = MSG_PRIO_SYSTEM;
+    msg->stream = NULL;
 
     ret_final = EXIT_SUCCESS;
 error_out_os_malloc_msg:
@@ -125,40 +600,315 @@ int create_broadcast_msg_user_left(struct user_info *user,
 
     msg->name = broadcast_banner;
     msg->timestamp = os_timestamp();
+    msg->prio = MSG_PRIO_SYSTEM;
+    msg->stream = NULL;
 
     ret_final = EXIT_SUCCESS;
 error_out_os_malloc:
     return ret_final;
 }
 
-struct user_info *get_user_from_fd(int fd, struct list_head *users) {
+int enable_user_zerocopy(struct user_info *user, size_t threshold) {
+    int enable = 1;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    ret = os_setsockopt(user->fd,
+                        SOL_SOCKET,
+                        SO_ZEROCOPY,
+                        &enable,
+                        sizeof(enable));
+    if (-1 == ret) {
+        printf("WARN: failed to enable zerocopy on fd %d\n", user->fd);
+        goto error_out_setsockopt;
+    }
+
+    user->zc_threshold = threshold;
+
+    ret_final = EXIT_SUCCESS;
+error_out_setsockopt:
+    return ret_final;
+}
+
+void flag_all_users(struct list_head *users) {
     struct user_info *cur_user = NULL;
-    struct user_info *n = NULL;
-    struct list_head tmp;
-    struct user_info *matched_user = NULL;
 
-    INIT_LIST_HEAD(&tmp);
-    list_splice_init(users, &tmp);
+    list_for_each_entry(cur_user, users, list) {
+        cur_user->remove_user = true;
+    }
+}
 
-    list_for_each_entry_safe(cur_user, n, &tmp, list) {
-        if (cur_user->fd == fd) {
-            matched_user = cur_user;
-            break;
+void flush_broadcast_batch(struct broadcast_batch *batch,
+                           const struct send_budget *budget,
+                           struct list_head *users) {
+    struct user_info *cur_user = NULL;
+    struct msg_frame *frame;
+    int ret;
+
+    if (0 == batch->num_frames) {
+        return;
+    }
+
+    // readers of batches read plain broadcasts too, skip the copy
+    if (1 == batch->num_frames) {
+        frame = get_msg_frame(batch->frames[0]);
+    } else {
+        frame = create_batch_frame(batch->frames, batch->num_frames);
+        if (NULL == frame) {
+            printf("ERRO: failed to create batch frame\n");
+            goto error_out_create_batch_frame;
         }
+        add_stat(STAT_BATCHES, 1);
     }
 
-    list_splice(&tmp, users);
+    list_for_each_entry(cur_user, users, list) {
+        if (true == cur_user->remove_user
+            || 0 == (cur_user->caps & MSG_FLAG_BATCH)) {
+            continue;
+        }
 
-    return matched_user;
+        ret = queue_user_msg(cur_user, frame, budget);
+        if (EXIT_FAILURE == ret) {
+            printf("WARN: failed to send message to fd %d\n", cur_user->fd);
+            cur_user->remove_user = true;
+        }
+    }
+
+    put_msg_frame(frame);
+error_out_create_batch_frame:
+    clear_broadcast_batch(batch);
+}
+
+int flush_user_sends(struct user_info *user) {
+    struct iovec iov[USER_SEND_IOV_MAX];
+    struct user_send *send = NULL;
+    struct user_send *n = NULL;
+    size_t batch_len;
+    size_t left;
+    bool sent = false;
+    uint32_t zc_id = 0;
+    int iovcnt;
+    int more;
+    int flags;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    while (false == list_empty(&user->send_queue)) {
+        iovcnt = 0;
+        batch_len = 0;
+        list_for_each_entry(send, &user->send_queue, list) {
+            if (USER_SEND_IOV_MAX == iovcnt) {
+                break;
+            }
+            iov[iovcnt].iov_base = &send->frame->buf[send->off];
+            iov[iovcnt].iov_len = send->frame->len - send->off;
+            batch_len += iov[iovcnt].iov_len;
+            iovcnt++;
+        }
+
+        flags = 0;
+        if (user->zc_threshold > 0 && batch_len >= user->zc_threshold) {
+            flags = MSG_ZEROCOPY;
+        }
+
+        // the next send follows right away, don't push a partial segment
+        more = 0;
+        if (true == user->cork && (size_t)iovcnt < user->send_queue_frames) {
+            more = MSG_MORE;
+        }
+
+        ret = sendv_available(user->fd, iov, iovcnt, flags | more);
+        if (-1 == ret && 0 != flags && ENOBUFS == os_get_error()) {
+            // too many pages pinned by earlier sends, copy this batch
+            flags = 0;
+            ret = sendv_available(user->fd, iov, iovcnt, flags | more);
+        }
+        if (-1 == ret) {
+            printf("ERRO: failed to send queued message to fd %d\n", user->fd);
+            goto error_out_sendv_available;
+        }
+        if (0 == ret) {
+            break;  // socket buffer is full
+        }
+
+        sent = true;
+        user->send_queue_len -= ret;
+        if (0 != flags) {
+            zc_id = user->zc_next_id++;
+            add_stat(STAT_ZEROCOPY_SENDS, 1);
+        }
+
+        left = ret;
+        list_for_each_entry_safe(send, n, &user->send_queue, list) {
+            if (0 != flags) {
+                if (0 == send->zc_pending) {
+                    send->zc_first = zc_id;
+                }
+                send->zc_last = zc_id;
+                send->zc_pending++;
+            }
+
+            if (left < send->frame->len - send->off) {
+                send->off += left;
+                break;
+            }
+
+            left -= send->frame->len - send->off;
+            list_del(&send->list);
+            user->send_queue_frames--;
+            if (MSG_PRIO_CHAT == send->frame->prio) {
+                user->prio_jumps = 0;
+            }
+            if (send->zc_pending > 0) {
+                // the kernel reads the frame until the send completes
+                list_add_tail(&send->list, &user->zc_queue);
+                user->zc_queue_len += send->frame->len;
+            } else {
+                put_msg_frame(send->frame);
+                os_free(send);
+            }
+            if (0 == left) {
+                break;
+            }
+        }
+
+        if ((size_t)ret < batch_len) {
+            break;  // socket buffer is full
+        }
+    }
+
+    if (true == user->defer_stall_timer) {
+        user->stall_update = true;
+        user->stall_sent = user->stall_sent || sent;
+    } else {
+        update_stall_timer(user, sent);
+    }
+
+    ret_final = EXIT_SUCCESS;
+error_out_sendv_available:
+    return ret_final;
+}
+
+struct user_info *get_user_from_fd(int fd, struct user_table *table) {
+    if (fd < 0 || fd >= table->num_fds) {
+        return NULL;
+    }
+
+    return table->users[fd];
 }
 
 void init_user_list(struct list_head *users) {
     INIT_LIST_HEAD(users);
 }
 
-void remove_flagged_users(struct list_head *users) {
+int queue_user_msg(struct user_info *user,
+                   struct msg_frame *frame,
+                   const struct send_budget *budget) {
+    struct msg_frame *marker = NULL;
+    size_t missed = 0;
+    size_t dropped;
+    bool was_empty = list_empty(&user->send_queue);
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    if (false == fits_send_budget(user, frame->len, budget)) {
+        switch (budget->policy) {
+        case SEND_POLICY_DROP_OLDEST:
+            // chat goes first, system messages only make room for their own
+            dropped = drop_oldest_user_sends(user,
+                                             MSG_PRIO_CHAT,
+                                             frame->len,
+                                             budget);
+            if (MSG_PRIO_SYSTEM == frame->prio) {
+                dropped += drop_oldest_user_sends(user,
+                                                  MSG_PRIO_SYSTEM,
+                                                  frame->len,
+                                                  budget);
+            }
+            if (false == fits_send_budget(user, frame->len, budget)) {
+                // only the partly sent message or system messages are left
+                add_stat(STAT_SLOW_DROPPED_OLDEST, dropped + 1);
+                ret_final = EXIT_SUCCESS;
+                goto out_dropped;
+            }
+            add_stat(STAT_SLOW_DROPPED_OLDEST, dropped);
+            break;
+        case SEND_POLICY_DROP_NEWEST:
+            // system messages make room by dropping the newest chat
+            dropped = 0;
+            if (MSG_PRIO_SYSTEM == frame->prio) {
+                dropped = drop_newest_user_sends(user,
+                                                 MSG_PRIO_CHAT,
+                                                 frame->len,
+                                                 budget);
+            }
+            if (false == fits_send_budget(user, frame->len, budget)) {
+                add_stat(STAT_SLOW_DROPPED_NEWEST, dropped + 1);
+                ret_final = EXIT_SUCCESS;
+                goto out_dropped;
+            }
+            add_stat(STAT_SLOW_DROPPED_NEWEST, dropped);
+            break;
+        case SEND_POLICY_COLLAPSE:
+            // a system message has nothing to collapse without chat
+            if (MSG_PRIO_SYSTEM == frame->prio
+                && false == has_unsent_chat(user)) {
+                add_stat(STAT_SLOW_DROPPED_NEWEST, 1);
+                ret_final = EXIT_SUCCESS;
+                goto out_dropped;
+            }
+            marker = collapse_user_sends(user, frame, &missed);
+            if (NULL == marker) {
+                printf("ERRO: failed to create marker for fd %d\n", user->fd);
+                goto error_out_collapse_user_sends;
+            }
+            break;
+        default:
+            printf("WARN: send queue of fd %d is full\n", user->fd);
+            add_stat(STAT_SLOW_DISCONNECTS, 1);
+            goto error_out_queue_full;
+        }
+    }
+
+    if (NULL == marker) {
+        ret = add_user_send(user, frame, 0);
+    } else {
+        // the marker stands in for a chat message, not a system one
+        ret = add_user_send(user, marker, missed);
+        put_msg_frame(marker);
+        if (EXIT_SUCCESS == ret && MSG_PRIO_SYSTEM == frame->prio) {
+            ret = add_user_send(user, frame, 0);
+        }
+    }
+    if (EXIT_FAILURE == ret) {
+        goto error_out_add_user_send;
+    }
+
+    // otherwise the queue is flushed once the fd becomes writable
+    if (true == was_empty) {
+        ret_final = flush_user_sends(user);
+        goto out_flushed;
+    }
+
+    ret_final = EXIT_SUCCESS;
+out_flushed:
+out_dropped:
+    return ret_final;
+error_out_add_user_send:
+error_out_collapse_user_sends:
+error_out_queue_full:
+    return ret_final;
+}
+
+void remove_flagged_users(int epollfd,
+                          struct list_head *users,
+                          struct user_table *table,
+                          user_closer closer) {
     struct user_info *cur_user = NULL;
     struct user_info *n = NULL;
+    struct user_send *send = NULL;
+    struct user_send *next_send = NULL;
+    struct linger reset = {.l_onoff = 1, .l_linger = 0};
     struct list_head tmp;
 
     INIT_LIST_HEAD(&tmp);
@@ -166,8 +916,44 @@ void remove_flagged_users(struct list_head *users) {
 
     list_for_each_entry_safe(cur_user, n, &tmp, list) {
         if (true == cur_user->remove_user) {
+            table->users[cur_user->fd] = NULL;
+            if (-1 != epollfd) {
+                os_epoll_ctl(epollfd, EPOLL_CTL_DEL, cur_user->fd, NULL);
+            }
+            if (true == has_zerocopy_in_flight(cur_user)) {
+                // reset the connection so the kernel drops the bytes it
+                // still has to send instead of reading freed frames
+                os_setsockopt(cur_user->fd,
+                              SOL_SOCKET,
+                              SO_LINGER,
+                              &reset,
+                              sizeof(reset));
+            }
+            if (NULL != closer) {
+                closer(cur_user->fd);
+            }
             os_close(cur_user->fd);
+            del_timer(&cur_user->idle_timer);
+            del_timer(&cur_user->stall_timer);
             os_free(cur_user->name);
+            exit_msg_reader(&cur_user->reader);
+            list_for_each_entry_safe(send,
+                                     next_send,
+                                     &cur_user->send_queue,
+                                     list) {
+                list_del(&send->list);
+                put_msg_frame(send->frame);
+                os_free(send);
+            }
+            list_for_each_entry_safe(send,
+                                     next_send,
+                                     &cur_user->zc_queue,
+                                     list) {
+                list_del(&send->list);
+                put_msg_frame(send->frame);
+                os_free(send);
+            }
+            list_del(&cur_user->read_list);
             list_del(&cur_user->list);
             os_free(cur_user);
         }
@@ -176,24 +962,145 @@ void remove_flagged_users(struct list_head *users) {
     list_splice(&tmp, users);
 }
 
+int restore_user_state(struct user_info *user, struct user_state *state) {
+    struct user_send *send;
+    int ret;
+    int ret_final = EXIT_FAILURE;
+
+    user->reader.streaming = state->streaming;
+    user->reader.stream.id = state->stream_id;
+    user->reader.stream.len = state->stream_len;
+    user->reader.stream_left = state->stream_left;
+
+    if (state->in_len > 0) {
+        ret = ring_init(&user->reader.ring, state->in_len);
+        if (EXIT_FAILURE == ret) {
+            printf("ERRO: failed to map receive ring\n");
+            goto error_out_ring_init;
+        }
+        os_memcpy(user->reader.ring.buf, state->in_buf, state->in_len);
+        ring_produce(&user->reader.ring, state->in_len);
+    }
+
+    if (state->out_len > 0) {
+        send = os_malloc(sizeof(struct user_send));
+        if (NULL == send) {
+            printf("ERRO: failed to allocate memory for queued bytes\n");
+            goto error_out_malloc_send;
+        }
+        send->frame = create_msg_frame(state->out_len);
+        if (NULL == send->frame) {
+            os_free(send);
+            goto error_out_create_msg_frame;
+        }
+        os_memcpy(send->frame->buf, state->out_buf, state->out_len);
+        send->off = 0;
+        send->missed = 0;
+        send->zc_pending = 0;
+        list_add_tail(&send->list, &user->send_queue);
+        user->send_queue_len = state->out_len;
+        user->send_queue_frames = 1;
+    }
+
+    ret_final = EXIT_SUCCESS;
+error_out_create_msg_frame:
+error_out_malloc_send:
+error_out_ring_init:
+    return ret_final;
+}
+
 void send_broadcast_msg_to_users(struct msg_broadcast *msg,
+                                 msg_sender sender,
+                                 const struct send_budget *budget,
+                                 struct broadcast_batch *batch,
+                                 struct user_fanout *fanout,
                                  struct list_head *users) {
     struct user_info *cur_user = NULL;
     struct user_info *n = NULL;
+    struct broadcast_frames frames;
+    struct msg_frame *frame;
     struct list_head tmp;
+    int num_encodings = get_num_encodings(msg);
+    int encoding = 0;
+    int user_encoding;
+    int ret;
+
+    frames.msg = msg;
+    for (int i = 0; i < USER_FRAME_ENCODINGS; i++) {
+        frames.frames[i] = NULL;
+        frames.encoded[i] = false;
+    }
+
+    // system messages don't wait for a batch, stream parts can't be batched
+    if (MSG_PRIO_SYSTEM == msg->prio || NULL != msg->stream) {
+        batch = NULL;
+    }
+
+    if (NULL != batch) {
+        frame = get_encoded_frame(&frames, USER_FRAME_PLAIN);
+        if (NULL != frame) {
+            add_batch_frame(batch, frame, budget, users);
+        }
+    }
+
+    // falls back to sending on this thread from the encoding whose table
+    // can't grow
+    if (NULL != fanout && NULL == sender) {
+        for (; encoding < num_encodings; encoding++) {
+            ret = collect_fanout_users(fanout, msg, encoding, batch, users);
+            if (EXIT_FAILURE == ret) {
+                break;
+            }
+            if (0 == fanout->num_users) {
+                continue;
+            }
+            frame = get_encoded_frame(&frames, encoding);
+            if (NULL != frame) {
+                fanout_frame(fanout, frame, budget);
+            }
+        }
+        if (num_encodings == encoding) {
+            goto out_fanout;
+        }
+    }
 
     INIT_LIST_HEAD(&tmp);
     list_splice_init(users, &tmp);
 
     list_for_each_entry_safe(cur_user, n, &tmp, list) {
-        if (false == cur_user->remove_user) {
-            int ret = send_broadcast_msg(cur_user->fd, msg);
-            if (EXIT_FAILURE == ret) {
-                printf("WARN: failed to send message to fd %d\n", cur_user->fd);
-                cur_user->remove_user = true;
-            }
+        if (NULL != batch && 0 != (cur_user->caps & MSG_FLAG_BATCH)) {
+            continue;
+        }
+        if (true == cur_user->remove_user) {
+            continue;
+        }
+
+        // users of the earlier encodings got the frame from the fanout
+        user_encoding = get_frame_encoding(cur_user, msg);
+        if (user_encoding < encoding) {
+            continue;
+        }
+
+        frame = get_encoded_frame(&frames, user_encoding);
+        if (NULL == frame) {
+            continue;
+        }
+        if (NULL == sender) {
+            ret = queue_user_msg(cur_user, frame, budget);
+        } else {
+            ret = sender(cur_user->fd, frame);
+        }
+        if (EXIT_FAILURE == ret) {
+            printf("WARN: failed to send message to fd %d\n", cur_user->fd);
+            cur_user->remove_user = true;
         }
     }
 
     list_splice(&tmp, users);
+out_fanout:
+    for (int i = 0; i < USER_FRAME_ENCODINGS; i++) {
+        if (NULL != frames.frames[i]) {
+            put_msg_frame(frames.frames[i]);
+        }
+    }
 }
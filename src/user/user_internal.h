@@ -4,37 +4,177 @@
 #define SRC_USER_USER_INTERNAL_H_
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
 
 #include "include/list.h"
 #include "src/message/message.h"
+#include "src/timer/timer.h"
+#include "src/user/user.h"
+
+#define USER_IDLE_TIMEOUT_MS (5 * 60 * 1000)
+#define USER_SEND_IOV_MAX UIO_MAXIOV
+#define BATCH_MAX_FRAMES 256
+#define USER_PRIO_MAX_JUMPS 16  // system messages that may pass a chat one
+#define USER_TABLE_MIN_FDS 64
+
+// encodings of one broadcast for users with different capabilities
+#define USER_FRAME_PLAIN 0
+#define USER_FRAME_V2 1
+#define USER_FRAME_ENCODINGS 2
+
+struct user_send {
+    struct list_head list;
+    struct msg_frame *frame;
+    size_t off;
+    size_t missed;              // > 0 for a "you missed N messages" marker
+    unsigned int zc_pending;    // MSG_ZEROCOPY sends not completed yet
+    uint32_t zc_first;          // ids of first and last MSG_ZEROCOPY send
+    uint32_t zc_last;
+};
+
+// broadcasts waiting to be sent as one frame to users that read batches
+struct broadcast_batch {
+    struct msg_frame *frames[BATCH_MAX_FRAMES];
+    int num_frames;
+    size_t len;             // bytes of the waiting frames
+    size_t max_len;         // bytes that may wait before the batch is sent
+    uint64_t window_ms;     // time the first broadcast may wait
+    uint64_t deadline;      // os_monotonic_ms() the batch is due at
+};
+
+// frames of one broadcast, encoded on first use and shared by every user
+// with the same encoding, NULL for users that don't get the broadcast
+struct broadcast_frames {
+    struct msg_broadcast *msg;
+    struct msg_frame *frames[USER_FRAME_ENCODINGS];
+    bool encoded[USER_FRAME_ENCODINGS];
+};
+
+// recipients of one broadcast, split between the fanout workers
+struct user_fanout {
+    void **users;
+    int num_users;
+    int cap;
+    struct msg_frame *frame;
+    const struct send_budget *budget;
+};
+
+// users of an event loop indexed by fd, so an event finds its user without
+// walking the user lists
+struct user_table {
+    struct user_info **users;   // NULL for fds without a user
+    int num_fds;
+};
 
 struct user_info {
     int fd;
     bool remove_user;
+    uint8_t caps;               // MSG_FLAG_* granted at registration
+    bool cork;                  // MSG_MORE on all but the last send
+    bool defer_stall_timer;     // a fanout worker is sending to the user
+    bool stall_update;          // stall timer is updated after the fanout
+    bool stall_sent;
     char *name;
+    struct msg_reader reader;
+    struct list_head send_queue;
+    size_t send_queue_len;
+    size_t send_queue_frames;
+    size_t zc_threshold;        // 0 if MSG_ZEROCOPY is not used
+    uint32_t zc_next_id;
+    struct list_head zc_queue;  // sent messages the kernel may still read
+    size_t zc_queue_len;
+    unsigned int prio_jumps;    // system messages queued ahead of chat
+    struct timer idle_timer;
+    struct timer stall_timer;
+    struct list_head read_list;     // queued after using up the read budget
     struct list_head list;
 };
 
 /**
  * Add user to registered user list.
  *
+ * Copies the name of the new user out of the receive buffer. Grants the
+ * capabilities it asked for that the server supports.
+ *
  * @param fd (int) - File descriptor of new user.
  * @param msg (struct msg_new_user *) - Message from new user.
  * @param users (struct list_head *) - List of registered users.
+ * @param table (struct user_table *) - User table of the event loop.
+ * @malloc (struct user_info **) - Grown user table.
  * @malloc (struct user_info *) - Buffer to store info of new user.
+ * @malloc user->name (char *) - Name of new user.
  * @return (struct user_info *) - New user on success, NULL on failure.
  */
 struct user_info *add_new_user(int fd,
                                struct msg_new_user *msg,
-                               struct list_head *users);
+                               struct list_head *users,
+                               struct user_table *table);
 
 /**
- * Copy user file descriptors into buffer.
+ * Add user that has not sent its name yet.
  *
- * @param user_fds (int *) - Buffer to hold fds.
- * @param users (struct list_head *) - List of registered users.
+ * The user table grows to hold the fd if needed.
+ *
+ * @param fd (int) - File descriptor of new user.
+ * @param users (struct list_head *) - List of pending users.
+ * @param table (struct user_table *) - User table of the event loop.
+ * @malloc (struct user_info **) - Grown user table.
+ * @malloc (struct user_info *) - Buffer to store info of new user.
+ * @fail - Fail to grow user table.
+ * @fail - Fail to allocate user.
+ * @return (struct user_info *) - New user on success, NULL on failure.
+ */
+struct user_info *add_pending_user(int fd,
+                                   struct list_head *users,
+                                   struct user_table *table);
+
+/**
+ * Drop every broadcast waiting in a batch without sending it.
+ *
+ * @param batch (struct broadcast_batch *) - Batch of broadcasts.
+ * @free (struct msg_frame *) - Reference to each waiting frame.
+ */
+void clear_broadcast_batch(struct broadcast_batch *batch);
+
+/**
+ * Free the recipient table of a fanout.
+ *
+ * @param fanout (struct user_fanout *) - Fanout of broadcasts.
+ * @free (void **) - Recipient table.
+ */
+void clear_user_fanout(struct user_fanout *fanout);
+
+/**
+ * Free a user table.
+ *
+ * Only for a table without users, it grows again on the next user.
+ *
+ * @param table (struct user_table *) - User table of the event loop.
+ * @free (struct user_info **) - User table.
+ */
+void clear_user_table(struct user_table *table);
+
+/**
+ * Release messages whose MSG_ZEROCOPY sends completed.
+ *
+ * @param user (struct user_info *) - User with SO_ZEROCOPY enabled.
+ * @param lo (uint32_t) - Id of first completed send.
+ * @param hi (uint32_t) - Id of last completed send.
+ * @free (struct user_send *) - Sent messages that no send reads any longer,
+ *                              their frame reference is dropped.
+ */
+void complete_zerocopy_sends(struct user_info *user, uint32_t lo, uint32_t hi);
+
+/**
+ * Copy the bytes queued for a user into one buffer.
+ *
+ * @param user (struct user_info *) - User with a non-empty send queue.
+ * @malloc (uint8_t *) - Buffer of user->send_queue_len bytes.
+ * @return (uint8_t *) - Buffer on success, NULL on failure.
  */
-void copy_user_fds(int *user_fds, struct list_head *users);
+uint8_t *copy_user_sends(struct user_info *user);
 
 /**
  * Count the number of users.
@@ -44,6 +184,17 @@ void copy_user_fds(int *user_fds, struct list_head *users);
  */
 int count_num_users(struct list_head *users);
 
+/**
+ * Count the bytes queued for users.
+ *
+ * Messages that were sent with MSG_ZEROCOPY count until the kernel reports
+ * their completion.
+ *
+ * @param users (struct list_head *) - List of users.
+ * @return (size_t) - Number of bytes that wait to be sent.
+ */
+size_t count_queued_bytes(struct list_head *users);
+
 /**
  * Create broadcast message for user joining.
  *
@@ -67,35 +218,178 @@ int create_broadcast_msg_user_left(struct user_info *user,
                                    struct msg_broadcast *msg);
 
 /**
- * Get user name from fd
+ * Send messages of at least threshold bytes to user with MSG_ZEROCOPY.
+ *
+ * @param user (struct user_info *) - User.
+ * @param threshold (size_t) - Smallest number of bytes sent with one
+ *                             MSG_ZEROCOPY send.
+ * @fail - Fail to enable SO_ZEROCOPY on user's fd.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int enable_user_zerocopy(struct user_info *user, size_t threshold);
+
+/**
+ * Flag every user for removal.
+ *
+ * @param users (struct list_head *) - List of users.
+ */
+void flag_all_users(struct list_head *users);
+
+/**
+ * Send the broadcasts waiting in a batch.
  *
- * @param fd (int) - File descriptor of registerd user.
+ * Queues one MSG_TYPE_BATCH frame for every user that reads batches, a
+ * single broadcast is queued as it is. Flags users for removal whose send
+ * queue is full. The batch is empty afterwards, even if the batch frame
+ * can't be created.
+ *
+ * @param batch (struct broadcast_batch *) - Batch of broadcasts.
+ * @param budget (const struct send_budget *) - Send budget of every user.
  * @param users (struct list_head *) - List of registered users.
+ * @malloc (struct msg_frame *) - Batch frame, freed once no queue holds it
+ *                                any longer.
+ * @free (struct msg_frame *) - Reference to each waiting frame.
+ */
+void flush_broadcast_batch(struct broadcast_batch *batch,
+                           const struct send_budget *budget,
+                           struct list_head *users);
+
+/**
+ * Send queued messages to user.
+ *
+ * Sends until the queue is empty or the socket buffer is full, gathering up
+ * to USER_SEND_IOV_MAX queued messages into each send. The rest of the
+ * queue is sent once the fd becomes writable again. Sends of at least
+ * user->zc_threshold bytes use MSG_ZEROCOPY, their messages move to the
+ * user's zerocopy queue until complete_zerocopy_sends() releases them.
+ * The stall timer is armed while messages are left in the queue and
+ * restarted whenever some of them are sent. While user->defer_stall_timer
+ * is set the update is only recorded, the thread that owns the user's
+ * timers applies it.
+ *
+ * @param user (struct user_info *) - Registered user.
+ * @free (struct user_send *) - Messages that were sent completely, their
+ *                              frame reference is dropped.
+ * @fail - Fail to send to user's fd.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int flush_user_sends(struct user_info *user);
+
+/**
+ * Get user name from fd
+ *
+ * Looks the fd up in the user table, pending and registered users alike.
+ *
+ * @param fd (int) - File descriptor of user.
+ * @param table (struct user_table *) - User table of the event loop.
  * @return (struct user_info *) - User on success, NULL on failure.
  */
-struct user_info *get_user_from_fd(int fd, struct list_head *users);
+struct user_info *get_user_from_fd(int fd, struct user_table *table);
 
 /**
  * Initialize user list
  */
 void init_user_list(struct list_head *user);
 
+/**
+ * Queue broadcast message for user.
+ *
+ * The message is sent right away if nothing else is queued for the user.
+ * A MSG_PRIO_SYSTEM frame is queued ahead of the unsent chat, unless the
+ * oldest chat message was passed USER_PRIO_MAX_JUMPS times already. A
+ * message that doesn't fit the user's send budget is handled by the
+ * budget's policy, which drops chat before system messages. Dropping a
+ * message never touches the one that is partly sent. A collapse marker may
+ * exceed the budget by its own size, and by the system message it made
+ * room for.
+ *
+ * @param user (struct user_info *) - Registered user.
+ * @param frame (struct msg_frame *) - Encoded broadcast message, the queue
+ *                                     takes its own reference.
+ * @param budget (const struct send_budget *) - Send budget of user.
+ * @malloc (struct user_send *) - Queue entry.
+ * @malloc (struct msg_frame *) - Collapse marker.
+ * @free (struct user_send *) - Messages dropped by the policy, their frame
+ *                              reference is dropped.
+ * @fail - Send queue of user is full with SEND_POLICY_DISCONNECT.
+ * @fail - Fail to create collapse marker.
+ * @fail - Fail to allocate queue entry.
+ * @fail - Fail to send to user's fd.
+ * @return (int) - EXIT_SUCCESS on success or if the message was dropped,
+ *                 EXIT_FAILURE on failure.
+ */
+int queue_user_msg(struct user_info *user,
+                   struct msg_frame *frame,
+                   const struct send_budget *budget);
+
 /**
  * Remove flagged users.
  *
+ * @param epollfd (int) - epoll instance that user fds are registered with,
+ *                        -1 if they are not registered with epoll.
  * @param users (struct list_head *) - List of registered users
+ * @param table (struct user_table *) - User table the users are dropped
+ *                                      from.
+ * @param closer (user_closer) - Function called before a user's fd is
+ *                               closed, NULL for none.
  * @free (char *) - Buffer to store user name.
+ * @free (struct ring) - Receive ring of user.
+ * @free (struct user_send *) - Messages that were not sent or whose
+ *                              MSG_ZEROCOPY sends did not complete, their
+ *                              frame reference is dropped.
  * @close (int) - User's file descriptor.
  * @free (struct user_info *) - Buffer to store user info.
  */
-void remove_flagged_users(struct list_head *users);
+void remove_flagged_users(int epollfd,
+                          struct list_head *users,
+                          struct user_table *table,
+                          user_closer closer);
+
+/**
+ * Restore receive buffer, stream and send queue of an imported user.
+ *
+ * @param user (struct user_info *) - User with empty buffers.
+ * @param state (struct user_state *) - Exported state of user.
+ * @malloc (struct ring) - Receive ring of user.
+ * @malloc (struct user_send *) - Queue entry.
+ * @malloc (struct msg_frame *) - Queued bytes.
+ * @fail - Fail to allocate buffers.
+ * @return (int) - EXIT_SUCCESS on success, EXIT_FAILURE on failure.
+ */
+int restore_user_state(struct user_info *user, struct user_state *state);
 
 /**
  * Send broadcast message to registered users.
  *
- * Flags users for removal that fail to receive broadcast message.
+ * The message is encoded once for each encoding the users' capabilities
+ * need, and the same frame is sent to or queued for every user with that
+ * encoding. Flags users for removal that fail to receive broadcast
+ * message. With a batch, users that read batches get chat messages with
+ * the next flush_broadcast_batch() instead. The batch is flushed first if the
+ * message doesn't fit, and right away once it holds batch->max_len bytes.
+ * With a fanout, the queued messages are sent to the users by the fanout
+ * workers in parallel and the call returns once every user got it. Parts
+ * of a stream are never batched and only go to users that read v2 frames,
+ * other users get one notice when a stream starts.
+ *
+ * @param msg (struct msg_broadcast *) - Broadcast message.
+ * @param sender (msg_sender) - Function to send message to one user, NULL
+ *                              to queue the message with queue_user_msg().
+ * @param budget (const struct send_budget *) - Send budget of every user.
+ * @param batch (struct broadcast_batch *) - Batch of broadcasts, NULL to
+ *                                           send to every user right away.
+ * @param fanout (struct user_fanout *) - Fanout of broadcasts, NULL to send
+ *                                        on the calling thread only.
+ * @param users (struct list_head *) - List of registered users.
+ * @malloc (struct msg_frame *) - Encoded message, freed once no queue holds
+ *                                it any longer.
+ * @malloc (void **) - Recipient table of fanout, grown as needed.
  */
 void send_broadcast_msg_to_users(struct msg_broadcast *msg,
+                                 msg_sender sender,
+                                 const struct send_budget *budget,
+                                 struct broadcast_batch *batch,
+                                 struct user_fanout *fanout,
                                  struct list_head *users);
 
 #endif  // SRC_USER_USER_INTERNAL_H_
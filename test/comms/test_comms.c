@@ -2,10 +2,15 @@
 
 #include <errno.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdlib.h>
 
+#include "include/common.h"
 #include "mocks/mock_comms_internal.h"
+#include "mocks/mock_fileio.h"
 #include "mocks/mock_osdep.h"
+#include "mocks/mock_stats.h"
+#include "mocks/mock_timer.h"
 #include "mocks/mock_user.h"
 #include "src/comms/comms.h"
 #include "unity/src/unity.h"
@@ -13,7 +18,10 @@
 void setUp(void) {
     /* set stuff up here */
     mock_comms_internal_Init();
+    mock_fileio_Init();
     mock_osdep_Init();
+    mock_stats_Init();
+    mock_timer_Init();
     mock_user_Init();
 }
 
@@ -21,12 +29,207 @@ void tearDown(void) {
     /* clean stuff up here */
     mock_comms_internal_Verify();
     mock_comms_internal_Destroy();
+    mock_fileio_Verify();
+    mock_fileio_Destroy();
     mock_osdep_Verify();
     mock_osdep_Destroy();
+    mock_stats_Verify();
+    mock_stats_Destroy();
+    mock_timer_Verify();
+    mock_timer_Destroy();
     mock_user_Verify();
     mock_user_Destroy();
 }
 
+int handler(int fd) {
+    return fd;
+}
+
+static struct timer *saved_timer;
+
+void init_timer_save_timer(struct timer *timer,
+                           timer_callback callback,
+                           int num_calls) {
+    UNUSED_PARAMETER(num_calls);
+
+    timer->callback = callback;
+    saved_timer = timer;
+}
+
+int run_timers_expire_saved_timer(int num_calls) {
+    UNUSED_PARAMETER(num_calls);
+
+    saved_timer->callback(saved_timer);
+    return 1;
+}
+
+void test_add_event_handler_fail_add_fd(void) {
+    int epollfd = 3;
+    int fd = 4;
+    int ret;
+
+    register_event_handler_ExpectAndReturn(fd, &handler, EXIT_SUCCESS);
+    add_fd_to_event_loop_ExpectAndReturn(epollfd, fd, EPOLLIN, EXIT_FAILURE);
+    unregister_event_handler_Expect(fd);
+    ret = add_event_handler(epollfd, fd, &handler);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_add_event_handler_fail_register(void) {
+    int epollfd = 3;
+    int fd = 4;
+    int ret;
+
+    register_event_handler_ExpectAndReturn(fd, &handler, EXIT_FAILURE);
+    ret = add_event_handler(epollfd, fd, &handler);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_add_event_handler_pass(void) {
+    int epollfd = 3;
+    int fd = 4;
+    int ret;
+
+    register_event_handler_ExpectAndReturn(fd, &handler, EXIT_SUCCESS);
+    add_fd_to_event_loop_ExpectAndReturn(epollfd, fd, EPOLLIN, EXIT_SUCCESS);
+    ret = add_event_handler(epollfd, fd, &handler);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_add_user_to_event_loop_fail_add_fd(void) {
+    char name[] = "bob";
+    struct user_state state = {3, name, NULL, 0, NULL, 0, false, 0, 0, 0, 0};
+    int epollfd = 4;
+
+    add_fd_to_event_loop_ExpectAndReturn(epollfd, 3, USER_EVENTS,
+                                         EXIT_FAILURE);
+    os_close_ExpectAndReturn(3, 0);
+    os_free_Expect(name);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE,
+                          add_user_to_event_loop(epollfd, &state));
+}
+
+void test_add_user_to_event_loop_pass(void) {
+    struct user_state state = {3, NULL, NULL, 0, NULL, 0, false, 0, 0, 0, 0};
+    int epollfd = 4;
+
+    add_fd_to_event_loop_ExpectAndReturn(epollfd, 3, USER_EVENTS,
+                                         EXIT_SUCCESS);
+    import_user_ExpectAndReturn(&state, EXIT_SUCCESS);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS,
+                          add_user_to_event_loop(epollfd, &state));
+}
+
+void test_drain_event_loop_fail_epoll_ctl(void) {
+    int epollfd = 3;
+    int listenfd = 2;
+    int ret;
+
+    os_epoll_ctl_ExpectAndReturn(epollfd, EPOLL_CTL_DEL, listenfd, NULL, -1);
+    ret = drain_event_loop(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_drain_event_loop_fail_monitor_socks(void) {
+    int epollfd = 3;
+    int listenfd = 2;
+    int ret;
+
+    os_epoll_ctl_ExpectAndReturn(epollfd, EPOLL_CTL_DEL, listenfd, NULL, 0);
+    init_timer_ExpectAnyArgs();
+    mod_timer_ExpectAnyArgs();
+    get_num_queued_bytes_ExpectAndReturn(100);
+    has_unread_users_ExpectAndReturn(false);
+    get_timer_timeout_ExpectAndReturn(100);
+    get_batch_timeout_ExpectAndReturn(-1);
+    os_epoll_wait_ExpectAnyArgsAndReturn(-1);
+    os_get_error_ExpectAndReturn(EBADF);
+    del_timer_ExpectAnyArgs();
+    drop_all_users_Expect();
+    update_user_list_Expect(epollfd);
+    ret = drain_event_loop(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_drain_event_loop_pass(void) {
+    int epollfd = 3;
+    int listenfd = 2;
+    int ret;
+
+    os_epoll_ctl_ExpectAndReturn(epollfd, EPOLL_CTL_DEL, listenfd, NULL, 0);
+    init_timer_ExpectAnyArgs();
+    mod_timer_ExpectAnyArgs();
+    get_num_queued_bytes_ExpectAndReturn(100);
+    has_unread_users_ExpectAndReturn(false);
+    get_timer_timeout_ExpectAndReturn(100);
+    get_batch_timeout_ExpectAndReturn(-1);
+    os_epoll_wait_ExpectAnyArgsAndReturn(1);
+    run_timers_ExpectAndReturn(0);
+    continue_user_reads_Expect();
+    process_fds_ExpectAndReturn(epollfd, listenfd, NULL, 1, EXIT_SUCCESS);
+    process_fds_IgnoreArg_events();
+    flush_batched_msgs_Expect();
+    update_user_list_Expect(epollfd);
+    get_num_queued_bytes_ExpectAndReturn(0);
+    del_timer_ExpectAnyArgs();
+    drop_all_users_Expect();
+    update_user_list_Expect(epollfd);
+    ret = drain_event_loop(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_drain_event_loop_pass_expired(void) {
+    int epollfd = 3;
+    int listenfd = 2;
+    int ret;
+
+    os_epoll_ctl_ExpectAndReturn(epollfd, EPOLL_CTL_DEL, listenfd, NULL, 0);
+    init_timer_StubWithCallback(&init_timer_save_timer);
+    mod_timer_ExpectAnyArgs();
+    get_num_queued_bytes_ExpectAndReturn(100);
+    has_unread_users_ExpectAndReturn(false);
+    get_timer_timeout_ExpectAndReturn(100);
+    get_batch_timeout_ExpectAndReturn(-1);
+    os_epoll_wait_ExpectAnyArgsAndReturn(0);
+    run_timers_StubWithCallback(&run_timers_expire_saved_timer);
+    continue_user_reads_Expect();
+    process_fds_ExpectAndReturn(epollfd, listenfd, NULL, 0, EXIT_SUCCESS);
+    process_fds_IgnoreArg_events();
+    flush_batched_msgs_Expect();
+    update_user_list_Expect(epollfd);
+    get_num_queued_bytes_ExpectAndReturn(100);
+    get_num_queued_bytes_ExpectAndReturn(100);
+    del_timer_ExpectAnyArgs();
+    drop_all_users_Expect();
+    update_user_list_Expect(epollfd);
+    ret = drain_event_loop(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_get_sock_profile_fail_unknown(void) {
+    TEST_ASSERT_NULL(get_sock_profile("unknown"));
+}
+
+void test_get_sock_profile_pass(void) {
+    struct sock_profile *profile;
+
+    profile = get_sock_profile("low-latency");
+
+    TEST_ASSERT_NOT_NULL(profile);
+    TEST_ASSERT_EQUAL_STRING("low-latency", profile->name);
+    TEST_ASSERT_TRUE(profile->nodelay);
+    TEST_ASSERT_TRUE(profile->cork);
+}
+
 void test_init_listen_sock_fail_bind(void) {
     struct sockaddr_in servaddr;
     int fd = 2;
@@ -36,7 +239,7 @@ void test_init_listen_sock_fail_bind(void) {
     servaddr.sin_addr.s_addr = htobe32(INADDR_LOOPBACK);
     servaddr.sin_port = htobe16(1234);
 
-    os_socket_ExpectAndReturn(AF_INET, SOCK_STREAM, 0, fd);
+    os_socket_ExpectAndReturn(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0, fd);
     os_setsockopt_ExpectAndReturn(fd,
                                   SOL_SOCKET,
                                   SO_REUSEADDR,
@@ -51,7 +254,7 @@ void test_init_listen_sock_fail_bind(void) {
                             (struct sockaddr *)&servaddr,
                             sizeof(servaddr),
                             -1);
-    ret = init_listen_sock();
+    ret = init_listen_sock(false);
 
     TEST_ASSERT_EQUAL_INT(-1, ret);
 }
@@ -65,7 +268,7 @@ void test_init_listen_sock_fail_listen(void) {
     servaddr.sin_addr.s_addr = htobe32(INADDR_LOOPBACK);
     servaddr.sin_port = htobe16(1234);
 
-    os_socket_ExpectAndReturn(AF_INET, SOCK_STREAM, 0, fd);
+    os_socket_ExpectAndReturn(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0, fd);
     os_setsockopt_ExpectAndReturn(fd,
                                   SOL_SOCKET,
                                   SO_REUSEADDR,
@@ -80,8 +283,8 @@ void test_init_listen_sock_fail_listen(void) {
                             (struct sockaddr *)&servaddr,
                             sizeof(servaddr),
                             0);
-    os_listen_ExpectAndReturn(fd, 5, -1);
-    ret = init_listen_sock();
+    os_listen_ExpectAndReturn(fd, SOMAXCONN, -1);
+    ret = init_listen_sock(false);
 
     TEST_ASSERT_EQUAL_INT(-1, ret);
 }
@@ -90,7 +293,7 @@ void test_init_listen_sock_fail_setsockopt(void) {
     int fd = 2;
     int ret;
 
-    os_socket_ExpectAndReturn(AF_INET, SOCK_STREAM, 0, fd);
+    os_socket_ExpectAndReturn(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0, fd);
     os_setsockopt_ExpectAndReturn(fd,
                                   SOL_SOCKET,
                                   SO_REUSEADDR,
@@ -98,7 +301,7 @@ void test_init_listen_sock_fail_setsockopt(void) {
                                   sizeof(int),
                                   -1);
     os_setsockopt_IgnoreArg_optval();
-    ret = init_listen_sock();
+    ret = init_listen_sock(false);
 
     TEST_ASSERT_EQUAL_INT(-1, ret);
 }
@@ -106,8 +309,8 @@ void test_init_listen_sock_fail_setsockopt(void) {
 void test_init_listen_sock_fail_socket(void) {
     int ret;
 
-    os_socket_ExpectAndReturn(AF_INET, SOCK_STREAM, 0, -1);
-    ret = init_listen_sock();
+    os_socket_ExpectAndReturn(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0, -1);
+    ret = init_listen_sock(false);
 
     TEST_ASSERT_EQUAL_INT(-1, ret);
 }
@@ -121,7 +324,7 @@ void test_init_listen_sock_pass(void) {
     servaddr.sin_addr.s_addr = htobe32(INADDR_LOOPBACK);
     servaddr.sin_port = htobe16(1234);
 
-    os_socket_ExpectAndReturn(AF_INET, SOCK_STREAM, 0, fd);
+    os_socket_ExpectAndReturn(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0, fd);
     os_setsockopt_ExpectAndReturn(fd,
                                   SOL_SOCKET,
                                   SO_REUSEADDR,
@@ -136,71 +339,331 @@ void test_init_listen_sock_pass(void) {
                             (struct sockaddr *)&servaddr,
                             sizeof(servaddr),
                             0);
-    os_listen_ExpectAndReturn(fd, 5, 0);
-    ret = init_listen_sock();
+    os_listen_ExpectAndReturn(fd, SOMAXCONN, 0);
+    ret = init_listen_sock(false);
 
     TEST_ASSERT_EQUAL_INT(fd, ret);
 }
 
-void test_monitor_socks_fail_process_fds(void) {
+void test_init_listen_sock_fail_reuse_port(void) {
+    int fd = 2;
+    int ret;
+
+    os_socket_ExpectAndReturn(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0, fd);
+    os_setsockopt_ExpectAndReturn(fd,
+                                  SOL_SOCKET,
+                                  SO_REUSEADDR,
+                                  NULL,
+                                  sizeof(int),
+                                  0);
+    os_setsockopt_IgnoreArg_optval();
+    os_setsockopt_ExpectAndReturn(fd,
+                                  SOL_SOCKET,
+                                  SO_REUSEPORT,
+                                  NULL,
+                                  sizeof(int),
+                                  -1);
+    os_setsockopt_IgnoreArg_optval();
+    ret = init_listen_sock(true);
+
+    TEST_ASSERT_EQUAL_INT(-1, ret);
+}
+
+void test_init_listen_sock_pass_reuse_port(void) {
+    struct sockaddr_in servaddr;
+    int fd = 2;
+    int ret;
+
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htobe32(INADDR_LOOPBACK);
+    servaddr.sin_port = htobe16(1234);
+
+    os_socket_ExpectAndReturn(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0, fd);
+    os_setsockopt_ExpectAndReturn(fd,
+                                  SOL_SOCKET,
+                                  SO_REUSEADDR,
+                                  NULL,
+                                  sizeof(int),
+                                  0);
+    os_setsockopt_IgnoreArg_optval();
+    os_setsockopt_ExpectAndReturn(fd,
+                                  SOL_SOCKET,
+                                  SO_REUSEPORT,
+                                  NULL,
+                                  sizeof(int),
+                                  0);
+    os_setsockopt_IgnoreArg_optval();
+    os_memset_ExpectAndReturn(NULL, 0, sizeof(struct sockaddr_in), &servaddr);
+    os_memset_ReturnMemThruPtr_s(&servaddr, sizeof(servaddr));
+    os_memset_IgnoreArg_s();
+    os_bind_ExpectAndReturn(fd,
+                            (struct sockaddr *)&servaddr,
+                            sizeof(servaddr),
+                            0);
+    os_listen_ExpectAndReturn(fd, SOMAXCONN, 0);
+    ret = init_listen_sock(true);
+
+    TEST_ASSERT_EQUAL_INT(fd, ret);
+}
+
+void test_init_event_loop_fail_add_fd(void) {
     int listenfd = 2;
-    int max_fd = 2;
+    int epollfd = 3;
     int ret;
 
-    set_fds_ExpectAndReturn(listenfd, NULL, max_fd);
-    set_fds_IgnoreArg_rfds();
-    os_select_ExpectAndReturn(max_fd+1, NULL, NULL, NULL, NULL, 1);
-    os_select_IgnoreArg_readfds();
-    process_fds_ExpectAndReturn(listenfd, max_fd, NULL, EXIT_FAILURE);
-    process_fds_IgnoreArg_rfds();
-    ret = monitor_socks(listenfd);
+    set_fd_nonblocking_ExpectAndReturn(listenfd, EXIT_SUCCESS);
+    os_epoll_create1_ExpectAndReturn(EPOLL_CLOEXEC, epollfd);
+    add_fd_to_event_loop_ExpectAndReturn(epollfd, listenfd, EPOLLIN, EXIT_FAILURE);
+    os_close_ExpectAndReturn(epollfd, 0);
+    ret = init_event_loop(listenfd);
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(-1, ret);
+}
+
+void test_init_event_loop_fail_epoll_create(void) {
+    int listenfd = 2;
+    int ret;
+
+    set_fd_nonblocking_ExpectAndReturn(listenfd, EXIT_SUCCESS);
+    os_epoll_create1_ExpectAndReturn(EPOLL_CLOEXEC, -1);
+    ret = init_event_loop(listenfd);
+
+    TEST_ASSERT_EQUAL_INT(-1, ret);
+}
+
+void test_init_event_loop_fail_set_fd_nonblocking(void) {
+    int listenfd = 2;
+    int ret;
+
+    set_fd_nonblocking_ExpectAndReturn(listenfd, EXIT_FAILURE);
+    ret = init_event_loop(listenfd);
+
+    TEST_ASSERT_EQUAL_INT(-1, ret);
+}
+
+void test_init_event_loop_pass(void) {
+    int listenfd = 2;
+    int epollfd = 3;
+    int ret;
+
+    set_fd_nonblocking_ExpectAndReturn(listenfd, EXIT_SUCCESS);
+    os_epoll_create1_ExpectAndReturn(EPOLL_CLOEXEC, epollfd);
+    add_fd_to_event_loop_ExpectAndReturn(epollfd, listenfd, EPOLLIN, EXIT_SUCCESS);
+    ret = init_event_loop(listenfd);
+
+    TEST_ASSERT_EQUAL_INT(epollfd, ret);
 }
 
-void test_monitor_socks_fail_select_ebadf(void) {
+void test_monitor_socks_fail_epoll_wait_ebadf(void) {
+    int epollfd = 3;
     int listenfd = 2;
-    int max_fd = 2;
     int ret;
 
-    set_fds_ExpectAndReturn(listenfd, NULL, max_fd);
-    set_fds_IgnoreArg_rfds();
-    os_select_ExpectAndReturn(max_fd+1, NULL, NULL, NULL, NULL, -1);
-    os_select_IgnoreArg_readfds();
+    has_unread_users_ExpectAndReturn(false);
+    get_timer_timeout_ExpectAndReturn(-1);
+    get_batch_timeout_ExpectAndReturn(-1);
+    os_epoll_wait_ExpectAndReturn(epollfd, NULL, 0, -1, -1);
+    os_epoll_wait_IgnoreArg_events();
+    os_epoll_wait_IgnoreArg_maxevents();
     os_get_error_ExpectAndReturn(EBADF);
-    ret = monitor_socks(listenfd);
+    ret = monitor_socks(epollfd, listenfd);
 
     TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
 }
 
-void test_monitor_socks_fail_select_eintr(void) {
+void test_monitor_socks_fail_epoll_wait_eintr(void) {
+    int epollfd = 3;
     int listenfd = 2;
-    int max_fd = 2;
     int ret;
 
-    set_fds_ExpectAndReturn(listenfd, NULL, max_fd);
-    set_fds_IgnoreArg_rfds();
-    os_select_ExpectAndReturn(max_fd+1, NULL, NULL, NULL, NULL, -1);
-    os_select_IgnoreArg_readfds();
+    has_unread_users_ExpectAndReturn(false);
+    get_timer_timeout_ExpectAndReturn(-1);
+    get_batch_timeout_ExpectAndReturn(-1);
+    os_epoll_wait_ExpectAndReturn(epollfd, NULL, 0, -1, -1);
+    os_epoll_wait_IgnoreArg_events();
+    os_epoll_wait_IgnoreArg_maxevents();
     os_get_error_ExpectAndReturn(EINTR);
-    ret = monitor_socks(listenfd);
+    ret = monitor_socks(epollfd, listenfd);
 
     TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
 }
 
+void test_monitor_socks_fail_process_fds(void) {
+    int epollfd = 3;
+    int listenfd = 2;
+    int ret;
+
+    has_unread_users_ExpectAndReturn(false);
+    get_timer_timeout_ExpectAndReturn(-1);
+    get_batch_timeout_ExpectAndReturn(-1);
+    os_epoll_wait_ExpectAndReturn(epollfd, NULL, 0, -1, 1);
+    os_epoll_wait_IgnoreArg_events();
+    os_epoll_wait_IgnoreArg_maxevents();
+    run_timers_ExpectAndReturn(0);
+    continue_user_reads_Expect();
+    process_fds_ExpectAndReturn(epollfd, listenfd, NULL, 1, EXIT_FAILURE);
+    process_fds_IgnoreArg_events();
+    ret = monitor_socks(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
 void test_monitor_socks_pass(void) {
+    int epollfd = 3;
+    int listenfd = 2;
+    int ret;
+
+    has_unread_users_ExpectAndReturn(false);
+    get_timer_timeout_ExpectAndReturn(-1);
+    get_batch_timeout_ExpectAndReturn(-1);
+    os_epoll_wait_ExpectAndReturn(epollfd, NULL, 0, -1, 1);
+    os_epoll_wait_IgnoreArg_events();
+    os_epoll_wait_IgnoreArg_maxevents();
+    run_timers_ExpectAndReturn(0);
+    continue_user_reads_Expect();
+    process_fds_ExpectAndReturn(epollfd, listenfd, NULL, 1, EXIT_SUCCESS);
+    process_fds_IgnoreArg_events();
+    flush_batched_msgs_Expect();
+    update_user_list_Expect(epollfd);
+    ret = monitor_socks(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_monitor_socks_pass_batch(void) {
+    int epollfd = 3;
+    int listenfd = 2;
+    int ret;
+
+    has_unread_users_ExpectAndReturn(false);
+    get_timer_timeout_ExpectAndReturn(100);
+    get_batch_timeout_ExpectAndReturn(1);
+    os_epoll_wait_ExpectAndReturn(epollfd, NULL, 0, 1, 0);
+    os_epoll_wait_IgnoreArg_events();
+    os_epoll_wait_IgnoreArg_maxevents();
+    run_timers_ExpectAndReturn(0);
+    continue_user_reads_Expect();
+    process_fds_ExpectAndReturn(epollfd, listenfd, NULL, 0, EXIT_SUCCESS);
+    process_fds_IgnoreArg_events();
+    flush_batched_msgs_Expect();
+    update_user_list_Expect(epollfd);
+    ret = monitor_socks(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_monitor_socks_pass_timers(void) {
+    int epollfd = 3;
+    int listenfd = 2;
+    int ret;
+
+    has_unread_users_ExpectAndReturn(false);
+    get_timer_timeout_ExpectAndReturn(100);
+    get_batch_timeout_ExpectAndReturn(-1);
+    os_epoll_wait_ExpectAndReturn(epollfd, NULL, 0, 100, 0);
+    os_epoll_wait_IgnoreArg_events();
+    os_epoll_wait_IgnoreArg_maxevents();
+    run_timers_ExpectAndReturn(2);
+    continue_user_reads_Expect();
+    process_fds_ExpectAndReturn(epollfd, listenfd, NULL, 0, EXIT_SUCCESS);
+    process_fds_IgnoreArg_events();
+    flush_batched_msgs_Expect();
+    update_user_list_Expect(epollfd);
+    ret = monitor_socks(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_monitor_socks_pass_unread_users(void) {
+    int epollfd = 3;
     int listenfd = 2;
-    int max_fd = 2;
     int ret;
 
-    set_fds_ExpectAndReturn(listenfd, NULL, max_fd);
-    set_fds_IgnoreArg_rfds();
-    os_select_ExpectAndReturn(max_fd+1, NULL, NULL, NULL, NULL, 1);
-    os_select_IgnoreArg_readfds();
-    process_fds_ExpectAndReturn(listenfd, max_fd, NULL, EXIT_SUCCESS);
-    process_fds_IgnoreArg_rfds();
-    update_user_list_Expect();
-    ret = monitor_socks(listenfd);
+    // users that used up their read budget are read without sleeping
+    has_unread_users_ExpectAndReturn(true);
+    os_epoll_wait_ExpectAndReturn(epollfd, NULL, 0, 0, 0);
+    os_epoll_wait_IgnoreArg_events();
+    os_epoll_wait_IgnoreArg_maxevents();
+    run_timers_ExpectAndReturn(0);
+    continue_user_reads_Expect();
+    process_fds_ExpectAndReturn(epollfd, listenfd, NULL, 0, EXIT_SUCCESS);
+    process_fds_IgnoreArg_events();
+    flush_batched_msgs_Expect();
+    update_user_list_Expect(epollfd);
+    ret = monitor_socks(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_set_listen_backlog_pass(void) {
+    int fd = 2;
+    int ret;
+
+    set_listen_backlog(16);
+    os_socket_ExpectAndReturn(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0, fd);
+    os_setsockopt_ExpectAnyArgsAndReturn(0);
+    os_memset_ExpectAnyArgsAndReturn(NULL);
+    os_bind_ExpectAnyArgsAndReturn(0);
+    os_listen_ExpectAndReturn(fd, 16, 0);
+    ret = init_listen_sock(false);
+    set_listen_backlog(SOMAXCONN);
+
+    TEST_ASSERT_EQUAL_INT(fd, ret);
+}
+
+void test_tune_sock_fail_setsockopt(void) {
+    int fd = 4;
+    int ret;
+
+    set_stat_sock_profile_Expect("low-latency");
+    set_sock_profile(get_sock_profile("low-latency"));
+    os_setsockopt_ExpectAndReturn(fd,
+                                  IPPROTO_TCP,
+                                  TCP_NODELAY,
+                                  NULL,
+                                  sizeof(int),
+                                  -1);
+    os_setsockopt_IgnoreArg_optval();
+    ret = tune_sock(fd);
+    set_stat_sock_profile_Expect("default");
+    set_sock_profile(get_sock_profile("default"));
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_tune_sock_pass(void) {
+    int fd = 4;
+    int ret;
+
+    // the default profile leaves the socket alone
+    ret = tune_sock(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_tune_sock_pass_throughput(void) {
+    int fd = 4;
+    int ret;
+
+    set_stat_sock_profile_Expect("throughput");
+    set_sock_profile(get_sock_profile("throughput"));
+    os_setsockopt_ExpectAndReturn(fd,
+                                  SOL_SOCKET,
+                                  SO_SNDBUF,
+                                  NULL,
+                                  sizeof(int),
+                                  0);
+    os_setsockopt_IgnoreArg_optval();
+    os_setsockopt_ExpectAndReturn(fd,
+                                  SOL_SOCKET,
+                                  SO_RCVBUF,
+                                  NULL,
+                                  sizeof(int),
+                                  0);
+    os_setsockopt_IgnoreArg_optval();
+    ret = tune_sock(fd);
+    set_stat_sock_profile_Expect("default");
+    set_sock_profile(get_sock_profile("default"));
 
     TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
 }
@@ -208,14 +671,38 @@ void test_monitor_socks_pass(void) {
 /* not needed when using generate_test_runner.rb */
 int main(void) {
     UNITY_BEGIN();
+    RUN_TEST(test_add_event_handler_fail_add_fd);
+    RUN_TEST(test_add_event_handler_fail_register);
+    RUN_TEST(test_add_event_handler_pass);
+    RUN_TEST(test_add_user_to_event_loop_fail_add_fd);
+    RUN_TEST(test_add_user_to_event_loop_pass);
+    RUN_TEST(test_drain_event_loop_fail_epoll_ctl);
+    RUN_TEST(test_drain_event_loop_fail_monitor_socks);
+    RUN_TEST(test_drain_event_loop_pass);
+    RUN_TEST(test_drain_event_loop_pass_expired);
+    RUN_TEST(test_get_sock_profile_fail_unknown);
+    RUN_TEST(test_get_sock_profile_pass);
     RUN_TEST(test_init_listen_sock_fail_bind);
     RUN_TEST(test_init_listen_sock_fail_listen);
     RUN_TEST(test_init_listen_sock_fail_setsockopt);
     RUN_TEST(test_init_listen_sock_fail_socket);
     RUN_TEST(test_init_listen_sock_pass);
+    RUN_TEST(test_init_listen_sock_fail_reuse_port);
+    RUN_TEST(test_init_listen_sock_pass_reuse_port);
+    RUN_TEST(test_init_event_loop_fail_add_fd);
+    RUN_TEST(test_init_event_loop_fail_epoll_create);
+    RUN_TEST(test_init_event_loop_fail_set_fd_nonblocking);
+    RUN_TEST(test_init_event_loop_pass);
+    RUN_TEST(test_monitor_socks_fail_epoll_wait_ebadf);
+    RUN_TEST(test_monitor_socks_fail_epoll_wait_eintr);
     RUN_TEST(test_monitor_socks_fail_process_fds);
-    RUN_TEST(test_monitor_socks_fail_select_ebadf);
-    RUN_TEST(test_monitor_socks_fail_select_eintr);
     RUN_TEST(test_monitor_socks_pass);
+    RUN_TEST(test_monitor_socks_pass_batch);
+    RUN_TEST(test_monitor_socks_pass_timers);
+    RUN_TEST(test_monitor_socks_pass_unread_users);
+    RUN_TEST(test_set_listen_backlog_pass);
+    RUN_TEST(test_tune_sock_fail_setsockopt);
+    RUN_TEST(test_tune_sock_pass);
+    RUN_TEST(test_tune_sock_pass_throughput);
     return UNITY_END();
 }
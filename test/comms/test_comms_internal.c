@@ -1,193 +1,538 @@
 // Copyright 2020 author. All rights reserved.
 
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include "mocks/mock_fileio.h"
+#include "include/common.h"
+#include "mocks/mock_comms.h"
 #include "mocks/mock_osdep.h"
+#include "mocks/mock_stats.h"
 #include "mocks/mock_user.h"
 #include "src/comms/comms_internal.h"
 #include "unity/src/unity.h"
 
 void setUp(void) {
     /* set stuff up here */
-    mock_fileio_Init();
+    mock_comms_Init();
     mock_user_Init();
     mock_osdep_Init();
+    mock_stats_Init();
 }
 
 void tearDown(void) {
     /* clean stuff up here */
-    mock_fileio_Verify();
-    mock_fileio_Destroy();
+    mock_comms_Verify();
+    mock_comms_Destroy();
     mock_user_Verify();
     mock_user_Destroy();
     mock_osdep_Verify();
     mock_osdep_Destroy();
+    mock_stats_Verify();
+    mock_stats_Destroy();
 }
 
-void test_process_fds_fail_accept(void) {
+int handler_fail(int fd) {
+    UNUSED_PARAMETER(fd);
+
+    return EXIT_FAILURE;
+}
+
+int handler_pass(int fd) {
+    UNUSED_PARAMETER(fd);
+
+    return EXIT_SUCCESS;
+}
+
+void expect_accept_stats(int num_accepted) {
+    add_stat_Expect(STAT_ACCEPT_WAKEUPS, 1);
+    add_stat_Expect(STAT_ACCEPTS, num_accepted);
+    max_stat_Expect(STAT_ACCEPTS_MAX, num_accepted);
+}
+
+void expect_accept_user(int listenfd, int userfd, int ret_add, int ret_new) {
+    os_accept4_ExpectAndReturn(listenfd,
+                               NULL,
+                               NULL,
+                               SOCK_NONBLOCK | SOCK_CLOEXEC,
+                               userfd);
+    tune_sock_ExpectAndReturn(userfd, EXIT_SUCCESS);
+    os_memset_ExpectAnyArgsAndReturn(NULL);
+    os_epoll_ctl_ExpectAnyArgsAndReturn(ret_add);
+    if (-1 == ret_add) {
+        os_close_ExpectAndReturn(userfd, 0);
+        return;
+    }
+    handle_new_user_ExpectAndReturn(userfd, ret_new);
+    if (EXIT_FAILURE == ret_new) {
+        os_close_ExpectAndReturn(userfd, 0);
+    }
+}
+
+void expect_accept_error(int listenfd, int err) {
+    os_accept4_ExpectAndReturn(listenfd,
+                               NULL,
+                               NULL,
+                               SOCK_NONBLOCK | SOCK_CLOEXEC,
+                               -1);
+    os_get_error_ExpectAndReturn(err);
+}
+
+void test_accept_users_fail_accept(void) {
+    int epollfd = 1;
     int listenfd = 2;
-    int max_fd = 2;
-    fd_set rfds;
     int ret;
 
-    os_fd_isset_ExpectAndReturn(0, &rfds, 0);
-    os_fd_isset_ExpectAndReturn(1, &rfds, 0);
-    os_fd_isset_ExpectAndReturn(listenfd, &rfds, 1);
-    os_accept_ExpectAndReturn(listenfd, NULL, NULL, -1);
-    ret = process_fds(listenfd, max_fd, &rfds);
+    expect_accept_error(listenfd, EBADF);
+    expect_accept_stats(0);
+    ret = accept_users(epollfd, listenfd);
 
     TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
 }
 
-void test_process_fds_fail_handle_new_user(void) {
+void test_accept_users_fail_add_fd_to_event_loop(void) {
+    int epollfd = 1;
+    int listenfd = 2;
+    int userfd = 3;
+    int ret;
+
+    expect_accept_user(listenfd, userfd, -1, EXIT_SUCCESS);
+    expect_accept_error(listenfd, EAGAIN);
+    expect_accept_stats(1);
+    ret = accept_users(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_accept_users_fail_handle_new_user(void) {
+    int epollfd = 1;
+    int listenfd = 2;
+    int userfd = 3;
+    int ret;
+
+    expect_accept_user(listenfd, userfd, 0, EXIT_FAILURE);
+    expect_accept_error(listenfd, EAGAIN);
+    expect_accept_stats(1);
+    ret = accept_users(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_accept_users_pass(void) {
+    int epollfd = 1;
+    int listenfd = 2;
+    int userfd = 3;
+    int userfd2 = 4;
+    int ret;
+
+    expect_accept_user(listenfd, userfd, 0, EXIT_SUCCESS);
+    expect_accept_user(listenfd, userfd2, 0, EXIT_SUCCESS);
+    expect_accept_error(listenfd, EAGAIN);
+    expect_accept_stats(2);
+    ret = accept_users(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_accept_users_pass_budget(void) {
+    int epollfd = 1;
+    int listenfd = 2;
+    int ret;
+
+    for (int i = 0; i < ACCEPT_BUDGET; i++) {
+        expect_accept_user(listenfd, 3 + i, 0, EXIT_SUCCESS);
+    }
+    add_stat_Expect(STAT_ACCEPT_BUDGET_HIT, 1);
+    os_getsockopt_ExpectAnyArgsAndReturn(-1);
+    expect_accept_stats(ACCEPT_BUDGET);
+    ret = accept_users(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_accept_users_pass_tune_sock_fail(void) {
+    int epollfd = 1;
     int listenfd = 2;
     int userfd = 3;
-    int max_fd = 2;
-    fd_set rfds;
     int ret;
 
-    os_fd_isset_ExpectAndReturn(0, &rfds, 0);
-    os_fd_isset_ExpectAndReturn(1, &rfds, 0);
-    os_fd_isset_ExpectAndReturn(listenfd, &rfds, 1);
-    os_accept_ExpectAndReturn(listenfd, NULL, NULL, userfd);
-    set_fd_nonblocking_ExpectAndReturn(userfd, EXIT_SUCCESS);
-    handle_new_user_ExpectAndReturn(userfd, EXIT_FAILURE);
-    os_close_ExpectAndReturn(userfd, 0);
-    ret = process_fds(listenfd, max_fd, &rfds);
+    // the user is served without its socket options
+    os_accept4_ExpectAndReturn(listenfd,
+                               NULL,
+                               NULL,
+                               SOCK_NONBLOCK | SOCK_CLOEXEC,
+                               userfd);
+    tune_sock_ExpectAndReturn(userfd, EXIT_FAILURE);
+    add_stat_Expect(STAT_SOCK_TUNE_FAILED, 1);
+    os_memset_ExpectAnyArgsAndReturn(NULL);
+    os_epoll_ctl_ExpectAnyArgsAndReturn(0);
+    handle_new_user_ExpectAndReturn(userfd, EXIT_SUCCESS);
+    expect_accept_error(listenfd, EAGAIN);
+    expect_accept_stats(1);
+    ret = accept_users(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_accept_users_pass_emfile(void) {
+    int epollfd = 1;
+    int listenfd = 2;
+    int ret;
+
+    expect_accept_error(listenfd, EMFILE);
+    expect_accept_stats(0);
+    ret = accept_users(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_accept_users_pass_econnaborted(void) {
+    int epollfd = 1;
+    int listenfd = 2;
+    int userfd = 3;
+    int ret;
+
+    expect_accept_error(listenfd, ECONNABORTED);
+    expect_accept_user(listenfd, userfd, 0, EXIT_SUCCESS);
+    expect_accept_error(listenfd, EAGAIN);
+    expect_accept_stats(1);
+    ret = accept_users(epollfd, listenfd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_add_fd_to_event_loop_fail_epoll_ctl(void) {
+    struct epoll_event zero;
+    struct epoll_event event;
+    int epollfd = 2;
+    int fd = 3;
+    int ret;
+
+    memset(&zero, 0, sizeof(zero));
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+
+    os_memset_ExpectAndReturn(NULL, 0, sizeof(event), &event);
+    os_memset_IgnoreArg_s();
+    os_memset_ReturnMemThruPtr_s(&zero, sizeof(zero));
+    os_epoll_ctl_ExpectAndReturn(epollfd, EPOLL_CTL_ADD, fd, &event, -1);
+    ret = add_fd_to_event_loop(epollfd, fd, EPOLLIN);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_add_fd_to_event_loop_pass(void) {
+    struct epoll_event zero;
+    struct epoll_event event;
+    int epollfd = 2;
+    int fd = 3;
+    int ret;
+
+    memset(&zero, 0, sizeof(zero));
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+
+    os_memset_ExpectAndReturn(NULL, 0, sizeof(event), &event);
+    os_memset_IgnoreArg_s();
+    os_memset_ReturnMemThruPtr_s(&zero, sizeof(zero));
+    os_epoll_ctl_ExpectAndReturn(epollfd, EPOLL_CTL_ADD, fd, &event, 0);
+    ret = add_fd_to_event_loop(epollfd, fd, EPOLLIN);
 
     TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
 }
 
+void test_get_event_handler_fail(void) {
+    TEST_ASSERT_NULL(get_event_handler(3));
+}
+
+void test_get_event_handler_pass(void) {
+    int fd = 3;
+
+    register_event_handler(fd, &handler_pass);
+
+    TEST_ASSERT_EQUAL_PTR(&handler_pass, get_event_handler(fd));
+    unregister_event_handler(fd);
+}
+
+void test_process_fds_fail_accept(void) {
+    int epollfd = 1;
+    int listenfd = 2;
+    struct epoll_event events[1];
+    int ret;
+
+    events[0].events = EPOLLIN;
+    events[0].data.fd = listenfd;
+
+    expect_accept_error(listenfd, EBADF);
+    expect_accept_stats(0);
+    ret = process_fds(epollfd, listenfd, events, 1);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
 void test_process_fds_fail_handle_registered_user(void) {
+    int epollfd = 1;
     int listenfd = 2;
     int userfd = 3;
-    int max_fd = 3;
-    fd_set rfds;
+    struct epoll_event events[1];
     int ret;
 
-    os_fd_isset_ExpectAndReturn(0, &rfds, 0);
-    os_fd_isset_ExpectAndReturn(1, &rfds, 0);
-    os_fd_isset_ExpectAndReturn(listenfd, &rfds, 0);
-    os_fd_isset_ExpectAndReturn(userfd, &rfds, 1);
+    events[0].events = EPOLLIN;
+    events[0].data.fd = userfd;
+
     handle_registered_user_ExpectAndReturn(userfd, EXIT_FAILURE);
-    ret = process_fds(listenfd, max_fd, &rfds);
+    ret = process_fds(epollfd, listenfd, events, 1);
 
     TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
 }
 
-void test_process_fds_fail_set_fd_nonblocking(void) {
+void test_process_fds_fail_handler(void) {
+    int epollfd = 1;
+    int listenfd = 2;
+    int wakefd = 3;
+    struct epoll_event events[1];
+    int ret;
+
+    events[0].events = EPOLLIN;
+    events[0].data.fd = wakefd;
+
+    register_event_handler(wakefd, &handler_fail);
+    ret = process_fds(epollfd, listenfd, events, 1);
+    unregister_event_handler(wakefd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_process_fds_fail_handle_zerocopy_completions(void) {
+    int epollfd = 1;
     int listenfd = 2;
     int userfd = 3;
-    int max_fd = 2;
-    fd_set rfds;
+    struct epoll_event events[1];
     int ret;
 
-    os_fd_isset_ExpectAndReturn(0, &rfds, 0);
-    os_fd_isset_ExpectAndReturn(1, &rfds, 0);
-    os_fd_isset_ExpectAndReturn(listenfd, &rfds, 1);
-    os_accept_ExpectAndReturn(listenfd, NULL, NULL, userfd);
-    set_fd_nonblocking_ExpectAndReturn(userfd, EXIT_FAILURE);
-    os_close_ExpectAndReturn(userfd, 0);
-    ret = process_fds(listenfd, max_fd, &rfds);
+    events[0].events = EPOLLERR;
+    events[0].data.fd = userfd;
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    handle_zerocopy_completions_ExpectAndReturn(userfd, EXIT_FAILURE);
+    handle_registered_user_ExpectAndReturn(userfd, EXIT_SUCCESS);
+    ret = process_fds(epollfd, listenfd, events, 1);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
 }
 
-void test_process_fds_pass_handle_new_user(void) {
+void test_process_fds_fail_handle_writable_user(void) {
+    int epollfd = 1;
     int listenfd = 2;
     int userfd = 3;
-    int max_fd = 2;
-    fd_set rfds;
+    struct epoll_event events[1];
     int ret;
 
-    os_fd_isset_ExpectAndReturn(0, &rfds, 0);
-    os_fd_isset_ExpectAndReturn(1, &rfds, 0);
-    os_fd_isset_ExpectAndReturn(listenfd, &rfds, 1);
-    os_accept_ExpectAndReturn(listenfd, NULL, NULL, userfd);
-    set_fd_nonblocking_ExpectAndReturn(userfd, EXIT_SUCCESS);
-    handle_new_user_ExpectAndReturn(userfd, EXIT_SUCCESS);
-    ret = process_fds(listenfd, max_fd, &rfds);
+    events[0].events = EPOLLOUT;
+    events[0].data.fd = userfd;
+
+    handle_writable_user_ExpectAndReturn(userfd, EXIT_FAILURE);
+    ret = process_fds(epollfd, listenfd, events, 1);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_process_fds_pass_accept(void) {
+    int epollfd = 1;
+    int listenfd = 2;
+    int userfd = 3;
+    struct epoll_event events[1];
+    int ret;
+
+    events[0].events = EPOLLIN;
+    events[0].data.fd = listenfd;
+
+    expect_accept_user(listenfd, userfd, 0, EXIT_SUCCESS);
+    expect_accept_error(listenfd, EAGAIN);
+    expect_accept_stats(1);
+    ret = process_fds(epollfd, listenfd, events, 1);
 
     TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
 }
 
 void test_process_fds_pass_handle_registered_user(void) {
+    int epollfd = 1;
     int listenfd = 2;
     int userfd = 3;
-    int max_fd = 3;
-    fd_set rfds;
+    int userfd2 = 4;
+    struct epoll_event events[2];
     int ret;
 
-    os_fd_isset_ExpectAndReturn(0, &rfds, 0);
-    os_fd_isset_ExpectAndReturn(1, &rfds, 0);
-    os_fd_isset_ExpectAndReturn(listenfd, &rfds, 0);
-    os_fd_isset_ExpectAndReturn(userfd, &rfds, 1);
+    events[0].events = EPOLLIN;
+    events[0].data.fd = userfd;
+    events[1].events = EPOLLIN;
+    events[1].data.fd = userfd2;
+
     handle_registered_user_ExpectAndReturn(userfd, EXIT_SUCCESS);
-    ret = process_fds(listenfd, max_fd, &rfds);
+    handle_registered_user_ExpectAndReturn(userfd2, EXIT_SUCCESS);
+    ret = process_fds(epollfd, listenfd, events, 2);
 
     TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
 }
 
-void test_set_fds_fail_malloc(void) {
-    int num_users = 2;
-    fd_set rfds;
+void test_process_fds_pass_handle_writable_user(void) {
+    int epollfd = 1;
     int listenfd = 2;
+    int userfd = 3;
+    int userfd2 = 4;
+    struct epoll_event events[2];
     int ret;
 
-    os_fd_zero_Expect(&rfds);
-    os_fd_set_Expect(listenfd, &rfds);
-    get_num_users_ExpectAndReturn(num_users);
-    os_malloc_ExpectAndReturn(num_users*sizeof(int), NULL);
-    ret = set_fds(listenfd, &rfds);
+    events[0].events = EPOLLOUT;
+    events[0].data.fd = userfd;
+    events[1].events = EPOLLIN | EPOLLOUT;
+    events[1].data.fd = userfd2;
+
+    handle_writable_user_ExpectAndReturn(userfd, EXIT_SUCCESS);
+    handle_writable_user_ExpectAndReturn(userfd2, EXIT_SUCCESS);
+    handle_registered_user_ExpectAndReturn(userfd2, EXIT_SUCCESS);
+    ret = process_fds(epollfd, listenfd, events, 2);
 
-    TEST_ASSERT_EQUAL_INT(listenfd, ret);
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
 }
 
-void test_set_fds_add_users(void) {
-    int num_users = 2;
-    int user_fds[2] = {3, 4};
-    fd_set rfds;
+void test_process_fds_pass_handle_zerocopy_completions(void) {
+    int epollfd = 1;
     int listenfd = 2;
+    int userfd = 3;
+    struct epoll_event events[1];
     int ret;
 
-    os_fd_zero_Expect(&rfds);
-    os_fd_set_Expect(listenfd, &rfds);
-    get_num_users_ExpectAndReturn(num_users);
-    os_malloc_ExpectAndReturn(num_users*sizeof(int), user_fds);
-    get_user_fds_Expect(user_fds);
-    os_fd_set_Expect(user_fds[0], &rfds);
-    os_fd_set_Expect(user_fds[1], &rfds);
-    os_free_Expect(user_fds);
-    ret = set_fds(listenfd, &rfds);
+    events[0].events = EPOLLERR | EPOLLOUT;
+    events[0].data.fd = userfd;
+
+    handle_zerocopy_completions_ExpectAndReturn(userfd, EXIT_SUCCESS);
+    handle_writable_user_ExpectAndReturn(userfd, EXIT_SUCCESS);
+    handle_registered_user_ExpectAndReturn(userfd, EXIT_SUCCESS);
+    ret = process_fds(epollfd, listenfd, events, 1);
 
-    TEST_ASSERT_EQUAL_INT(user_fds[num_users-1], ret);
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
 }
 
-void test_set_fds_no_users(void) {
-    fd_set rfds;
+void test_process_fds_pass_handler(void) {
+    int epollfd = 1;
     int listenfd = 2;
+    int wakefd = 3;
+    int userfd = 4;
+    struct epoll_event events[2];
+    int ret;
+
+    events[0].events = EPOLLIN;
+    events[0].data.fd = wakefd;
+    events[1].events = EPOLLIN;
+    events[1].data.fd = userfd;
+
+    register_event_handler(wakefd, &handler_pass);
+    handle_registered_user_ExpectAndReturn(userfd, EXIT_SUCCESS);
+    ret = process_fds(epollfd, listenfd, events, 2);
+    unregister_event_handler(wakefd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_register_event_handler_fail_full(void) {
     int ret;
 
-    os_fd_zero_Expect(&rfds);
-    os_fd_set_Expect(listenfd, &rfds);
-    get_num_users_ExpectAndReturn(0);
-    ret = set_fds(listenfd, &rfds);
+    for (int fd = 0; fd < MAX_EVENT_HANDLERS; fd++) {
+        ret = register_event_handler(fd, &handler_pass);
+        TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    }
+
+    ret = register_event_handler(MAX_EVENT_HANDLERS, &handler_pass);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    for (int fd = 0; fd < MAX_EVENT_HANDLERS; fd++) {
+        unregister_event_handler(fd);
+    }
+}
+
+void test_sample_listen_queue_fail_getsockopt(void) {
+    int listenfd = 2;
+
+    os_getsockopt_ExpectAnyArgsAndReturn(-1);
+    sample_listen_queue(listenfd);
+}
+
+void test_sample_listen_queue_pass_full(void) {
+    struct tcp_info info;
+    int listenfd = 2;
+
+    memset(&info, 0, sizeof(info));
+    info.tcpi_unacked = 128;
+    info.tcpi_sacked = 128;
+
+    os_getsockopt_ExpectAndReturn(listenfd, IPPROTO_TCP, TCP_INFO,
+                                  NULL, NULL, 0);
+    os_getsockopt_IgnoreArg_optval();
+    os_getsockopt_IgnoreArg_optlen();
+    os_getsockopt_ReturnMemThruPtr_optval(&info, sizeof(info));
+    add_stat_Expect(STAT_LISTEN_QUEUE_FULL, 1);
+    sample_listen_queue(listenfd);
+}
+
+void test_sample_listen_queue_pass_not_full(void) {
+    struct tcp_info info;
+    int listenfd = 2;
+
+    memset(&info, 0, sizeof(info));
+    info.tcpi_unacked = 3;
+    info.tcpi_sacked = 128;
+
+    os_getsockopt_ExpectAndReturn(listenfd, IPPROTO_TCP, TCP_INFO,
+                                  NULL, NULL, 0);
+    os_getsockopt_IgnoreArg_optval();
+    os_getsockopt_IgnoreArg_optlen();
+    os_getsockopt_ReturnMemThruPtr_optval(&info, sizeof(info));
+    sample_listen_queue(listenfd);
+}
+
+void test_unregister_event_handler_pass(void) {
+    register_event_handler(3, &handler_pass);
+    register_event_handler(4, &handler_fail);
+    unregister_event_handler(3);
 
-    TEST_ASSERT_EQUAL_INT(listenfd, ret);
+    TEST_ASSERT_NULL(get_event_handler(3));
+    TEST_ASSERT_EQUAL_PTR(&handler_fail, get_event_handler(4));
+    unregister_event_handler(4);
 }
 
 /* not needed when using generate_test_runner.rb */
 int main(void) {
     UNITY_BEGIN();
+    RUN_TEST(test_accept_users_fail_accept);
+    RUN_TEST(test_accept_users_fail_add_fd_to_event_loop);
+    RUN_TEST(test_accept_users_fail_handle_new_user);
+    RUN_TEST(test_accept_users_pass);
+    RUN_TEST(test_accept_users_pass_budget);
+    RUN_TEST(test_accept_users_pass_tune_sock_fail);
+    RUN_TEST(test_accept_users_pass_emfile);
+    RUN_TEST(test_accept_users_pass_econnaborted);
+    RUN_TEST(test_add_fd_to_event_loop_fail_epoll_ctl);
+    RUN_TEST(test_add_fd_to_event_loop_pass);
+    RUN_TEST(test_get_event_handler_fail);
+    RUN_TEST(test_get_event_handler_pass);
     RUN_TEST(test_process_fds_fail_accept);
-    RUN_TEST(test_process_fds_fail_handle_new_user);
     RUN_TEST(test_process_fds_fail_handle_registered_user);
-    RUN_TEST(test_process_fds_fail_set_fd_nonblocking);
-    RUN_TEST(test_process_fds_pass_handle_new_user);
+    RUN_TEST(test_process_fds_fail_handler);
+    RUN_TEST(test_process_fds_fail_handle_writable_user);
+    RUN_TEST(test_process_fds_fail_handle_zerocopy_completions);
+    RUN_TEST(test_process_fds_pass_accept);
     RUN_TEST(test_process_fds_pass_handle_registered_user);
-    RUN_TEST(test_set_fds_fail_malloc);
-    RUN_TEST(test_set_fds_add_users);
-    RUN_TEST(test_set_fds_no_users);
+    RUN_TEST(test_process_fds_pass_handle_writable_user);
+    RUN_TEST(test_process_fds_pass_handle_zerocopy_completions);
+    RUN_TEST(test_process_fds_pass_handler);
+    RUN_TEST(test_register_event_handler_fail_full);
+    RUN_TEST(test_sample_listen_queue_fail_getsockopt);
+    RUN_TEST(test_sample_listen_queue_pass_full);
+    RUN_TEST(test_sample_listen_queue_pass_not_full);
+    RUN_TEST(test_unregister_event_handler_pass);
     return UNITY_END();
 }
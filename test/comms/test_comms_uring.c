@@ -0,0 +1,349 @@
+// Copyright 2020 author. All rights reserved.
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "mocks/mock_comms_uring_internal.h"
+#include "mocks/mock_osdep.h"
+#include "mocks/mock_timer.h"
+#include "mocks/mock_uring.h"
+#include "mocks/mock_user.h"
+#include "src/comms/comms_uring.h"
+#include "unity/src/unity.h"
+
+#define URING_ENTRIES 256
+#define URING_BUF_GROUP 0
+#define URING_NR_BUFS 256
+#define URING_BUF_SIZE 4096
+
+void setUp(void) {
+    /* set stuff up here */
+    mock_comms_uring_internal_Init();
+    mock_osdep_Init();
+    mock_timer_Init();
+    mock_uring_Init();
+    mock_user_Init();
+}
+
+void tearDown(void) {
+    /* clean stuff up here */
+    mock_comms_uring_internal_Verify();
+    mock_comms_uring_internal_Destroy();
+    mock_osdep_Verify();
+    mock_osdep_Destroy();
+    mock_timer_Verify();
+    mock_timer_Destroy();
+    mock_uring_Verify();
+    mock_uring_Destroy();
+    mock_user_Verify();
+    mock_user_Destroy();
+}
+
+int handler(int fd) {
+    return fd;
+}
+
+void test_add_uring_event_handler_pass(void) {
+    int ret;
+
+    arm_poll_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
+    ret = add_uring_event_handler(7, &handler);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_drain_uring_event_loop_fail_get_sqe(void) {
+    int ret;
+
+    get_sqe_ExpectAnyArgsAndReturn(NULL);
+    set_user_closer_Expect(NULL);
+    drop_all_users_Expect();
+    update_user_list_Expect(-1);
+    ret = drain_uring_event_loop();
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_drain_uring_event_loop_fail_monitor_socks(void) {
+    struct io_uring_sqe sqe;
+    int ret;
+
+    get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_cancel_Expect(&sqe,
+                             URING_USER_DATA(NULL, URING_OP_ACCEPT),
+                             URING_USER_DATA(NULL, URING_OP_CANCEL));
+    get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_timeout_ExpectAnyArgs();
+    has_queued_sends_ExpectAnyArgsAndReturn(true);
+    arm_timer_timeout_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
+    uring_submit_ExpectAnyArgsAndReturn(-1);
+    os_get_error_ExpectAndReturn(EBADF);
+    set_user_closer_Expect(NULL);
+    drop_all_users_Expect();
+    update_user_list_Expect(-1);
+    ret = drain_uring_event_loop();
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_drain_uring_event_loop_pass(void) {
+    struct io_uring_sqe sqe;
+    int ret;
+
+    get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_cancel_ExpectAnyArgs();
+    get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_timeout_ExpectAnyArgs();
+    has_queued_sends_ExpectAnyArgsAndReturn(true);
+    arm_timer_timeout_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
+    uring_submit_ExpectAnyArgsAndReturn(1);
+    uring_peek_cqe_ExpectAnyArgsAndReturn(NULL);
+    run_timers_ExpectAndReturn(0);
+    update_user_list_Expect(-1);
+    has_queued_sends_ExpectAnyArgsAndReturn(false);
+    set_user_closer_Expect(NULL);
+    drop_all_users_Expect();
+    update_user_list_Expect(-1);
+    ret = drain_uring_event_loop();
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_exit_uring_event_loop_pass(void) {
+    os_free_Expect(NULL);
+    uring_exit_buf_ring_ExpectAnyArgs();
+    uring_exit_ExpectAnyArgs();
+    exit_uring_event_loop();
+}
+
+void test_init_uring_event_loop_fail_arm_accept(void) {
+    int listenfd = 3;
+    int ret;
+
+    os_memset_ExpectAnyArgsAndReturn(NULL);
+    uring_init_ExpectAndReturn(NULL, URING_ENTRIES, 0, EXIT_SUCCESS);
+    uring_init_IgnoreArg_ring();
+    uring_init_buf_ring_ExpectAndReturn(NULL,
+                                        NULL,
+                                        URING_BUF_GROUP,
+                                        URING_NR_BUFS,
+                                        URING_BUF_SIZE,
+                                        EXIT_SUCCESS);
+    uring_init_buf_ring_IgnoreArg_ring();
+    uring_init_buf_ring_IgnoreArg_br();
+    arm_accept_ExpectAnyArgsAndReturn(EXIT_FAILURE);
+    uring_exit_buf_ring_ExpectAnyArgs();
+    uring_exit_ExpectAnyArgs();
+    ret = init_uring_event_loop(listenfd, false);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_init_uring_event_loop_fail_init_buf_ring(void) {
+    int listenfd = 3;
+    int ret;
+
+    os_memset_ExpectAnyArgsAndReturn(NULL);
+    uring_init_ExpectAndReturn(NULL, URING_ENTRIES, 0, EXIT_SUCCESS);
+    uring_init_IgnoreArg_ring();
+    uring_init_buf_ring_ExpectAnyArgsAndReturn(EXIT_FAILURE);
+    uring_exit_ExpectAnyArgs();
+    ret = init_uring_event_loop(listenfd, false);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_init_uring_event_loop_fail_uring_init(void) {
+    int listenfd = 3;
+    int ret;
+
+    os_memset_ExpectAnyArgsAndReturn(NULL);
+    uring_init_ExpectAndReturn(NULL, URING_ENTRIES, 0, EXIT_FAILURE);
+    uring_init_IgnoreArg_ring();
+    ret = init_uring_event_loop(listenfd, false);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_init_uring_event_loop_pass(void) {
+    int listenfd = 3;
+    int ret;
+
+    os_memset_ExpectAnyArgsAndReturn(NULL);
+    uring_init_ExpectAndReturn(NULL, URING_ENTRIES, 0, EXIT_SUCCESS);
+    uring_init_IgnoreArg_ring();
+    uring_init_buf_ring_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
+    arm_accept_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
+    set_msg_sender_Expect(&uring_send_broadcast_msg);
+    set_user_closer_Expect(&uring_close_user);
+    ret = init_uring_event_loop(listenfd, false);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_init_uring_event_loop_pass_sqpoll(void) {
+    int listenfd = 3;
+    int ret;
+
+    os_memset_ExpectAnyArgsAndReturn(NULL);
+    uring_init_ExpectAndReturn(NULL,
+                               URING_ENTRIES,
+                               IORING_SETUP_SQPOLL,
+                               EXIT_SUCCESS);
+    uring_init_IgnoreArg_ring();
+    uring_init_buf_ring_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
+    arm_accept_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
+    set_msg_sender_Expect(&uring_send_broadcast_msg);
+    set_user_closer_Expect(&uring_close_user);
+    ret = init_uring_event_loop(listenfd, true);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_monitor_socks_uring_fail_arm_timer_timeout(void) {
+    int ret;
+
+    arm_timer_timeout_ExpectAnyArgsAndReturn(EXIT_FAILURE);
+    uring_submit_ExpectAndReturn(NULL, 1, 0);
+    uring_submit_IgnoreArg_ring();
+    uring_peek_cqe_ExpectAnyArgsAndReturn(NULL);
+    run_timers_ExpectAndReturn(1);
+    update_user_list_Expect(-1);
+    ret = monitor_socks_uring();
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_monitor_socks_uring_fail_submit_ebadf(void) {
+    int ret;
+
+    arm_timer_timeout_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
+    uring_submit_ExpectAndReturn(NULL, 1, -1);
+    uring_submit_IgnoreArg_ring();
+    os_get_error_ExpectAndReturn(EBADF);
+    ret = monitor_socks_uring();
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_monitor_socks_uring_fail_submit_eintr(void) {
+    int ret;
+
+    arm_timer_timeout_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
+    uring_submit_ExpectAndReturn(NULL, 1, -1);
+    uring_submit_IgnoreArg_ring();
+    os_get_error_ExpectAndReturn(EINTR);
+    ret = monitor_socks_uring();
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_monitor_socks_uring_pass(void) {
+    struct io_uring_cqe cqe1 = {.user_data = 1, .res = 5, .flags = 0};
+    struct io_uring_cqe cqe2 = {.user_data = 3, .res = 10, .flags = 0};
+    int ret;
+
+    arm_timer_timeout_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
+    uring_submit_ExpectAndReturn(NULL, 1, 0);
+    uring_submit_IgnoreArg_ring();
+    uring_peek_cqe_ExpectAnyArgsAndReturn(&cqe1);
+    process_cqe_Expect(NULL, &cqe1);
+    process_cqe_IgnoreArg_loop();
+    uring_cqe_seen_ExpectAnyArgs();
+    uring_peek_cqe_ExpectAnyArgsAndReturn(&cqe2);
+    process_cqe_Expect(NULL, &cqe2);
+    process_cqe_IgnoreArg_loop();
+    uring_cqe_seen_ExpectAnyArgs();
+    uring_peek_cqe_ExpectAnyArgsAndReturn(NULL);
+    run_timers_ExpectAndReturn(0);
+    update_user_list_Expect(-1);
+    ret = monitor_socks_uring();
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_uring_close_user_fail_get_conn(void) {
+    int fd = 4;
+
+    get_conn_ExpectAndReturn(NULL, fd, NULL);
+    get_conn_IgnoreArg_loop();
+    uring_close_user(fd);
+}
+
+void test_uring_close_user_pass(void) {
+    struct uring_conn conn = {.fd = 4};
+
+    get_conn_ExpectAndReturn(NULL, conn.fd, &conn);
+    get_conn_IgnoreArg_loop();
+    close_conn_Expect(NULL, &conn);
+    close_conn_IgnoreArg_loop();
+    release_conn_Expect(&conn);
+    uring_close_user(conn.fd);
+}
+
+void test_uring_send_broadcast_msg_fail_get_conn(void) {
+    struct msg_frame frame;
+    int fd = 4;
+    int ret;
+
+    get_conn_ExpectAndReturn(NULL, fd, NULL);
+    get_conn_IgnoreArg_loop();
+    ret = uring_send_broadcast_msg(fd, &frame);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_uring_send_broadcast_msg_fail_queue_broadcast_msg(void) {
+    struct uring_conn conn = {.fd = 4};
+    struct msg_frame frame;
+    int ret;
+
+    get_conn_ExpectAndReturn(NULL, conn.fd, &conn);
+    get_conn_IgnoreArg_loop();
+    queue_broadcast_msg_ExpectAndReturn(NULL, &conn, &frame, EXIT_FAILURE);
+    queue_broadcast_msg_IgnoreArg_loop();
+    close_conn_Expect(NULL, &conn);
+    close_conn_IgnoreArg_loop();
+    ret = uring_send_broadcast_msg(conn.fd, &frame);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_uring_send_broadcast_msg_pass(void) {
+    struct uring_conn conn = {.fd = 4};
+    struct msg_frame frame;
+    int ret;
+
+    get_conn_ExpectAndReturn(NULL, conn.fd, &conn);
+    get_conn_IgnoreArg_loop();
+    queue_broadcast_msg_ExpectAndReturn(NULL, &conn, &frame, EXIT_SUCCESS);
+    queue_broadcast_msg_IgnoreArg_loop();
+    ret = uring_send_broadcast_msg(conn.fd, &frame);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+/* not needed when using generate_test_runner.rb */
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_add_uring_event_handler_pass);
+    RUN_TEST(test_drain_uring_event_loop_fail_get_sqe);
+    RUN_TEST(test_drain_uring_event_loop_fail_monitor_socks);
+    RUN_TEST(test_drain_uring_event_loop_pass);
+    RUN_TEST(test_exit_uring_event_loop_pass);
+    RUN_TEST(test_init_uring_event_loop_fail_arm_accept);
+    RUN_TEST(test_init_uring_event_loop_fail_init_buf_ring);
+    RUN_TEST(test_init_uring_event_loop_fail_uring_init);
+    RUN_TEST(test_init_uring_event_loop_pass);
+    RUN_TEST(test_init_uring_event_loop_pass_sqpoll);
+    RUN_TEST(test_monitor_socks_uring_fail_arm_timer_timeout);
+    RUN_TEST(test_monitor_socks_uring_fail_submit_ebadf);
+    RUN_TEST(test_monitor_socks_uring_fail_submit_eintr);
+    RUN_TEST(test_monitor_socks_uring_pass);
+    RUN_TEST(test_uring_close_user_fail_get_conn);
+    RUN_TEST(test_uring_close_user_pass);
+    RUN_TEST(test_uring_send_broadcast_msg_fail_get_conn);
+    RUN_TEST(test_uring_send_broadcast_msg_fail_queue_broadcast_msg);
+    RUN_TEST(test_uring_send_broadcast_msg_pass);
+    return UNITY_END();
+}
@@ -0,0 +1,1043 @@
+// Copyright 2020 author. All rights reserved.
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "include/common.h"
+#include "include/list.h"
+#include "mocks/mock_comms.h"
+#include "mocks/mock_message.h"
+#include "mocks/mock_osdep.h"
+#include "mocks/mock_stats.h"
+#include "mocks/mock_timer.h"
+#include "mocks/mock_uring.h"
+#include "mocks/mock_user.h"
+#include "src/comms/comms_uring_internal.h"
+#include "unity/src/unity.h"
+
+#define NUM_CONNS 64
+
+static struct uring_conn *conns[NUM_CONNS];
+
+void setUp(void) {
+    /* set stuff up here */
+    mock_comms_Init();
+    mock_message_Init();
+    mock_osdep_Init();
+    mock_stats_Init();
+    mock_timer_Init();
+    mock_uring_Init();
+    mock_user_Init();
+    memset(conns, 0, sizeof(conns));
+}
+
+void tearDown(void) {
+    /* clean stuff up here */
+    mock_comms_Verify();
+    mock_comms_Destroy();
+    mock_message_Verify();
+    mock_message_Destroy();
+    mock_osdep_Verify();
+    mock_osdep_Destroy();
+    mock_stats_Verify();
+    mock_stats_Destroy();
+    mock_timer_Verify();
+    mock_timer_Destroy();
+    mock_uring_Verify();
+    mock_uring_Destroy();
+    mock_user_Verify();
+    mock_user_Destroy();
+}
+
+static int handled_fd;
+
+static void init_loop(struct uring_loop *loop) {
+    memset(loop, 0, sizeof(struct uring_loop));
+    loop->conns = conns;
+    loop->num_conns = NUM_CONNS;
+    loop->listenfd = 3;
+}
+
+int handler(int fd) {
+    handled_fd = fd;
+    return EXIT_SUCCESS;
+}
+
+struct test_frame {
+    struct msg_frame frame;
+    uint8_t buf[16];
+};
+
+void init_timer_save_callback(struct timer *timer,
+                              timer_callback callback,
+                              int num_calls) {
+    UNUSED_PARAMETER(num_calls);
+
+    timer->callback = callback;
+}
+
+static void init_conn(struct uring_conn *conn, int fd) {
+    memset(conn, 0, sizeof(struct uring_conn));
+    conn->fd = fd;
+    INIT_LIST_HEAD(&conn->send_queue);
+}
+
+void test_add_conn_fail_malloc(void) {
+    struct uring_loop loop;
+    struct uring_conn *ret;
+    int fd = 5;
+
+    init_loop(&loop);
+
+    os_malloc_ExpectAndReturn(sizeof(struct uring_conn), NULL);
+    ret = add_conn(&loop, fd);
+
+    TEST_ASSERT_NULL(ret);
+    TEST_ASSERT_NULL(conns[fd]);
+}
+
+void test_add_conn_fail_realloc(void) {
+    struct uring_loop loop;
+    struct uring_conn *ret;
+    int fd = NUM_CONNS;
+
+    init_loop(&loop);
+
+    os_realloc_ExpectAndReturn(conns,
+                               2 * NUM_CONNS * sizeof(struct uring_conn *),
+                               NULL);
+    ret = add_conn(&loop, fd);
+
+    TEST_ASSERT_NULL(ret);
+    TEST_ASSERT_EQUAL_INT(NUM_CONNS, loop.num_conns);
+}
+
+void test_add_conn_pass(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    struct uring_conn *ret;
+    int fd = 5;
+
+    init_loop(&loop);
+
+    os_malloc_ExpectAndReturn(sizeof(struct uring_conn), &conn);
+    init_timer_ExpectAnyArgs();
+    init_timer_ExpectAnyArgs();
+    ret = add_conn(&loop, fd);
+
+    TEST_ASSERT_EQUAL_PTR(&conn, ret);
+    TEST_ASSERT_EQUAL_PTR(&conn, conns[fd]);
+    TEST_ASSERT_EQUAL_PTR(&loop, conn.loop);
+    TEST_ASSERT_EQUAL_INT(fd, conn.fd);
+    TEST_ASSERT_TRUE(list_empty(&conn.send_queue));
+}
+
+void test_add_conn_pass_grow(void) {
+    struct uring_conn *grown[2 * NUM_CONNS];
+    struct uring_loop loop;
+    struct uring_conn conn;
+    struct uring_conn *ret;
+    int fd = NUM_CONNS;
+
+    init_loop(&loop);
+
+    os_realloc_ExpectAndReturn(conns,
+                               2 * NUM_CONNS * sizeof(struct uring_conn *),
+                               grown);
+    os_memset_ExpectAndReturn(&grown[NUM_CONNS],
+                              0,
+                              NUM_CONNS * sizeof(struct uring_conn *),
+                              NULL);
+    os_memset_IgnoreArg_s();
+    os_malloc_ExpectAndReturn(sizeof(struct uring_conn), &conn);
+    init_timer_ExpectAnyArgs();
+    init_timer_ExpectAnyArgs();
+    ret = add_conn(&loop, fd);
+
+    TEST_ASSERT_EQUAL_PTR(&conn, ret);
+    TEST_ASSERT_EQUAL_PTR(grown, loop.conns);
+    TEST_ASSERT_EQUAL_INT(2 * NUM_CONNS, loop.num_conns);
+    TEST_ASSERT_EQUAL_PTR(&conn, grown[fd]);
+}
+
+void test_add_conn_pass_register_timeout(void) {
+    struct uring_loop loop;
+    struct uring_conn *conn;
+    struct io_uring_sqe sqe;
+    int fd = 5;
+
+    init_loop(&loop);
+    conn = malloc(sizeof(struct uring_conn));
+    TEST_ASSERT_NOT_NULL(conn);
+
+    os_malloc_ExpectAndReturn(sizeof(struct uring_conn), conn);
+    init_timer_StubWithCallback(&init_timer_save_callback);
+    TEST_ASSERT_EQUAL_PTR(conn, add_conn(&loop, fd));
+    conn->recv_armed = true;
+
+    // the connection is freed once the receive is cancelled
+    del_timer_Expect(&conn->register_timer);
+    del_timer_Expect(&conn->stall_timer);
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_cancel_ExpectAnyArgs();
+    os_close_ExpectAndReturn(fd, 0);
+    conn->register_timer.callback(&conn->register_timer);
+
+    TEST_ASSERT_TRUE(conn->closing);
+    TEST_ASSERT_NULL(conns[fd]);
+    free(conn);
+}
+
+void test_add_conn_pass_stall_timeout(void) {
+    struct uring_loop loop;
+    struct uring_conn *conn;
+    struct io_uring_sqe sqe;
+    int fd = 5;
+
+    init_loop(&loop);
+    conn = malloc(sizeof(struct uring_conn));
+    TEST_ASSERT_NOT_NULL(conn);
+
+    os_malloc_ExpectAndReturn(sizeof(struct uring_conn), conn);
+    init_timer_StubWithCallback(&init_timer_save_callback);
+    TEST_ASSERT_EQUAL_PTR(conn, add_conn(&loop, fd));
+    conn->registered = true;
+    conn->recv_armed = true;
+
+    drop_user_ExpectAndReturn(fd, EXIT_SUCCESS);
+    del_timer_Expect(&conn->register_timer);
+    del_timer_Expect(&conn->stall_timer);
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_cancel_ExpectAnyArgs();
+    conn->stall_timer.callback(&conn->stall_timer);
+
+    TEST_ASSERT_TRUE(conn->closing);
+    TEST_ASSERT_NULL(conns[fd]);
+    free(conn);
+}
+
+void test_arm_accept_fail_get_sqe(void) {
+    struct uring_loop loop;
+    int ret;
+
+    init_loop(&loop);
+
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    uring_submit_ExpectAnyArgsAndReturn(-1);
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    ret = arm_accept(&loop);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_arm_accept_pass(void) {
+    struct uring_loop loop;
+    struct io_uring_sqe sqe;
+    int ret;
+
+    init_loop(&loop);
+
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_multishot_accept_Expect(&sqe,
+                                       loop.listenfd,
+                                       URING_USER_DATA(NULL,
+                                                       URING_OP_ACCEPT));
+    ret = arm_accept(&loop);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_arm_poll_fail_get_sqe(void) {
+    struct uring_loop loop;
+    int ret;
+
+    init_loop(&loop);
+    loop.handler_fd = 7;
+
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    uring_submit_ExpectAnyArgsAndReturn(-1);
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    ret = arm_poll(&loop);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_arm_poll_pass(void) {
+    struct uring_loop loop;
+    struct io_uring_sqe sqe;
+    int ret;
+
+    init_loop(&loop);
+    loop.handler_fd = 7;
+
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_poll_add_Expect(&sqe,
+                               7,
+                               POLLIN,
+                               URING_USER_DATA(NULL, URING_OP_POLL));
+    ret = arm_poll(&loop);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_arm_recv_fail_get_sqe(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    int ret;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    uring_submit_ExpectAnyArgsAndReturn(-1);
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    ret = arm_recv(&loop, &conn);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_FALSE(conn.recv_armed);
+}
+
+void test_arm_recv_pass(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    struct io_uring_sqe sqe;
+    int ret;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_recv_multishot_Expect(&sqe,
+                                     conn.fd,
+                                     loop.buf_ring.bgid,
+                                     URING_USER_DATA(&conn, URING_OP_RECV));
+    ret = arm_recv(&loop, &conn);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_TRUE(conn.recv_armed);
+}
+
+void test_arm_timer_timeout_fail_get_sqe(void) {
+    struct uring_loop loop;
+    int ret;
+
+    init_loop(&loop);
+
+    get_timer_timeout_ExpectAndReturn(100);
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    uring_submit_ExpectAnyArgsAndReturn(-1);
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    ret = arm_timer_timeout(&loop);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_FALSE(loop.timer_armed);
+}
+
+void test_arm_timer_timeout_pass(void) {
+    struct uring_loop loop;
+    struct io_uring_sqe sqe;
+    int ret;
+
+    init_loop(&loop);
+
+    get_timer_timeout_ExpectAndReturn(1500);
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_timeout_Expect(&sqe,
+                              &loop.timer_ts,
+                              1,
+                              URING_USER_DATA(NULL, URING_OP_TIMER));
+    ret = arm_timer_timeout(&loop);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_TRUE(loop.timer_armed);
+    TEST_ASSERT_EQUAL_INT(1, loop.timer_ts.tv_sec);
+    TEST_ASSERT_EQUAL_INT(500000000, loop.timer_ts.tv_nsec);
+}
+
+void test_arm_timer_timeout_pass_armed(void) {
+    struct uring_loop loop;
+    int ret;
+
+    init_loop(&loop);
+    loop.timer_armed = true;
+
+    get_timer_timeout_ExpectAndReturn(100);
+    ret = arm_timer_timeout(&loop);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_arm_timer_timeout_pass_no_timers(void) {
+    struct uring_loop loop;
+    int ret;
+
+    init_loop(&loop);
+
+    get_timer_timeout_ExpectAndReturn(-1);
+    ret = arm_timer_timeout(&loop);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_FALSE(loop.timer_armed);
+}
+
+void test_close_conn_pass_already_closing(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+    conn.closing = true;
+
+    close_conn(&loop, &conn);
+}
+
+void test_close_conn_pass_registered(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    struct io_uring_sqe sqe;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+    conn.registered = true;
+    conn.recv_armed = true;
+    conns[conn.fd] = &conn;
+
+    del_timer_Expect(&conn.register_timer);
+    del_timer_Expect(&conn.stall_timer);
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_cancel_Expect(&sqe,
+                             URING_USER_DATA(&conn, URING_OP_RECV),
+                             URING_USER_DATA(NULL, URING_OP_CANCEL));
+    close_conn(&loop, &conn);
+
+    TEST_ASSERT_TRUE(conn.closing);
+    TEST_ASSERT_NULL(conns[conn.fd]);
+}
+
+void test_close_conn_pass_unregistered(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+    conns[conn.fd] = &conn;
+
+    del_timer_Expect(&conn.register_timer);
+    del_timer_Expect(&conn.stall_timer);
+    os_close_ExpectAndReturn(conn.fd, 0);
+    close_conn(&loop, &conn);
+
+    TEST_ASSERT_TRUE(conn.closing);
+    TEST_ASSERT_NULL(conns[conn.fd]);
+}
+
+void test_consume_input_fail_decode_msg(void) {
+    struct uring_conn conn;
+    uint8_t buf[8] = {0};
+    int ret;
+
+    init_conn(&conn, 5);
+
+    decode_msg_new_user_ExpectAndReturn(buf, sizeof(buf), NULL, -1);
+    decode_msg_new_user_IgnoreArg_data();
+    ret = consume_input(&conn, buf, sizeof(buf));
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_consume_input_fail_register_new_user(void) {
+    struct uring_conn conn;
+    uint8_t buf[8] = {0};
+    int ret;
+
+    init_conn(&conn, 5);
+
+    decode_msg_new_user_ExpectAndReturn(buf, sizeof(buf), NULL, sizeof(buf));
+    decode_msg_new_user_IgnoreArg_data();
+    register_new_user_ExpectAndReturn(conn.fd, NULL, EXIT_FAILURE);
+    register_new_user_IgnoreArg_user_msg();
+    ret = consume_input(&conn, buf, sizeof(buf));
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_FALSE(conn.registered);
+}
+
+void test_consume_input_pass_complete_partial(void) {
+    struct uring_conn conn;
+    uint8_t in_buf[8] = {0x01, 0x02, 0x03};
+    uint8_t buf[5] = {0x04, 0x05, 0x06, 0x07, 0x08};
+    int ret;
+
+    init_conn(&conn, 5);
+    conn.registered = true;
+    conn.in_buf = in_buf;
+    conn.in_len = 3;
+    conn.in_cap = sizeof(in_buf);
+
+    os_memcpy_ExpectAndReturn(&in_buf[3], buf, sizeof(buf), NULL);
+    os_memcpy_IgnoreArg_dest();
+    os_memcpy_ReturnMemThruPtr_dest(buf, sizeof(buf));
+    decode_msg_registered_user_ExpectAndReturn(in_buf,
+                                               sizeof(in_buf),
+                                               NULL,
+                                               sizeof(in_buf));
+    decode_msg_registered_user_IgnoreArg_data();
+    broadcast_user_msg_ExpectAndReturn(conn.fd, NULL, EXIT_SUCCESS);
+    broadcast_user_msg_IgnoreArg_user_msg();
+    ret = consume_input(&conn, buf, sizeof(buf));
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_INT(0, conn.in_len);
+    TEST_ASSERT_EQUAL_UINT8(0x04, in_buf[3]);
+}
+
+void test_consume_input_pass_keep_partial(void) {
+    struct uring_conn conn;
+    uint8_t in_buf[4];
+    uint8_t buf[10] = {
+        0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0xaa,   // complete frame
+        0x00, 0x02, 0x00                            // partial frame
+    };
+    int ret;
+
+    init_conn(&conn, 5);
+
+    decode_msg_new_user_ExpectAndReturn(buf, sizeof(buf), NULL, 7);
+    decode_msg_new_user_IgnoreArg_data();
+    register_new_user_ExpectAndReturn(conn.fd, NULL, EXIT_SUCCESS);
+    register_new_user_IgnoreArg_user_msg();
+    del_timer_Expect(&conn.register_timer);
+    decode_msg_registered_user_ExpectAndReturn(&buf[7], 3, NULL, 0);
+    decode_msg_registered_user_IgnoreArg_data();
+    os_realloc_ExpectAndReturn(NULL, 3, in_buf);
+    ret = consume_input(&conn, buf, sizeof(buf));
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_TRUE(conn.registered);
+    TEST_ASSERT_EQUAL_PTR(in_buf, conn.in_buf);
+    TEST_ASSERT_EQUAL_INT(3, conn.in_len);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(in_buf, &buf[7], 3));
+}
+
+void test_get_conn_fail_out_of_range(void) {
+    struct uring_loop loop;
+
+    init_loop(&loop);
+
+    TEST_ASSERT_NULL(get_conn(&loop, -1));
+    TEST_ASSERT_NULL(get_conn(&loop, NUM_CONNS));
+}
+
+void test_get_conn_pass(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+
+    init_loop(&loop);
+    conns[5] = &conn;
+
+    TEST_ASSERT_EQUAL_PTR(&conn, get_conn(&loop, 5));
+}
+
+void test_get_sqe_pass_after_submit(void) {
+    struct uring_loop loop;
+    struct io_uring_sqe sqe;
+
+    init_loop(&loop);
+
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    uring_submit_ExpectAndReturn(NULL, 0, 1);
+    uring_submit_IgnoreArg_ring();
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+
+    TEST_ASSERT_EQUAL_PTR(&sqe, get_sqe(&loop));
+}
+
+void test_handle_accept_cqe_fail_accept(void) {
+    struct uring_loop loop;
+    struct io_uring_sqe sqe;
+
+    init_loop(&loop);
+
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_multishot_accept_ExpectAnyArgs();
+    handle_accept_cqe(&loop, -EMFILE, 0);
+}
+
+void test_handle_accept_cqe_fail_add_conn(void) {
+    struct uring_loop loop;
+    int fd = 5;
+
+    init_loop(&loop);
+
+    tune_sock_ExpectAndReturn(fd, EXIT_SUCCESS);
+    os_malloc_ExpectAndReturn(sizeof(struct uring_conn), NULL);
+    os_close_ExpectAndReturn(fd, 0);
+    handle_accept_cqe(&loop, fd, IORING_CQE_F_MORE);
+}
+
+void test_handle_accept_cqe_pass_draining(void) {
+    struct uring_loop loop;
+
+    init_loop(&loop);
+    loop.draining = true;
+
+    handle_accept_cqe(&loop, -ECANCELED, 0);
+}
+
+void test_handle_accept_cqe_pass(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    struct io_uring_sqe sqe;
+    int fd = 5;
+
+    init_loop(&loop);
+
+    tune_sock_ExpectAndReturn(fd, EXIT_FAILURE);
+    add_stat_Expect(STAT_SOCK_TUNE_FAILED, 1);
+    os_malloc_ExpectAndReturn(sizeof(struct uring_conn), &conn);
+    init_timer_ExpectAnyArgs();
+    init_timer_ExpectAnyArgs();
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_recv_multishot_ExpectAnyArgs();
+    mod_timer_Expect(&conn.register_timer, USER_REGISTER_TIMEOUT_MS);
+    handle_accept_cqe(&loop, fd, IORING_CQE_F_MORE);
+
+    TEST_ASSERT_EQUAL_PTR(&conn, conns[fd]);
+    TEST_ASSERT_TRUE(conn.recv_armed);
+}
+
+void test_handle_poll_cqe_fail_poll(void) {
+    struct uring_loop loop;
+    struct io_uring_sqe sqe;
+
+    init_loop(&loop);
+    loop.handler_fd = 7;
+    loop.handler = &handler;
+    handled_fd = -1;
+
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_poll_add_ExpectAnyArgs();
+    handle_poll_cqe(&loop, -EINVAL);
+
+    TEST_ASSERT_EQUAL_INT(-1, handled_fd);
+}
+
+void test_handle_poll_cqe_pass(void) {
+    struct uring_loop loop;
+    struct io_uring_sqe sqe;
+
+    init_loop(&loop);
+    loop.handler_fd = 7;
+    loop.handler = &handler;
+    handled_fd = -1;
+
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_poll_add_ExpectAnyArgs();
+    handle_poll_cqe(&loop, POLLIN);
+
+    TEST_ASSERT_EQUAL_INT(7, handled_fd);
+}
+
+void test_handle_recv_cqe_pass_data(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    uint8_t buf[16] = {0};
+    uint16_t bid = 3;
+    uint32_t flags = IORING_CQE_F_MORE
+                     | IORING_CQE_F_BUFFER
+                     | (bid << IORING_CQE_BUFFER_SHIFT);
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+    conn.registered = true;
+    conn.recv_armed = true;
+
+    uring_get_buf_ExpectAndReturn(NULL, bid, buf);
+    uring_get_buf_IgnoreArg_br();
+    decode_msg_registered_user_ExpectAndReturn(buf, 6, NULL, 6);
+    decode_msg_registered_user_IgnoreArg_data();
+    broadcast_user_msg_ExpectAndReturn(conn.fd, NULL, EXIT_SUCCESS);
+    broadcast_user_msg_IgnoreArg_user_msg();
+    uring_recycle_buf_Expect(NULL, bid);
+    uring_recycle_buf_IgnoreArg_br();
+    handle_recv_cqe(&loop, &conn, 6, flags);
+
+    TEST_ASSERT_FALSE(conn.closing);
+    TEST_ASSERT_TRUE(conn.recv_armed);
+}
+
+void test_handle_recv_cqe_pass_enobufs(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    struct io_uring_sqe sqe;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+    conn.recv_armed = true;
+
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_recv_multishot_ExpectAnyArgs();
+    handle_recv_cqe(&loop, &conn, -ENOBUFS, 0);
+
+    TEST_ASSERT_FALSE(conn.closing);
+    TEST_ASSERT_TRUE(conn.recv_armed);
+}
+
+void test_handle_recv_cqe_pass_eof(void) {
+    struct uring_loop loop;
+    struct uring_conn *conn;
+
+    init_loop(&loop);
+    conn = malloc(sizeof(struct uring_conn));
+    TEST_ASSERT_NOT_NULL(conn);
+    init_conn(conn, 5);
+    conn->registered = true;
+    conn->recv_armed = true;
+    conns[conn->fd] = conn;
+
+    drop_user_ExpectAndReturn(conn->fd, EXIT_SUCCESS);
+    del_timer_Expect(&conn->register_timer);
+    del_timer_Expect(&conn->stall_timer);
+    os_free_Expect(NULL);
+    os_free_Expect(conn);
+    handle_recv_cqe(&loop, conn, 0, 0);
+
+    TEST_ASSERT_NULL(conns[5]);
+    free(conn);
+}
+
+void test_handle_send_cqe_fail_send(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+    conn.registered = true;
+    conn.send_in_flight = true;
+    conn.recv_armed = true;
+
+    drop_user_ExpectAndReturn(conn.fd, EXIT_SUCCESS);
+    del_timer_Expect(&conn.register_timer);
+    del_timer_Expect(&conn.stall_timer);
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    uring_submit_ExpectAnyArgsAndReturn(-1);
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    handle_send_cqe(&loop, &conn, -EPIPE);
+
+    TEST_ASSERT_TRUE(conn.closing);
+    TEST_ASSERT_FALSE(conn.send_in_flight);
+}
+
+void test_handle_send_cqe_pass(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    struct uring_send send;
+    struct msg_frame frame;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+    conn.send_in_flight = true;
+    frame.len = 10;
+    send.frame = &frame;
+    send.off = 0;
+    list_add_tail(&send.list, &conn.send_queue);
+
+    put_msg_frame_Expect(&frame);
+    os_free_Expect(&send);
+    del_timer_Expect(&conn.stall_timer);
+    handle_send_cqe(&loop, &conn, 10);
+
+    TEST_ASSERT_TRUE(list_empty(&conn.send_queue));
+    TEST_ASSERT_FALSE(conn.send_in_flight);
+}
+
+void test_handle_send_cqe_pass_short_send(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    struct uring_send send;
+    struct test_frame frame;
+    struct io_uring_sqe sqe;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+    conn.send_in_flight = true;
+    frame.frame.len = 10;
+    send.frame = &frame.frame;
+    send.off = 0;
+    list_add_tail(&send.list, &conn.send_queue);
+
+    mod_timer_Expect(&conn.stall_timer, USER_STALL_TIMEOUT_MS);
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_send_Expect(&sqe,
+                           conn.fd,
+                           &frame.frame.buf[4],
+                           6,
+                           MSG_NOSIGNAL,
+                           URING_USER_DATA(&conn, URING_OP_SEND));
+    uring_prep_send_IgnoreArg_buf();
+    handle_send_cqe(&loop, &conn, 4);
+
+    TEST_ASSERT_EQUAL_INT(4, send.off);
+    TEST_ASSERT_TRUE(conn.send_in_flight);
+}
+
+void test_has_queued_sends_pass(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    struct uring_send send;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+    conns[5] = &conn;
+
+    TEST_ASSERT_FALSE(has_queued_sends(&loop));
+
+    list_add_tail(&send.list, &conn.send_queue);
+
+    TEST_ASSERT_TRUE(has_queued_sends(&loop));
+}
+
+void test_process_cqe_pass_accept(void) {
+    struct uring_loop loop;
+    struct io_uring_cqe cqe;
+    struct io_uring_sqe sqe;
+
+    init_loop(&loop);
+    cqe.user_data = URING_USER_DATA(NULL, URING_OP_ACCEPT);
+    cqe.res = -EAGAIN;
+    cqe.flags = 0;
+
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_multishot_accept_ExpectAnyArgs();
+    process_cqe(&loop, &cqe);
+}
+
+void test_process_cqe_pass_cancel(void) {
+    struct uring_loop loop;
+    struct io_uring_cqe cqe;
+
+    init_loop(&loop);
+    cqe.user_data = URING_USER_DATA(NULL, URING_OP_CANCEL);
+    cqe.res = 0;
+    cqe.flags = 0;
+
+    process_cqe(&loop, &cqe);
+}
+
+void test_process_cqe_pass_timeout(void) {
+    struct uring_loop loop;
+    struct io_uring_cqe cqe;
+
+    init_loop(&loop);
+    cqe.user_data = URING_USER_DATA(NULL, URING_OP_TIMEOUT);
+    cqe.res = -ETIME;
+    cqe.flags = 0;
+
+    process_cqe(&loop, &cqe);
+
+    TEST_ASSERT_TRUE(loop.drain_expired);
+}
+
+void test_process_cqe_pass_timer(void) {
+    struct uring_loop loop;
+    struct io_uring_cqe cqe;
+
+    init_loop(&loop);
+    loop.timer_armed = true;
+    cqe.user_data = URING_USER_DATA(NULL, URING_OP_TIMER);
+    cqe.res = -ETIME;
+    cqe.flags = 0;
+
+    process_cqe(&loop, &cqe);
+
+    TEST_ASSERT_FALSE(loop.timer_armed);
+    TEST_ASSERT_FALSE(loop.drain_expired);
+}
+
+void test_queue_broadcast_msg_fail_malloc(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    struct msg_frame frame;
+    int ret;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+
+    os_malloc_ExpectAndReturn(sizeof(struct uring_send), NULL);
+    ret = queue_broadcast_msg(&loop, &conn, &frame);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_queue_broadcast_msg_fail_submit_send(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    struct msg_frame frame;
+    struct uring_send send;
+    int ret;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+
+    os_malloc_ExpectAndReturn(sizeof(struct uring_send), &send);
+    get_msg_frame_ExpectAndReturn(&frame, &frame);
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    uring_submit_ExpectAnyArgsAndReturn(-1);
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    put_msg_frame_Expect(&frame);
+    os_free_Expect(&send);
+    ret = queue_broadcast_msg(&loop, &conn, &frame);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_TRUE(list_empty(&conn.send_queue));
+}
+
+void test_queue_broadcast_msg_pass(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    struct msg_frame frame;
+    struct uring_send send;
+    struct io_uring_sqe sqe;
+    int ret;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+
+    os_malloc_ExpectAndReturn(sizeof(struct uring_send), &send);
+    get_msg_frame_ExpectAndReturn(&frame, &frame);
+    uring_get_sqe_ExpectAnyArgsAndReturn(&sqe);
+    uring_prep_send_ExpectAnyArgs();
+    timer_pending_ExpectAndReturn(&conn.stall_timer, false);
+    mod_timer_Expect(&conn.stall_timer, USER_STALL_TIMEOUT_MS);
+    ret = queue_broadcast_msg(&loop, &conn, &frame);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&send.list, conn.send_queue.next);
+    TEST_ASSERT_EQUAL_PTR(&frame, send.frame);
+    TEST_ASSERT_TRUE(conn.send_in_flight);
+}
+
+void test_queue_broadcast_msg_pass_send_in_flight(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    struct msg_frame frame;
+    struct uring_send send;
+    int ret;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+    conn.send_in_flight = true;
+
+    os_malloc_ExpectAndReturn(sizeof(struct uring_send), &send);
+    get_msg_frame_ExpectAndReturn(&frame, &frame);
+    timer_pending_ExpectAndReturn(&conn.stall_timer, true);
+    ret = queue_broadcast_msg(&loop, &conn, &frame);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_FALSE(list_empty(&conn.send_queue));
+}
+
+void test_release_conn_pass(void) {
+    struct uring_conn conn;
+    struct uring_send send;
+    struct msg_frame frame;
+    uint8_t in_buf[4];
+
+    init_conn(&conn, 5);
+    conn.closing = true;
+    conn.in_buf = in_buf;
+    send.frame = &frame;
+    list_add_tail(&send.list, &conn.send_queue);
+
+    put_msg_frame_Expect(&frame);
+    os_free_Expect(&send);
+    os_free_Expect(in_buf);
+    os_free_Expect(&conn);
+    release_conn(&conn);
+}
+
+void test_release_conn_pass_in_use(void) {
+    struct uring_conn conn;
+
+    init_conn(&conn, 5);
+    conn.closing = true;
+    conn.send_in_flight = true;
+
+    release_conn(&conn);
+}
+
+void test_submit_send_fail_get_sqe(void) {
+    struct uring_loop loop;
+    struct uring_conn conn;
+    int ret;
+
+    init_loop(&loop);
+    init_conn(&conn, 5);
+
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    uring_submit_ExpectAnyArgsAndReturn(-1);
+    uring_get_sqe_ExpectAnyArgsAndReturn(NULL);
+    ret = submit_send(&loop, &conn);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_FALSE(conn.send_in_flight);
+}
+
+/* not needed when using generate_test_runner.rb */
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_add_conn_fail_malloc);
+    RUN_TEST(test_add_conn_fail_realloc);
+    RUN_TEST(test_add_conn_pass);
+    RUN_TEST(test_add_conn_pass_grow);
+    RUN_TEST(test_add_conn_pass_register_timeout);
+    RUN_TEST(test_add_conn_pass_stall_timeout);
+    RUN_TEST(test_arm_accept_fail_get_sqe);
+    RUN_TEST(test_arm_accept_pass);
+    RUN_TEST(test_arm_poll_fail_get_sqe);
+    RUN_TEST(test_arm_poll_pass);
+    RUN_TEST(test_arm_recv_fail_get_sqe);
+    RUN_TEST(test_arm_recv_pass);
+    RUN_TEST(test_arm_timer_timeout_fail_get_sqe);
+    RUN_TEST(test_arm_timer_timeout_pass);
+    RUN_TEST(test_arm_timer_timeout_pass_armed);
+    RUN_TEST(test_arm_timer_timeout_pass_no_timers);
+    RUN_TEST(test_close_conn_pass_already_closing);
+    RUN_TEST(test_close_conn_pass_registered);
+    RUN_TEST(test_close_conn_pass_unregistered);
+    RUN_TEST(test_consume_input_fail_decode_msg);
+    RUN_TEST(test_consume_input_fail_register_new_user);
+    RUN_TEST(test_consume_input_pass_complete_partial);
+    RUN_TEST(test_consume_input_pass_keep_partial);
+    RUN_TEST(test_get_conn_fail_out_of_range);
+    RUN_TEST(test_get_conn_pass);
+    RUN_TEST(test_get_sqe_pass_after_submit);
+    RUN_TEST(test_handle_accept_cqe_fail_accept);
+    RUN_TEST(test_handle_accept_cqe_fail_add_conn);
+    RUN_TEST(test_handle_accept_cqe_pass);
+    RUN_TEST(test_handle_accept_cqe_pass_draining);
+    RUN_TEST(test_handle_poll_cqe_fail_poll);
+    RUN_TEST(test_handle_poll_cqe_pass);
+    RUN_TEST(test_handle_recv_cqe_pass_data);
+    RUN_TEST(test_handle_recv_cqe_pass_enobufs);
+    RUN_TEST(test_handle_recv_cqe_pass_eof);
+    RUN_TEST(test_handle_send_cqe_fail_send);
+    RUN_TEST(test_handle_send_cqe_pass);
+    RUN_TEST(test_handle_send_cqe_pass_short_send);
+    RUN_TEST(test_has_queued_sends_pass);
+    RUN_TEST(test_process_cqe_pass_accept);
+    RUN_TEST(test_process_cqe_pass_cancel);
+    RUN_TEST(test_process_cqe_pass_timeout);
+    RUN_TEST(test_process_cqe_pass_timer);
+    RUN_TEST(test_queue_broadcast_msg_fail_malloc);
+    RUN_TEST(test_queue_broadcast_msg_fail_submit_send);
+    RUN_TEST(test_queue_broadcast_msg_pass);
+    RUN_TEST(test_queue_broadcast_msg_pass_send_in_flight);
+    RUN_TEST(test_release_conn_pass);
+    RUN_TEST(test_release_conn_pass_in_use);
+    RUN_TEST(test_submit_send_fail_get_sqe);
+    return UNITY_END();
+}
@@ -0,0 +1,233 @@
+// Copyright 2020 author. All rights reserved.
+
+#include <stdlib.h>
+
+#include "include/common.h"
+#include "mocks/mock_fanout_internal.h"
+#include "mocks/mock_osdep.h"
+#include "mocks/mock_stats.h"
+#include "src/fanout/fanout.h"
+#include "src/fanout/fanout_internal.h"
+#include "src/stats/stats.h"
+#include "unity/src/unity.h"
+
+void setUp(void) {
+    /* set stuff up here */
+    mock_fanout_internal_Init();
+    mock_osdep_Init();
+    mock_stats_Init();
+}
+
+void tearDown(void) {
+    /* clean stuff up here */
+    mock_fanout_internal_Verify();
+    mock_fanout_internal_Destroy();
+    mock_osdep_Verify();
+    mock_osdep_Destroy();
+    mock_stats_Verify();
+    mock_stats_Destroy();
+}
+
+static int num_calls;
+
+static void count_item(void *item, void *arg) {
+    UNUSED_PARAMETER(item);
+    UNUSED_PARAMETER(arg);
+
+    num_calls++;
+}
+
+static void expect_start(struct fanout_worker *workers,
+                         struct fanout_share *shares,
+                         int num) {
+    os_eventfd_ExpectAnyArgsAndReturn(9);
+    os_malloc_ExpectAndReturn(num * sizeof(struct fanout_worker), workers);
+    os_malloc_ExpectAndReturn((num + 1) * sizeof(struct fanout_share),
+                              shares);
+    for (int i = 0; i < num; i++) {
+        init_fanout_worker_ExpectAndReturn(&workers[i], i + 1, EXIT_SUCCESS);
+    }
+    os_pthread_sigmask_ExpectAnyArgsAndReturn(0);
+    for (int i = 0; i < num; i++) {
+        os_pthread_create_ExpectAnyArgsAndReturn(0);
+    }
+    os_pthread_sigmask_ExpectAnyArgsAndReturn(0);
+}
+
+static void expect_stop(struct fanout_worker *workers,
+                        struct fanout_share *shares,
+                        int num) {
+    for (int i = 0; i < num; i++) {
+        os_eventfd_write_ExpectAndReturn(workers[i].wakefd, 1, 0);
+    }
+    for (int i = 0; i < num; i++) {
+        os_pthread_join_ExpectAndReturn(workers[i].thread, 0);
+    }
+    for (int i = 0; i < num; i++) {
+        exit_fanout_worker_Expect(&workers[i]);
+    }
+    os_free_Expect(shares);
+    os_free_Expect(workers);
+    os_close_ExpectAndReturn(9, 0);
+}
+
+void test_run_fanout_pass_serial(void) {
+    int items[4];
+    void *item_ptrs[4] = {&items[0], &items[1], &items[2], &items[3]};
+
+    // without workers every item is handled on the calling thread
+    num_calls = 0;
+    run_fanout(item_ptrs, 4, &count_item, NULL);
+
+    TEST_ASSERT_EQUAL_INT(4, num_calls);
+}
+
+void test_run_fanout_pass_small(void) {
+    struct fanout_worker workers[1] = {{.thread = 7, .wakefd = 5}};
+    struct fanout_share shares[2];
+    int item;
+    void *item_ptrs[FANOUT_CHUNK_LEN];
+    int ret;
+
+    for (int i = 0; i < FANOUT_CHUNK_LEN; i++) {
+        item_ptrs[i] = &item;
+    }
+
+    expect_start(workers, shares, 1);
+    ret = start_fanout_workers(1);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+
+    // a single chunk isn't worth waking the workers up for
+    num_calls = 0;
+    run_fanout(item_ptrs, FANOUT_CHUNK_LEN, &count_item, NULL);
+
+    TEST_ASSERT_EQUAL_INT(FANOUT_CHUNK_LEN, num_calls);
+
+    expect_stop(workers, shares, 1);
+    stop_fanout_workers();
+}
+
+void test_run_fanout_pass_workers(void) {
+    struct fanout_worker workers[2] = {
+        {.thread = 7, .wakefd = 5},
+        {.thread = 8, .wakefd = 6},
+    };
+    struct fanout_share shares[3];
+    int item;
+    void *item_ptrs[2 * FANOUT_CHUNK_LEN];
+    int ret;
+
+    for (int i = 0; i < 2 * FANOUT_CHUNK_LEN; i++) {
+        item_ptrs[i] = &item;
+    }
+
+    expect_start(workers, shares, 2);
+    ret = start_fanout_workers(2);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_INT(2, get_num_fanout_workers());
+
+    // the job is still pending for the workers, wait for the last one
+    init_fanout_job_ExpectAnyArgs();
+    os_eventfd_write_ExpectAndReturn(workers[0].wakefd, 1, 0);
+    os_eventfd_write_ExpectAndReturn(workers[1].wakefd, 1, 0);
+    run_fanout_chunks_Expect(NULL, 0);
+    run_fanout_chunks_IgnoreArg_pool();
+    os_eventfd_read_ExpectAndReturn(9, NULL, 0);
+    os_eventfd_read_IgnoreArg_value();
+    add_stat_Expect(STAT_FANOUT_JOBS, 1);
+    run_fanout(item_ptrs, 2 * FANOUT_CHUNK_LEN, &count_item, NULL);
+
+    expect_stop(workers, shares, 2);
+    stop_fanout_workers();
+
+    TEST_ASSERT_EQUAL_INT(0, get_num_fanout_workers());
+}
+
+void test_start_fanout_workers_fail_eventfd(void) {
+    int ret;
+
+    os_eventfd_ExpectAnyArgsAndReturn(-1);
+    ret = start_fanout_workers(2);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_start_fanout_workers_fail_init_fanout_worker(void) {
+    struct fanout_worker workers[2];
+    struct fanout_share shares[3];
+    int ret;
+
+    os_eventfd_ExpectAnyArgsAndReturn(9);
+    os_malloc_ExpectAndReturn(sizeof(workers), workers);
+    os_malloc_ExpectAndReturn(sizeof(shares), shares);
+    init_fanout_worker_ExpectAndReturn(&workers[0], 1, EXIT_SUCCESS);
+    init_fanout_worker_ExpectAndReturn(&workers[1], 2, EXIT_FAILURE);
+    exit_fanout_worker_Expect(&workers[0]);
+    os_free_Expect(shares);
+    os_free_Expect(workers);
+    os_close_ExpectAndReturn(9, 0);
+    ret = start_fanout_workers(2);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_start_fanout_workers_fail_malloc(void) {
+    int ret;
+
+    os_eventfd_ExpectAnyArgsAndReturn(9);
+    os_malloc_ExpectAndReturn(2 * sizeof(struct fanout_worker), NULL);
+    os_close_ExpectAndReturn(9, 0);
+    ret = start_fanout_workers(2);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_start_fanout_workers_fail_pthread_create(void) {
+    struct fanout_worker workers[2];
+    struct fanout_share shares[3];
+    int ret;
+
+    workers[0].wakefd = 5;
+    workers[0].thread = 7;
+
+    os_eventfd_ExpectAnyArgsAndReturn(9);
+    os_malloc_ExpectAndReturn(sizeof(workers), workers);
+    os_malloc_ExpectAndReturn(sizeof(shares), shares);
+    init_fanout_worker_ExpectAndReturn(&workers[0], 1, EXIT_SUCCESS);
+    init_fanout_worker_ExpectAndReturn(&workers[1], 2, EXIT_SUCCESS);
+    os_pthread_sigmask_ExpectAnyArgsAndReturn(0);
+    os_pthread_create_ExpectAnyArgsAndReturn(0);
+    os_pthread_create_ExpectAnyArgsAndReturn(-1);
+    os_pthread_sigmask_ExpectAnyArgsAndReturn(0);
+    os_eventfd_write_ExpectAndReturn(workers[0].wakefd, 1, 0);
+    os_pthread_join_ExpectAndReturn(workers[0].thread, 0);
+    exit_fanout_worker_Expect(&workers[0]);
+    exit_fanout_worker_Expect(&workers[1]);
+    os_free_Expect(shares);
+    os_free_Expect(workers);
+    os_close_ExpectAndReturn(9, 0);
+    ret = start_fanout_workers(2);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(0, get_num_fanout_workers());
+}
+
+void test_stop_fanout_workers_pass_not_started(void) {
+    stop_fanout_workers();
+}
+
+/* not needed when using generate_test_runner.rb */
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_run_fanout_pass_serial);
+    RUN_TEST(test_run_fanout_pass_small);
+    RUN_TEST(test_run_fanout_pass_workers);
+    RUN_TEST(test_start_fanout_workers_fail_eventfd);
+    RUN_TEST(test_start_fanout_workers_fail_init_fanout_worker);
+    RUN_TEST(test_start_fanout_workers_fail_malloc);
+    RUN_TEST(test_start_fanout_workers_fail_pthread_create);
+    RUN_TEST(test_stop_fanout_workers_pass_not_started);
+    return UNITY_END();
+}
@@ -0,0 +1,161 @@
+// Copyright 2020 author. All rights reserved.
+
+#include <stdlib.h>
+#include <sys/eventfd.h>
+
+#include "include/common.h"
+#include "mocks/mock_osdep.h"
+#include "mocks/mock_stats.h"
+#include "src/fanout/fanout_internal.h"
+#include "src/stats/stats.h"
+#include "unity/src/unity.h"
+
+void setUp(void) {
+    /* set stuff up here */
+    mock_osdep_Init();
+    mock_stats_Init();
+}
+
+void tearDown(void) {
+    /* clean stuff up here */
+    mock_osdep_Verify();
+    mock_osdep_Destroy();
+    mock_stats_Verify();
+    mock_stats_Destroy();
+}
+
+static void count_item(void *item, void *arg) {
+    UNUSED_PARAMETER(arg);
+
+    (*(int *)item)++;
+}
+
+static void init_test_pool(struct fanout_pool *pool,
+                           struct fanout_share *shares,
+                           int num_shares) {
+    pool->shares = shares;
+    pool->num_shares = num_shares;
+}
+
+void test_exit_fanout_worker_pass(void) {
+    struct fanout_worker worker = {.wakefd = 5};
+
+    os_close_ExpectAndReturn(worker.wakefd, 0);
+    exit_fanout_worker(&worker);
+}
+
+void test_init_fanout_job_pass(void) {
+    struct fanout_share shares[3];
+    struct fanout_pool pool;
+    int arg;
+
+    init_test_pool(&pool, shares, 3);
+
+    // 8 chunks, the last one is partial
+    init_fanout_job(&pool, NULL, 7 * FANOUT_CHUNK_LEN + 1, &count_item, &arg);
+
+    TEST_ASSERT_EQUAL_INT(0, shares[0].next);
+    TEST_ASSERT_EQUAL_INT(2, shares[0].end);
+    TEST_ASSERT_EQUAL_INT(2, shares[1].next);
+    TEST_ASSERT_EQUAL_INT(5, shares[1].end);
+    TEST_ASSERT_EQUAL_INT(5, shares[2].next);
+    TEST_ASSERT_EQUAL_INT(8, shares[2].end);
+    TEST_ASSERT_EQUAL_INT(3, pool.pending);
+    TEST_ASSERT_EQUAL_PTR(&arg, pool.arg);
+}
+
+void test_init_fanout_worker_fail_eventfd(void) {
+    struct fanout_worker worker;
+    int ret;
+
+    os_eventfd_ExpectAndReturn(0, EFD_CLOEXEC, -1);
+    ret = init_fanout_worker(&worker, 1);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_init_fanout_worker_pass(void) {
+    struct fanout_worker worker;
+    int ret;
+
+    os_eventfd_ExpectAndReturn(0, EFD_CLOEXEC, 5);
+    ret = init_fanout_worker(&worker, 1);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_INT(1, worker.id);
+    TEST_ASSERT_EQUAL_INT(5, worker.wakefd);
+}
+
+void test_run_fanout_chunks_pass(void) {
+    static int counts[2 * FANOUT_CHUNK_LEN + 1];
+    static void *items[2 * FANOUT_CHUNK_LEN + 1];
+    struct fanout_share shares[2];
+    struct fanout_pool pool;
+
+    for (int i = 0; i < 2 * FANOUT_CHUNK_LEN + 1; i++) {
+        counts[i] = 0;
+        items[i] = &counts[i];
+    }
+    init_test_pool(&pool, shares, 2);
+    init_fanout_job(&pool, items, 2 * FANOUT_CHUNK_LEN + 1, &count_item, NULL);
+
+    // the other thread never shows up, its two chunks are stolen
+    add_stat_Expect(STAT_FANOUT_STEALS, 1);
+    add_stat_Expect(STAT_FANOUT_STEALS, 1);
+    run_fanout_chunks(&pool, 0);
+
+    for (int i = 0; i < 2 * FANOUT_CHUNK_LEN + 1; i++) {
+        TEST_ASSERT_EQUAL_INT(1, counts[i]);
+    }
+}
+
+void test_take_fanout_chunk_fail_empty(void) {
+    struct fanout_share shares[2] = {{.next = 1, .end = 1},
+                                     {.next = 3, .end = 3}};
+    struct fanout_pool pool;
+
+    init_test_pool(&pool, shares, 2);
+
+    TEST_ASSERT_EQUAL_INT(-1, take_fanout_chunk(&pool, 1));
+    TEST_ASSERT_EQUAL_INT(1, shares[0].next);
+    TEST_ASSERT_EQUAL_INT(3, shares[1].next);
+}
+
+void test_take_fanout_chunk_pass(void) {
+    struct fanout_share shares[2] = {{.next = 0, .end = 1},
+                                     {.next = 1, .end = 3}};
+    struct fanout_pool pool;
+
+    init_test_pool(&pool, shares, 2);
+
+    TEST_ASSERT_EQUAL_INT(1, take_fanout_chunk(&pool, 1));
+    TEST_ASSERT_EQUAL_INT(2, shares[1].next);
+}
+
+void test_take_fanout_chunk_pass_steal(void) {
+    struct fanout_share shares[3] = {{.next = 1, .end = 1},
+                                     {.next = 1, .end = 1},
+                                     {.next = 2, .end = 3}};
+    struct fanout_pool pool;
+
+    init_test_pool(&pool, shares, 3);
+
+    add_stat_Expect(STAT_FANOUT_STEALS, 1);
+
+    TEST_ASSERT_EQUAL_INT(2, take_fanout_chunk(&pool, 0));
+    TEST_ASSERT_EQUAL_INT(3, shares[2].next);
+}
+
+/* not needed when using generate_test_runner.rb */
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_exit_fanout_worker_pass);
+    RUN_TEST(test_init_fanout_job_pass);
+    RUN_TEST(test_init_fanout_worker_fail_eventfd);
+    RUN_TEST(test_init_fanout_worker_pass);
+    RUN_TEST(test_run_fanout_chunks_pass);
+    RUN_TEST(test_take_fanout_chunk_fail_empty);
+    RUN_TEST(test_take_fanout_chunk_pass);
+    RUN_TEST(test_take_fanout_chunk_pass_steal);
+    return UNITY_END();
+}
@@ -1,228 +1,574 @@
 // Copyright 2020 author. All rights reserved.
 
+#include <endian.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "include/common.h"
 #include "mocks/mock_message_internal.h"
+#include "mocks/mock_osdep.h"
+#include "mocks/mock_ring.h"
 #include "src/message/message.h"
 #include "unity/src/unity.h"
 
 void setUp(void) {
     /* set stuff up here */
     mock_message_internal_Init();
+    mock_osdep_Init();
+    mock_ring_Init();
 }
 
 void tearDown(void) {
     /* clean stuff up here */
     mock_message_internal_Verify();
     mock_message_internal_Destroy();
+    mock_osdep_Verify();
+    mock_osdep_Destroy();
+    mock_ring_Verify();
+    mock_ring_Destroy();
 }
 
-void test_get_msg_new_user_fail(void) {
-    int fd = 3;
+struct test_frame {
+    struct msg_frame frame;
+    uint8_t buf[128];
+};
+
+static void init_test_frame(struct test_frame *frame, const char *body) {
+    size_t len = strlen(body);
+
+    frame->frame.len = sizeof(struct msg_hdr) + len;
+    memset(frame->frame.buf, 0xff, sizeof(struct msg_hdr));
+    memcpy(&frame->frame.buf[sizeof(struct msg_hdr)], body, len);
+}
+
+void test_copy_msg_view_fail_malloc(void) {
+    char str[] = "John Doe";
+    struct msg_view view = {.str = str, .len = strlen(str)};
+
+    os_malloc_ExpectAndReturn(strlen(str) + 1, NULL);
+
+    TEST_ASSERT_NULL(copy_msg_view(&view));
+}
+
+void test_copy_msg_view_pass(void) {
+    char str[] = "John Doe";
+    struct msg_view view = {.str = str, .len = strlen(str)};
+    char copy[sizeof(str)];
+
+    os_malloc_ExpectAndReturn(strlen(str) + 1, copy);
+
+    TEST_ASSERT_EQUAL_PTR(copy, copy_msg_view(&view));
+    TEST_ASSERT_EQUAL_STRING(str, copy);
+}
+
+void test_create_batch_frame_fail_len(void) {
+    static uint8_t buf[sizeof(struct msg_frame) + MSG_MAX_FRAME_LEN];
+    struct msg_frame *big = (struct msg_frame *)buf;
+    struct msg_frame *frames[2] = {big, big};
+
+    big->len = MSG_MAX_FRAME_LEN;
+
+    TEST_ASSERT_NULL(create_batch_frame(frames, 2));
+}
+
+void test_create_batch_frame_fail_malloc(void) {
+    struct test_frame frame1;
+    struct test_frame frame2;
+    struct msg_frame *frames[2] = {&frame1.frame, &frame2.frame};
+
+    init_test_frame(&frame1, "abc");
+    init_test_frame(&frame2, "de");
+
+    os_malloc_ExpectAndReturn(sizeof(struct msg_frame) + 11, NULL);
+
+    TEST_ASSERT_NULL(create_batch_frame(frames, 2));
+}
+
+void test_create_batch_frame_pass(void) {
+    const uint8_t expected[] = {0x00, 0x04, 0x00, 0x05, 0x00, 0x00,
+                                'a', 'b', 'c', 'd', 'e'};
+    struct test_frame frame1;
+    struct test_frame frame2;
+    struct test_frame batch;
+    struct msg_frame *frames[2] = {&frame1.frame, &frame2.frame};
+
+    init_test_frame(&frame1, "abc");
+    init_test_frame(&frame2, "de");
+
+    os_malloc_ExpectAndReturn(sizeof(struct msg_frame) + 11, &batch);
+
+    TEST_ASSERT_EQUAL_PTR(&batch.frame, create_batch_frame(frames, 2));
+    TEST_ASSERT_EQUAL_INT(1, batch.frame.refs);
+    TEST_ASSERT_EQUAL_INT(sizeof(expected), batch.frame.len);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, batch.frame.buf, sizeof(expected));
+}
+
+void test_create_broadcast_frame_fail_malloc(void) {
+    struct msg_broadcast data;
+
+    data.timestamp = 0;
+    data.name = (char *)"John Doe";
+    data.msg = (char *)"Hello, World!";
+    data.stream = NULL;
+
+    os_malloc_ExpectAndReturn(sizeof(struct msg_frame) + 51, NULL);
+
+    TEST_ASSERT_NULL(create_broadcast_frame(&data));
+}
+
+void test_create_broadcast_frame_fail_too_long(void) {
+    static char name[MSG_MAX_FRAME_LEN];
+    struct msg_broadcast data;
+
+    memset(name, 'a', sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    data.timestamp = 0;
+    data.name = name;
+    data.msg = (char *)"Hello, World!";
+    data.stream = NULL;
+
+    TEST_ASSERT_NULL(create_broadcast_frame(&data));
+}
+
+void test_create_broadcast_frame_pass(void) {
+    struct test_frame frame;
+    struct msg_broadcast data;
+
+    data.timestamp = 0x12345678;
+    data.name = (char *)"John Doe";
+    data.msg = (char *)"Hello, World!";
+    data.stream = NULL;
+    data.prio = MSG_PRIO_SYSTEM;
+
+    os_malloc_ExpectAndReturn(sizeof(struct msg_frame) + 51, &frame);
+
+    TEST_ASSERT_EQUAL_PTR(&frame.frame, create_broadcast_frame(&data));
+    TEST_ASSERT_EQUAL_INT(1, frame.frame.refs);
+    TEST_ASSERT_EQUAL_INT(MSG_PRIO_SYSTEM, frame.frame.prio);
+    TEST_ASSERT_EQUAL_INT(51, frame.frame.len);
+    TEST_ASSERT_EQUAL_HEX8(0x03, frame.frame.buf[1]);
+}
+
+void test_create_broadcast_frame_pass_part(void) {
+    struct test_frame frame;
+    struct msg_stream stream;
+    struct msg_broadcast data;
+
+    stream.id = 1;
+    stream.off = 3;
+    stream.len = 5;
+    stream.part.str = (char *)"hi";
+    stream.part.len = 2;
+    data.timestamp = 0x12345678;
+    data.name = (char *)"bob";
+    data.msg = NULL;
+    data.stream = &stream;
+    data.prio = MSG_PRIO_CHAT;
+
+    os_malloc_ExpectAndReturn(sizeof(struct msg_frame) + 80, &frame);
+
+    TEST_ASSERT_EQUAL_PTR(&frame.frame, create_broadcast_frame(&data));
+    TEST_ASSERT_EQUAL_INT(80, frame.frame.len);
+    TEST_ASSERT_EQUAL_HEX8(0x05, frame.frame.buf[1]);
+    TEST_ASSERT_EQUAL_HEX8(MSG_FLAG_V2, frame.frame.buf[4]);
+}
+
+void test_create_caps_frame_fail_malloc(void) {
+    os_malloc_ExpectAndReturn(sizeof(struct msg_frame) + 6, NULL);
+
+    TEST_ASSERT_NULL(create_caps_frame(MSG_FLAG_BATCH));
+}
+
+void test_create_caps_frame_pass(void) {
+    const uint8_t expected[] = {0x00, 0x01, 0x00, 0x00,
+                                MSG_FLAG_BATCH, MSG_CAPS_SUPPORTED};
+    struct test_frame frame;
+
+    os_malloc_ExpectAndReturn(sizeof(struct msg_frame) + 6, &frame);
+
+    TEST_ASSERT_EQUAL_PTR(&frame.frame, create_caps_frame(MSG_FLAG_BATCH));
+    TEST_ASSERT_EQUAL_INT(MSG_PRIO_SYSTEM, frame.frame.prio);
+    TEST_ASSERT_EQUAL_INT(sizeof(expected), frame.frame.len);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, frame.frame.buf, sizeof(expected));
+}
+
+void test_create_msg_frame_fail_malloc(void) {
+    os_malloc_ExpectAndReturn(sizeof(struct msg_frame) + 8, NULL);
+
+    TEST_ASSERT_NULL(create_msg_frame(8));
+}
+
+void test_create_msg_frame_pass(void) {
+    struct test_frame frame;
+
+    os_malloc_ExpectAndReturn(sizeof(struct msg_frame) + 8, &frame);
+
+    TEST_ASSERT_EQUAL_PTR(&frame.frame, create_msg_frame(8));
+    TEST_ASSERT_EQUAL_INT(1, frame.frame.refs);
+    TEST_ASSERT_EQUAL_INT(MSG_PRIO_CHAT, frame.frame.prio);
+    TEST_ASSERT_EQUAL_INT(8, frame.frame.len);
+}
+
+void test_decode_msg_new_user_fail(void) {
+    uint8_t buf[4];
     struct msg_new_user data;
     int ret;
 
-    get_msg_IgnoreAndReturn(EXIT_FAILURE);
-    ret = get_msg_new_user(fd, &data);
+    decode_msg_IgnoreAndReturn(-1);
+    ret = decode_msg_new_user(buf, sizeof(buf), &data);
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(-1, ret);
 }
 
-void test_get_msg_new_user_pass(void) {
-    int fd = 3;
+void test_decode_msg_new_user_pass(void) {
+    uint8_t buf[16];
     struct msg_new_user data;
     int ret;
 
-    get_msg_IgnoreAndReturn(EXIT_SUCCESS);
-    ret = get_msg_new_user(fd, &data);
+    decode_msg_IgnoreAndReturn(sizeof(buf));
+    ret = decode_msg_new_user(buf, sizeof(buf), &data);
 
-    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), ret);
 }
 
-void test_get_msg_registered_user_fail(void) {
-    int fd = 3;
+void test_decode_msg_registered_user_fail(void) {
+    uint8_t buf[4];
     struct msg_registered_user data;
     int ret;
 
-    get_msg_IgnoreAndReturn(EXIT_FAILURE);
-    ret = get_msg_registered_user(fd, &data);
+    decode_msg_IgnoreAndReturn(-1);
+    ret = decode_msg_registered_user(buf, sizeof(buf), &data);
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(-1, ret);
 }
 
-void test_get_msg_registered_user_pass(void) {
-    int fd = 3;
+void test_decode_msg_registered_user_fail_stream(void) {
+    uint8_t buf[16];
     struct msg_registered_user data;
     int ret;
 
-    get_msg_IgnoreAndReturn(EXIT_SUCCESS);
-    ret = get_msg_registered_user(fd, &data);
+    data.streamed = true;
+
+    decode_msg_IgnoreAndReturn(sizeof(buf));
+    ret = decode_msg_registered_user(buf, sizeof(buf), &data);
 
-    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_INT(-1, ret);
 }
 
-void test_send_broadcast_msg_fail_1st_send(void) {
-    int fd = 3;
+void test_decode_msg_registered_user_pass(void) {
+    uint8_t buf[16];
+    struct msg_registered_user data;
+    int ret;
+
+    data.streamed = false;
+
+    decode_msg_IgnoreAndReturn(sizeof(buf));
+    ret = decode_msg_registered_user(buf, sizeof(buf), &data);
+
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), ret);
+}
+
+void test_encode_broadcast_msg_fail_len(void) {
     struct msg_broadcast data;
+    uint8_t buf[8];
     int ret;
 
     data.timestamp = 0;
     data.name = (char *)"John Doe";
     data.msg = (char *)"Hello, World!";
+    data.stream = NULL;
 
-    send_data_ExpectAnyArgsAndReturn(EXIT_FAILURE);
-    ret = send_broadcast_msg(fd, &data);
+    ret = encode_broadcast_msg(&data, buf, sizeof(buf));
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(-1, ret);
 }
 
-void test_send_broadcast_msg_fail_2nd_send(void) {
-    int fd = 3;
+void test_encode_broadcast_msg_fail_too_long(void) {
+    static char msg[UINT16_MAX];
     struct msg_broadcast data;
+    uint8_t buf[8];
     int ret;
 
+    memset(msg, 'a', sizeof(msg) - 1);
+    msg[sizeof(msg) - 1] = '\0';
     data.timestamp = 0;
     data.name = (char *)"John Doe";
-    data.msg = (char *)"Hello, World!";
+    data.msg = msg;
+    data.stream = NULL;
 
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_FAILURE);
-    ret = send_broadcast_msg(fd, &data);
+    ret = encode_broadcast_msg(&data, buf, sizeof(buf));
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(-1, ret);
 }
 
-void test_send_broadcast_msg_fail_3rd_send(void) {
-    int fd = 3;
+void test_encode_broadcast_msg_pass(void) {
+    const uint8_t expected[] = {
+        0x00, 0x03, 0x00, 0x2d, 0x00, 0x00,     // header
+        0x00, 0x02, 0x00, 0x01, 0x00, 0x04,     // timestamp
+        0x12, 0x34, 0x56, 0x78,
+        0x00, 0x01, 0x00, 0x02, 0x00, 0x09,     // name
+        0x4a, 0x6f, 0x68, 0x6e, 0x20, 0x44, 0x6f, 0x65,
+        0x00,
+        0x00, 0x01, 0x00, 0x03, 0x00, 0x0e,     // msg
+        0x48, 0x65, 0x6c, 0x6c, 0x6f, 0x2c, 0x20, 0x57,
+        0x6f, 0x72, 0x6c, 0x64, 0x21, 0x00
+    };
     struct msg_broadcast data;
+    uint8_t buf[128];
     int ret;
 
-    data.timestamp = 0;
+    data.timestamp = 0x12345678;
     data.name = (char *)"John Doe";
     data.msg = (char *)"Hello, World!";
+    data.stream = NULL;
 
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_FAILURE);
-    ret = send_broadcast_msg(fd, &data);
+    ret = encode_broadcast_msg(&data, buf, sizeof(buf));
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(sizeof(expected), ret);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(buf, expected, sizeof(expected)));
 }
 
-void test_send_broadcast_msg_fail_4th_send(void) {
-    int fd = 3;
+void test_encode_broadcast_msg_pass_part(void) {
+    const uint8_t expected[] = {
+        0x00, 0x05, 0x00, 0x00, 0x02, 0x00,     // header
+        0x00, 0x00, 0x00, 0x46,
+        0x00, 0x02, 0x00, 0x01, 0x00, 0x00, 0x00, 0x04,     // timestamp
+        0x12, 0x34, 0x56, 0x78,
+        0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x04,     // name
+        0x62, 0x6f, 0x62, 0x00,
+        0x00, 0x02, 0x00, 0x04, 0x00, 0x00, 0x00, 0x04,     // stream
+        0x00, 0x00, 0x00, 0x01,
+        0x00, 0x02, 0x00, 0x05, 0x00, 0x00, 0x00, 0x04,     // offset
+        0x00, 0x00, 0x00, 0x03,
+        0x00, 0x02, 0x00, 0x06, 0x00, 0x00, 0x00, 0x04,     // length
+        0x00, 0x00, 0x00, 0x05,
+        0x00, 0x03, 0x00, 0x03, 0x00, 0x00, 0x00, 0x02,     // part
+        0x68, 0x69
+    };
+    char part[] = "hi";
+    struct msg_stream stream;
     struct msg_broadcast data;
+    uint8_t buf[128];
     int ret;
 
-    data.timestamp = 0;
-    data.name = (char *)"John Doe";
-    data.msg = (char *)"Hello, World!";
+    stream.id = 1;
+    stream.off = 3;
+    stream.len = 5;
+    stream.part.str = part;
+    stream.part.len = 2;
+    data.timestamp = 0x12345678;
+    data.name = (char *)"bob";
+    data.msg = NULL;
+    data.stream = &stream;
+
+    ret = encode_broadcast_msg(&data, buf, sizeof(buf));
+
+    TEST_ASSERT_EQUAL_INT(sizeof(expected), ret);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(buf, expected, sizeof(expected)));
+}
+
+void test_exit_msg_reader(void) {
+    struct msg_reader reader;
+
+    release_msg_ring_Expect(&reader);
+    exit_msg_reader(&reader);
+}
+
+void test_get_msg_frame_pass(void) {
+    struct msg_frame frame;
 
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_FAILURE);
-    ret = send_broadcast_msg(fd, &data);
+    frame.refs = 1;
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_PTR(&frame, get_msg_frame(&frame));
+    TEST_ASSERT_EQUAL_INT(2, frame.refs);
 }
 
-void test_send_broadcast_msg_fail_5th_send(void) {
+void test_get_msg_new_user_fail(void) {
     int fd = 3;
-    struct msg_broadcast data;
+    struct msg_reader reader;
+    struct msg_new_user data;
     int ret;
 
-    data.timestamp = 0;
-    data.name = (char *)"John Doe";
-    data.msg = (char *)"Hello, World!";
+    read_msg_ExpectAndReturn(fd, &reader, &data, NULL, -1);
+    read_msg_IgnoreArg_parser();
+    ret = get_msg_new_user(fd, &reader, &data);
+
+    TEST_ASSERT_EQUAL_INT(-1, ret);
+}
+
+void test_get_msg_new_user_incomplete(void) {
+    int fd = 3;
+    struct msg_reader reader;
+    struct msg_new_user data;
+    int ret;
 
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_FAILURE);
-    ret = send_broadcast_msg(fd, &data);
+    read_msg_ExpectAndReturn(fd, &reader, &data, NULL, 0);
+    read_msg_IgnoreArg_parser();
+    ret = get_msg_new_user(fd, &reader, &data);
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(0, ret);
 }
 
-void test_send_broadcast_msg_fail_6th_send(void) {
+void test_get_msg_new_user_pass(void) {
     int fd = 3;
-    struct msg_broadcast data;
+    struct msg_reader reader;
+    struct msg_new_user data;
     int ret;
 
-    data.timestamp = 0;
-    data.name = (char *)"John Doe";
-    data.msg = (char *)"Hello, World!";
+    read_msg_ExpectAndReturn(fd, &reader, &data, NULL, 1);
+    read_msg_IgnoreArg_parser();
+    ret = get_msg_new_user(fd, &reader, &data);
+
+    TEST_ASSERT_EQUAL_INT(1, ret);
+}
 
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_FAILURE);
-    ret = send_broadcast_msg(fd, &data);
+void test_get_msg_registered_user_fail(void) {
+    int fd = 3;
+    struct msg_reader reader;
+    struct msg_registered_user data;
+    int ret;
+
+    reader.streaming = false;
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    read_msg_ExpectAndReturn(fd, &reader, &data, NULL, -1);
+    read_msg_IgnoreArg_parser();
+    ret = get_msg_registered_user(fd, &reader, &data);
+
+    TEST_ASSERT_EQUAL_INT(-1, ret);
 }
 
-void test_send_broadcast_msg_fail_7th_send(void) {
+void test_get_msg_registered_user_incomplete(void) {
     int fd = 3;
-    struct msg_broadcast data;
+    struct msg_reader reader;
+    struct msg_registered_user data;
     int ret;
 
-    data.timestamp = 0;
-    data.name = (char *)"John Doe";
-    data.msg = (char *)"Hello, World!";
+    reader.streaming = false;
 
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_FAILURE);
-    ret = send_broadcast_msg(fd, &data);
+    read_msg_ExpectAndReturn(fd, &reader, &data, NULL, 0);
+    read_msg_IgnoreArg_parser();
+    ret = get_msg_registered_user(fd, &reader, &data);
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(0, ret);
 }
 
-void test_send_broadcast_msg_pass(void) {
+void test_get_msg_registered_user_pass(void) {
     int fd = 3;
-    struct msg_broadcast data;
+    struct msg_reader reader;
+    struct msg_registered_user data;
     int ret;
 
-    data.timestamp = 0;
-    data.name = (char *)"John Doe";
-    data.msg = (char *)"Hello, World!";
+    reader.streaming = false;
+    data.streamed = false;
+
+    read_msg_ExpectAndReturn(fd, &reader, &data, NULL, 1);
+    read_msg_IgnoreArg_parser();
+    ret = get_msg_registered_user(fd, &reader, &data);
+
+    TEST_ASSERT_EQUAL_INT(1, ret);
+}
+
+void test_get_msg_registered_user_pass_part(void) {
+    int fd = 3;
+    struct msg_reader reader;
+    struct msg_registered_user data;
+    int ret;
+
+    reader.streaming = true;
+
+    read_msg_part_ExpectAndReturn(fd, &reader, &data, 0);
+    ret = get_msg_registered_user(fd, &reader, &data);
+
+    TEST_ASSERT_EQUAL_INT(0, ret);
+}
+
+void test_get_msg_registered_user_pass_stream(void) {
+    int fd = 3;
+    struct msg_reader reader;
+    struct msg_registered_user data;
+    struct msg_registered_user start;
+    int ret;
+
+    reader.streaming = false;
+    reader.stream.id = 1;
+    start.streamed = true;
+    start.stream.len = 100000;
+
+    read_msg_ExpectAndReturn(fd, &reader, &data, NULL, 1);
+    read_msg_IgnoreArg_parser();
+    read_msg_ReturnMemThruPtr_data(&start, sizeof(start));
+    read_msg_part_ExpectAndReturn(fd, &reader, &data, 1);
+    ret = get_msg_registered_user(fd, &reader, &data);
+
+    TEST_ASSERT_EQUAL_INT(1, ret);
+    TEST_ASSERT_TRUE(reader.streaming);
+    TEST_ASSERT_EQUAL_INT(2, reader.stream.id);
+    TEST_ASSERT_EQUAL_INT(100000, reader.stream.len);
+    TEST_ASSERT_EQUAL_INT(100000, reader.stream_left);
+}
+
+void test_init_msg_reader(void) {
+    struct msg_reader reader;
+
+    memset(&reader, 0xff, sizeof(reader));
+    init_msg_reader(&reader);
+
+    TEST_ASSERT_NULL(reader.ring.buf);
+    TEST_ASSERT_EQUAL_INT(0, reader.ring.cap);
+    TEST_ASSERT_EQUAL_INT(0, reader.ring.head);
+    TEST_ASSERT_EQUAL_INT(0, reader.ring.len);
+    TEST_ASSERT_FALSE(reader.streaming);
+    TEST_ASSERT_EQUAL_INT(0, reader.stream.id);
+    TEST_ASSERT_EQUAL_INT(0, reader.stream_left);
+}
+
+void test_put_msg_frame_pass(void) {
+    struct msg_frame frame;
+
+    frame.refs = 2;
+    put_msg_frame(&frame);
 
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    send_data_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
-    ret = send_broadcast_msg(fd, &data);
+    TEST_ASSERT_EQUAL_INT(1, frame.refs);
 
-    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    os_free_Expect(&frame);
+    put_msg_frame(&frame);
 }
 
-/* not needed when using generate_test_runner.rb */
 int main(void) {
     UNITY_BEGIN();
+    RUN_TEST(test_copy_msg_view_fail_malloc);
+    RUN_TEST(test_copy_msg_view_pass);
+    RUN_TEST(test_create_batch_frame_fail_len);
+    RUN_TEST(test_create_batch_frame_fail_malloc);
+    RUN_TEST(test_create_batch_frame_pass);
+    RUN_TEST(test_create_broadcast_frame_fail_malloc);
+    RUN_TEST(test_create_broadcast_frame_fail_too_long);
+    RUN_TEST(test_create_broadcast_frame_pass);
+    RUN_TEST(test_create_broadcast_frame_pass_part);
+    RUN_TEST(test_create_caps_frame_fail_malloc);
+    RUN_TEST(test_create_caps_frame_pass);
+    RUN_TEST(test_create_msg_frame_fail_malloc);
+    RUN_TEST(test_create_msg_frame_pass);
+    RUN_TEST(test_decode_msg_new_user_fail);
+    RUN_TEST(test_decode_msg_new_user_pass);
+    RUN_TEST(test_decode_msg_registered_user_fail);
+    RUN_TEST(test_decode_msg_registered_user_fail_stream);
+    RUN_TEST(test_decode_msg_registered_user_pass);
+    RUN_TEST(test_encode_broadcast_msg_fail_len);
+    RUN_TEST(test_encode_broadcast_msg_fail_too_long);
+    RUN_TEST(test_encode_broadcast_msg_pass);
+    RUN_TEST(test_encode_broadcast_msg_pass_part);
+    RUN_TEST(test_exit_msg_reader);
+    RUN_TEST(test_get_msg_frame_pass);
     RUN_TEST(test_get_msg_new_user_fail);
+    RUN_TEST(test_get_msg_new_user_incomplete);
     RUN_TEST(test_get_msg_new_user_pass);
     RUN_TEST(test_get_msg_registered_user_fail);
+    RUN_TEST(test_get_msg_registered_user_incomplete);
     RUN_TEST(test_get_msg_registered_user_pass);
-    RUN_TEST(test_send_broadcast_msg_fail_1st_send);
-    RUN_TEST(test_send_broadcast_msg_fail_2nd_send);
-    RUN_TEST(test_send_broadcast_msg_fail_3rd_send);
-    RUN_TEST(test_send_broadcast_msg_fail_4th_send);
-    RUN_TEST(test_send_broadcast_msg_fail_5th_send);
-    RUN_TEST(test_send_broadcast_msg_fail_6th_send);
-    RUN_TEST(test_send_broadcast_msg_fail_7th_send);
-    RUN_TEST(test_send_broadcast_msg_pass);
+    RUN_TEST(test_get_msg_registered_user_pass_part);
+    RUN_TEST(test_get_msg_registered_user_pass_stream);
+    RUN_TEST(test_init_msg_reader);
+    RUN_TEST(test_put_msg_frame_pass);
     return UNITY_END();
 }
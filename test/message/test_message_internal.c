@@ -7,6 +7,7 @@
 #include "include/common.h"
 #include "mocks/mock_fileio.h"
 #include "mocks/mock_osdep.h"
+#include "mocks/mock_ring.h"
 #include "src/message/message_internal.h"
 #include "src/message/message.h"
 #include "unity/src/unity.h"
@@ -17,6 +18,7 @@ void setUp(void) {
     /* set stuff up here */
     mock_fileio_Init();
     mock_osdep_Init();
+    mock_ring_Init();
 }
 
 void tearDown(void) {
@@ -25,9 +27,11 @@ void tearDown(void) {
     mock_fileio_Destroy();
     mock_osdep_Verify();
     mock_osdep_Destroy();
+    mock_ring_Verify();
+    mock_ring_Destroy();
 }
 
-int msg_parser_fail(uint8_t *buf, struct msg_hdr *hdr, void *data) {
+int msg_parser_fail(uint8_t *buf, struct msg_info *hdr, void *data) {
     UNUSED_PARAMETER(buf);
     UNUSED_PARAMETER(hdr);
     UNUSED_PARAMETER(data);
@@ -35,262 +39,589 @@ int msg_parser_fail(uint8_t *buf, struct msg_hdr *hdr, void *data) {
     return EXIT_FAILURE;
 }
 
-int msg_parser_pass(uint8_t *buf, struct msg_hdr *hdr, void *data) {
-    const char *name = "John Doe";
+int msg_parser_pass(uint8_t *buf, struct msg_info *hdr, void *data) {
+    static char name[] = "John Doe";
     struct msg_new_user *user_info = (struct msg_new_user *)data;
 
     UNUSED_PARAMETER(buf);
     UNUSED_PARAMETER(hdr);
 
-    user_info->name = malloc(strlen(name) + 1);
-    if (NULL == user_info->name) {
-        return EXIT_FAILURE;
-    }
-
-    memcpy(user_info->name, name, strlen(name));
-    user_info->name[strlen(name)] = 0;
+    user_info->name.str = name;
+    user_info->name.len = strlen(name);
 
     return EXIT_SUCCESS;
 }
 
-void test_get_field_string_fail_wrong_field_len_long(void) {
-    const char *name = "John Doe";
-    uint8_t buf[MSG_BUF_LEN];
-    struct msg_field *field = (struct msg_field *)buf;
-    uint8_t *field_string = &buf[sizeof(struct msg_field)];
-    char *ret;
-
-    field->type = FIELD_TYPE_STRING;
-    field->id = FIELD_ID_NAME;
-    field->len = strlen(name) + 2;
+// field in network byte order, returns the length of the field
+static size_t put_field(uint8_t *buf,
+                        uint16_t type,
+                        uint16_t id,
+                        uint16_t len,
+                        const char *str) {
+    struct msg_field field;
 
-    memcpy(field_string, name, strlen(name));
-    ret = get_field_string((struct msg_field *)buf);
+    field.type = htobe16(type);
+    field.id = htobe16(id);
+    field.len = htobe16(len);
+    memcpy(buf, &field, sizeof(field));
+    memcpy(&buf[sizeof(field)], str, strlen(str) + 1);
 
-    TEST_ASSERT_NULL(ret);
+    return sizeof(field) + len;
 }
 
-void test_get_field_string_fail_wrong_field_len_short(void) {
-    const char *name = "John Doe";
-    uint8_t buf[MSG_BUF_LEN];
-    struct msg_field *field = (struct msg_field *)buf;
-    uint8_t *field_string = &buf[sizeof(struct msg_field)];
-    char *ret;
+// v2 field header in network byte order, returns the length of the header
+static size_t put_field_v2(uint8_t *buf,
+                           uint16_t type,
+                           uint16_t id,
+                           uint32_t len) {
+    struct msg_field_v2 field;
+
+    field.type = htobe16(type);
+    field.id = htobe16(id);
+    field.len = htobe32(len);
+    memcpy(buf, &field, sizeof(field));
 
-    field->type = FIELD_TYPE_STRING;
-    field->id = FIELD_ID_NAME;
-    field->len = strlen(name) - 1;
+    return sizeof(field);
+}
 
-    memcpy(field_string, name, strlen(name));
-    ret = get_field_string((struct msg_field *)buf);
+// v2 header in network byte order
+static void put_hdr_v2(uint8_t *buf, uint8_t flags, uint32_t len) {
+    struct msg_hdr_v2 hdr;
 
-    TEST_ASSERT_NULL(ret);
+    hdr.type = htobe16(MSG_TYPE_NEW_USER);
+    hdr.len16 = 0;
+    hdr.flags = MSG_FLAG_V2 | flags;
+    hdr.ret = 0;
+    hdr.len = htobe32(len);
+    memcpy(buf, &hdr, sizeof(hdr));
 }
 
-void test_get_field_string_fail_wrong_field_type(void) {
-    const char *name = "John Doe";
-    uint8_t buf[MSG_BUF_LEN];
-    struct msg_field *field = (struct msg_field *)buf;
-    uint8_t *field_string = &buf[sizeof(struct msg_field)];
-    char *ret;
+void test_decode_msg_fail_frame_len(void) {
+    uint8_t buf[sizeof(struct msg_hdr_v2)];
+    struct msg_new_user data;
+    int ret;
 
-    field->type = FIELD_TYPE_UINT32;
-    field->id = FIELD_ID_NAME;
-    field->len = strlen(name) + 1;
+    // too long to buffer, even before it has arrived
+    put_hdr_v2(buf, 0, UINT16_MAX + 1);
 
-    memcpy(field_string, name, strlen(name));
-    ret = get_field_string((struct msg_field *)buf);
+    ret = decode_msg(buf, sizeof(buf), &data, &msg_parser_pass);
 
-    TEST_ASSERT_NULL(ret);
+    TEST_ASSERT_EQUAL_INT(-1, ret);
 }
 
-void test_get_field_string_pass(void) {
-    const char *name = "John Doe";
-    uint8_t buf[MSG_BUF_LEN];
-    struct msg_field *field = (struct msg_field *)buf;
-    uint8_t *field_string = &buf[sizeof(struct msg_field)];
-    char *ret;
+void test_decode_msg_fail_msg_parser(void) {
+    struct msg_hdr hdr;
+    uint8_t buf[sizeof(struct msg_hdr) + 1];
+    struct msg_new_user data;
+    int ret;
 
-    field->type = FIELD_TYPE_STRING;
-    field->id = FIELD_ID_NAME;
-    field->len = strlen(name) + 1;
+    hdr.type = htobe16(MSG_TYPE_NEW_USER);
+    hdr.len = htobe16(1);
+    hdr.flags = 0;
+    memcpy(buf, &hdr, sizeof(hdr));
 
-    memcpy(field_string, name, strlen(name));
-    buf[sizeof(struct msg_field) + strlen(name)] = 0;
-    ret = get_field_string((struct msg_field *)buf);
+    ret = decode_msg(buf, sizeof(buf), &data, &msg_parser_fail);
 
-    TEST_ASSERT_NOT_NULL(ret);
-    TEST_ASSERT_EQUAL_INT(0, memcmp(ret, name, strlen(name)));
+    TEST_ASSERT_EQUAL_INT(-1, ret);
 }
 
-void test_get_msg_fail_malloc(void) {
-    int fd = 3;
-    struct msg_new_user data;
+void test_decode_msg_fail_stream(void) {
     struct msg_hdr hdr;
-    uint16_t msg_len = 1;
+    uint8_t buf[sizeof(struct msg_hdr) + 1];
+    struct msg_new_user data;
     int ret;
 
     hdr.type = htobe16(MSG_TYPE_NEW_USER);
-    hdr.len = htobe16(msg_len);
+    hdr.len = htobe16(1);
+    hdr.flags = MSG_FLAG_STREAM;
+    memcpy(buf, &hdr, sizeof(hdr));
 
-    reliable_read_ExpectAnyArgsAndReturn(sizeof(struct msg_hdr));
-    reliable_read_ReturnMemThruPtr_buf(&hdr, sizeof(hdr));
-    os_malloc_ExpectAndReturn(msg_len, NULL);
-    reliable_read_ExpectAnyArgsAndReturn(msg_len);
-    ret = get_msg(fd, &data, &msg_parser_fail);
+    ret = decode_msg(buf, sizeof(buf), &data, &msg_parser_pass);
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(-1, ret);
 }
 
-void test_get_msg_fail_msg_parser(void) {
-    int fd = 3;
-    struct msg_new_user data;
+void test_decode_msg_incomplete_data(void) {
     struct msg_hdr hdr;
-    uint16_t msg_len = 1;
-    uint8_t buf[msg_len];
+    uint8_t buf[sizeof(struct msg_hdr) + 1];
+    struct msg_new_user data;
     int ret;
 
     hdr.type = htobe16(MSG_TYPE_NEW_USER);
-    hdr.len = htobe16(msg_len);
+    hdr.len = htobe16(2);
+    hdr.flags = 0;
+    memcpy(buf, &hdr, sizeof(hdr));
 
-    reliable_read_ExpectAnyArgsAndReturn(sizeof(struct msg_hdr));
-    reliable_read_ReturnMemThruPtr_buf(&hdr, sizeof(hdr));
-    os_malloc_ExpectAndReturn(msg_len, &buf);
-    reliable_read_ExpectAnyArgsAndReturn(msg_len);
-    os_free_Expect(&buf);
-    ret = get_msg(fd, &data, &msg_parser_fail);
+    ret = decode_msg(buf, sizeof(buf), &data, &msg_parser_fail);
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(0, ret);
 }
 
-void test_get_msg_fail_read_data(void) {
-    int fd = 3;
+void test_decode_msg_incomplete_hdr(void) {
+    uint8_t buf[sizeof(struct msg_hdr) - 1];
+    struct msg_new_user data;
+    int ret;
+
+    ret = decode_msg(buf, sizeof(buf), &data, &msg_parser_fail);
+
+    TEST_ASSERT_EQUAL_INT(0, ret);
+}
+
+void test_decode_msg_incomplete_hdr_v2(void) {
+    uint8_t buf[sizeof(struct msg_hdr_v2)];
     struct msg_new_user data;
+    int ret;
+
+    put_hdr_v2(buf, 0, 1);
+
+    ret = decode_msg(buf, sizeof(struct msg_hdr), &data, &msg_parser_pass);
+
+    TEST_ASSERT_EQUAL_INT(0, ret);
+}
+
+void test_decode_msg_pass(void) {
+    const char *name = "John Doe";
     struct msg_hdr hdr;
-    uint16_t msg_len = 1;
-    uint8_t buf[msg_len];
+    uint8_t buf[sizeof(struct msg_hdr) + 2];
+    struct msg_new_user data;
     int ret;
 
+    memset(&data, 0, sizeof(struct msg_new_user));
     hdr.type = htobe16(MSG_TYPE_NEW_USER);
-    hdr.len = htobe16(msg_len);
+    hdr.len = htobe16(1);
+    hdr.flags = 0;
+    memcpy(buf, &hdr, sizeof(hdr));
 
-    reliable_read_ExpectAnyArgsAndReturn(sizeof(struct msg_hdr));
-    reliable_read_ReturnMemThruPtr_buf(&hdr, sizeof(hdr));
-    os_malloc_ExpectAndReturn(msg_len, &buf);
-    reliable_read_ExpectAnyArgsAndReturn(-1);
-    os_free_Expect(&buf);
-    ret = get_msg(fd, &data, &msg_parser_fail);
+    // trailing byte belongs to the next frame
+    ret = decode_msg(buf, sizeof(buf), &data, &msg_parser_pass);
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(sizeof(struct msg_hdr) + 1, ret);
+    TEST_ASSERT_EQUAL_INT(strlen(name), data.name.len);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(data.name.str, name, strlen(name)));
 }
 
-void test_get_msg_fail_read_hdr_error(void) {
-    int fd = 3;
+void test_decode_msg_pass_v2(void) {
+    uint8_t buf[sizeof(struct msg_hdr_v2) + 1];
     struct msg_new_user data;
     int ret;
 
-    reliable_read_IgnoreAndReturn(-1);
-    ret = get_msg(fd, &data, msg_parser_fail);
+    put_hdr_v2(buf, 0, 1);
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    ret = decode_msg(buf, sizeof(buf), &data, &msg_parser_pass);
+
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), ret);
 }
 
-void test_get_msg_fail_read_hdr_fd_closed(void) {
+static void init_test_ring(struct ring *ring,
+                           uint8_t *buf,
+                           size_t cap,
+                           size_t head,
+                           size_t len) {
+    ring->buf = buf;
+    ring->cap = cap;
+    ring->head = head;
+    ring->len = len;
+}
+
+static void consume_test_ring(struct ring *ring, size_t len, int num_calls) {
+    UNUSED_PARAMETER(num_calls);
+
+    ring->head += len;
+    ring->len -= len;
+}
+
+static void produce_test_ring(struct ring *ring, size_t len, int num_calls) {
+    UNUSED_PARAMETER(num_calls);
+
+    ring->len += len;
+}
+
+void test_fill_msg_reader_fail_full(void) {
+    uint8_t buf[16];
+    struct msg_reader reader;
+    int fd = 3;
+    int ret;
+
+    init_test_ring(&reader.ring,
+                   buf,
+                   MSG_READER_MAX_CAP,
+                   0,
+                   MSG_READER_MAX_CAP);
+
+    ret = fill_msg_reader(fd, &reader);
+
+    TEST_ASSERT_EQUAL_INT(-1, ret);
+}
+
+void test_fill_msg_reader_fail_read(void) {
+    uint8_t buf[16];
+    struct msg_reader reader;
+    int fd = 3;
+    int ret;
+
+    init_test_ring(&reader.ring, buf, sizeof(buf), 0, 0);
+
+    read_available_ExpectAndReturn(fd, buf, sizeof(buf), -1);
+    ret = fill_msg_reader(fd, &reader);
+
+    TEST_ASSERT_EQUAL_INT(-1, ret);
+    TEST_ASSERT_EQUAL_INT(0, reader.ring.len);
+}
+
+void test_fill_msg_reader_fail_ring_grow(void) {
+    uint8_t buf[16];
+    struct msg_reader reader;
+    int fd = 3;
+    int ret;
+
+    init_test_ring(&reader.ring,
+                   buf,
+                   MSG_READER_MIN_CAP,
+                   0,
+                   MSG_READER_MIN_CAP);
+
+    ring_grow_ExpectAndReturn(&reader.ring,
+                              2 * MSG_READER_MIN_CAP,
+                              EXIT_FAILURE);
+    ret = fill_msg_reader(fd, &reader);
+
+    TEST_ASSERT_EQUAL_INT(-1, ret);
+}
+
+void test_fill_msg_reader_fail_ring_pool_get(void) {
+    struct msg_reader reader;
+    int fd = 3;
+    int ret;
+
+    init_test_ring(&reader.ring, NULL, 0, 0, 0);
+
+    ring_pool_get_ExpectAndReturn(NULL, &reader.ring, EXIT_FAILURE);
+    ring_pool_get_IgnoreArg_pool();
+    ret = fill_msg_reader(fd, &reader);
+
+    TEST_ASSERT_EQUAL_INT(-1, ret);
+}
+
+void test_fill_msg_reader_pass_grow(void) {
+    static uint8_t buf[4 * MSG_READER_MIN_CAP];
+    struct msg_reader reader;
+    struct ring grown;
+    int fd = 3;
+    int ret;
+
+    init_test_ring(&reader.ring,
+                   buf,
+                   MSG_READER_MIN_CAP,
+                   0,
+                   MSG_READER_MIN_CAP);
+    init_test_ring(&grown,
+                   buf,
+                   2 * MSG_READER_MIN_CAP,
+                   0,
+                   MSG_READER_MIN_CAP);
+
+    ring_grow_ExpectAndReturn(&reader.ring,
+                              2 * MSG_READER_MIN_CAP,
+                              EXIT_SUCCESS);
+    ring_grow_ReturnMemThruPtr_ring(&grown, sizeof(grown));
+    read_available_ExpectAndReturn(fd,
+                                   &buf[MSG_READER_MIN_CAP],
+                                   MSG_READER_MIN_CAP,
+                                   0);
+    ret = fill_msg_reader(fd, &reader);
+
+    TEST_ASSERT_EQUAL_INT(0, ret);
+}
+
+void test_fill_msg_reader_pass_grow_max(void) {
+    uint8_t buf[16];
+    struct msg_reader reader;
+    int fd = 3;
+    int ret;
+
+    init_test_ring(&reader.ring,
+                   buf,
+                   16 * MSG_READER_MIN_CAP,
+                   0,
+                   16 * MSG_READER_MIN_CAP);
+
+    ring_grow_ExpectAndReturn(&reader.ring, MSG_READER_MAX_CAP, EXIT_SUCCESS);
+    read_available_ExpectAnyArgsAndReturn(0);
+    ret = fill_msg_reader(fd, &reader);
+
+    TEST_ASSERT_EQUAL_INT(0, ret);
+}
+
+void test_fill_msg_reader_pass_ring_pool_get(void) {
+    uint8_t buf[2 * MSG_READER_MIN_CAP];
+    struct msg_reader reader;
+    struct ring mapped;
     int fd = 3;
-    struct msg_new_user data;
     int ret;
 
-    reliable_read_IgnoreAndReturn(0);
-    ret = get_msg(fd, &data, msg_parser_fail);
+    init_test_ring(&reader.ring, NULL, 0, 0, 0);
+    init_test_ring(&mapped, buf, MSG_READER_MIN_CAP, 0, 0);
+
+    ring_pool_get_ExpectAndReturn(NULL, &reader.ring, EXIT_SUCCESS);
+    ring_pool_get_IgnoreArg_pool();
+    ring_pool_get_ReturnMemThruPtr_ring(&mapped, sizeof(mapped));
+    read_available_ExpectAndReturn(fd, buf, MSG_READER_MIN_CAP, 3);
+    ring_produce_Expect(&reader.ring, 3);
+    ret = fill_msg_reader(fd, &reader);
+
+    TEST_ASSERT_EQUAL_INT(3, ret);
+}
+
+void test_fill_msg_reader_pass_wrap(void) {
+    uint8_t buf[32] = "0123456789abcdef0123456789abcdef";
+    struct msg_reader reader;
+    int fd = 3;
+    int ret;
+
+    // the partial frame stays at the end, the read continues in the second
+    // mapping of the ring
+    init_test_ring(&reader.ring, buf, 16, 10, 4);
+
+    read_available_ExpectAndReturn(fd, &buf[14], 12, 3);
+    ring_produce_Expect(&reader.ring, 3);
+    ret = fill_msg_reader(fd, &reader);
+
+    TEST_ASSERT_EQUAL_INT(3, ret);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(&buf[10], "abcd", 4));
+}
+
+void test_get_field_stream_fail_trailing(void) {
+    uint8_t buf[MSG_BUF_LEN];
+    uint32_t stream_len;
+    size_t len;
+    int ret;
+
+    // the streamed data follows the frame, not the field header
+    len = put_field_v2(buf, FIELD_TYPE_BYTES, FIELD_ID_MSG, 100000);
+    ret = get_field_stream(buf, len + 1, FIELD_ID_MSG, &stream_len);
 
     TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
 }
 
-void test_get_msg_pass(void) {
+void test_get_field_stream_fail_wrong_field_id(void) {
+    uint8_t buf[MSG_BUF_LEN];
+    uint32_t stream_len;
+    size_t len;
+    int ret;
+
+    len = put_field_v2(buf, FIELD_TYPE_BYTES, FIELD_ID_NAME, 100000);
+    ret = get_field_stream(buf, len, FIELD_ID_MSG, &stream_len);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_get_field_stream_fail_wrong_field_type(void) {
+    uint8_t buf[MSG_BUF_LEN];
+    uint32_t stream_len;
+    size_t len;
+    int ret;
+
+    len = put_field_v2(buf, FIELD_TYPE_STRING, FIELD_ID_MSG, 100000);
+    ret = get_field_stream(buf, len, FIELD_ID_MSG, &stream_len);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_get_field_stream_pass(void) {
+    uint8_t buf[MSG_BUF_LEN];
+    uint32_t stream_len;
+    size_t len;
+    int ret;
+
+    len = put_field_v2(buf, FIELD_TYPE_BYTES, FIELD_ID_MSG, 100000);
+    ret = get_field_stream(buf, len, FIELD_ID_MSG, &stream_len);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_INT(100000, stream_len);
+}
+
+void test_get_field_string_fail_short_hdr(void) {
     const char *name = "John Doe";
-    int fd = 3;
-    struct msg_new_user data;
-    struct msg_hdr hdr;
-    uint16_t msg_len = 1;
-    uint8_t buf[msg_len];
+    uint8_t buf[MSG_BUF_LEN];
+    struct msg_view view;
     int ret;
 
-    memset(&data, 0, sizeof(struct msg_new_user));
-    hdr.type = htobe16(MSG_TYPE_NEW_USER);
-    hdr.len = htobe16(msg_len);
+    put_field(buf, FIELD_TYPE_STRING, FIELD_ID_NAME, strlen(name) + 1, name);
+    ret = get_field_string(buf,
+                           sizeof(struct msg_field) - 1,
+                           0,
+                           FIELD_ID_NAME,
+                           &view);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_get_field_string_fail_wrong_field_id(void) {
+    const char *name = "John Doe";
+    uint8_t buf[MSG_BUF_LEN];
+    struct msg_view view;
+    size_t len;
+    int ret;
+
+    len = put_field(buf, FIELD_TYPE_STRING, FIELD_ID_NAME, strlen(name) + 1,
+                    name);
+    ret = get_field_string(buf, len, 0, FIELD_ID_MSG, &view);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_get_field_string_fail_wrong_field_len_long(void) {
+    const char *name = "John Doe";
+    uint8_t buf[MSG_BUF_LEN];
+    struct msg_view view;
+    size_t len;
+    int ret;
+
+    len = put_field(buf, FIELD_TYPE_STRING, FIELD_ID_NAME, strlen(name) + 2,
+                    name);
+    ret = get_field_string(buf, len, 0, FIELD_ID_NAME, &view);
 
-    reliable_read_ExpectAnyArgsAndReturn(sizeof(struct msg_hdr));
-    reliable_read_ReturnMemThruPtr_buf(&hdr, sizeof(hdr));
-    os_malloc_ExpectAndReturn(msg_len, &buf);
-    reliable_read_ExpectAnyArgsAndReturn(msg_len);
-    os_free_Expect(&buf);
-    ret = get_msg(fd, &data, &msg_parser_pass);
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_get_field_string_fail_wrong_field_len_overflow(void) {
+    const char *name = "John Doe";
+    uint8_t buf[MSG_BUF_LEN];
+    struct msg_view view;
+    size_t len;
+    int ret;
+
+    // field claims more bytes than the message holds
+    len = put_field(buf, FIELD_TYPE_STRING, FIELD_ID_NAME, strlen(name) + 1,
+                    name);
+    ret = get_field_string(buf, len - 1, 0, FIELD_ID_NAME, &view);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
 
+void test_get_field_string_fail_wrong_field_len_short(void) {
+    const char *name = "John Doe";
+    uint8_t buf[MSG_BUF_LEN];
+    struct msg_view view;
+    size_t len;
+    int ret;
+
+    len = put_field(buf, FIELD_TYPE_STRING, FIELD_ID_NAME, strlen(name) - 1,
+                    name);
+    ret = get_field_string(buf, len, 0, FIELD_ID_NAME, &view);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_get_field_string_fail_wrong_field_type(void) {
+    const char *name = "John Doe";
+    uint8_t buf[MSG_BUF_LEN];
+    struct msg_view view;
+    size_t len;
+    int ret;
+
+    len = put_field(buf, FIELD_TYPE_UINT32, FIELD_ID_NAME, strlen(name) + 1,
+                    name);
+    ret = get_field_string(buf, len, 0, FIELD_ID_NAME, &view);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_get_field_string_pass(void) {
+    const char *name = "John Doe";
+    uint8_t buf[MSG_BUF_LEN];
+    uint8_t orig[MSG_BUF_LEN];
+    struct msg_view view;
+    size_t len;
+    int ret;
+
+    len = put_field(buf, FIELD_TYPE_STRING, FIELD_ID_NAME, strlen(name) + 1,
+                    name);
+    memcpy(orig, buf, len);
+    ret = get_field_string(buf, len, 0, FIELD_ID_NAME, &view);
+
+    // the view points into the buffer, which is left in network byte order
     TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
-    TEST_ASSERT_NOT_NULL(data.name);
-    TEST_ASSERT_EQUAL_INT(0, memcmp(data.name, name, strlen(name)));
+    TEST_ASSERT_EQUAL_PTR(&buf[sizeof(struct msg_field)], view.str);
+    TEST_ASSERT_EQUAL_INT(strlen(name), view.len);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(orig, buf, len));
+}
+
+void test_get_field_string_pass_v2(void) {
+    const char *name = "John Doe";
+    uint8_t buf[MSG_BUF_LEN];
+    struct msg_view view;
+    size_t len;
+    int ret;
+
+    len = put_field_v2(buf, FIELD_TYPE_STRING, FIELD_ID_NAME,
+                       strlen(name) + 1);
+    memcpy(&buf[len], name, strlen(name) + 1);
+    len += strlen(name) + 1;
+    ret = get_field_string(buf, len, MSG_FLAG_V2, FIELD_ID_NAME, &view);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&buf[sizeof(struct msg_field_v2)], view.str);
+    TEST_ASSERT_EQUAL_INT(strlen(name), view.len);
 }
 
 void test_parse_msg_new_user_fail_get_name_fail(void) {
-    struct msg_field field;
-    struct msg_hdr hdr;
+    const char *name = "John Doe";
+    uint8_t buf[MSG_BUF_LEN];
+    struct msg_info hdr;
     struct msg_new_user data;
     int ret;
 
     hdr.type = MSG_TYPE_NEW_USER;
-    field.type = htobe16(FIELD_TYPE_UINT32);
-    field.id = htobe16(FIELD_ID_NAME);
+    hdr.flags = 0;
+    hdr.len = put_field(buf, FIELD_TYPE_UINT32, FIELD_ID_NAME,
+                        strlen(name) + 1, name);
 
-    ret = parse_msg_new_user((uint8_t *)&field, &hdr, &data);
+    ret = parse_msg_new_user(buf, &hdr, &data);
 
     TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
 }
 
-void test_parse_msg_new_user_fail_malloc(void) {
-    const char *name = "John Doe";
+void test_parse_msg_new_user_fail_stream(void) {
     uint8_t buf[MSG_BUF_LEN];
-    struct msg_field *field = (struct msg_field *)buf;
-    struct msg_hdr hdr;
+    struct msg_info hdr;
     struct msg_new_user data;
-    uint8_t *field_string = &buf[sizeof(struct msg_field)];
-    uint16_t field_len = strlen(name) + 1;
     int ret;
 
     hdr.type = MSG_TYPE_NEW_USER;
-    field->type = htobe16(FIELD_TYPE_STRING);
-    field->id = htobe16(FIELD_ID_NAME);
-    field->len = htobe16(field_len);
-
-    memcpy(field_string, name, strlen(name));
-    buf[sizeof(struct msg_field) + strlen(name)] = 0;
+    hdr.flags = MSG_FLAG_V2 | MSG_FLAG_STREAM;
+    hdr.len = put_field_v2(buf, FIELD_TYPE_BYTES, FIELD_ID_NAME, 100000);
 
-    os_malloc_ExpectAndReturn(field_len, NULL);
     ret = parse_msg_new_user(buf, &hdr, &data);
 
     TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
 }
 
 void test_parse_msg_new_user_fail_wrong_field_id(void) {
-    struct msg_field field;
-    struct msg_hdr hdr;
+    const char *name = "John Doe";
+    uint8_t buf[MSG_BUF_LEN];
+    struct msg_info hdr;
     struct msg_new_user data;
     int ret;
 
     hdr.type = MSG_TYPE_NEW_USER;
-    field.id = htobe16(FIELD_ID_MSG);
+    hdr.flags = 0;
+    hdr.len = put_field(buf, FIELD_TYPE_STRING, FIELD_ID_MSG,
+                        strlen(name) + 1, name);
 
-    ret = parse_msg_new_user((uint8_t *)&field, &hdr, &data);
+    ret = parse_msg_new_user(buf, &hdr, &data);
 
     TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
 }
 
 void test_parse_msg_new_user_fail_wrong_msg_type(void) {
     uint8_t buf[4] = {0x01, 0x02, 0x03, 0x00};
-    struct msg_hdr hdr;
+    struct msg_info hdr;
     struct msg_new_user data;
     int ret;
 
     hdr.type = MSG_TYPE_REGISTERED_USER;
+    hdr.flags = 0;
 
     ret = parse_msg_new_user(buf, &hdr, &data);
 
@@ -300,90 +631,66 @@ void test_parse_msg_new_user_fail_wrong_msg_type(void) {
 void test_parse_msg_new_user_pass(void) {
     const char *name = "John Doe";
     uint8_t buf[MSG_BUF_LEN];
-    struct msg_field *field = (struct msg_field *)buf;
-    struct msg_hdr hdr;
+    struct msg_info hdr;
     struct msg_new_user data;
-    uint8_t *field_string = &buf[sizeof(struct msg_field)];
-    uint16_t field_len = strlen(name) + 1;
-    uint8_t malloc_buf[field_len];
     int ret;
 
     hdr.type = MSG_TYPE_NEW_USER;
-    field->type = htobe16(FIELD_TYPE_STRING);
-    field->id = htobe16(FIELD_ID_NAME);
-    field->len = htobe16(field_len);
-
-    memcpy(field_string, name, strlen(name));
-    buf[sizeof(struct msg_field) + strlen(name)] = 0;
+    hdr.flags = MSG_FLAG_BATCH;
+    hdr.len = put_field(buf, FIELD_TYPE_STRING, FIELD_ID_NAME,
+                        strlen(name) + 1, name);
 
-    os_malloc_ExpectAndReturn(field_len, &malloc_buf);
     ret = parse_msg_new_user(buf, &hdr, &data);
 
     TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
-    TEST_ASSERT_NOT_NULL(data.name);
-    TEST_ASSERT_EQUAL_INT(0, memcmp(data.name, name, strlen(name)));
+    TEST_ASSERT_EQUAL_PTR(&buf[sizeof(struct msg_field)], data.name.str);
+    TEST_ASSERT_EQUAL_INT(strlen(name), data.name.len);
+    TEST_ASSERT_EQUAL_STRING(name, data.name.str);
+    TEST_ASSERT_EQUAL_HEX8(MSG_FLAG_BATCH, data.flags);
 }
 
 void test_parse_msg_registered_user_fail_get_msg_fail(void) {
-    struct msg_field field;
-    struct msg_hdr hdr;
-    struct msg_new_user data;
-    int ret;
-
-    hdr.type = MSG_TYPE_REGISTERED_USER;
-    field.type = htobe16(FIELD_TYPE_UINT32);
-    field.id = htobe16(FIELD_ID_MSG);
-
-    ret = parse_msg_registered_user((uint8_t *)&field, &hdr, &data);
-
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
-}
-
-void test_parse_msg_registered_user_fail_malloc(void) {
     const char *msg = "Hello, World!";
     uint8_t buf[MSG_BUF_LEN];
-    struct msg_field *field = (struct msg_field *)buf;
-    struct msg_hdr hdr;
+    struct msg_info hdr;
     struct msg_registered_user data;
-    uint8_t *field_string = &buf[sizeof(struct msg_field)];
-    uint16_t field_len = strlen(msg) + 1;
     int ret;
 
     hdr.type = MSG_TYPE_REGISTERED_USER;
-    field->type = htobe16(FIELD_TYPE_STRING);
-    field->id = htobe16(FIELD_ID_MSG);
-    field->len = htobe16(field_len);
-
-    memcpy(field_string, msg, strlen(msg));
-    buf[sizeof(struct msg_field) + strlen(msg)] = 0;
+    hdr.flags = 0;
+    hdr.len = put_field(buf, FIELD_TYPE_UINT32, FIELD_ID_MSG,
+                        strlen(msg) + 1, msg);
 
-    os_malloc_ExpectAndReturn(field_len, NULL);
     ret = parse_msg_registered_user(buf, &hdr, &data);
 
     TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
 }
 
 void test_parse_msg_registered_user_fail_wrong_field_id(void) {
-    struct msg_field field;
-    struct msg_hdr hdr;
-    struct msg_new_user data;
+    const char *msg = "Hello, World!";
+    uint8_t buf[MSG_BUF_LEN];
+    struct msg_info hdr;
+    struct msg_registered_user data;
     int ret;
 
     hdr.type = MSG_TYPE_REGISTERED_USER;
-    field.id = htobe16(FIELD_ID_NAME);
+    hdr.flags = 0;
+    hdr.len = put_field(buf, FIELD_TYPE_STRING, FIELD_ID_NAME,
+                        strlen(msg) + 1, msg);
 
-    ret = parse_msg_registered_user((uint8_t *)&field, &hdr, &data);
+    ret = parse_msg_registered_user(buf, &hdr, &data);
 
     TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
 }
 
 void test_parse_msg_registered_user_fail_wrong_msg_type(void) {
     uint8_t buf[4] = {0x01, 0x02, 0x03, 0x00};
-    struct msg_hdr hdr;
-    struct msg_new_user data;
+    struct msg_info hdr;
+    struct msg_registered_user data;
     int ret;
 
     hdr.type = MSG_TYPE_NEW_USER;
+    hdr.flags = 0;
 
     ret = parse_msg_registered_user(buf, &hdr, &data);
 
@@ -393,67 +700,319 @@ void test_parse_msg_registered_user_fail_wrong_msg_type(void) {
 void test_parse_msg_registered_user_pass(void) {
     const char *msg = "Hello, World!";
     uint8_t buf[MSG_BUF_LEN];
-    struct msg_field *field = (struct msg_field *)buf;
-    struct msg_hdr hdr;
+    struct msg_info hdr;
     struct msg_registered_user data;
-    uint8_t *field_string = &buf[sizeof(struct msg_field)];
-    uint16_t field_len = strlen(msg) + 1;
-    uint8_t malloc_buf[field_len];
     int ret;
 
     hdr.type = MSG_TYPE_REGISTERED_USER;
-    field->type = htobe16(FIELD_TYPE_STRING);
-    field->id = htobe16(FIELD_ID_MSG);
-    field->len = htobe16(field_len);
+    hdr.flags = 0;
+    hdr.len = put_field(buf, FIELD_TYPE_STRING, FIELD_ID_MSG,
+                        strlen(msg) + 1, msg);
 
-    memcpy(field_string, msg, strlen(msg));
-    buf[sizeof(struct msg_field) + strlen(msg)] = 0;
+    ret = parse_msg_registered_user(buf, &hdr, &data);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&buf[sizeof(struct msg_field)], data.msg.str);
+    TEST_ASSERT_EQUAL_INT(strlen(msg), data.msg.len);
+    TEST_ASSERT_EQUAL_STRING(msg, data.msg.str);
+}
+
+void test_parse_msg_registered_user_pass_stream(void) {
+    uint8_t buf[MSG_BUF_LEN];
+    struct msg_info hdr;
+    struct msg_registered_user data;
+    int ret;
+
+    hdr.type = MSG_TYPE_REGISTERED_USER;
+    hdr.flags = MSG_FLAG_V2 | MSG_FLAG_STREAM;
+    hdr.len = put_field_v2(buf, FIELD_TYPE_BYTES, FIELD_ID_MSG, 100000);
 
-    os_malloc_ExpectAndReturn(field_len, &malloc_buf);
     ret = parse_msg_registered_user(buf, &hdr, &data);
 
     TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
-    TEST_ASSERT_NOT_NULL(data.msg);
-    TEST_ASSERT_EQUAL_INT(0, memcmp(data.msg, msg, strlen(msg)));
+    TEST_ASSERT_TRUE(data.streamed);
+    TEST_ASSERT_EQUAL_INT(100000, data.stream.len);
+    TEST_ASSERT_EQUAL_INT(0, data.msg.len);
 }
 
-void test_send_data_fail_reliable_write_error(void) {
+static size_t put_frame(uint8_t *buf) {
+    struct msg_hdr hdr;
+
+    hdr.type = htobe16(MSG_TYPE_NEW_USER);
+    hdr.len = htobe16(1);
+    hdr.flags = 0;
+    memcpy(buf, &hdr, sizeof(hdr));
+    buf[sizeof(hdr)] = 0;
+
+    return sizeof(hdr) + 1;
+}
+
+void test_read_msg_fail_decode(void) {
+    uint8_t buf[16];
+    struct msg_reader reader;
+    struct msg_new_user data;
     int fd = 3;
-    uint8_t buf[4] = {0x01, 0x02, 0x03, 0x00};
-    reliable_write_ExpectAndReturn(fd, buf, sizeof(buf), -1);
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, send_data(fd, buf, sizeof(buf)));
+    int ret;
+
+    init_test_ring(&reader.ring, buf, sizeof(buf), 0, put_frame(buf));
+
+    ret = read_msg(fd, &reader, &data, &msg_parser_fail);
+
+    TEST_ASSERT_EQUAL_INT(-1, ret);
 }
 
-void test_send_data_pass(void) {
+void test_read_msg_fail_fill_msg_reader(void) {
+    uint8_t buf[16];
+    struct msg_reader reader;
+    struct msg_new_user data;
     int fd = 3;
-    uint8_t buf[4] = {0x01, 0x02, 0x03, 0x00};
-    reliable_write_ExpectAndReturn(fd, buf, sizeof(buf), 4);
-    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, send_data(fd, buf, sizeof(buf)));
+    int ret;
+
+    init_test_ring(&reader.ring, buf, sizeof(buf), 0, 0);
+
+    read_available_ExpectAndReturn(fd, buf, sizeof(buf), -1);
+    ret = read_msg(fd, &reader, &data, &msg_parser_fail);
+
+    TEST_ASSERT_EQUAL_INT(-1, ret);
+}
+
+void test_read_msg_incomplete(void) {
+    uint8_t buf[16];
+    uint8_t frame[16];
+    struct msg_reader reader;
+    struct msg_new_user data;
+    int fd = 3;
+    int ret;
+
+    put_frame(frame);
+    init_test_ring(&reader.ring, buf, sizeof(buf), 0, 0);
+
+    ring_produce_StubWithCallback(&produce_test_ring);
+    read_available_ExpectAndReturn(fd, buf, sizeof(buf), 4);
+    read_available_ReturnMemThruPtr_buf(frame, 4);
+    read_available_ExpectAndReturn(fd, &buf[4], sizeof(buf) - 4, 0);
+    ret = read_msg(fd, &reader, &data, &msg_parser_fail);
+
+    TEST_ASSERT_EQUAL_INT(0, ret);
+    TEST_ASSERT_EQUAL_INT(4, reader.ring.len);
+}
+
+void test_read_msg_incomplete_drained(void) {
+    uint8_t buf[16];
+    struct msg_reader reader;
+    struct msg_new_user data;
+    int fd = 3;
+    int ret;
+
+    init_test_ring(&reader.ring, buf, sizeof(buf), 0, 0);
+
+    read_available_ExpectAndReturn(fd, buf, sizeof(buf), 0);
+    ring_pool_put_Expect(NULL, &reader.ring);
+    ring_pool_put_IgnoreArg_pool();
+    ret = read_msg(fd, &reader, &data, &msg_parser_fail);
+
+    TEST_ASSERT_EQUAL_INT(0, ret);
+}
+
+static void init_test_stream(struct msg_reader *reader,
+                             uint32_t len,
+                             uint32_t left) {
+    reader->streaming = true;
+    reader->stream.id = 7;
+    reader->stream.len = len;
+    reader->stream_left = left;
+}
+
+void test_read_msg_part_fail_fill_msg_reader(void) {
+    uint8_t buf[16];
+    struct msg_reader reader;
+    struct msg_registered_user data;
+    int fd = 3;
+    int ret;
+
+    init_test_ring(&reader.ring, buf, sizeof(buf), 0, 0);
+    init_test_stream(&reader, 100, 100);
+
+    read_available_ExpectAndReturn(fd, buf, sizeof(buf), -1);
+    ret = read_msg_part(fd, &reader, &data);
+
+    TEST_ASSERT_EQUAL_INT(-1, ret);
+}
+
+void test_read_msg_part_incomplete(void) {
+    uint8_t buf[16];
+    struct msg_reader reader;
+    struct msg_registered_user data;
+    int fd = 3;
+    int ret;
+
+    init_test_ring(&reader.ring, buf, sizeof(buf), 0, 0);
+    init_test_stream(&reader, 100, 100);
+
+    // the drained ring goes back to the pool until more bytes arrive
+    read_available_ExpectAndReturn(fd, buf, sizeof(buf), 0);
+    ring_pool_put_Expect(NULL, &reader.ring);
+    ring_pool_put_IgnoreArg_pool();
+    ret = read_msg_part(fd, &reader, &data);
+
+    TEST_ASSERT_EQUAL_INT(0, ret);
+    TEST_ASSERT_TRUE(reader.streaming);
+}
+
+void test_read_msg_part_pass_last(void) {
+    uint8_t buf[16] = "abcdefgh";
+    struct msg_reader reader;
+    struct msg_registered_user data;
+    int fd = 3;
+    int ret;
+
+    // the bytes after the stream belong to the next frame
+    init_test_ring(&reader.ring, buf, sizeof(buf), 0, 8);
+    init_test_stream(&reader, 100, 5);
+
+    ring_consume_StubWithCallback(&consume_test_ring);
+    ret = read_msg_part(fd, &reader, &data);
+
+    TEST_ASSERT_EQUAL_INT(1, ret);
+    TEST_ASSERT_TRUE(data.streamed);
+    TEST_ASSERT_EQUAL_INT(7, data.stream.id);
+    TEST_ASSERT_EQUAL_INT(95, data.stream.off);
+    TEST_ASSERT_EQUAL_INT(100, data.stream.len);
+    TEST_ASSERT_EQUAL_PTR(buf, data.stream.part.str);
+    TEST_ASSERT_EQUAL_INT(5, data.stream.part.len);
+    TEST_ASSERT_EQUAL_INT(3, reader.ring.len);
+    TEST_ASSERT_FALSE(reader.streaming);
+}
+
+void test_read_msg_part_pass_resumed(void) {
+    uint8_t buf[16];
+    struct msg_reader reader;
+    struct msg_registered_user data;
+    int fd = 3;
+    int ret;
+
+    init_test_ring(&reader.ring, buf, sizeof(buf), 0, 0);
+    init_test_stream(&reader, 100, 100);
+
+    ring_consume_StubWithCallback(&consume_test_ring);
+    ring_produce_StubWithCallback(&produce_test_ring);
+    read_available_ExpectAndReturn(fd, buf, sizeof(buf), 16);
+    ret = read_msg_part(fd, &reader, &data);
+
+    TEST_ASSERT_EQUAL_INT(1, ret);
+    TEST_ASSERT_EQUAL_INT(0, data.stream.off);
+    TEST_ASSERT_EQUAL_INT(16, data.stream.part.len);
+    TEST_ASSERT_EQUAL_INT(84, reader.stream_left);
+    TEST_ASSERT_TRUE(reader.streaming);
+}
+
+void test_read_msg_pass_buffered(void) {
+    uint8_t buf[32];
+    struct msg_reader reader;
+    struct msg_new_user data;
+    size_t frame_len;
+    int fd = 3;
+    int ret;
+
+    frame_len = put_frame(buf);
+    put_frame(&buf[frame_len]);
+    init_test_ring(&reader.ring, buf, sizeof(buf), 0, 2 * frame_len);
+
+    ring_consume_StubWithCallback(&consume_test_ring);
+    ret = read_msg(fd, &reader, &data, &msg_parser_pass);
+
+    TEST_ASSERT_EQUAL_INT(1, ret);
+    TEST_ASSERT_EQUAL_INT(frame_len, reader.ring.head);
+
+    ret = read_msg(fd, &reader, &data, &msg_parser_pass);
+
+    TEST_ASSERT_EQUAL_INT(1, ret);
+    TEST_ASSERT_EQUAL_INT(2 * frame_len, reader.ring.head);
+    TEST_ASSERT_EQUAL_INT(0, reader.ring.len);
+}
+
+void test_read_msg_pass_resumed(void) {
+    uint8_t buf[16];
+    uint8_t frame[16];
+    struct msg_reader reader;
+    struct msg_new_user data;
+    size_t frame_len;
+    int fd = 3;
+    int ret;
+
+    frame_len = put_frame(frame);
+    memcpy(buf, frame, 4);
+    init_test_ring(&reader.ring, buf, sizeof(buf), 0, 4);
+
+    ring_consume_StubWithCallback(&consume_test_ring);
+    ring_produce_StubWithCallback(&produce_test_ring);
+    read_available_ExpectAndReturn(fd, &buf[4], sizeof(buf) - 4, 3);
+    read_available_ReturnMemThruPtr_buf(&frame[4], frame_len - 4);
+    ret = read_msg(fd, &reader, &data, &msg_parser_pass);
+
+    TEST_ASSERT_EQUAL_INT(1, ret);
+    TEST_ASSERT_EQUAL_INT(frame_len, reader.ring.head);
+    TEST_ASSERT_EQUAL_INT(0, reader.ring.len);
+}
+
+void test_release_msg_ring_pass(void) {
+    struct msg_reader reader;
+
+    ring_pool_put_Expect(NULL, &reader.ring);
+    ring_pool_put_IgnoreArg_pool();
+    release_msg_ring(&reader);
 }
 
-/* not needed when using generate_test_runner.rb */
 int main(void) {
     UNITY_BEGIN();
+    RUN_TEST(test_decode_msg_fail_frame_len);
+    RUN_TEST(test_decode_msg_fail_msg_parser);
+    RUN_TEST(test_decode_msg_fail_stream);
+    RUN_TEST(test_decode_msg_incomplete_data);
+    RUN_TEST(test_decode_msg_incomplete_hdr);
+    RUN_TEST(test_decode_msg_incomplete_hdr_v2);
+    RUN_TEST(test_decode_msg_pass);
+    RUN_TEST(test_decode_msg_pass_v2);
+    RUN_TEST(test_fill_msg_reader_fail_full);
+    RUN_TEST(test_fill_msg_reader_fail_read);
+    RUN_TEST(test_fill_msg_reader_fail_ring_grow);
+    RUN_TEST(test_fill_msg_reader_fail_ring_pool_get);
+    RUN_TEST(test_fill_msg_reader_pass_grow);
+    RUN_TEST(test_fill_msg_reader_pass_grow_max);
+    RUN_TEST(test_fill_msg_reader_pass_ring_pool_get);
+    RUN_TEST(test_fill_msg_reader_pass_wrap);
+    RUN_TEST(test_get_field_stream_fail_trailing);
+    RUN_TEST(test_get_field_stream_fail_wrong_field_id);
+    RUN_TEST(test_get_field_stream_fail_wrong_field_type);
+    RUN_TEST(test_get_field_stream_pass);
+    RUN_TEST(test_get_field_string_fail_short_hdr);
+    RUN_TEST(test_get_field_string_fail_wrong_field_id);
     RUN_TEST(test_get_field_string_fail_wrong_field_len_long);
+    RUN_TEST(test_get_field_string_fail_wrong_field_len_overflow);
     RUN_TEST(test_get_field_string_fail_wrong_field_len_short);
     RUN_TEST(test_get_field_string_fail_wrong_field_type);
     RUN_TEST(test_get_field_string_pass);
-    RUN_TEST(test_get_msg_fail_msg_parser);
-    RUN_TEST(test_get_msg_fail_read_data);
-    RUN_TEST(test_get_msg_fail_read_hdr_error);
-    RUN_TEST(test_get_msg_fail_read_hdr_fd_closed);
-    RUN_TEST(test_get_msg_pass);
+    RUN_TEST(test_get_field_string_pass_v2);
     RUN_TEST(test_parse_msg_new_user_fail_get_name_fail);
-    RUN_TEST(test_parse_msg_new_user_fail_malloc);
+    RUN_TEST(test_parse_msg_new_user_fail_stream);
     RUN_TEST(test_parse_msg_new_user_fail_wrong_field_id);
     RUN_TEST(test_parse_msg_new_user_fail_wrong_msg_type);
     RUN_TEST(test_parse_msg_new_user_pass);
     RUN_TEST(test_parse_msg_registered_user_fail_get_msg_fail);
-    RUN_TEST(test_parse_msg_registered_user_fail_malloc);
     RUN_TEST(test_parse_msg_registered_user_fail_wrong_field_id);
     RUN_TEST(test_parse_msg_registered_user_fail_wrong_msg_type);
     RUN_TEST(test_parse_msg_registered_user_pass);
-    RUN_TEST(test_send_data_fail_reliable_write_error);
-    RUN_TEST(test_send_data_pass);
+    RUN_TEST(test_parse_msg_registered_user_pass_stream);
+    RUN_TEST(test_read_msg_fail_decode);
+    RUN_TEST(test_read_msg_fail_fill_msg_reader);
+    RUN_TEST(test_read_msg_incomplete);
+    RUN_TEST(test_read_msg_incomplete_drained);
+    RUN_TEST(test_read_msg_part_fail_fill_msg_reader);
+    RUN_TEST(test_read_msg_part_incomplete);
+    RUN_TEST(test_read_msg_part_pass_last);
+    RUN_TEST(test_read_msg_part_pass_resumed);
+    RUN_TEST(test_read_msg_pass_buffered);
+    RUN_TEST(test_read_msg_pass_resumed);
+    RUN_TEST(test_release_msg_ring_pass);
     return UNITY_END();
 }
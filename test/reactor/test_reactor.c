@@ -0,0 +1,118 @@
+// Copyright 2020 author. All rights reserved.
+
+#include <stdlib.h>
+
+#include "mocks/mock_osdep.h"
+#include "mocks/mock_reactor_internal.h"
+#include "mocks/mock_user.h"
+#include "src/reactor/reactor.h"
+#include "src/reactor/reactor_internal.h"
+#include "unity/src/unity.h"
+
+void setUp(void) {
+    /* set stuff up here */
+    mock_osdep_Init();
+    mock_reactor_internal_Init();
+    mock_user_Init();
+}
+
+void tearDown(void) {
+    /* clean stuff up here */
+    mock_osdep_Verify();
+    mock_osdep_Destroy();
+    mock_reactor_internal_Verify();
+    mock_reactor_internal_Destroy();
+    mock_user_Verify();
+    mock_user_Destroy();
+}
+
+void test_start_reactors_fail_init_reactor(void) {
+    struct reactor reactors[2];
+    int ret;
+
+    os_malloc_ExpectAndReturn(sizeof(reactors), reactors);
+    init_reactor_ExpectAndReturn(&reactors[0], 0, EXIT_SUCCESS);
+    init_reactor_ExpectAndReturn(&reactors[1], 1, EXIT_FAILURE);
+    exit_reactor_Expect(&reactors[0]);
+    os_free_Expect(reactors);
+    ret = start_reactors(2);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_start_reactors_fail_malloc(void) {
+    int ret;
+
+    os_malloc_ExpectAndReturn(2 * sizeof(struct reactor), NULL);
+    ret = start_reactors(2);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_start_reactors_fail_pthread_create(void) {
+    struct reactor reactors[2];
+    int ret;
+
+    reactors[0].wakefd = 5;
+    reactors[0].thread = 7;
+
+    os_malloc_ExpectAndReturn(sizeof(reactors), reactors);
+    init_reactor_ExpectAndReturn(&reactors[0], 0, EXIT_SUCCESS);
+    init_reactor_ExpectAndReturn(&reactors[1], 1, EXIT_SUCCESS);
+    os_pthread_sigmask_ExpectAnyArgsAndReturn(0);
+    os_pthread_create_ExpectAnyArgsAndReturn(0);
+    os_pthread_create_ExpectAnyArgsAndReturn(-1);
+    os_pthread_sigmask_ExpectAnyArgsAndReturn(0);
+    os_eventfd_write_ExpectAndReturn(reactors[0].wakefd, 1, 0);
+    os_pthread_join_ExpectAndReturn(reactors[0].thread, 0);
+    exit_reactor_Expect(&reactors[0]);
+    exit_reactor_Expect(&reactors[1]);
+    os_free_Expect(reactors);
+    ret = start_reactors(2);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_FALSE(reactors[0].running);
+}
+
+void test_start_reactors_pass(void) {
+    struct reactor reactors[2];
+    int ret;
+
+    reactors[0].wakefd = 5;
+    reactors[0].thread = 7;
+    reactors[1].wakefd = 6;
+    reactors[1].thread = 8;
+
+    os_malloc_ExpectAndReturn(sizeof(reactors), reactors);
+    init_reactor_ExpectAndReturn(&reactors[0], 0, EXIT_SUCCESS);
+    init_reactor_ExpectAndReturn(&reactors[1], 1, EXIT_SUCCESS);
+    os_pthread_sigmask_ExpectAnyArgsAndReturn(0);
+    os_pthread_create_ExpectAnyArgsAndReturn(0);
+    os_pthread_create_ExpectAnyArgsAndReturn(0);
+    os_pthread_sigmask_ExpectAnyArgsAndReturn(0);
+    ret = start_reactors(2);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+
+    os_eventfd_write_ExpectAndReturn(reactors[0].wakefd, 1, 0);
+    os_eventfd_write_ExpectAndReturn(reactors[1].wakefd, 1, 0);
+    os_pthread_join_ExpectAndReturn(reactors[0].thread, 0);
+    os_pthread_join_ExpectAndReturn(reactors[1].thread, 0);
+    exit_reactor_Expect(&reactors[0]);
+    exit_reactor_Expect(&reactors[1]);
+    os_free_Expect(reactors);
+    stop_reactors();
+
+    TEST_ASSERT_FALSE(reactors[0].running);
+    TEST_ASSERT_FALSE(reactors[1].running);
+}
+
+/* not needed when using generate_test_runner.rb */
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_start_reactors_fail_init_reactor);
+    RUN_TEST(test_start_reactors_fail_malloc);
+    RUN_TEST(test_start_reactors_fail_pthread_create);
+    RUN_TEST(test_start_reactors_pass);
+    return UNITY_END();
+}
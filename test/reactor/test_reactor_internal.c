@@ -0,0 +1,349 @@
+// Copyright 2020 author. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+#include "mocks/mock_comms.h"
+#include "mocks/mock_osdep.h"
+#include "mocks/mock_timer.h"
+#include "mocks/mock_user.h"
+#include "src/reactor/reactor_internal.h"
+#include "unity/src/unity.h"
+
+void setUp(void) {
+    /* set stuff up here */
+    mock_comms_Init();
+    mock_osdep_Init();
+    mock_timer_Init();
+    mock_user_Init();
+}
+
+void tearDown(void) {
+    /* clean stuff up here */
+    mock_comms_Verify();
+    mock_comms_Destroy();
+    mock_osdep_Verify();
+    mock_osdep_Destroy();
+    mock_timer_Verify();
+    mock_timer_Destroy();
+    mock_user_Verify();
+    mock_user_Destroy();
+}
+
+int wake_handler(int fd) {
+    return fd;
+}
+
+void *memcpy_callback(void *dest, const void *src, size_t n, int num_calls) {
+    (void)num_calls;
+
+    return memcpy(dest, src, n);
+}
+
+void test_copy_broadcast_msg_fail_malloc(void) {
+    struct msg_broadcast data;
+    struct reactor_msg *msg;
+
+    data.timestamp = 1234;
+    data.name = (char *)"John Doe";
+    data.msg = (char *)"Hello, World!";
+    data.stream = NULL;
+
+    os_malloc_ExpectAndReturn(sizeof(struct reactor_msg) + 9 + 14, NULL);
+    msg = copy_broadcast_msg(&data);
+
+    TEST_ASSERT_NULL(msg);
+}
+
+void test_copy_broadcast_msg_pass(void) {
+    uint8_t buf[sizeof(struct reactor_msg) + 9 + 14];
+    struct msg_broadcast data;
+    struct reactor_msg *msg;
+
+    data.timestamp = 1234;
+    data.name = (char *)"John Doe";
+    data.msg = (char *)"Hello, World!";
+    data.stream = NULL;
+    data.prio = MSG_PRIO_SYSTEM;
+
+    os_malloc_ExpectAndReturn(sizeof(buf), buf);
+    os_memcpy_StubWithCallback(memcpy_callback);
+    msg = copy_broadcast_msg(&data);
+
+    TEST_ASSERT_EQUAL_PTR(buf, msg);
+    TEST_ASSERT_EQUAL_UINT32(1234, msg->data.timestamp);
+    TEST_ASSERT_EQUAL_INT(MSG_PRIO_SYSTEM, msg->data.prio);
+    TEST_ASSERT_EQUAL_STRING("John Doe", msg->data.name);
+    TEST_ASSERT_EQUAL_STRING("Hello, World!", msg->data.msg);
+}
+
+void test_copy_broadcast_msg_pass_stream(void) {
+    uint8_t buf[sizeof(struct reactor_msg) + 9 + 2];
+    char part[] = "hi";
+    struct msg_stream stream;
+    struct msg_broadcast data;
+    struct reactor_msg *msg;
+
+    stream.id = 1;
+    stream.off = 3;
+    stream.len = 5;
+    stream.part.str = part;
+    stream.part.len = 2;
+    data.timestamp = 1234;
+    data.name = (char *)"John Doe";
+    data.msg = NULL;
+    data.prio = MSG_PRIO_CHAT;
+    data.stream = &stream;
+
+    // the part is copied, the stream it belongs to is not
+    os_malloc_ExpectAndReturn(sizeof(buf), buf);
+    os_memcpy_StubWithCallback(memcpy_callback);
+    msg = copy_broadcast_msg(&data);
+
+    TEST_ASSERT_EQUAL_PTR(buf, msg);
+    TEST_ASSERT_EQUAL_PTR(&msg->stream, msg->data.stream);
+    TEST_ASSERT_NULL(msg->data.msg);
+    TEST_ASSERT_EQUAL_INT(3, msg->stream.off);
+    TEST_ASSERT_EQUAL_INT(5, msg->stream.len);
+    TEST_ASSERT_EQUAL_PTR(&msg->buf[9], msg->stream.part.str);
+    TEST_ASSERT_EQUAL_INT(0, memcmp("hi", msg->stream.part.str, 2));
+}
+
+void test_drain_inbox_pass(void) {
+    struct reactor reactor;
+    struct reactor_msg msg1;
+    struct reactor_msg msg2;
+    int ret;
+
+    reactor.wakefd = 5;
+    INIT_LIST_HEAD(&reactor.inbox);
+    list_add_tail(&msg1.list, &reactor.inbox);
+    list_add_tail(&msg2.list, &reactor.inbox);
+
+    os_eventfd_read_ExpectAndReturn(reactor.wakefd, NULL, 0);
+    os_eventfd_read_IgnoreArg_value();
+    os_pthread_mutex_lock_ExpectAndReturn(&reactor.inbox_lock, 0);
+    os_pthread_mutex_unlock_ExpectAndReturn(&reactor.inbox_lock, 0);
+    deliver_forwarded_msg_Expect(&msg1.data);
+    os_free_Expect(&msg1);
+    deliver_forwarded_msg_Expect(&msg2.data);
+    os_free_Expect(&msg2);
+    ret = drain_inbox(&reactor);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_TRUE(list_empty(&reactor.inbox));
+}
+
+void test_exit_reactor_pass(void) {
+    struct reactor reactor;
+    struct reactor_msg msg;
+
+    reactor.listenfd = 3;
+    reactor.epollfd = 4;
+    reactor.wakefd = 5;
+    INIT_LIST_HEAD(&reactor.inbox);
+    list_add_tail(&msg.list, &reactor.inbox);
+
+    os_free_Expect(&msg);
+    os_close_ExpectAndReturn(reactor.epollfd, 0);
+    os_close_ExpectAndReturn(reactor.listenfd, 0);
+    os_pthread_mutex_destroy_ExpectAndReturn(&reactor.inbox_lock, 0);
+    os_close_ExpectAndReturn(reactor.wakefd, 0);
+    exit_reactor(&reactor);
+}
+
+void test_init_reactor_fail_eventfd(void) {
+    struct reactor reactor;
+    int ret;
+
+    os_eventfd_ExpectAndReturn(0, EFD_NONBLOCK | EFD_CLOEXEC, -1);
+    ret = init_reactor(&reactor, 1);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_init_reactor_fail_event_loop(void) {
+    struct reactor reactor;
+    int ret;
+
+    os_eventfd_ExpectAndReturn(0, EFD_NONBLOCK | EFD_CLOEXEC, 5);
+    os_pthread_mutex_init_ExpectAndReturn(&reactor.inbox_lock, 0);
+    init_listen_sock_ExpectAndReturn(true, 3);
+    init_event_loop_ExpectAndReturn(3, -1);
+    os_close_ExpectAndReturn(3, 0);
+    os_pthread_mutex_destroy_ExpectAndReturn(&reactor.inbox_lock, 0);
+    os_close_ExpectAndReturn(5, 0);
+    ret = init_reactor(&reactor, 1);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_init_reactor_fail_listen_sock(void) {
+    struct reactor reactor;
+    int ret;
+
+    os_eventfd_ExpectAndReturn(0, EFD_NONBLOCK | EFD_CLOEXEC, 5);
+    os_pthread_mutex_init_ExpectAndReturn(&reactor.inbox_lock, 0);
+    init_listen_sock_ExpectAndReturn(true, -1);
+    os_pthread_mutex_destroy_ExpectAndReturn(&reactor.inbox_lock, 0);
+    os_close_ExpectAndReturn(5, 0);
+    ret = init_reactor(&reactor, 1);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_init_reactor_fail_mutex_init(void) {
+    struct reactor reactor;
+    int ret;
+
+    os_eventfd_ExpectAndReturn(0, EFD_NONBLOCK | EFD_CLOEXEC, 5);
+    os_pthread_mutex_init_ExpectAndReturn(&reactor.inbox_lock, -1);
+    os_close_ExpectAndReturn(5, 0);
+    ret = init_reactor(&reactor, 1);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_init_reactor_pass(void) {
+    struct reactor reactor;
+    int ret;
+
+    os_eventfd_ExpectAndReturn(0, EFD_NONBLOCK | EFD_CLOEXEC, 5);
+    os_pthread_mutex_init_ExpectAndReturn(&reactor.inbox_lock, 0);
+    init_listen_sock_ExpectAndReturn(true, 3);
+    init_event_loop_ExpectAndReturn(3, 4);
+    ret = init_reactor(&reactor, 1);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_INT(1, reactor.id);
+    TEST_ASSERT_EQUAL_INT(3, reactor.listenfd);
+    TEST_ASSERT_EQUAL_INT(4, reactor.epollfd);
+    TEST_ASSERT_EQUAL_INT(5, reactor.wakefd);
+    TEST_ASSERT_TRUE(reactor.running);
+    TEST_ASSERT_TRUE(list_empty(&reactor.inbox));
+}
+
+void test_post_reactor_msg_pass_empty(void) {
+    struct reactor reactor;
+    struct reactor_msg msg;
+
+    reactor.wakefd = 5;
+    INIT_LIST_HEAD(&reactor.inbox);
+
+    os_pthread_mutex_lock_ExpectAndReturn(&reactor.inbox_lock, 0);
+    os_pthread_mutex_unlock_ExpectAndReturn(&reactor.inbox_lock, 0);
+    os_eventfd_write_ExpectAndReturn(reactor.wakefd, 1, 0);
+    post_reactor_msg(&reactor, &msg);
+
+    TEST_ASSERT_EQUAL_PTR(&msg.list, reactor.inbox.next);
+}
+
+void test_post_reactor_msg_pass_not_empty(void) {
+    struct reactor reactor;
+    struct reactor_msg msg1;
+    struct reactor_msg msg2;
+
+    reactor.wakefd = 5;
+    INIT_LIST_HEAD(&reactor.inbox);
+    list_add_tail(&msg1.list, &reactor.inbox);
+
+    os_pthread_mutex_lock_ExpectAndReturn(&reactor.inbox_lock, 0);
+    os_pthread_mutex_unlock_ExpectAndReturn(&reactor.inbox_lock, 0);
+    post_reactor_msg(&reactor, &msg2);
+
+    TEST_ASSERT_EQUAL_PTR(&msg2.list, reactor.inbox.prev);
+}
+
+void test_run_reactor_loop_fail_add_event_handler(void) {
+    struct reactor reactor;
+    int ret;
+
+    reactor.id = 1;
+    reactor.epollfd = 4;
+    reactor.wakefd = 5;
+
+    add_event_handler_ExpectAndReturn(4, 5, &wake_handler, EXIT_FAILURE);
+    ret = run_reactor_loop(&reactor, &wake_handler);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_run_reactor_loop_fail_drain_event_loop(void) {
+    struct reactor reactor;
+    int ret;
+
+    reactor.id = 1;
+    reactor.listenfd = 3;
+    reactor.epollfd = 4;
+    reactor.wakefd = 5;
+    reactor.running = false;
+
+    add_event_handler_ExpectAndReturn(4, 5, &wake_handler, EXIT_SUCCESS);
+    init_timers_Expect();
+    init_user_Expect();
+    drain_event_loop_ExpectAndReturn(4, 3, EXIT_FAILURE);
+    ret = run_reactor_loop(&reactor, &wake_handler);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_run_reactor_loop_fail_monitor_socks(void) {
+    struct reactor reactor;
+    int ret;
+
+    reactor.id = 1;
+    reactor.listenfd = 3;
+    reactor.epollfd = 4;
+    reactor.wakefd = 5;
+    reactor.running = true;
+
+    add_event_handler_ExpectAndReturn(4, 5, &wake_handler, EXIT_SUCCESS);
+    init_timers_Expect();
+    init_user_Expect();
+    monitor_socks_ExpectAndReturn(4, 3, EXIT_FAILURE);
+    ret = run_reactor_loop(&reactor, &wake_handler);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_run_reactor_loop_pass(void) {
+    struct reactor reactor;
+    int ret;
+
+    reactor.id = 1;
+    reactor.listenfd = 3;
+    reactor.epollfd = 4;
+    reactor.wakefd = 5;
+    reactor.running = false;
+
+    add_event_handler_ExpectAndReturn(4, 5, &wake_handler, EXIT_SUCCESS);
+    init_timers_Expect();
+    init_user_Expect();
+    drain_event_loop_ExpectAndReturn(4, 3, EXIT_SUCCESS);
+    ret = run_reactor_loop(&reactor, &wake_handler);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+/* not needed when using generate_test_runner.rb */
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_copy_broadcast_msg_fail_malloc);
+    RUN_TEST(test_copy_broadcast_msg_pass);
+    RUN_TEST(test_copy_broadcast_msg_pass_stream);
+    RUN_TEST(test_drain_inbox_pass);
+    RUN_TEST(test_exit_reactor_pass);
+    RUN_TEST(test_init_reactor_fail_eventfd);
+    RUN_TEST(test_init_reactor_fail_event_loop);
+    RUN_TEST(test_init_reactor_fail_listen_sock);
+    RUN_TEST(test_init_reactor_fail_mutex_init);
+    RUN_TEST(test_init_reactor_pass);
+    RUN_TEST(test_post_reactor_msg_pass_empty);
+    RUN_TEST(test_post_reactor_msg_pass_not_empty);
+    RUN_TEST(test_run_reactor_loop_fail_add_event_handler);
+    RUN_TEST(test_run_reactor_loop_fail_drain_event_loop);
+    RUN_TEST(test_run_reactor_loop_fail_monitor_socks);
+    RUN_TEST(test_run_reactor_loop_pass);
+    return UNITY_END();
+}
@@ -0,0 +1,54 @@
+// Copyright 2020 author. All rights reserved.
+
+#include <stdlib.h>
+
+#include "src/stats/stats.h"
+#include "unity/src/unity.h"
+
+void setUp(void) {
+    /* set stuff up here */
+    reset_stats();
+}
+
+void tearDown(void) {
+    /* clean stuff up here */
+}
+
+void test_add_stat_pass(void) {
+    add_stat(STAT_ACCEPTS, 3);
+    add_stat(STAT_ACCEPTS, 4);
+
+    TEST_ASSERT_EQUAL_UINT64(7, get_stat(STAT_ACCEPTS));
+    TEST_ASSERT_EQUAL_UINT64(0, get_stat(STAT_ACCEPT_WAKEUPS));
+}
+
+void test_max_stat_pass(void) {
+    max_stat(STAT_ACCEPTS_MAX, 5);
+    max_stat(STAT_ACCEPTS_MAX, 2);
+
+    TEST_ASSERT_EQUAL_UINT64(5, get_stat(STAT_ACCEPTS_MAX));
+
+    max_stat(STAT_ACCEPTS_MAX, 9);
+
+    TEST_ASSERT_EQUAL_UINT64(9, get_stat(STAT_ACCEPTS_MAX));
+}
+
+void test_reset_stats_pass(void) {
+    for (int i = 0; i < NUM_STATS; i++) {
+        add_stat(i, 1);
+    }
+    reset_stats();
+
+    for (int i = 0; i < NUM_STATS; i++) {
+        TEST_ASSERT_EQUAL_UINT64(0, get_stat(i));
+    }
+}
+
+/* not needed when using generate_test_runner.rb */
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_add_stat_pass);
+    RUN_TEST(test_max_stat_pass);
+    RUN_TEST(test_reset_stats_pass);
+    return UNITY_END();
+}
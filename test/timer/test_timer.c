@@ -0,0 +1,139 @@
+// Copyright 2020 author. All rights reserved.
+
+#include <stdlib.h>
+
+#include "include/common.h"
+#include "include/list.h"
+#include "mocks/mock_osdep.h"
+#include "mocks/mock_timer_internal.h"
+#include "src/timer/timer.h"
+#include "unity/src/unity.h"
+
+static struct list_head queued;
+
+void setUp(void) {
+    /* set stuff up here */
+    mock_osdep_Init();
+    mock_timer_internal_Init();
+    INIT_LIST_HEAD(&queued);
+}
+
+void tearDown(void) {
+    /* clean stuff up here */
+    mock_osdep_Verify();
+    mock_osdep_Destroy();
+    mock_timer_internal_Verify();
+    mock_timer_internal_Destroy();
+}
+
+void init_timer_wheel_callback(struct timer_wheel *wheel,
+                               uint64_t now,
+                               int num_calls) {
+    UNUSED_PARAMETER(num_calls);
+
+    wheel->now = now;
+    wheel->tick = now / TIMER_TICK_MS + 1;
+    wheel->num_timers = 0;
+}
+
+void queue_timer_callback(struct timer_wheel *wheel,
+                          struct timer *timer,
+                          int num_calls) {
+    UNUSED_PARAMETER(wheel);
+    UNUSED_PARAMETER(num_calls);
+
+    list_add_tail(&timer->list, &queued);
+}
+
+void timer_callback_nop(struct timer *timer) {
+    UNUSED_PARAMETER(timer);
+}
+
+void start_timers(uint64_t now) {
+    os_monotonic_ms_ExpectAndReturn(now);
+    init_timer_wheel_StubWithCallback(&init_timer_wheel_callback);
+    init_timers();
+}
+
+void test_del_timer_pass(void) {
+    struct timer timer;
+
+    start_timers(1050);
+    queue_timer_StubWithCallback(&queue_timer_callback);
+    init_timer(&timer, &timer_callback_nop);
+    mod_timer(&timer, 100);
+    del_timer(&timer);
+
+    TEST_ASSERT_FALSE(timer_pending(&timer));
+    TEST_ASSERT_TRUE(list_empty(&queued));
+    TEST_ASSERT_EQUAL_INT(-1, get_timer_timeout());
+
+    // disarming a disarmed timer does nothing
+    del_timer(&timer);
+}
+
+void test_get_timer_timeout_pass(void) {
+    struct timer timer;
+
+    start_timers(1030);
+
+    TEST_ASSERT_EQUAL_INT(-1, get_timer_timeout());
+
+    queue_timer_StubWithCallback(&queue_timer_callback);
+    init_timer(&timer, &timer_callback_nop);
+    mod_timer(&timer, 5000);
+
+    TEST_ASSERT_EQUAL_INT(70, get_timer_timeout());
+    del_timer(&timer);
+}
+
+void test_init_timer_pass(void) {
+    struct timer timer;
+
+    init_timer(&timer, &timer_callback_nop);
+
+    TEST_ASSERT_FALSE(timer_pending(&timer));
+    TEST_ASSERT_EQUAL_PTR(&timer_callback_nop, timer.callback);
+}
+
+void test_mod_timer_pass(void) {
+    struct timer timer;
+
+    start_timers(1000);
+    queue_timer_StubWithCallback(&queue_timer_callback);
+    init_timer(&timer, &timer_callback_nop);
+    mod_timer(&timer, 250);
+
+    TEST_ASSERT_TRUE(timer_pending(&timer));
+    TEST_ASSERT_EQUAL_UINT64(13, timer.expires);
+
+    // moving an armed timer doesn't arm it twice
+    mod_timer(&timer, 300);
+
+    TEST_ASSERT_EQUAL_UINT64(13, timer.expires);
+    TEST_ASSERT_EQUAL_PTR(&timer.list, queued.next);
+    TEST_ASSERT_EQUAL_PTR(&timer.list, queued.prev);
+    del_timer(&timer);
+}
+
+void test_run_timers_pass(void) {
+    int ret;
+
+    os_monotonic_ms_ExpectAndReturn(2000);
+    expire_timers_ExpectAndReturn(NULL, 2000, 3);
+    expire_timers_IgnoreArg_wheel();
+    ret = run_timers();
+
+    TEST_ASSERT_EQUAL_INT(3, ret);
+}
+
+/* not needed when using generate_test_runner.rb */
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_del_timer_pass);
+    RUN_TEST(test_get_timer_timeout_pass);
+    RUN_TEST(test_init_timer_pass);
+    RUN_TEST(test_mod_timer_pass);
+    RUN_TEST(test_run_timers_pass);
+    return UNITY_END();
+}
@@ -0,0 +1,183 @@
+// Copyright 2020 author. All rights reserved.
+
+#include <stdlib.h>
+
+#include "include/common.h"
+#include "include/list.h"
+#include "src/timer/timer_internal.h"
+#include "unity/src/unity.h"
+
+#define NUM_TEST_TIMERS 20000
+
+struct test_timer {
+    struct timer timer;
+    uint64_t deadline;
+    uint64_t fired;
+};
+
+static struct timer_wheel wheel;
+static struct test_timer timers[NUM_TEST_TIMERS];
+static int num_fired;
+
+void setUp(void) {
+    /* set stuff up here */
+    num_fired = 0;
+}
+
+void tearDown(void) {
+    /* clean stuff up here */
+}
+
+void record_expiry(struct timer *timer) {
+    struct test_timer *test = container_of(timer, struct test_timer, timer);
+
+    test->fired = wheel.tick - 1;
+    num_fired++;
+}
+
+void rearm_expiry(struct timer *timer) {
+    num_fired++;
+    if (num_fired < 3) {
+        timer->expires = wheel.tick;
+        queue_timer(&wheel, timer);
+        wheel.num_timers++;
+    }
+}
+
+void arm_test_timer(struct test_timer *test,
+                    uint64_t expires,
+                    timer_callback callback) {
+    INIT_LIST_HEAD(&test->timer.list);
+    test->timer.expires = expires;
+    test->timer.callback = callback;
+    test->deadline = expires;
+    test->fired = 0;
+    queue_timer(&wheel, &test->timer);
+    wheel.num_timers++;
+}
+
+void test_cascade_timers_pass(void) {
+    struct test_timer test;
+
+    init_timer_wheel(&wheel, 0);
+    arm_test_timer(&test, wheel.tick + 300, &record_expiry);
+
+    TEST_ASSERT_EQUAL_PTR(&test.timer.list, wheel.slots[1][1].next);
+
+    wheel.tick = 256;
+    cascade_timers(&wheel, 1);
+
+    TEST_ASSERT_TRUE(list_empty(&wheel.slots[1][1]));
+    TEST_ASSERT_EQUAL_PTR(&test.timer.list, wheel.slots[0][301 & 0xff].next);
+}
+
+void test_expire_timers_pass(void) {
+    uint64_t now = 1234567;
+    int ret;
+
+    init_timer_wheel(&wheel, now);
+    for (int i = 0; i < NUM_TEST_TIMERS; i++) {
+        arm_test_timer(&timers[i],
+                       wheel.tick + (uint64_t)rand() % 100000,
+                       &record_expiry);
+    }
+
+    // wake up at uneven intervals, like an event loop would
+    while (num_fired < NUM_TEST_TIMERS) {
+        now += (uint64_t)rand() % (50 * TIMER_TICK_MS);
+        ret = expire_timers(&wheel, now);
+        TEST_ASSERT_EQUAL_UINT64(now / TIMER_TICK_MS + 1, wheel.tick);
+        TEST_ASSERT_TRUE(ret >= 0);
+    }
+
+    for (int i = 0; i < NUM_TEST_TIMERS; i++) {
+        TEST_ASSERT_EQUAL_UINT64(timers[i].deadline, timers[i].fired);
+        TEST_ASSERT_TRUE(list_empty(&timers[i].timer.list));
+    }
+    TEST_ASSERT_EQUAL_INT(0, wheel.num_timers);
+}
+
+void test_expire_timers_pass_no_timers(void) {
+    int ret;
+
+    init_timer_wheel(&wheel, 1000);
+    ret = expire_timers(&wheel, 50000);
+
+    TEST_ASSERT_EQUAL_INT(0, ret);
+    TEST_ASSERT_EQUAL_UINT64(501, wheel.tick);
+    TEST_ASSERT_EQUAL_UINT64(50000, wheel.now);
+}
+
+void test_expire_timers_pass_rearm(void) {
+    struct test_timer test;
+    int ret;
+
+    init_timer_wheel(&wheel, 1000);
+    arm_test_timer(&test, wheel.tick, &rearm_expiry);
+
+    // a timer re-armed from its callback runs on the next tick
+    ret = expire_timers(&wheel, 1100);
+
+    TEST_ASSERT_EQUAL_INT(1, ret);
+    TEST_ASSERT_EQUAL_INT(1, wheel.num_timers);
+
+    ret = expire_timers(&wheel, 1199);
+
+    TEST_ASSERT_EQUAL_INT(0, ret);
+
+    ret = expire_timers(&wheel, 1200);
+
+    TEST_ASSERT_EQUAL_INT(1, ret);
+
+    ret = expire_timers(&wheel, 1300);
+
+    TEST_ASSERT_EQUAL_INT(1, ret);
+    TEST_ASSERT_EQUAL_INT(0, wheel.num_timers);
+}
+
+void test_init_timer_wheel_pass(void) {
+    init_timer_wheel(&wheel, 1050);
+
+    TEST_ASSERT_EQUAL_UINT64(1050, wheel.now);
+    TEST_ASSERT_EQUAL_UINT64(11, wheel.tick);
+    TEST_ASSERT_EQUAL_INT(0, wheel.num_timers);
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+            TEST_ASSERT_TRUE(list_empty(&wheel.slots[level][i]));
+        }
+    }
+}
+
+void test_queue_timer_pass(void) {
+    struct test_timer due;
+    struct test_timer soon;
+    struct test_timer later;
+    struct test_timer never;
+
+    init_timer_wheel(&wheel, 0);
+    wheel.tick = 10;
+    arm_test_timer(&due, 3, &record_expiry);
+    arm_test_timer(&soon, 12, &record_expiry);
+    arm_test_timer(&later, 10 + 70000, &record_expiry);
+    arm_test_timer(&never, UINT64_MAX, &record_expiry);
+
+    TEST_ASSERT_EQUAL_PTR(&due.timer.list, wheel.slots[0][10].next);
+    TEST_ASSERT_EQUAL_PTR(&soon.timer.list, wheel.slots[0][12].next);
+    TEST_ASSERT_EQUAL_PTR(&later.timer.list,
+                          wheel.slots[2][(70010 >> 16) & 0xff].next);
+    TEST_ASSERT_EQUAL_PTR(&never.timer.list,
+                          wheel.slots[3][((10 + TIMER_WHEEL_MAX_TICKS - 1)
+                                          >> 24) & 0xff].next);
+}
+
+/* not needed when using generate_test_runner.rb */
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_cascade_timers_pass);
+    RUN_TEST(test_expire_timers_pass);
+    RUN_TEST(test_expire_timers_pass_no_timers);
+    RUN_TEST(test_expire_timers_pass_rearm);
+    RUN_TEST(test_init_timer_wheel_pass);
+    RUN_TEST(test_queue_timer_pass);
+    return UNITY_END();
+}
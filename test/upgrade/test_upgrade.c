@@ -0,0 +1,229 @@
+// Copyright 2020 author. All rights reserved.
+
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "include/common.h"
+#include "mocks/mock_fileio.h"
+#include "mocks/mock_osdep.h"
+#include "mocks/mock_upgrade_internal.h"
+#include "mocks/mock_user.h"
+#include "src/upgrade/upgrade.h"
+#include "unity/src/unity.h"
+
+static char prog[] = "./server";
+static char *argv[] = {prog, NULL};
+static int sv[2] = {3, 4};
+
+void setUp(void) {
+    /* set stuff up here */
+    mock_fileio_Init();
+    mock_osdep_Init();
+    mock_upgrade_internal_Init();
+    mock_user_Init();
+}
+
+void tearDown(void) {
+    /* clean stuff up here */
+    mock_fileio_Verify();
+    mock_fileio_Destroy();
+    mock_osdep_Verify();
+    mock_osdep_Destroy();
+    mock_upgrade_internal_Verify();
+    mock_upgrade_internal_Destroy();
+    mock_user_Verify();
+    mock_user_Destroy();
+}
+
+void expect_recv_fd(int fd, uint32_t type, int ret) {
+    static struct upgrade_hdr hdr[8];
+    static int fds[8];
+    static int n;
+
+    n = (n + 1) % 8;
+    hdr[n].type = type;
+    hdr[n].name_len = 0;
+    hdr[n].in_len = 0;
+    hdr[n].out_len = 0;
+    fds[n] = fd;
+    recv_fd_ExpectAndReturn(5, NULL, NULL, sizeof(struct upgrade_hdr), ret);
+    recv_fd_IgnoreArg_fd();
+    recv_fd_IgnoreArg_buf();
+    recv_fd_ReturnThruPtr_fd(&fds[n]);
+    recv_fd_ReturnMemThruPtr_buf(&hdr[n], sizeof(hdr[n]));
+}
+
+void expect_socketpair(void) {
+    os_socketpair_ExpectAndReturn(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0,
+                                  NULL, 0);
+    os_socketpair_IgnoreArg_sv();
+    os_socketpair_ReturnArrayThruPtr_sv(sv, 2);
+}
+
+void test_receive_listen_sock_fail_recv_fd(void) {
+    expect_recv_fd(-1, 0, EXIT_FAILURE);
+
+    TEST_ASSERT_EQUAL_INT(-1, receive_listen_sock(5));
+}
+
+void test_receive_listen_sock_fail_type(void) {
+    expect_recv_fd(6, UPGRADE_USER, EXIT_SUCCESS);
+    os_close_ExpectAndReturn(6, 0);
+
+    TEST_ASSERT_EQUAL_INT(-1, receive_listen_sock(5));
+}
+
+void test_receive_listen_sock_pass(void) {
+    expect_recv_fd(6, UPGRADE_LISTEN_SOCK, EXIT_SUCCESS);
+
+    TEST_ASSERT_EQUAL_INT(6, receive_listen_sock(5));
+}
+
+void test_receive_users_fail_receive_user(void) {
+    expect_recv_fd(6, UPGRADE_USER, EXIT_SUCCESS);
+    receive_user_ExpectAndReturn(5, 6, NULL, 7, EXIT_FAILURE);
+    receive_user_IgnoreArg_hdr();
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, receive_users(5, 7));
+}
+
+void test_receive_users_fail_recv_fd(void) {
+    expect_recv_fd(-1, 0, EXIT_FAILURE);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, receive_users(5, 7));
+}
+
+void test_receive_users_fail_send_fd(void) {
+    expect_recv_fd(-1, UPGRADE_END, EXIT_SUCCESS);
+    send_fd_ExpectAndReturn(5, -1, NULL, 1, EXIT_FAILURE);
+    send_fd_IgnoreArg_buf();
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, receive_users(5, 7));
+}
+
+void test_receive_users_fail_type(void) {
+    expect_recv_fd(6, UPGRADE_LISTEN_SOCK, EXIT_SUCCESS);
+    os_close_ExpectAndReturn(6, 0);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, receive_users(5, 7));
+}
+
+void test_receive_users_pass(void) {
+    expect_recv_fd(6, UPGRADE_USER, EXIT_SUCCESS);
+    receive_user_ExpectAndReturn(5, 6, NULL, 7, EXIT_SUCCESS);
+    receive_user_IgnoreArg_hdr();
+    expect_recv_fd(8, UPGRADE_USER, EXIT_SUCCESS);
+    receive_user_ExpectAndReturn(5, 8, NULL, 7, EXIT_SUCCESS);
+    receive_user_IgnoreArg_hdr();
+    expect_recv_fd(-1, UPGRADE_END, EXIT_SUCCESS);
+    send_fd_ExpectAndReturn(5, -1, NULL, 1, EXIT_SUCCESS);
+    send_fd_IgnoreArg_buf();
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, receive_users(5, 7));
+}
+
+void test_start_upgrade_fail_export_users(void) {
+    expect_socketpair();
+    spawn_server_ExpectAndReturn(argv, 4, 42);
+    os_close_ExpectAndReturn(4, 0);
+    os_memset_ExpectAnyArgsAndReturn(NULL);
+    send_fd_ExpectAndReturn(3, 6, NULL, sizeof(struct upgrade_hdr),
+                            EXIT_SUCCESS);
+    send_fd_IgnoreArg_buf();
+    export_users_ExpectAndReturn(&send_user, NULL, EXIT_FAILURE);
+    export_users_IgnoreArg_arg();
+    os_close_ExpectAndReturn(3, 0);
+    os_waitpid_ExpectAndReturn(42, NULL, 0, 42);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, start_upgrade(argv, 6));
+}
+
+void test_start_upgrade_fail_read_full(void) {
+    expect_socketpair();
+    spawn_server_ExpectAndReturn(argv, 4, 42);
+    os_close_ExpectAndReturn(4, 0);
+    os_memset_ExpectAnyArgsAndReturn(NULL);
+    send_fd_ExpectAndReturn(3, 6, NULL, sizeof(struct upgrade_hdr),
+                            EXIT_SUCCESS);
+    send_fd_IgnoreArg_buf();
+    export_users_ExpectAndReturn(&send_user, NULL, EXIT_SUCCESS);
+    export_users_IgnoreArg_arg();
+    send_fd_ExpectAndReturn(3, -1, NULL, sizeof(struct upgrade_hdr),
+                            EXIT_SUCCESS);
+    send_fd_IgnoreArg_buf();
+    read_full_ExpectAndReturn(3, NULL, 1, EXIT_FAILURE);
+    read_full_IgnoreArg_buf();
+    os_close_ExpectAndReturn(3, 0);
+    os_waitpid_ExpectAndReturn(42, NULL, 0, 42);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, start_upgrade(argv, 6));
+}
+
+void test_start_upgrade_fail_send_fd(void) {
+    expect_socketpair();
+    spawn_server_ExpectAndReturn(argv, 4, 42);
+    os_close_ExpectAndReturn(4, 0);
+    os_memset_ExpectAnyArgsAndReturn(NULL);
+    send_fd_ExpectAndReturn(3, 6, NULL, sizeof(struct upgrade_hdr),
+                            EXIT_FAILURE);
+    send_fd_IgnoreArg_buf();
+    os_close_ExpectAndReturn(3, 0);
+    os_waitpid_ExpectAndReturn(42, NULL, 0, 42);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, start_upgrade(argv, 6));
+}
+
+void test_start_upgrade_fail_socketpair(void) {
+    os_socketpair_ExpectAnyArgsAndReturn(-1);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, start_upgrade(argv, 6));
+}
+
+void test_start_upgrade_fail_spawn_server(void) {
+    expect_socketpair();
+    spawn_server_ExpectAndReturn(argv, 4, -1);
+    os_close_ExpectAndReturn(4, 0);
+    os_close_ExpectAndReturn(3, 0);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, start_upgrade(argv, 6));
+}
+
+void test_start_upgrade_pass(void) {
+    expect_socketpair();
+    spawn_server_ExpectAndReturn(argv, 4, 42);
+    os_close_ExpectAndReturn(4, 0);
+    os_memset_ExpectAnyArgsAndReturn(NULL);
+    send_fd_ExpectAndReturn(3, 6, NULL, sizeof(struct upgrade_hdr),
+                            EXIT_SUCCESS);
+    send_fd_IgnoreArg_buf();
+    export_users_ExpectAndReturn(&send_user, NULL, EXIT_SUCCESS);
+    export_users_IgnoreArg_arg();
+    send_fd_ExpectAndReturn(3, -1, NULL, sizeof(struct upgrade_hdr),
+                            EXIT_SUCCESS);
+    send_fd_IgnoreArg_buf();
+    read_full_ExpectAndReturn(3, NULL, 1, EXIT_SUCCESS);
+    read_full_IgnoreArg_buf();
+    os_close_ExpectAndReturn(3, 0);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, start_upgrade(argv, 6));
+}
+
+/* not needed when using generate_test_runner.rb */
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_receive_listen_sock_fail_recv_fd);
+    RUN_TEST(test_receive_listen_sock_fail_type);
+    RUN_TEST(test_receive_listen_sock_pass);
+    RUN_TEST(test_receive_users_fail_receive_user);
+    RUN_TEST(test_receive_users_fail_recv_fd);
+    RUN_TEST(test_receive_users_fail_send_fd);
+    RUN_TEST(test_receive_users_fail_type);
+    RUN_TEST(test_receive_users_pass);
+    RUN_TEST(test_start_upgrade_fail_export_users);
+    RUN_TEST(test_start_upgrade_fail_read_full);
+    RUN_TEST(test_start_upgrade_fail_send_fd);
+    RUN_TEST(test_start_upgrade_fail_socketpair);
+    RUN_TEST(test_start_upgrade_fail_spawn_server);
+    RUN_TEST(test_start_upgrade_pass);
+    return UNITY_END();
+}
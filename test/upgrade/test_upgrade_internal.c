@@ -0,0 +1,291 @@
+// Copyright 2020 author. All rights reserved.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/common.h"
+#include "mocks/mock_comms.h"
+#include "mocks/mock_fileio.h"
+#include "mocks/mock_osdep.h"
+#include "src/upgrade/upgrade_internal.h"
+#include "unity/src/unity.h"
+
+void setUp(void) {
+    /* set stuff up here */
+    mock_comms_Init();
+    mock_fileio_Init();
+    mock_osdep_Init();
+}
+
+void tearDown(void) {
+    /* clean stuff up here */
+    mock_comms_Verify();
+    mock_comms_Destroy();
+    mock_fileio_Verify();
+    mock_fileio_Destroy();
+    mock_osdep_Verify();
+    mock_osdep_Destroy();
+}
+
+void *os_malloc_callback(size_t size, int num_calls) {
+    UNUSED_PARAMETER(num_calls);
+
+    return malloc(size);
+}
+
+static char prog[] = "./server";
+static char opt_l[] = "-l";
+static char opt_l_arg[] = "8";
+static char opt_u[] = "-u";
+static char opt_u_arg[] = "7";
+static char user_name[] = "bob";
+static struct user_state added_state;
+
+int add_user_to_event_loop_save_state(int epollfd,
+                                      struct user_state *state,
+                                      int num_calls) {
+    UNUSED_PARAMETER(epollfd);
+    UNUSED_PARAMETER(num_calls);
+
+    added_state = *state;
+    return EXIT_SUCCESS;
+}
+
+static struct upgrade_hdr sent_hdr;
+
+int send_fd_save_hdr(int sock,
+                     int fd,
+                     const void *buf,
+                     size_t len,
+                     int num_calls) {
+    UNUSED_PARAMETER(sock);
+    UNUSED_PARAMETER(fd);
+
+    if (0 == num_calls) {
+        TEST_ASSERT_EQUAL_UINT(sizeof(sent_hdr), len);
+        memcpy(&sent_hdr, buf, len);
+    }
+    return EXIT_SUCCESS;
+}
+
+void test_build_upgrade_argv_fail_malloc(void) {
+    char *argv[] = {prog, NULL};
+
+    os_malloc_ExpectAnyArgsAndReturn(NULL);
+
+    TEST_ASSERT_NULL(build_upgrade_argv(argv, 5));
+}
+
+void test_build_upgrade_argv_pass(void) {
+    char *argv[] = {prog, opt_u, opt_u_arg, opt_l, opt_l_arg, NULL};
+    char **new_argv;
+
+    os_malloc_StubWithCallback(&os_malloc_callback);
+
+    new_argv = build_upgrade_argv(argv, 5);
+
+    TEST_ASSERT_NOT_NULL(new_argv);
+    TEST_ASSERT_EQUAL_STRING("./server", new_argv[0]);
+    TEST_ASSERT_EQUAL_STRING("-l", new_argv[1]);
+    TEST_ASSERT_EQUAL_STRING("8", new_argv[2]);
+    TEST_ASSERT_EQUAL_STRING("-u", new_argv[3]);
+    TEST_ASSERT_EQUAL_STRING("5", new_argv[4]);
+    TEST_ASSERT_NULL(new_argv[5]);
+    free(new_argv);
+}
+
+void test_receive_user_fail_malloc(void) {
+    struct upgrade_hdr hdr = {UPGRADE_USER, 4, 0, 0, 0, 0, 0, 0, 0};
+
+    os_malloc_ExpectAndReturn(4, NULL);
+    os_free_Expect(NULL);
+    os_free_Expect(NULL);
+    os_free_Expect(NULL);
+    os_close_ExpectAndReturn(7, 0);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, receive_user(3, 7, &hdr, 4));
+}
+
+void test_receive_user_fail_read_full(void) {
+    struct upgrade_hdr hdr = {UPGRADE_USER, 4, 0, 0, 0, 0, 0, 0, 0};
+    char name[4];
+
+    os_malloc_ExpectAndReturn(4, name);
+    read_full_ExpectAndReturn(3, name, 4, EXIT_FAILURE);
+    os_free_Expect(name);
+    os_free_Expect(NULL);
+    os_free_Expect(NULL);
+    os_close_ExpectAndReturn(7, 0);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, receive_user(3, 7, &hdr, 4));
+}
+
+void test_receive_user_pass(void) {
+    struct upgrade_hdr hdr = {UPGRADE_USER, 4, 2, 3, 0, 0, 0, 0, MSG_FLAG_V2};
+    char name[4];
+    uint8_t in_buf[2];
+    uint8_t out_buf[3];
+
+    os_malloc_ExpectAndReturn(4, name);
+    read_full_ExpectAndReturn(3, name, 4, EXIT_SUCCESS);
+    read_full_IgnoreArg_buf();
+    read_full_ReturnMemThruPtr_buf("bob", 4);
+    os_malloc_ExpectAndReturn(2, in_buf);
+    read_full_ExpectAndReturn(3, in_buf, 2, EXIT_SUCCESS);
+    read_full_IgnoreArg_buf();
+    read_full_ReturnMemThruPtr_buf("in", 2);
+    os_malloc_ExpectAndReturn(3, out_buf);
+    read_full_ExpectAndReturn(3, out_buf, 3, EXIT_SUCCESS);
+    read_full_IgnoreArg_buf();
+    read_full_ReturnMemThruPtr_buf("out", 3);
+    add_user_to_event_loop_StubWithCallback(
+        &add_user_to_event_loop_save_state);
+    os_free_Expect(in_buf);
+    os_free_Expect(out_buf);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, receive_user(3, 7, &hdr, 4));
+    TEST_ASSERT_EQUAL_INT(7, added_state.fd);
+    TEST_ASSERT_EQUAL_STRING("bob", added_state.name);
+    TEST_ASSERT_EQUAL_PTR(in_buf, added_state.in_buf);
+    TEST_ASSERT_EQUAL_UINT(2, added_state.in_len);
+    TEST_ASSERT_EQUAL_MEMORY("in", in_buf, 2);
+    TEST_ASSERT_EQUAL_PTR(out_buf, added_state.out_buf);
+    TEST_ASSERT_EQUAL_UINT(3, added_state.out_len);
+    TEST_ASSERT_EQUAL_MEMORY("out", out_buf, 3);
+    TEST_ASSERT_EQUAL_UINT8(MSG_FLAG_V2, added_state.caps);
+}
+
+void test_receive_user_pass_fail_add_user(void) {
+    struct upgrade_hdr hdr = {UPGRADE_USER, 0, 0, 0, 0, 0, 0, 0, 0};
+
+    add_user_to_event_loop_ExpectAnyArgsAndReturn(EXIT_FAILURE);
+    os_free_Expect(NULL);
+    os_free_Expect(NULL);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, receive_user(3, 7, &hdr, 4));
+}
+
+void test_send_user_fail_send_fd(void) {
+    struct user_state state = {
+        7, user_name, NULL, 0, NULL, 0, false, 0, 0, 0, 0,
+    };
+    int sock = 3;
+
+    send_fd_ExpectAnyArgsAndReturn(EXIT_FAILURE);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, send_user(&state, &sock));
+}
+
+void test_send_user_pass(void) {
+    uint8_t in_buf[] = {1, 2};
+    uint8_t out_buf[] = {3, 4, 5};
+    struct user_state state = {
+        7, user_name, in_buf, 2, out_buf, 3, false, 0, 0, 0, MSG_FLAG_BATCH,
+    };
+    struct upgrade_hdr hdr = {
+        UPGRADE_USER, 4, 2, 3, 0, 0, 0, 0, MSG_FLAG_BATCH,
+    };
+    int sock = 3;
+
+    send_fd_ExpectAndReturn(3, 7, &hdr, sizeof(hdr), EXIT_SUCCESS);
+    send_fd_ExpectAndReturn(3, -1, "bob", 4, EXIT_SUCCESS);
+    send_fd_ExpectAndReturn(3, -1, in_buf, 2, EXIT_SUCCESS);
+    send_fd_ExpectAndReturn(3, -1, out_buf, 3, EXIT_SUCCESS);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, send_user(&state, &sock));
+}
+
+void test_send_user_pass_pending(void) {
+    struct user_state state = {7, NULL, NULL, 0, NULL, 0, false, 0, 0, 0, 0};
+    struct upgrade_hdr hdr = {UPGRADE_USER, 0, 0, 0, 0, 0, 0, 0, 0};
+    int sock = 3;
+
+    send_fd_ExpectAndReturn(3, 7, &hdr, sizeof(hdr), EXIT_SUCCESS);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, send_user(&state, &sock));
+}
+
+void test_send_user_pass_stream(void) {
+    uint8_t in_buf[] = {'a', 'b'};
+    struct user_state state = {
+        7, user_name, in_buf, 2, NULL, 0, true, 3, 100000, 99990, 0,
+    };
+    char name[4];
+    uint8_t received_in_buf[2];
+    int sock = 3;
+
+    send_fd_StubWithCallback(&send_fd_save_hdr);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, send_user(&state, &sock));
+
+    // the new process picks the stream up where the old one left it
+    os_malloc_ExpectAndReturn(4, name);
+    read_full_ExpectAndReturn(3, name, 4, EXIT_SUCCESS);
+    read_full_IgnoreArg_buf();
+    read_full_ReturnMemThruPtr_buf("bob", 4);
+    os_malloc_ExpectAndReturn(2, received_in_buf);
+    read_full_ExpectAndReturn(3, received_in_buf, 2, EXIT_SUCCESS);
+    read_full_IgnoreArg_buf();
+    read_full_ReturnMemThruPtr_buf(in_buf, 2);
+    add_user_to_event_loop_StubWithCallback(
+        &add_user_to_event_loop_save_state);
+    os_free_Expect(received_in_buf);
+    os_free_Expect(NULL);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, receive_user(3, 7, &sent_hdr, 4));
+    TEST_ASSERT_EQUAL_STRING("bob", added_state.name);
+    TEST_ASSERT_EQUAL_UINT(2, added_state.in_len);
+    TEST_ASSERT_EQUAL_MEMORY(in_buf, received_in_buf, 2);
+    TEST_ASSERT_TRUE(added_state.streaming);
+    TEST_ASSERT_EQUAL_UINT32(3, added_state.stream_id);
+    TEST_ASSERT_EQUAL_UINT32(100000, added_state.stream_len);
+    TEST_ASSERT_EQUAL_UINT32(99990, added_state.stream_left);
+}
+
+void test_spawn_server_fail_fork(void) {
+    char *argv[] = {prog, NULL};
+
+    os_fork_ExpectAndReturn(-1);
+
+    TEST_ASSERT_EQUAL_INT(-1, spawn_server(argv, 5));
+}
+
+void test_spawn_server_pass(void) {
+    char *argv[] = {prog, NULL};
+
+    os_fork_ExpectAndReturn(42);
+
+    TEST_ASSERT_EQUAL_INT(42, spawn_server(argv, 5));
+}
+
+void test_spawn_server_pass_child(void) {
+    char *argv[] = {prog, NULL};
+
+    os_fork_ExpectAndReturn(0);
+    os_dup_ExpectAndReturn(5, 6);
+    os_malloc_StubWithCallback(&os_malloc_callback);
+    os_execv_ExpectAndReturn("./server", NULL, -1);
+    os_execv_IgnoreArg_argv();
+    os_exit_Expect(EXIT_FAILURE);
+
+    spawn_server(argv, 5);
+}
+
+/* not needed when using generate_test_runner.rb */
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_build_upgrade_argv_fail_malloc);
+    RUN_TEST(test_build_upgrade_argv_pass);
+    RUN_TEST(test_receive_user_fail_malloc);
+    RUN_TEST(test_receive_user_fail_read_full);
+    RUN_TEST(test_receive_user_pass);
+    RUN_TEST(test_receive_user_pass_fail_add_user);
+    RUN_TEST(test_send_user_fail_send_fd);
+    RUN_TEST(test_send_user_pass);
+    RUN_TEST(test_send_user_pass_pending);
+    RUN_TEST(test_send_user_pass_stream);
+    RUN_TEST(test_spawn_server_fail_fork);
+    RUN_TEST(test_spawn_server_pass);
+    RUN_TEST(test_spawn_server_pass_child);
+    return UNITY_END();
+}
@@ -1,137 +1,698 @@
 // Copyright 2020 author. All rights reserved.
 
 #include <stdlib.h>
+#include <string.h>
 
+#include "include/common.h"
+#include "mocks/mock_fanout.h"
+#include "mocks/mock_fileio.h"
 #include "mocks/mock_message.h"
 #include "mocks/mock_osdep.h"
+#include "mocks/mock_stats.h"
+#include "mocks/mock_timer.h"
 #include "mocks/mock_user_internal.h"
+#include "src/stats/stats.h"
 #include "src/user/user.h"
 #include "unity/src/unity.h"
 
 void setUp(void) {
     /* set stuff up here */
+    mock_fanout_Init();
+    mock_fileio_Init();
     mock_message_Init();
     mock_osdep_Init();
+    mock_stats_Init();
+    mock_timer_Init();
     mock_user_internal_Init();
+
+    // the fanout workers are not started
+    get_num_fanout_workers_IgnoreAndReturn(0);
 }
 
 void tearDown(void) {
     /* clean stuff up here */
+    mock_fanout_Verify();
+    mock_fanout_Destroy();
+    mock_fileio_Verify();
+    mock_fileio_Destroy();
     mock_message_Verify();
     mock_message_Destroy();
     mock_osdep_Verify();
     mock_osdep_Destroy();
+    mock_stats_Verify();
+    mock_stats_Destroy();
+    mock_timer_Verify();
+    mock_timer_Destroy();
     mock_user_internal_Verify();
     mock_user_internal_Destroy();
 }
 
-void test_get_num_users(void) {
-    int num_users = 1;
+static char test_user_name[] = "John Doe";
+static msg_sender used_sender;
+
+int test_sender(int fd, struct msg_frame *frame) {
+    UNUSED_PARAMETER(fd);
+    UNUSED_PARAMETER(frame);
+
+    return EXIT_SUCCESS;
+}
+
+void send_broadcast_msg_to_users_save_sender(struct msg_broadcast *msg,
+                                             msg_sender sender,
+                                             const struct send_budget *budget,
+                                             struct broadcast_batch *batch,
+                                             struct user_fanout *fanout,
+                                             struct list_head *users,
+                                             int num_calls) {
+    UNUSED_PARAMETER(msg);
+    UNUSED_PARAMETER(budget);
+    UNUSED_PARAMETER(batch);
+    UNUSED_PARAMETER(fanout);
+    UNUSED_PARAMETER(users);
+    UNUSED_PARAMETER(num_calls);
+
+    used_sender = sender;
+}
+
+void send_broadcast_msg_to_users_fill_batch(struct msg_broadcast *msg,
+                                            msg_sender sender,
+                                            const struct send_budget *budget,
+                                            struct broadcast_batch *batch,
+                                            struct user_fanout *fanout,
+                                            struct list_head *users,
+                                            int num_calls) {
+    UNUSED_PARAMETER(msg);
+    UNUSED_PARAMETER(sender);
+    UNUSED_PARAMETER(budget);
+    UNUSED_PARAMETER(fanout);
+    UNUSED_PARAMETER(users);
+    UNUSED_PARAMETER(num_calls);
+
+    TEST_ASSERT_NOT_NULL(batch);
+    TEST_ASSERT_EQUAL_INT(USER_BATCH_MAX_LEN, batch->max_len);
+    TEST_ASSERT_EQUAL_INT(5, batch->window_ms);
+    batch->num_frames = 1;
+    batch->len = 10;
+    batch->deadline = 105;
+}
+
+void init_timer_save_callback(struct timer *timer,
+                              timer_callback callback,
+                              int num_calls) {
+    UNUSED_PARAMETER(num_calls);
+
+    timer->callback = callback;
+}
+
+void init_user_list_init_head(struct list_head *users, int num_calls) {
+    UNUSED_PARAMETER(num_calls);
+
+    INIT_LIST_HEAD(users);
+}
+
+static struct user_info imported_users[2];
+static int num_imported_users;
+
+struct user_info *add_pending_user_add_to_list(int fd,
+                                               struct list_head *users,
+                                               struct user_table *table,
+                                               int num_calls) {
+    struct user_info *user = &imported_users[num_imported_users++];
+
+    UNUSED_PARAMETER(table);
+    UNUSED_PARAMETER(num_calls);
+
+    user->fd = fd;
+    user->name = NULL;
+    user->caps = 0;
+    user->remove_user = false;
+    user->reader.ring.buf = NULL;
+    user->reader.ring.len = 0;
+    user->reader.streaming = false;
+    user->reader.stream.id = 0;
+    user->reader.stream.len = 0;
+    user->reader.stream_left = 0;
+    user->send_queue_len = 0;
+    list_add_tail(&user->list, users);
+    return user;
+}
+
+static int exported_fds[2];
+static struct user_state exported_state;
+static int num_exported_users;
+
+int exporter_save_fd(struct user_state *state, void *arg) {
+    UNUSED_PARAMETER(arg);
+
+    exported_fds[num_exported_users++] = state->fd;
+    exported_state = *state;
+    return EXIT_SUCCESS;
+}
+
+int exporter_fail(struct user_state *state, void *arg) {
+    UNUSED_PARAMETER(state);
+    UNUSED_PARAMETER(arg);
+
+    return EXIT_FAILURE;
+}
+
+static void import_test_users(void) {
+    struct user_state state = {3, NULL, NULL, 0, NULL, 0, false, 0, 0, 0, 0};
+
+    num_imported_users = 0;
+    num_exported_users = 0;
+    init_user_list_StubWithCallback(&init_user_list_init_head);
+    init_user();
+    add_pending_user_StubWithCallback(&add_pending_user_add_to_list);
+    init_timer_Ignore();
+    mod_timer_Ignore();
+    restore_user_state_IgnoreAndReturn(EXIT_SUCCESS);
+
+    state.name = test_user_name;
+    import_user(&state);
+    state.fd = 4;
+    state.name = NULL;
+    import_user(&state);
+}
+
+void test_broadcast_user_msg_fail_get_user(void) {
+    struct msg_registered_user user_msg;
+    int fd = 3;
     int ret;
 
-    count_num_users_ExpectAnyArgsAndReturn(num_users);
-    ret = get_num_users();
+    user_msg.msg.str = (char *)"Hello, World!";
+    user_msg.msg.len = strlen(user_msg.msg.str);
+    user_msg.streamed = false;
 
-    TEST_ASSERT_EQUAL_INT(num_users, ret);
+    get_user_from_fd_ExpectAndReturn(fd, NULL, NULL);
+    get_user_from_fd_IgnoreArg_table();
+    ret = broadcast_user_msg(fd, &user_msg);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_broadcast_user_msg_pass(void) {
+    const char *name = "John Doe";
+    struct msg_registered_user user_msg;
+    struct user_info user;
+    int fd = 3;
+    int ret;
+
+    user.fd = fd;
+    user.name = (char *)name;
+    user.remove_user = false;
+    user_msg.msg.str = (char *)"Hello, World!";
+    user_msg.msg.len = strlen(user_msg.msg.str);
+    user_msg.streamed = false;
+
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    os_timestamp_ExpectAndReturn(0);
+    send_broadcast_msg_to_users_ExpectAnyArgs();
+    ret = broadcast_user_msg(fd, &user_msg);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+static void expect_user_msg(struct user_info *user,
+                            struct msg_registered_user *user_msg) {
+    get_msg_registered_user_ExpectAndReturn(user->fd, &user->reader, NULL, 1);
+    get_msg_registered_user_IgnoreArg_data();
+    get_msg_registered_user_ReturnMemThruPtr_data(user_msg,
+                                                  sizeof(*user_msg));
+    os_timestamp_ExpectAndReturn(0);
+    send_broadcast_msg_to_users_ExpectAnyArgs();
 }
 
-void test_get_user_fds(void) {
-    int num_users = 2;
-    int user_fds[num_users];
-    int ret[num_users];
+static void init_test_read_budget(size_t max_frames) {
+    struct read_budget budget = {
+        .max_frames = max_frames,
+        .max_bytes = USER_READ_BUDGET_BYTES,
+    };
 
-    user_fds[0] = 3;
-    user_fds[1] = 4;
+    init_user_list_ExpectAnyArgs();
+    init_user_list_ExpectAnyArgs();
+    init_user();
+    set_read_budget(&budget);
+}
+
+static void reset_test_read_budget(void) {
+    struct read_budget budget = {
+        .max_frames = USER_READ_BUDGET_FRAMES,
+        .max_bytes = USER_READ_BUDGET_BYTES,
+    };
+
+    set_read_budget(&budget);
+}
+
+void test_continue_user_reads_pass(void) {
+    struct user_info user;
+    struct msg_registered_user user_msg = {
+        .msg = {.str = (char *)"Hello", .len = 5},
+    };
+    int ret;
+
+    user.fd = 3;
+    user.name = test_user_name;
+    user.remove_user = false;
+    INIT_LIST_HEAD(&user.read_list);
+    init_test_read_budget(1);
+
+    get_user_from_fd_ExpectAndReturn(user.fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    expect_user_msg(&user, &user_msg);
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    add_stat_Expect(STAT_READ_BUDGET_HIT, 1);
+    ret = handle_registered_user(user.fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_TRUE(has_unread_users());
+
+    // the rest of the messages are read with a fresh budget
+    expect_user_msg(&user, &user_msg);
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    add_stat_Expect(STAT_READ_BUDGET_HIT, 1);
+    continue_user_reads();
+
+    TEST_ASSERT_TRUE(has_unread_users());
+
+    get_msg_registered_user_ExpectAndReturn(user.fd, &user.reader, NULL, 0);
+    get_msg_registered_user_IgnoreArg_data();
+    continue_user_reads();
+
+    TEST_ASSERT_FALSE(has_unread_users());
+    reset_test_read_budget();
+}
+
+void test_continue_user_reads_pass_removed(void) {
+    struct user_info user;
+    struct msg_registered_user user_msg = {
+        .msg = {.str = (char *)"Hello", .len = 5},
+    };
+    int ret;
+
+    user.fd = 3;
+    user.name = test_user_name;
+    user.remove_user = false;
+    INIT_LIST_HEAD(&user.read_list);
+    init_test_read_budget(1);
+
+    get_user_from_fd_ExpectAndReturn(user.fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    expect_user_msg(&user, &user_msg);
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    add_stat_Expect(STAT_READ_BUDGET_HIT, 1);
+    ret = handle_registered_user(user.fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+
+    // users removed in the meantime are not read again
+    user.remove_user = true;
+    continue_user_reads();
+
+    TEST_ASSERT_FALSE(has_unread_users());
+    TEST_ASSERT_TRUE(list_empty(&user.read_list));
+    reset_test_read_budget();
+}
 
-    copy_user_fds_Expect(ret, NULL);
-    copy_user_fds_IgnoreArg_users();
-    copy_user_fds_ReturnMemThruPtr_user_fds(user_fds, sizeof(user_fds));
-    get_user_fds(ret);
+static struct msg_broadcast *forwarded_msg;
 
-    TEST_ASSERT_EQUAL_INT_ARRAY(user_fds, ret, num_users);
+void test_forwarder(struct msg_broadcast *data) {
+    forwarded_msg = data;
 }
 
-void test_handle_new_user_fail_add_new_user(void) {
+void test_deliver_forwarded_msg(void) {
+    struct msg_broadcast data;
+
+    send_broadcast_msg_to_users_Expect(&data, NULL, NULL, NULL, NULL, NULL);
+    send_broadcast_msg_to_users_IgnoreArg_sender();
+    send_broadcast_msg_to_users_IgnoreArg_budget();
+    send_broadcast_msg_to_users_IgnoreArg_batch();
+    send_broadcast_msg_to_users_IgnoreArg_fanout();
+    send_broadcast_msg_to_users_IgnoreArg_users();
+    deliver_forwarded_msg(&data);
+}
+
+void test_drop_all_users(void) {
+    clear_broadcast_batch_ExpectAnyArgs();
+    clear_user_fanout_ExpectAnyArgs();
+    flag_all_users_ExpectAnyArgs();
+    flag_all_users_ExpectAnyArgs();
+    drop_all_users();
+}
+
+void test_drop_user_fail_create_broadcast_msg(void) {
     const char *name = "John Doe";
-    struct msg_new_user user_msg;
+    struct user_info user;
     int fd = 3;
     int ret;
 
-    user_msg.name = (char *)name;
+    user.fd = fd;
+    user.name = (char *)name;
+    user.remove_user = false;
 
-    get_msg_new_user_ExpectAndReturn(fd, NULL, EXIT_SUCCESS);
-    get_msg_new_user_IgnoreArg_data();
-    add_new_user_ExpectAndReturn(fd, NULL, NULL, NULL);
-    add_new_user_IgnoreArg_msg();
-    add_new_user_IgnoreArg_users();
-    add_new_user_ReturnMemThruPtr_msg(&user_msg, sizeof(struct msg_new_user));
-    os_free_Expect(user_msg.name);
-    ret = handle_new_user(fd);
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    create_broadcast_msg_user_left_ExpectAndReturn(&user, NULL, EXIT_FAILURE);
+    create_broadcast_msg_user_left_IgnoreArg_msg();
+    ret = drop_user(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_TRUE(user.remove_user);
+}
+
+void test_drop_user_fail_get_user(void) {
+    int fd = 3;
+    int ret;
+
+    get_user_from_fd_ExpectAndReturn(fd, NULL, NULL);
+    get_user_from_fd_IgnoreArg_table();
+    ret = drop_user(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_drop_user_fail_pending(void) {
+    struct user_info user;
+    int fd = 3;
+    int ret;
+
+    user.fd = fd;
+    user.name = NULL;
+    user.remove_user = false;
+
+    // a user that never registered can't leave the channel
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    ret = drop_user(fd);
 
     TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_FALSE(user.remove_user);
+}
+
+void test_drop_user_pass(void) {
+    const char *name = "John Doe";
+    struct user_info user;
+    int fd = 3;
+    int ret;
+
+    user.fd = fd;
+    user.name = (char *)name;
+    user.remove_user = false;
+
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    create_broadcast_msg_user_left_ExpectAndReturn(&user, NULL, EXIT_SUCCESS);
+    create_broadcast_msg_user_left_IgnoreArg_msg();
+    send_broadcast_msg_to_users_ExpectAnyArgs();
+    os_free_ExpectAnyArgs();
+    ret = drop_user(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_TRUE(user.remove_user);
 }
 
-void test_handle_new_user_fail_create_broadcast_msg(void) {
+void test_drop_user_pass_already_removed(void) {
     const char *name = "John Doe";
+    struct user_info user;
+    int fd = 3;
+    int ret;
+
+    user.fd = fd;
+    user.name = (char *)name;
+    user.remove_user = true;
+
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    ret = drop_user(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_export_users_fail_exporter(void) {
+    import_test_users();
+    flush_broadcast_batch_ExpectAnyArgs();
+    os_free_Expect(NULL);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, export_users(&exporter_fail, NULL));
+}
+
+void test_export_users_pass(void) {
+    import_test_users();
+    imported_users[0].remove_user = true;
+    imported_users[1].send_queue_len = 5;
+    flush_broadcast_batch_ExpectAnyArgs();
+    copy_user_sends_ExpectAndReturn(&imported_users[1], NULL);
+
+    // the pending user fails to copy its queued bytes
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, export_users(&exporter_save_fd, NULL));
+    TEST_ASSERT_EQUAL_INT(0, num_exported_users);
+
+    imported_users[1].send_queue_len = 0;
+    imported_users[1].caps = MSG_FLAG_V2;
+    imported_users[1].reader.streaming = true;
+    imported_users[1].reader.stream.id = 2;
+    imported_users[1].reader.stream.len = 100000;
+    imported_users[1].reader.stream_left = 99996;
+    flush_broadcast_batch_ExpectAnyArgs();
+    os_free_Expect(NULL);
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, export_users(&exporter_save_fd, NULL));
+    TEST_ASSERT_EQUAL_INT(1, num_exported_users);
+    TEST_ASSERT_EQUAL_INT(4, exported_fds[0]);
+    TEST_ASSERT_EQUAL_UINT8(MSG_FLAG_V2, exported_state.caps);
+    TEST_ASSERT_TRUE(exported_state.streaming);
+    TEST_ASSERT_EQUAL_UINT32(2, exported_state.stream_id);
+    TEST_ASSERT_EQUAL_UINT32(100000, exported_state.stream_len);
+    TEST_ASSERT_EQUAL_UINT32(99996, exported_state.stream_left);
+}
+
+void test_flush_batched_msgs_pass(void) {
+    struct msg_broadcast data;
+
+    set_msg_sender(NULL);
+    set_batch_window(5, USER_BATCH_MAX_LEN);
+    init_user_list_StubWithCallback(&init_user_list_init_head);
+    init_user();
+    send_broadcast_msg_to_users_StubWithCallback(
+        &send_broadcast_msg_to_users_fill_batch);
+    deliver_forwarded_msg(&data);
+
+    // not due yet
+    os_monotonic_ms_ExpectAndReturn(104);
+    flush_batched_msgs();
+
+    os_monotonic_ms_ExpectAndReturn(105);
+    flush_broadcast_batch_ExpectAnyArgs();
+    flush_batched_msgs();
+
+    set_batch_window(0, 0);
+    init_user();
+}
+
+void test_get_batch_timeout_pass(void) {
+    struct msg_broadcast data;
+
+    set_msg_sender(NULL);
+    set_batch_window(5, USER_BATCH_MAX_LEN);
+    init_user_list_StubWithCallback(&init_user_list_init_head);
+    init_user();
+    TEST_ASSERT_EQUAL_INT(-1, get_batch_timeout());
+
+    send_broadcast_msg_to_users_StubWithCallback(
+        &send_broadcast_msg_to_users_fill_batch);
+    deliver_forwarded_msg(&data);
+    os_monotonic_ms_ExpectAndReturn(101);
+    TEST_ASSERT_EQUAL_INT(4, get_batch_timeout());
+    os_monotonic_ms_ExpectAndReturn(110);
+    TEST_ASSERT_EQUAL_INT(0, get_batch_timeout());
+
+    // batched bytes count as queued
+    count_queued_bytes_ExpectAnyArgsAndReturn(42);
+    TEST_ASSERT_EQUAL_INT(52, get_num_queued_bytes());
+
+    set_batch_window(0, 0);
+    init_user();
+}
+
+void test_get_num_queued_bytes(void) {
+    size_t ret;
+
+    count_queued_bytes_ExpectAnyArgsAndReturn(42);
+    ret = get_num_queued_bytes();
+
+    TEST_ASSERT_EQUAL_INT(42, ret);
+}
+
+void test_get_num_users(void) {
+    int num_users = 1;
+    int ret;
+
+    count_num_users_ExpectAnyArgsAndReturn(num_users);
+    ret = get_num_users();
+
+    TEST_ASSERT_EQUAL_INT(num_users, ret);
+}
+
+void test_handle_new_user_fail_add_pending_user(void) {
+    int fd = 3;
+    int ret;
+
+    add_pending_user_ExpectAndReturn(fd, NULL, NULL, NULL);
+    add_pending_user_IgnoreArg_users();
+    add_pending_user_IgnoreArg_table();
+    ret = handle_new_user(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_handle_new_user_fail_copy_msg_view(void) {
     struct msg_new_user user_msg;
     struct user_info user;
     int fd = 3;
     int ret;
 
-    user_msg.name = (char *)name;
+    user_msg.flags = 0;
+    user_msg.name.str = (char *)"John Doe";
+    user_msg.name.len = strlen(user_msg.name.str);
     user.fd = fd;
-    user.name = user_msg.name;
+    user.name = NULL;
     user.remove_user = false;
 
-    get_msg_new_user_ExpectAndReturn(fd, NULL, EXIT_SUCCESS);
+    add_pending_user_ExpectAndReturn(fd, NULL, NULL, &user);
+    add_pending_user_IgnoreArg_users();
+    add_pending_user_IgnoreArg_table();
+    init_timer_ExpectAnyArgs();
+    init_timer_ExpectAnyArgs();
+    mod_timer_Expect(&user.idle_timer, USER_REGISTER_TIMEOUT_MS);
+    get_msg_new_user_ExpectAndReturn(fd, &user.reader, NULL, 1);
     get_msg_new_user_IgnoreArg_data();
-    add_new_user_ExpectAndReturn(fd, NULL, NULL, &user);
-    add_new_user_IgnoreArg_msg();
-    add_new_user_IgnoreArg_users();
-    add_new_user_ReturnMemThruPtr_msg(&user_msg, sizeof(struct msg_new_user));
-    create_broadcast_msg_user_joined_ExpectAndReturn(&user, NULL, EXIT_FAILURE);
-    create_broadcast_msg_user_joined_IgnoreArg_msg();
+    get_msg_new_user_ReturnMemThruPtr_data(&user_msg,
+                                           sizeof(struct msg_new_user));
+    copy_msg_view_ExpectAnyArgsAndReturn(NULL);
     ret = handle_new_user(fd);
 
     TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_NULL(user.name);
+    TEST_ASSERT_TRUE(user.remove_user);
 }
 
 void test_handle_new_user_fail_get_user_msg(void) {
+    struct user_info user;
     int fd = 3;
     int ret;
 
-    get_msg_new_user_ExpectAndReturn(fd, NULL, EXIT_FAILURE);
+    user.fd = fd;
+    user.name = NULL;
+    user.remove_user = false;
+
+    add_pending_user_ExpectAndReturn(fd, NULL, NULL, &user);
+    add_pending_user_IgnoreArg_users();
+    add_pending_user_IgnoreArg_table();
+    init_timer_ExpectAnyArgs();
+    init_timer_ExpectAnyArgs();
+    mod_timer_Expect(&user.idle_timer, USER_REGISTER_TIMEOUT_MS);
+    get_msg_new_user_ExpectAndReturn(fd, &user.reader, NULL, -1);
     get_msg_new_user_IgnoreArg_data();
     ret = handle_new_user(fd);
 
-    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_TRUE(user.remove_user);
 }
 
-void test_handle_new_user_fail_pass(void) {
+void test_handle_new_user_pass(void) {
     const char *name = "John Doe";
     struct msg_new_user user_msg;
     struct user_info user;
     int fd = 3;
     int ret;
 
-    user_msg.name = (char *)name;
+    user_msg.flags = MSG_FLAG_BATCH | MSG_FLAG_V2 | MSG_FLAG_COMPRESS;
+    user_msg.name.str = (char *)name;
+    user_msg.name.len = strlen(name);
     user.fd = fd;
-    user.name = user_msg.name;
+    user.name = NULL;
     user.remove_user = false;
+    user.caps = 0;
+    INIT_LIST_HEAD(&user.list);
 
-    get_msg_new_user_ExpectAndReturn(fd, NULL, EXIT_SUCCESS);
+    init_user_list_StubWithCallback(&init_user_list_init_head);
+    init_user();
+    add_pending_user_ExpectAndReturn(fd, NULL, NULL, &user);
+    add_pending_user_IgnoreArg_users();
+    add_pending_user_IgnoreArg_table();
+    init_timer_ExpectAnyArgs();
+    init_timer_ExpectAnyArgs();
+    mod_timer_Expect(&user.idle_timer, USER_REGISTER_TIMEOUT_MS);
+    get_msg_new_user_ExpectAndReturn(fd, &user.reader, NULL, 1);
     get_msg_new_user_IgnoreArg_data();
-    add_new_user_ExpectAndReturn(fd, NULL, NULL, &user);
-    add_new_user_IgnoreArg_msg();
-    add_new_user_IgnoreArg_users();
-    add_new_user_ReturnMemThruPtr_msg(&user_msg, sizeof(struct msg_new_user));
+    get_msg_new_user_ReturnMemThruPtr_data(&user_msg,
+                                           sizeof(struct msg_new_user));
+    copy_msg_view_ExpectAnyArgsAndReturn((char *)name);
+    del_timer_Expect(&user.idle_timer);
+    init_timer_ExpectAnyArgs();
+    init_timer_ExpectAnyArgs();
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
     create_broadcast_msg_user_joined_ExpectAndReturn(&user, NULL, EXIT_SUCCESS);
     create_broadcast_msg_user_joined_IgnoreArg_msg();
     send_broadcast_msg_to_users_ExpectAnyArgs();
     os_free_ExpectAnyArgs();
+    get_msg_registered_user_ExpectAndReturn(fd, &user.reader, NULL, 0);
+    get_msg_registered_user_IgnoreArg_data();
+    ret = handle_new_user(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(name, user.name);
+    TEST_ASSERT_FALSE(user.remove_user);
+    // compression is asked for but not supported
+    TEST_ASSERT_EQUAL_HEX8(MSG_FLAG_BATCH | MSG_FLAG_V2, user.caps);
+}
+
+void test_handle_new_user_pass_incomplete(void) {
+    struct user_info user;
+    int fd = 3;
+    int ret;
+
+    user.fd = fd;
+    user.name = NULL;
+    user.remove_user = false;
+
+    add_pending_user_ExpectAndReturn(fd, NULL, NULL, &user);
+    add_pending_user_IgnoreArg_users();
+    add_pending_user_IgnoreArg_table();
+    init_timer_ExpectAnyArgs();
+    init_timer_ExpectAnyArgs();
+    mod_timer_Expect(&user.idle_timer, USER_REGISTER_TIMEOUT_MS);
+    get_msg_new_user_ExpectAndReturn(fd, &user.reader, NULL, 0);
+    get_msg_new_user_IgnoreArg_data();
+    ret = handle_new_user(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_NULL(user.name);
+    TEST_ASSERT_FALSE(user.remove_user);
+}
+
+void test_handle_new_user_pass_register_timeout(void) {
+    struct user_info user;
+    int fd = 3;
+    int ret;
+
+    user.fd = fd;
+    user.name = NULL;
+    user.remove_user = false;
+
+    add_pending_user_ExpectAndReturn(fd, NULL, NULL, &user);
+    add_pending_user_IgnoreArg_users();
+    add_pending_user_IgnoreArg_table();
+    init_timer_StubWithCallback(&init_timer_save_callback);
+    mod_timer_Expect(&user.idle_timer, USER_REGISTER_TIMEOUT_MS);
+    get_msg_new_user_ExpectAndReturn(fd, &user.reader, NULL, 0);
+    get_msg_new_user_IgnoreArg_data();
     ret = handle_new_user(fd);
 
     TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    user.idle_timer.callback(&user.idle_timer);
+    TEST_ASSERT_TRUE(user.remove_user);
 }
 
 void test_handle_registered_user_fail_create_broadcast_msg(void) {
@@ -143,10 +704,11 @@ void test_handle_registered_user_fail_create_broadcast_msg(void) {
     user.fd = fd;
     user.name = (char *)name;
     user.remove_user = false;
+    INIT_LIST_HEAD(&user.read_list);
 
     get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
-    get_user_from_fd_IgnoreArg_users();
-    get_msg_registered_user_ExpectAndReturn(fd, NULL, EXIT_FAILURE);
+    get_user_from_fd_IgnoreArg_table();
+    get_msg_registered_user_ExpectAndReturn(fd, &user.reader, NULL, -1);
     get_msg_registered_user_IgnoreArg_data();
     create_broadcast_msg_user_left_ExpectAndReturn(&user, NULL, EXIT_FAILURE);
     create_broadcast_msg_user_left_IgnoreArg_msg();
@@ -165,10 +727,11 @@ void test_handle_registered_user_fail_get_msg(void) {
     user.fd = fd;
     user.name = (char *)name;
     user.remove_user = false;
+    INIT_LIST_HEAD(&user.read_list);
 
     get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
-    get_user_from_fd_IgnoreArg_users();
-    get_msg_registered_user_ExpectAndReturn(fd, NULL, EXIT_FAILURE);
+    get_user_from_fd_IgnoreArg_table();
+    get_msg_registered_user_ExpectAndReturn(fd, &user.reader, NULL, -1);
     get_msg_registered_user_IgnoreArg_data();
     create_broadcast_msg_user_left_ExpectAndReturn(&user, NULL, EXIT_SUCCESS);
     create_broadcast_msg_user_left_IgnoreArg_msg();
@@ -185,13 +748,13 @@ void test_handle_registered_user_fail_get_user(void) {
     int ret;
 
     get_user_from_fd_ExpectAndReturn(fd, NULL, NULL);
-    get_user_from_fd_IgnoreArg_users();
+    get_user_from_fd_IgnoreArg_table();
     ret = handle_registered_user(fd);
 
     TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
 }
 
-void test_handle_registered_user_pass(void) {
+void test_handle_registered_user_pass_incomplete(void) {
     const char *name = "John Doe";
     struct user_info user;
     int fd = 3;
@@ -200,44 +763,695 @@ void test_handle_registered_user_pass(void) {
     user.fd = fd;
     user.name = (char *)name;
     user.remove_user = false;
+    INIT_LIST_HEAD(&user.read_list);
 
     get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
-    get_user_from_fd_IgnoreArg_users();
-    get_msg_registered_user_ExpectAndReturn(fd, NULL, EXIT_SUCCESS);
+    get_user_from_fd_IgnoreArg_table();
+    get_msg_registered_user_ExpectAndReturn(fd, &user.reader, NULL, 0);
     get_msg_registered_user_IgnoreArg_data();
-    os_timestamp_ExpectAndReturn(0);
-    send_broadcast_msg_to_users_ExpectAnyArgs();
-    os_free_ExpectAnyArgs();
     ret = handle_registered_user(fd);
 
     TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
     TEST_ASSERT_FALSE(user.remove_user);
 }
 
+void test_handle_registered_user_pass(void) {
+    const char *name = "John Doe";
+    struct user_info user;
+    int fd = 3;
+    struct msg_registered_user user_msg = {
+        .msg = {.str = (char *)"Hello", .len = 5},
+    };
+    int ret;
+
+    user.fd = fd;
+    user.name = (char *)name;
+    user.remove_user = false;
+    INIT_LIST_HEAD(&user.read_list);
+
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    get_msg_registered_user_ExpectAndReturn(fd, &user.reader, NULL, 1);
+    get_msg_registered_user_IgnoreArg_data();
+    get_msg_registered_user_ReturnMemThruPtr_data(&user_msg,
+                                                  sizeof(user_msg));
+    os_timestamp_ExpectAndReturn(0);
+    send_broadcast_msg_to_users_ExpectAnyArgs();
+    get_msg_registered_user_ExpectAndReturn(fd, &user.reader, NULL, 1);
+    get_msg_registered_user_IgnoreArg_data();
+    get_msg_registered_user_ReturnMemThruPtr_data(&user_msg,
+                                                  sizeof(user_msg));
+    os_timestamp_ExpectAndReturn(0);
+    send_broadcast_msg_to_users_ExpectAnyArgs();
+    get_msg_registered_user_ExpectAndReturn(fd, &user.reader, NULL, 0);
+    get_msg_registered_user_IgnoreArg_data();
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    ret = handle_registered_user(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_FALSE(user.remove_user);
+}
+
+void test_handle_registered_user_pass_pending(void) {
+    struct user_info user;
+    int fd = 3;
+    int ret;
+
+    user.fd = fd;
+    user.name = NULL;
+    user.remove_user = false;
+    INIT_LIST_HEAD(&user.read_list);
+
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    get_msg_new_user_ExpectAndReturn(fd, &user.reader, NULL, 0);
+    get_msg_new_user_IgnoreArg_data();
+    ret = handle_registered_user(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_FALSE(user.remove_user);
+}
+
+void test_handle_registered_user_pass_removed(void) {
+    struct user_info user;
+    int fd = 3;
+    int ret;
+
+    user.fd = fd;
+    user.name = (char *)"John Doe";
+    user.remove_user = true;
+    INIT_LIST_HEAD(&user.read_list);
+
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    ret = handle_registered_user(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_handle_registered_user_pass_read_budget(void) {
+    struct user_info user;
+    struct msg_registered_user user_msg = {
+        .msg = {.str = (char *)"Hello", .len = 5},
+    };
+    int ret;
+
+    user.fd = 3;
+    user.name = test_user_name;
+    user.remove_user = false;
+    INIT_LIST_HEAD(&user.read_list);
+    init_test_read_budget(2);
+
+    get_user_from_fd_ExpectAndReturn(user.fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    expect_user_msg(&user, &user_msg);
+    expect_user_msg(&user, &user_msg);
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    add_stat_Expect(STAT_READ_BUDGET_HIT, 1);
+    ret = handle_registered_user(user.fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_TRUE(has_unread_users());
+
+    // the user waits for continue_user_reads() even if it is readable again
+    get_user_from_fd_ExpectAndReturn(user.fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    ret = handle_registered_user(user.fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+
+    user.remove_user = true;
+    continue_user_reads();
+    reset_test_read_budget();
+}
+
+static void send_broadcast_part(struct msg_broadcast *msg,
+                                msg_sender sender,
+                                const struct send_budget *budget,
+                                struct broadcast_batch *batch,
+                                struct user_fanout *fanout,
+                                struct list_head *users,
+                                int num_calls) {
+    UNUSED_PARAMETER(sender);
+    UNUSED_PARAMETER(budget);
+    UNUSED_PARAMETER(batch);
+    UNUSED_PARAMETER(fanout);
+    UNUSED_PARAMETER(users);
+    UNUSED_PARAMETER(num_calls);
+
+    TEST_ASSERT_NOT_NULL(msg->stream);
+    TEST_ASSERT_EQUAL_INT(MSG_PRIO_CHAT, msg->prio);
+    TEST_ASSERT_EQUAL_INT(4096, msg->stream->off);
+    TEST_ASSERT_EQUAL_INT(3, msg->stream->part.len);
+}
+
+void test_handle_registered_user_pass_stream(void) {
+    struct user_info user;
+    struct msg_registered_user user_msg = {
+        .streamed = true,
+        .stream = {
+            .id = 1,
+            .off = 4096,
+            .len = 100000,
+            .part = {.str = (char *)"abc", .len = 3},
+        },
+    };
+    int ret;
+
+    user.fd = 3;
+    user.name = test_user_name;
+    user.remove_user = false;
+    INIT_LIST_HEAD(&user.read_list);
+
+    // each part is broadcast as it arrives
+    get_user_from_fd_ExpectAndReturn(user.fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    get_msg_registered_user_ExpectAndReturn(user.fd, &user.reader, NULL, 1);
+    get_msg_registered_user_IgnoreArg_data();
+    get_msg_registered_user_ReturnMemThruPtr_data(&user_msg,
+                                                  sizeof(user_msg));
+    os_timestamp_ExpectAndReturn(0);
+    send_broadcast_msg_to_users_StubWithCallback(&send_broadcast_part);
+    get_msg_registered_user_ExpectAndReturn(user.fd, &user.reader, NULL, 0);
+    get_msg_registered_user_IgnoreArg_data();
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    ret = handle_registered_user(user.fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_FALSE(user.remove_user);
+}
+
+void test_handle_writable_user_fail_flush(void) {
+    const char *name = "John Doe";
+    struct user_info user;
+    int fd = 3;
+    int ret;
+
+    user.fd = fd;
+    user.name = (char *)name;
+    user.remove_user = false;
+
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    flush_user_sends_ExpectAndReturn(&user, EXIT_FAILURE);
+    create_broadcast_msg_user_left_ExpectAndReturn(&user, NULL, EXIT_SUCCESS);
+    create_broadcast_msg_user_left_IgnoreArg_msg();
+    send_broadcast_msg_to_users_ExpectAnyArgs();
+    os_free_ExpectAnyArgs();
+    ret = handle_writable_user(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_TRUE(user.remove_user);
+}
+
+void test_handle_writable_user_fail_get_user(void) {
+    int fd = 3;
+    int ret;
+
+    get_user_from_fd_ExpectAndReturn(fd, NULL, NULL);
+    get_user_from_fd_IgnoreArg_table();
+    ret = handle_writable_user(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_handle_writable_user_pass(void) {
+    struct user_info user;
+    int fd = 3;
+    int ret;
+
+    user.fd = fd;
+    user.remove_user = false;
+
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    flush_user_sends_ExpectAndReturn(&user, EXIT_SUCCESS);
+    ret = handle_writable_user(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_FALSE(user.remove_user);
+}
+
+void test_handle_writable_user_pass_removed(void) {
+    struct user_info user;
+    int fd = 3;
+    int ret;
+
+    user.fd = fd;
+    user.remove_user = true;
+
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    ret = handle_writable_user(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_handle_zerocopy_completions_fail_get_user(void) {
+    int fd = 3;
+    int ret;
+
+    get_user_from_fd_ExpectAndReturn(fd, NULL, NULL);
+    get_user_from_fd_IgnoreArg_table();
+    ret = handle_zerocopy_completions(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_handle_zerocopy_completions_fail_recv(void) {
+    struct user_info user;
+    int fd = 3;
+    int ret;
+
+    user.fd = fd;
+
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    recv_zerocopy_completion_ExpectAnyArgsAndReturn(-1);
+    ret = handle_zerocopy_completions(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_handle_zerocopy_completions_pass(void) {
+    struct user_info user;
+    uint32_t lo = 4;
+    uint32_t hi = 6;
+    bool copied = true;
+    bool not_copied = false;
+    int fd = 3;
+    int ret;
+
+    user.fd = fd;
+
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    recv_zerocopy_completion_ExpectAnyArgsAndReturn(1);
+    recv_zerocopy_completion_ReturnThruPtr_lo(&lo);
+    recv_zerocopy_completion_ReturnThruPtr_hi(&hi);
+    recv_zerocopy_completion_ReturnThruPtr_copied(&copied);
+    complete_zerocopy_sends_Expect(&user, 4, 6);
+    add_stat_Expect(STAT_ZEROCOPY_COPIED, 3);
+    recv_zerocopy_completion_ExpectAnyArgsAndReturn(1);
+    recv_zerocopy_completion_ReturnThruPtr_lo(&hi);
+    recv_zerocopy_completion_ReturnThruPtr_hi(&hi);
+    recv_zerocopy_completion_ReturnThruPtr_copied(&not_copied);
+    complete_zerocopy_sends_Expect(&user, 6, 6);
+    recv_zerocopy_completion_ExpectAnyArgsAndReturn(0);
+    ret = handle_zerocopy_completions(fd);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_import_user_fail_add_pending_user(void) {
+    struct user_state state = {
+        3, test_user_name, NULL, 0, NULL, 0, false, 0, 0, 0, 0,
+    };
+
+    add_pending_user_ExpectAndReturn(3, NULL, NULL, NULL);
+    add_pending_user_IgnoreArg_users();
+    add_pending_user_IgnoreArg_table();
+    os_free_Expect(test_user_name);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, import_user(&state));
+}
+
+void test_import_user_fail_restore_user_state(void) {
+    struct user_state state = {3, NULL, NULL, 0, NULL, 0, false, 0, 0, 0, 0};
+    struct user_info user;
+
+    user.remove_user = false;
+    add_pending_user_ExpectAndReturn(3, NULL, NULL, &user);
+    add_pending_user_IgnoreArg_users();
+    add_pending_user_IgnoreArg_table();
+    init_timer_ExpectAnyArgs();
+    mod_timer_Expect(&user.idle_timer, USER_REGISTER_TIMEOUT_MS);
+    init_timer_ExpectAnyArgs();
+    restore_user_state_ExpectAndReturn(&user, &state, EXIT_FAILURE);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, import_user(&state));
+    TEST_ASSERT_TRUE(user.remove_user);
+}
+
+void test_import_user_pass(void) {
+    struct user_state state = {
+        3, test_user_name, NULL, 0, NULL, 5, false, 0, 0, 0, MSG_FLAG_BATCH,
+    };
+    struct user_info user;
+
+    user.remove_user = false;
+    user.reader.streaming = false;
+    user.send_queue_len = 5;
+    add_pending_user_ExpectAndReturn(3, NULL, NULL, &user);
+    add_pending_user_IgnoreArg_users();
+    add_pending_user_IgnoreArg_table();
+    init_timer_ExpectAnyArgs();
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    init_timer_ExpectAnyArgs();
+    restore_user_state_ExpectAndReturn(&user, &state, EXIT_SUCCESS);
+    mod_timer_Expect(&user.stall_timer, USER_STALL_TIMEOUT_MS);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, import_user(&state));
+    TEST_ASSERT_EQUAL_PTR(test_user_name, user.name);
+    TEST_ASSERT_EQUAL_UINT8(MSG_FLAG_BATCH, user.caps);
+    TEST_ASSERT_FALSE(user.remove_user);
+}
+
+void test_import_user_pass_stream(void) {
+    struct user_state state = {
+        3, test_user_name, NULL, 4, NULL, 0, true, 2, 100000, 99996, 0,
+    };
+    struct user_info user;
+
+    init_user_list_ExpectAnyArgs();
+    init_user_list_ExpectAnyArgs();
+    init_user();
+
+    user.remove_user = false;
+    user.reader.streaming = true;
+    user.reader.ring.len = 4;
+    user.send_queue_len = 0;
+    add_pending_user_ExpectAndReturn(3, NULL, NULL, &user);
+    add_pending_user_IgnoreArg_users();
+    add_pending_user_IgnoreArg_table();
+    init_timer_ExpectAnyArgs();
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    init_timer_ExpectAnyArgs();
+    restore_user_state_ExpectAndReturn(&user, &state, EXIT_SUCCESS);
+
+    // the buffered parts don't wait for the socket to signal
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, import_user(&state));
+    TEST_ASSERT_TRUE(has_unread_users());
+
+    user.remove_user = true;
+    continue_user_reads();
+
+    TEST_ASSERT_FALSE(has_unread_users());
+}
+
 void test_init_user(void) {
+    init_user_list_ExpectAnyArgs();
     init_user_list_ExpectAnyArgs();
     init_user();
 }
 
+void test_register_new_user_fail_add_new_user(void) {
+    struct msg_new_user user_msg;
+    int fd = 3;
+    int ret;
+
+    user_msg.flags = 0;
+    user_msg.name.str = (char *)"John Doe";
+    user_msg.name.len = strlen(user_msg.name.str);
+
+    add_new_user_ExpectAndReturn(fd, &user_msg, NULL, NULL, NULL);
+    add_new_user_IgnoreArg_users();
+    add_new_user_IgnoreArg_table();
+    ret = register_new_user(fd, &user_msg);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_register_new_user_pass(void) {
+    struct msg_new_user user_msg;
+    struct user_info user;
+    int fd = 3;
+    int ret;
+
+    user_msg.flags = 0;
+    user_msg.name.str = (char *)"John Doe";
+    user_msg.name.len = strlen(user_msg.name.str);
+    user.fd = fd;
+    user.name = user_msg.name.str;
+    user.remove_user = false;
+
+    add_new_user_ExpectAndReturn(fd, &user_msg, NULL, NULL, &user);
+    add_new_user_IgnoreArg_users();
+    add_new_user_IgnoreArg_table();
+    init_timer_Expect(&user.idle_timer, NULL);
+    init_timer_IgnoreArg_callback();
+    init_timer_Expect(&user.stall_timer, NULL);
+    init_timer_IgnoreArg_callback();
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    create_broadcast_msg_user_joined_ExpectAndReturn(&user, NULL, EXIT_SUCCESS);
+    create_broadcast_msg_user_joined_IgnoreArg_msg();
+    send_broadcast_msg_to_users_ExpectAnyArgs();
+    os_free_ExpectAnyArgs();
+    ret = register_new_user(fd, &user_msg);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+}
+
+void test_register_new_user_pass_idle_timeout(void) {
+    struct msg_new_user user_msg;
+    struct user_info user;
+    int fd = 3;
+
+    user_msg.flags = 0;
+    user_msg.name.str = (char *)"John Doe";
+    user_msg.name.len = strlen(user_msg.name.str);
+    user.fd = fd;
+    user.name = user_msg.name.str;
+    user.remove_user = false;
+
+    init_timer_StubWithCallback(&init_timer_save_callback);
+    add_new_user_ExpectAndReturn(fd, &user_msg, NULL, NULL, &user);
+    add_new_user_IgnoreArg_users();
+    add_new_user_IgnoreArg_table();
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    create_broadcast_msg_user_joined_ExpectAnyArgsAndReturn(EXIT_FAILURE);
+    register_new_user(fd, &user_msg);
+
+    create_broadcast_msg_user_left_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
+    send_broadcast_msg_to_users_ExpectAnyArgs();
+    os_free_ExpectAnyArgs();
+    user.idle_timer.callback(&user.idle_timer);
+
+    TEST_ASSERT_TRUE(user.remove_user);
+}
+
+void test_register_new_user_pass_negotiate(void) {
+    struct msg_new_user user_msg;
+    struct user_info user;
+    struct msg_frame frame;
+    int fd = 3;
+    int ret;
+
+    user_msg.flags = MSG_FLAG_NEGOTIATE | MSG_FLAG_BATCH;
+    user_msg.name.str = (char *)"John Doe";
+    user_msg.name.len = strlen(user_msg.name.str);
+    user.fd = fd;
+    user.name = user_msg.name.str;
+    user.remove_user = false;
+    user.caps = MSG_FLAG_BATCH;
+
+    // the granted capabilities go out ahead of the join notice
+    add_new_user_ExpectAndReturn(fd, &user_msg, NULL, NULL, &user);
+    add_new_user_IgnoreArg_users();
+    add_new_user_IgnoreArg_table();
+    create_caps_frame_ExpectAndReturn(MSG_FLAG_BATCH, &frame);
+    queue_user_msg_ExpectAndReturn(&user, &frame, NULL, EXIT_SUCCESS);
+    queue_user_msg_IgnoreArg_budget();
+    put_msg_frame_Expect(&frame);
+    init_timer_ExpectAnyArgs();
+    init_timer_ExpectAnyArgs();
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    create_broadcast_msg_user_joined_ExpectAndReturn(&user, NULL, EXIT_SUCCESS);
+    create_broadcast_msg_user_joined_IgnoreArg_msg();
+    send_broadcast_msg_to_users_ExpectAnyArgs();
+    os_free_ExpectAnyArgs();
+    ret = register_new_user(fd, &user_msg);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_FALSE(user.remove_user);
+}
+
+void test_register_new_user_pass_stall_timeout(void) {
+    struct msg_new_user user_msg;
+    struct user_info user;
+    int fd = 3;
+
+    user_msg.flags = 0;
+    user_msg.name.str = (char *)"John Doe";
+    user_msg.name.len = strlen(user_msg.name.str);
+    user.fd = fd;
+    user.name = user_msg.name.str;
+    user.remove_user = false;
+
+    init_timer_StubWithCallback(&init_timer_save_callback);
+    add_new_user_ExpectAndReturn(fd, &user_msg, NULL, NULL, &user);
+    add_new_user_IgnoreArg_users();
+    add_new_user_IgnoreArg_table();
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    create_broadcast_msg_user_joined_ExpectAnyArgsAndReturn(EXIT_FAILURE);
+    register_new_user(fd, &user_msg);
+
+    create_broadcast_msg_user_left_ExpectAnyArgsAndReturn(EXIT_SUCCESS);
+    send_broadcast_msg_to_users_ExpectAnyArgs();
+    os_free_ExpectAnyArgs();
+    user.stall_timer.callback(&user.stall_timer);
+
+    TEST_ASSERT_TRUE(user.remove_user);
+
+    // an expired timer of a removed user doesn't announce it again
+    user.idle_timer.callback(&user.idle_timer);
+}
+
+void test_set_msg_forwarder(void) {
+    struct msg_registered_user user_msg;
+    struct user_info user;
+    int fd = 3;
+
+    user.fd = fd;
+    user.name = (char *)"John Doe";
+    user.remove_user = false;
+    user_msg.msg.str = (char *)"Hello, World!";
+    user_msg.msg.len = strlen(user_msg.msg.str);
+    user_msg.streamed = false;
+    forwarded_msg = NULL;
+
+    set_msg_forwarder(&test_forwarder);
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    os_timestamp_ExpectAndReturn(0);
+    send_broadcast_msg_to_users_ExpectAnyArgs();
+    broadcast_user_msg(fd, &user_msg);
+    set_msg_forwarder(NULL);
+
+    TEST_ASSERT_NOT_NULL(forwarded_msg);
+}
+
+void test_set_msg_sender(void) {
+    struct msg_registered_user user_msg;
+    struct user_info user;
+    int fd = 3;
+
+    user.fd = fd;
+    user.name = (char *)"John Doe";
+    user.remove_user = false;
+    user_msg.msg.str = (char *)"Hello, World!";
+    user_msg.msg.len = strlen(user_msg.msg.str);
+    user_msg.streamed = false;
+
+    set_msg_sender(&test_sender);
+    get_user_from_fd_ExpectAndReturn(fd, NULL, &user);
+    get_user_from_fd_IgnoreArg_table();
+    mod_timer_Expect(&user.idle_timer, USER_IDLE_TIMEOUT_MS);
+    os_timestamp_ExpectAndReturn(0);
+    send_broadcast_msg_to_users_Stub(send_broadcast_msg_to_users_save_sender);
+    broadcast_user_msg(fd, &user_msg);
+    set_msg_sender(NULL);
+
+    TEST_ASSERT_EQUAL_PTR(&test_sender, used_sender);
+}
+
+void test_closer(int fd) {
+    UNUSED_PARAMETER(fd);
+}
+
+void test_set_user_closer(void) {
+    set_user_closer(&test_closer);
+    remove_flagged_users_Expect(5, NULL, NULL, &test_closer);
+    remove_flagged_users_IgnoreArg_users();
+    remove_flagged_users_IgnoreArg_table();
+    remove_flagged_users_Expect(5, NULL, NULL, &test_closer);
+    remove_flagged_users_IgnoreArg_users();
+    remove_flagged_users_IgnoreArg_table();
+    clear_user_table_Ignore();
+    update_user_list(5);
+    set_user_closer(NULL);
+}
+
+void test_set_zerocopy_threshold(void) {
+    struct user_info user;
+    int fd = 3;
+    int ret;
+
+    user.fd = fd;
+    user.name = NULL;
+    user.remove_user = false;
+
+    set_zerocopy_threshold(4096);
+    add_pending_user_ExpectAndReturn(fd, NULL, NULL, &user);
+    add_pending_user_IgnoreArg_users();
+    add_pending_user_IgnoreArg_table();
+    init_timer_ExpectAnyArgs();
+    init_timer_ExpectAnyArgs();
+    mod_timer_Expect(&user.idle_timer, USER_REGISTER_TIMEOUT_MS);
+    enable_user_zerocopy_ExpectAndReturn(&user, 4096, EXIT_FAILURE);
+    get_msg_new_user_ExpectAndReturn(fd, &user.reader, NULL, 0);
+    get_msg_new_user_IgnoreArg_data();
+    ret = handle_new_user(fd);
+    set_zerocopy_threshold(0);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_FALSE(user.remove_user);
+}
+
 void test_update_user_list(void) {
     remove_flagged_users_ExpectAnyArgs();
-    update_user_list();
+    remove_flagged_users_ExpectAnyArgs();
+    clear_user_table_Ignore();
+    update_user_list(5);
 }
 
 /* not needed when using generate_test_runner.rb */
 int main(void) {
     UNITY_BEGIN();
+    RUN_TEST(test_broadcast_user_msg_fail_get_user);
+    RUN_TEST(test_broadcast_user_msg_pass);
+    RUN_TEST(test_continue_user_reads_pass);
+    RUN_TEST(test_continue_user_reads_pass_removed);
+    RUN_TEST(test_deliver_forwarded_msg);
+    RUN_TEST(test_drop_all_users);
+    RUN_TEST(test_drop_user_fail_create_broadcast_msg);
+    RUN_TEST(test_drop_user_fail_get_user);
+    RUN_TEST(test_drop_user_fail_pending);
+    RUN_TEST(test_drop_user_pass);
+    RUN_TEST(test_drop_user_pass_already_removed);
+    RUN_TEST(test_export_users_fail_exporter);
+    RUN_TEST(test_export_users_pass);
+    RUN_TEST(test_flush_batched_msgs_pass);
+    RUN_TEST(test_get_batch_timeout_pass);
+    RUN_TEST(test_get_num_queued_bytes);
     RUN_TEST(test_get_num_users);
-    RUN_TEST(test_get_user_fds);
-    RUN_TEST(test_handle_new_user_fail_add_new_user);
-    RUN_TEST(test_handle_new_user_fail_create_broadcast_msg);
+    RUN_TEST(test_handle_new_user_fail_add_pending_user);
+    RUN_TEST(test_handle_new_user_fail_copy_msg_view);
     RUN_TEST(test_handle_new_user_fail_get_user_msg);
-    RUN_TEST(test_handle_new_user_fail_pass);
+    RUN_TEST(test_handle_new_user_pass);
+    RUN_TEST(test_handle_new_user_pass_incomplete);
+    RUN_TEST(test_handle_new_user_pass_register_timeout);
     RUN_TEST(test_handle_registered_user_fail_create_broadcast_msg);
     RUN_TEST(test_handle_registered_user_fail_get_msg);
     RUN_TEST(test_handle_registered_user_fail_get_user);
     RUN_TEST(test_handle_registered_user_pass);
+    RUN_TEST(test_handle_registered_user_pass_pending);
+    RUN_TEST(test_handle_registered_user_pass_removed);
+    RUN_TEST(test_handle_registered_user_pass_read_budget);
+    RUN_TEST(test_handle_registered_user_pass_stream);
+    RUN_TEST(test_handle_registered_user_pass_incomplete);
+    RUN_TEST(test_handle_writable_user_fail_flush);
+    RUN_TEST(test_handle_writable_user_fail_get_user);
+    RUN_TEST(test_handle_writable_user_pass);
+    RUN_TEST(test_handle_writable_user_pass_removed);
+    RUN_TEST(test_handle_zerocopy_completions_fail_get_user);
+    RUN_TEST(test_handle_zerocopy_completions_fail_recv);
+    RUN_TEST(test_handle_zerocopy_completions_pass);
+    RUN_TEST(test_import_user_fail_add_pending_user);
+    RUN_TEST(test_import_user_fail_restore_user_state);
+    RUN_TEST(test_import_user_pass);
+    RUN_TEST(test_import_user_pass_stream);
     RUN_TEST(test_init_user);
+    RUN_TEST(test_register_new_user_fail_add_new_user);
+    RUN_TEST(test_register_new_user_pass);
+    RUN_TEST(test_register_new_user_pass_idle_timeout);
+    RUN_TEST(test_register_new_user_pass_negotiate);
+    RUN_TEST(test_register_new_user_pass_stall_timeout);
+    RUN_TEST(test_set_msg_forwarder);
+    RUN_TEST(test_set_msg_sender);
+    RUN_TEST(test_set_user_closer);
+    RUN_TEST(test_set_zerocopy_threshold);
     RUN_TEST(test_update_user_list);
     return UNITY_END();
 }
@@ -1,12 +1,19 @@
 // Copyright 2020 author. All rights reserved.
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 
 #include "include/common.h"
+#include "mocks/mock_fanout.h"
+#include "mocks/mock_fileio.h"
 #include "mocks/mock_message.h"
 #include "mocks/mock_osdep.h"
+#include "mocks/mock_ring.h"
+#include "mocks/mock_stats.h"
+#include "mocks/mock_timer.h"
 #include "src/user/user_internal.h"
 #include "unity/src/unity.h"
 
@@ -22,99 +29,475 @@ char test_user_left_msg[22] = {
     0x61, 0x6e, 0x6e, 0x65, 0x6c, 0x00
 };
 
+// msg_sender that checks each send against the ones a test expects
+struct test_expected_send {
+    int fd;
+    struct msg_frame *frame;
+    int ret;
+};
+
+static struct test_expected_send expected_sends[4];
+static int num_expected_sends;
+static int num_test_sends;
+
+static void expect_test_send(int fd, struct msg_frame *frame, int ret) {
+    expected_sends[num_expected_sends].fd = fd;
+    expected_sends[num_expected_sends].frame = frame;
+    expected_sends[num_expected_sends].ret = ret;
+    num_expected_sends++;
+}
+
+static int send_test_frame(int fd, struct msg_frame *frame) {
+    struct test_expected_send *expected = &expected_sends[num_test_sends];
+
+    if (num_test_sends == num_expected_sends) {
+        TEST_FAIL_MESSAGE("sender should not have been called.");
+    }
+    num_test_sends++;
+
+    TEST_ASSERT_EQUAL_INT(expected->fd, fd);
+    TEST_ASSERT_EQUAL_PTR(expected->frame, frame);
+    return expected->ret;
+}
+
 void setUp(void) {
     /* set stuff up here */
+    mock_fanout_Init();
+    mock_fileio_Init();
     mock_message_Init();
     mock_osdep_Init();
+    mock_ring_Init();
+    mock_stats_Init();
+    mock_timer_Init();
+    num_expected_sends = 0;
+    num_test_sends = 0;
 }
 
 void tearDown(void) {
     /* clean stuff up here */
+    mock_fanout_Verify();
+    mock_fanout_Destroy();
+    mock_fileio_Verify();
+    mock_fileio_Destroy();
     mock_message_Verify();
     mock_message_Destroy();
     mock_osdep_Verify();
     mock_osdep_Destroy();
+    mock_ring_Verify();
+    mock_ring_Destroy();
+    mock_stats_Verify();
+    mock_stats_Destroy();
+    mock_timer_Verify();
+    mock_timer_Destroy();
+    TEST_ASSERT_EQUAL_INT(num_expected_sends, num_test_sends);
+}
+
+struct test_send {
+    struct user_send send;
+    struct msg_frame frame;
+    uint8_t buf[16];
+};
+
+static void init_test_send(struct test_send *send, size_t len, size_t off) {
+    send->send.frame = &send->frame;
+    send->frame.len = len;
+    send->frame.prio = MSG_PRIO_CHAT;
+    send->send.off = off;
+    send->send.missed = 0;
+    send->send.zc_pending = 0;
+}
+
+static void init_test_user(struct user_info *user, int fd) {
+    user->fd = fd;
+    INIT_LIST_HEAD(&user->send_queue);
+    user->send_queue_len = 0;
+    user->send_queue_frames = 0;
+    user->cork = false;
+    user->defer_stall_timer = false;
+    user->stall_update = false;
+    user->stall_sent = false;
+    user->zc_threshold = 0;
+    user->zc_next_id = 0;
+    INIT_LIST_HEAD(&user->zc_queue);
+    user->zc_queue_len = 0;
+    user->prio_jumps = 0;
+    INIT_LIST_HEAD(&user->read_list);
+}
+
+static struct send_budget test_budget = {
+    .policy = SEND_POLICY_DISCONNECT,
+    .max_bytes = USER_SEND_QUEUE_MAX,
+    .max_frames = USER_SEND_QUEUE_MAX_FRAMES,
+};
+
+static struct msg_frame *marker_frame;
+static const char *marker_text;
+
+struct msg_frame *create_broadcast_frame_check_marker(
+        struct msg_broadcast *data,
+        int num_calls) {
+    UNUSED_PARAMETER(num_calls);
+
+    TEST_ASSERT_EQUAL_STRING("BROADCAST", data->name);
+    TEST_ASSERT_EQUAL_STRING(marker_text, data->msg);
+    TEST_ASSERT_EQUAL_INT(MSG_PRIO_CHAT, data->prio);
+    return marker_frame;
 }
 
-int send_broadcast_msg_dont_call(int fd,
-                                 struct msg_broadcast *data,
-                                 int num_calls) {
+static struct user_info batch_plain_user;
+
+// the reader's queue is full so queueing a frame flags it, the plain user
+// never sees the batch
+static void init_test_batch_users(struct user_info *reader,
+                                  struct list_head *users) {
+    INIT_LIST_HEAD(users);
+    init_test_user(reader, 3);
+    reader->remove_user = false;
+    reader->caps = MSG_FLAG_BATCH;
+    reader->send_queue_len = USER_SEND_QUEUE_MAX;
+    list_add_tail(&reader->list, users);
+    init_test_user(&batch_plain_user, 4);
+    batch_plain_user.remove_user = false;
+    batch_plain_user.caps = 0;
+    batch_plain_user.send_queue_len = USER_SEND_QUEUE_MAX;
+    list_add_tail(&batch_plain_user.list, users);
+}
+
+static struct test_send *sendv_expected[2];
+
+int sendv_available_two_frames(int fd,
+                               struct iovec *iov,
+                               int iovcnt,
+                               int flags,
+                               int num_calls) {
+    int i;
+    int sent = 0;
+
     UNUSED_PARAMETER(fd);
-    UNUSED_PARAMETER(data);
+    UNUSED_PARAMETER(flags);
     UNUSED_PARAMETER(num_calls);
 
-    TEST_FAIL_MESSAGE("send_broadcast_msg() should not have been called.");
-    return EXIT_SUCCESS;
+    TEST_ASSERT_EQUAL_INT(2, iovcnt);
+    for (i = 0; i < iovcnt; i++) {
+        TEST_ASSERT_EQUAL_PTR(
+            &sendv_expected[i]->frame.buf[sendv_expected[i]->send.off],
+            iov[i].iov_base);
+        TEST_ASSERT_EQUAL_INT(
+            sendv_expected[i]->frame.len - sendv_expected[i]->send.off,
+            iov[i].iov_len);
+        sent += iov[i].iov_len;
+    }
+
+    return sent;
+}
+
+void test_add_new_user_fail_copy_msg_view(void) {
+    int fd = 3;
+    char name[] = "John Doe";
+    struct msg_new_user msg;
+    struct user_info *slots[8] = {NULL};
+    struct user_table table = {slots, 8};
+    struct list_head users;
+    struct user_info *ret;
+
+    msg.name.str = name;
+    msg.name.len = strlen(name);
+
+    INIT_LIST_HEAD(&users);
+
+    copy_msg_view_ExpectAndReturn(&msg.name, NULL);
+    ret = add_new_user(fd, &msg, &users, &table);
+
+    TEST_ASSERT_NULL(ret);
+    TEST_ASSERT_TRUE(list_empty(&users));
+    TEST_ASSERT_NULL(slots[fd]);
 }
 
 void test_add_new_user_fail_malloc(void) {
     int fd = 3;
-    const char *name = "John Doe";
+    char name[] = "John Doe";
+    char name_copy[] = "John Doe";
     struct msg_new_user msg;
+    struct user_info *slots[8] = {NULL};
+    struct user_table table = {slots, 8};
     struct list_head users;
     struct user_info *ret;
 
-    msg.name = (char *)name;
+    msg.name.str = name;
+    msg.name.len = strlen(name);
 
     INIT_LIST_HEAD(&users);
     TEST_ASSERT_TRUE(list_empty(&users));
 
+    copy_msg_view_ExpectAndReturn(&msg.name, name_copy);
     os_malloc_ExpectAndReturn(sizeof(struct user_info), NULL);
-    ret = add_new_user(fd, &msg, &users);
+    os_free_Expect(name_copy);
+    ret = add_new_user(fd, &msg, &users, &table);
 
     TEST_ASSERT_NULL(ret);
     TEST_ASSERT_TRUE(list_empty(&users));
+    TEST_ASSERT_NULL(slots[fd]);
 }
 
 void test_add_new_user_pass(void) {
     int fd = 3;
-    const char *name = "John Doe";
+    char name[] = "John Doe";
+    char name_copy[] = "John Doe";
     struct msg_new_user msg;
     struct user_info user_buf;
+    struct user_info *slots[8] = {NULL};
+    struct user_table table = {slots, 8};
     struct list_head users;
     struct user_info *ret;
 
-    msg.name = (char *)name;
+    msg.flags = MSG_FLAG_BATCH | MSG_FLAG_V2 | MSG_FLAG_NEGOTIATE;
+    msg.name.str = name;
+    msg.name.len = strlen(name);
 
     INIT_LIST_HEAD(&users);
     TEST_ASSERT_TRUE(list_empty(&users));
 
+    // the name is copied out of the receive buffer
+    copy_msg_view_ExpectAndReturn(&msg.name, name_copy);
     os_malloc_ExpectAndReturn(sizeof(struct user_info), &user_buf);
-    ret = add_new_user(fd, &msg, &users);
+    init_msg_reader_Expect(&user_buf.reader);
+    ret = add_new_user(fd, &msg, &users, &table);
 
     TEST_ASSERT_NOT_NULL(ret);
     TEST_ASSERT_FALSE(list_empty(&users));
     TEST_ASSERT_EQUAL_INT(fd, ret->fd);
     TEST_ASSERT_FALSE(ret->remove_user);
-    TEST_ASSERT_EQUAL_CHAR_ARRAY(msg.name, ret->name, strlen(msg.name));
+    TEST_ASSERT_EQUAL_HEX8(MSG_FLAG_BATCH | MSG_FLAG_V2, ret->caps);
+    TEST_ASSERT_EQUAL_PTR(name_copy, ret->name);
+    TEST_ASSERT_TRUE(list_empty(&ret->send_queue));
+    TEST_ASSERT_EQUAL_INT(0, ret->send_queue_len);
+    TEST_ASSERT_EQUAL_INT(0, ret->zc_threshold);
+    TEST_ASSERT_TRUE(list_empty(&ret->zc_queue));
+    TEST_ASSERT_EQUAL_INT(0, ret->zc_queue_len);
+    TEST_ASSERT_EQUAL_PTR(ret, slots[fd]);
 }
 
-void test_copy_user_fds_pass(void) {
-    int fd_user1 = 3;
-    int fd_user2 = 4;
-    const char *name1 = "John Doe";
-    const char *name2 = "Jane Doe";
-    struct user_info user1;
-    struct user_info user2;
+void test_add_pending_user_fail_malloc(void) {
+    int fd = 3;
+    struct user_info *slots[8] = {NULL};
+    struct user_table table = {slots, 8};
     struct list_head users;
-    int users_fds[2];
+    struct user_info *ret;
 
-    user1.fd = fd_user1;
-    user1.remove_user = true;
-    user1.name = (char *)name1;
+    INIT_LIST_HEAD(&users);
 
-    user2.fd = fd_user2;
-    user2.remove_user = false;
-    user2.name = (char *)name2;
+    os_malloc_ExpectAndReturn(sizeof(struct user_info), NULL);
+    ret = add_pending_user(fd, &users, &table);
+
+    TEST_ASSERT_NULL(ret);
+    TEST_ASSERT_TRUE(list_empty(&users));
+    TEST_ASSERT_NULL(slots[fd]);
+}
+
+void test_add_pending_user_fail_realloc(void) {
+    int fd = 3;
+    struct user_table table = {NULL, 0};
+    struct list_head users;
+    struct user_info *ret;
 
     INIT_LIST_HEAD(&users);
-    list_add(&user1.list, &users);
-    list_add(&user2.list, &users);
 
-    copy_user_fds(users_fds, &users);
+    os_realloc_ExpectAndReturn(NULL,
+                               USER_TABLE_MIN_FDS * sizeof(struct user_info *),
+                               NULL);
+    ret = add_pending_user(fd, &users, &table);
+
+    TEST_ASSERT_NULL(ret);
+    TEST_ASSERT_TRUE(list_empty(&users));
+    TEST_ASSERT_EQUAL_INT(0, table.num_fds);
+}
+
+void test_add_pending_user_pass(void) {
+    int fd = 3;
+    struct user_info user_buf;
+    struct user_info *slots[8] = {NULL};
+    struct user_table table = {slots, 8};
+    struct list_head users;
+    struct user_info *ret;
+
+    INIT_LIST_HEAD(&users);
+
+    os_malloc_ExpectAndReturn(sizeof(struct user_info), &user_buf);
+    init_msg_reader_Expect(&user_buf.reader);
+    ret = add_pending_user(fd, &users, &table);
+
+    TEST_ASSERT_EQUAL_PTR(&user_buf, ret);
+    TEST_ASSERT_FALSE(list_empty(&users));
+    TEST_ASSERT_EQUAL_INT(fd, ret->fd);
+    TEST_ASSERT_FALSE(ret->remove_user);
+    TEST_ASSERT_NULL(ret->name);
+    TEST_ASSERT_TRUE(list_empty(&ret->send_queue));
+    TEST_ASSERT_EQUAL_INT(0, ret->send_queue_len);
+    TEST_ASSERT_TRUE(list_empty(&ret->read_list));
+    TEST_ASSERT_EQUAL_PTR(ret, slots[fd]);
+}
+
+void test_add_pending_user_pass_grow(void) {
+    int fd = USER_TABLE_MIN_FDS;
+    struct user_info *slots[2 * USER_TABLE_MIN_FDS];
+    struct user_info *old_slots[USER_TABLE_MIN_FDS] = {NULL};
+    struct user_table table = {old_slots, USER_TABLE_MIN_FDS};
+    struct user_info user_buf;
+    struct list_head users;
+    struct user_info *ret;
+
+    INIT_LIST_HEAD(&users);
+
+    // the table doubles until the fd fits, new slots are empty
+    os_realloc_ExpectAndReturn(old_slots, sizeof(slots), slots);
+    os_memset_ExpectAndReturn(&slots[USER_TABLE_MIN_FDS],
+                              0,
+                              USER_TABLE_MIN_FDS * sizeof(struct user_info *),
+                              NULL);
+    os_malloc_ExpectAndReturn(sizeof(struct user_info), &user_buf);
+    init_msg_reader_Expect(&user_buf.reader);
+    ret = add_pending_user(fd, &users, &table);
+
+    TEST_ASSERT_EQUAL_PTR(&user_buf, ret);
+    TEST_ASSERT_EQUAL_PTR(slots, table.users);
+    TEST_ASSERT_EQUAL_INT(2 * USER_TABLE_MIN_FDS, table.num_fds);
+    TEST_ASSERT_EQUAL_PTR(&user_buf, slots[fd]);
+}
+
+void test_clear_broadcast_batch_pass(void) {
+    struct broadcast_batch batch;
+    struct msg_frame frame1;
+    struct msg_frame frame2;
+
+    batch.frames[0] = &frame1;
+    batch.frames[1] = &frame2;
+    batch.num_frames = 2;
+    batch.len = 20;
+
+    put_msg_frame_Expect(&frame1);
+    put_msg_frame_Expect(&frame2);
+    clear_broadcast_batch(&batch);
+
+    TEST_ASSERT_EQUAL_INT(0, batch.num_frames);
+    TEST_ASSERT_EQUAL_INT(0, batch.len);
+}
+
+void test_clear_user_fanout_pass(void) {
+    void *table[FANOUT_CHUNK_LEN];
+    struct user_fanout fanout = {
+        .users = table,
+        .num_users = 3,
+        .cap = FANOUT_CHUNK_LEN,
+    };
+
+    os_free_Expect(table);
+    clear_user_fanout(&fanout);
+
+    TEST_ASSERT_NULL(fanout.users);
+    TEST_ASSERT_EQUAL_INT(0, fanout.num_users);
+    TEST_ASSERT_EQUAL_INT(0, fanout.cap);
+}
+
+void test_clear_user_table_pass(void) {
+    struct user_info *slots[8];
+    struct user_table table = {slots, 8};
+
+    os_free_Expect(slots);
+    clear_user_table(&table);
+
+    TEST_ASSERT_NULL(table.users);
+    TEST_ASSERT_EQUAL_INT(0, table.num_fds);
+}
+
+void test_complete_zerocopy_sends_pass(void) {
+    struct user_info user;
+    struct test_send sent1;
+    struct test_send sent2;
+    struct test_send partial;
+
+    init_test_user(&user, 3);
+    init_test_send(&sent1, 10, 10);
+    sent1.send.zc_pending = 2;
+    sent1.send.zc_first = 0;
+    sent1.send.zc_last = 1;
+    init_test_send(&sent2, 8, 8);
+    sent2.send.zc_pending = 2;
+    sent2.send.zc_first = 1;
+    sent2.send.zc_last = 2;
+    init_test_send(&partial, 8, 2);
+    partial.send.zc_pending = 1;
+    partial.send.zc_first = 2;
+    partial.send.zc_last = 2;
+    list_add_tail(&sent1.send.list, &user.zc_queue);
+    list_add_tail(&sent2.send.list, &user.zc_queue);
+    list_add_tail(&partial.send.list, &user.send_queue);
+    user.zc_queue_len = 18;
+
+    put_msg_frame_Expect(&sent1.frame);
+    os_free_Expect(&sent1);
+    complete_zerocopy_sends(&user, 0, 1);
+
+    TEST_ASSERT_EQUAL_PTR(&sent2.send.list, user.zc_queue.next);
+    TEST_ASSERT_EQUAL_INT(1, sent2.send.zc_pending);
+    TEST_ASSERT_EQUAL_INT(1, partial.send.zc_pending);
+    TEST_ASSERT_EQUAL_INT(8, user.zc_queue_len);
+
+    put_msg_frame_Expect(&sent2.frame);
+    os_free_Expect(&sent2);
+    complete_zerocopy_sends(&user, 2, 2);
+
+    TEST_ASSERT_TRUE(list_empty(&user.zc_queue));
+    TEST_ASSERT_EQUAL_INT(0, partial.send.zc_pending);
+    TEST_ASSERT_EQUAL_INT(0, user.zc_queue_len);
+}
+
+void test_complete_zerocopy_sends_pass_wrap(void) {
+    struct user_info user;
+    struct test_send sent;
+
+    init_test_user(&user, 3);
+    init_test_send(&sent, 10, 10);
+    sent.send.zc_pending = 2;
+    sent.send.zc_first = UINT32_MAX;
+    sent.send.zc_last = 0;
+    list_add_tail(&sent.send.list, &user.zc_queue);
+    user.zc_queue_len = 10;
+
+    put_msg_frame_Expect(&sent.frame);
+    os_free_Expect(&sent);
+    complete_zerocopy_sends(&user, UINT32_MAX - 3, 0);
+
+    TEST_ASSERT_TRUE(list_empty(&user.zc_queue));
+    TEST_ASSERT_EQUAL_INT(0, user.zc_queue_len);
+}
+
+void test_copy_user_sends_fail_malloc(void) {
+    struct user_info user;
+
+    user.send_queue_len = 10;
+    os_malloc_ExpectAndReturn(10, NULL);
 
-    TEST_ASSERT_EQUAL_INT(fd_user2, users_fds[0]);
-    TEST_ASSERT_EQUAL_INT(fd_user1, users_fds[1]);
+    TEST_ASSERT_NULL(copy_user_sends(&user));
+}
+
+void test_copy_user_sends_pass(void) {
+    struct user_info user;
+    struct test_send send1;
+    struct test_send send2;
+    uint8_t buf[14];
+
+    INIT_LIST_HEAD(&user.send_queue);
+    init_test_send(&send1, 10, 4);
+    init_test_send(&send2, 8, 0);
+    list_add_tail(&send1.send.list, &user.send_queue);
+    list_add_tail(&send2.send.list, &user.send_queue);
+    user.send_queue_len = 14;
+
+    os_malloc_ExpectAndReturn(14, buf);
+    os_memcpy_ExpectAndReturn(buf, &send1.frame.buf[4], 6, buf);
+    os_memcpy_ExpectAndReturn(&buf[6], send2.frame.buf, 8, &buf[6]);
+
+    TEST_ASSERT_EQUAL_PTR(buf, copy_user_sends(&user));
 }
 
 void test_count_num_users_pass_count_0(void) {
@@ -142,6 +525,27 @@ void test_count_num_users_pass_count_2(void) {
     TEST_ASSERT_EQUAL_INT(2, ret);
 }
 
+void test_count_queued_bytes_pass(void) {
+    struct user_info user1;
+    struct user_info user2;
+    struct list_head users;
+    size_t ret;
+
+    INIT_LIST_HEAD(&users);
+    TEST_ASSERT_EQUAL_INT(0, count_queued_bytes(&users));
+
+    user1.send_queue_len = 10;
+    user1.zc_queue_len = 0;
+    user2.send_queue_len = 32;
+    user2.zc_queue_len = 8;
+    list_add(&user1.list, &users);
+    list_add(&user2.list, &users);
+
+    ret = count_queued_bytes(&users);
+
+    TEST_ASSERT_EQUAL_INT(50, ret);
+}
+
 void test_create_broadcast_msg_user_joined_fail_malloc(void) {
     struct msg_broadcast msg;
     struct user_info user;
@@ -185,6 +589,7 @@ void test_create_broadcast_msg_user_joined_pass(void) {
     ret = create_broadcast_msg_user_joined(&user, &msg);
 
     TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_INT(MSG_PRIO_SYSTEM, msg.prio);
 }
 
 void test_create_broadcast_msg_user_left_fail_malloc(void) {
@@ -230,43 +635,421 @@ void test_create_broadcast_msg_user_left_pass(void) {
     ret = create_broadcast_msg_user_left(&user, &msg);
 
     TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_INT(MSG_PRIO_SYSTEM, msg.prio);
 }
 
-void test_get_user_from_fd_fail(void) {
-    int fd_known = 3;
-    int fd_unknwon = 4;
-    const char *name = "John Doe";
+void test_enable_user_zerocopy_fail_setsockopt(void) {
+    struct user_info user;
+    int enable = 1;
+    int ret;
+
+    init_test_user(&user, 3);
+
+    os_setsockopt_ExpectAndReturn(user.fd,
+                                  SOL_SOCKET,
+                                  SO_ZEROCOPY,
+                                  &enable,
+                                  sizeof(enable),
+                                  -1);
+    ret = enable_user_zerocopy(&user, 4096);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(0, user.zc_threshold);
+}
+
+void test_enable_user_zerocopy_pass(void) {
+    struct user_info user;
+    int enable = 1;
+    int ret;
+
+    init_test_user(&user, 3);
+
+    os_setsockopt_ExpectAndReturn(user.fd,
+                                  SOL_SOCKET,
+                                  SO_ZEROCOPY,
+                                  &enable,
+                                  sizeof(enable),
+                                  0);
+    ret = enable_user_zerocopy(&user, 4096);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_INT(4096, user.zc_threshold);
+}
+
+void test_flag_all_users_pass(void) {
     struct user_info user1;
+    struct user_info user2;
     struct list_head users;
-    struct user_info *ret;
 
-    user1.fd = fd_known;
-    user1.remove_user = false;
-    user1.name = (char *)name;
     INIT_LIST_HEAD(&users);
+    user1.remove_user = false;
+    user2.remove_user = true;
     list_add(&user1.list, &users);
+    list_add(&user2.list, &users);
 
-    ret = get_user_from_fd(fd_unknwon, &users);
+    flag_all_users(&users);
 
-    TEST_ASSERT_NULL(ret);
+    TEST_ASSERT_TRUE(user1.remove_user);
+    TEST_ASSERT_TRUE(user2.remove_user);
+}
+
+void test_flush_broadcast_batch_fail_create(void) {
+    struct broadcast_batch batch;
+    struct user_info reader;
+    struct list_head users;
+    struct msg_frame frame1;
+    struct msg_frame frame2;
+
+    init_test_batch_users(&reader, &users);
+    batch.frames[0] = &frame1;
+    batch.frames[1] = &frame2;
+    batch.num_frames = 2;
+    batch.len = 20;
+
+    create_batch_frame_ExpectAndReturn(batch.frames, 2, NULL);
+    put_msg_frame_Expect(&frame1);
+    put_msg_frame_Expect(&frame2);
+    flush_broadcast_batch(&batch, &test_budget, &users);
+
+    TEST_ASSERT_EQUAL_INT(0, batch.num_frames);
+    TEST_ASSERT_FALSE(reader.remove_user);
+}
+
+void test_flush_broadcast_batch_pass(void) {
+    struct broadcast_batch batch;
+    struct user_info reader;
+    struct list_head users;
+    struct msg_frame frame1;
+    struct msg_frame frame2;
+    struct msg_frame batch_frame;
+
+    init_test_batch_users(&reader, &users);
+    batch.frames[0] = &frame1;
+    batch.frames[1] = &frame2;
+    batch.num_frames = 2;
+    batch.len = 20;
+    batch_frame.len = 14;
+
+    // only the reader's full queue sees the batch frame
+    create_batch_frame_ExpectAndReturn(batch.frames, 2, &batch_frame);
+    add_stat_Expect(STAT_BATCHES, 1);
+    add_stat_Expect(STAT_SLOW_DISCONNECTS, 1);
+    put_msg_frame_Expect(&batch_frame);
+    put_msg_frame_Expect(&frame1);
+    put_msg_frame_Expect(&frame2);
+    flush_broadcast_batch(&batch, &test_budget, &users);
+
+    TEST_ASSERT_EQUAL_INT(0, batch.num_frames);
+    TEST_ASSERT_EQUAL_INT(0, batch.len);
+    TEST_ASSERT_TRUE(reader.remove_user);
+}
+
+void test_flush_broadcast_batch_pass_empty(void) {
+    struct broadcast_batch batch;
+    struct user_info reader;
+    struct list_head users;
+
+    init_test_batch_users(&reader, &users);
+    batch.num_frames = 0;
+    batch.len = 0;
+
+    flush_broadcast_batch(&batch, &test_budget, &users);
+
+    TEST_ASSERT_FALSE(reader.remove_user);
+}
+
+void test_flush_broadcast_batch_pass_single(void) {
+    struct broadcast_batch batch;
+    struct user_info reader;
+    struct list_head users;
+    struct msg_frame frame;
+
+    init_test_batch_users(&reader, &users);
+    batch.frames[0] = &frame;
+    batch.num_frames = 1;
+    batch.len = 10;
+    frame.len = 10;
+
+    // a single broadcast is not copied into a batch frame
+    get_msg_frame_ExpectAndReturn(&frame, &frame);
+    add_stat_Expect(STAT_SLOW_DISCONNECTS, 1);
+    put_msg_frame_Expect(&frame);
+    put_msg_frame_Expect(&frame);
+    flush_broadcast_batch(&batch, &test_budget, &users);
+
+    TEST_ASSERT_EQUAL_INT(0, batch.num_frames);
+    TEST_ASSERT_TRUE(reader.remove_user);
+}
+
+void test_flush_user_sends_fail_send(void) {
+    struct user_info user;
+    struct test_send send;
+    struct iovec iov;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&send, 10, 0);
+    list_add_tail(&send.send.list, &user.send_queue);
+    user.send_queue_len = 10;
+
+    iov.iov_base = send.frame.buf;
+    iov.iov_len = 10;
+    sendv_available_ExpectAndReturn(user.fd, &iov, 1, 0, -1);
+    ret = flush_user_sends(&user);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_PTR(&send.send.list, user.send_queue.next);
+}
+
+void test_flush_user_sends_pass(void) {
+    struct user_info user;
+    struct test_send send1;
+    struct test_send send2;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&send1, 10, 4);
+    init_test_send(&send2, 8, 0);
+    list_add_tail(&send1.send.list, &user.send_queue);
+    list_add_tail(&send2.send.list, &user.send_queue);
+    user.send_queue_len = 14;
+    user.prio_jumps = 2;
+
+    // both frames go out with one send
+    sendv_expected[0] = &send1;
+    sendv_expected[1] = &send2;
+    sendv_available_StubWithCallback(&sendv_available_two_frames);
+    put_msg_frame_Expect(&send1.frame);
+    os_free_Expect(&send1);
+    put_msg_frame_Expect(&send2.frame);
+    os_free_Expect(&send2);
+    del_timer_Expect(&user.stall_timer);
+    ret = flush_user_sends(&user);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_TRUE(list_empty(&user.send_queue));
+    TEST_ASSERT_EQUAL_INT(0, user.send_queue_len);
+    TEST_ASSERT_EQUAL_INT(0, user.prio_jumps);
+}
+
+void test_flush_user_sends_pass_cork(void) {
+    struct user_info user;
+    struct test_send send;
+    struct iovec iov;
+    int ret;
+
+    init_test_user(&user, 3);
+    user.cork = true;
+    init_test_send(&send, 10, 0);
+    list_add_tail(&send.send.list, &user.send_queue);
+    user.send_queue_len = 10;
+    user.send_queue_frames = 1;
+
+    // nothing follows the last send of a flush so it isn't corked
+    iov.iov_base = send.frame.buf;
+    iov.iov_len = 10;
+    sendv_available_ExpectAndReturn(user.fd, &iov, 1, 0, 10);
+    put_msg_frame_Expect(&send.frame);
+    os_free_Expect(&send);
+    del_timer_Expect(&user.stall_timer);
+    ret = flush_user_sends(&user);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_TRUE(list_empty(&user.send_queue));
+}
+
+void test_flush_user_sends_pass_deferred(void) {
+    struct user_info user;
+    struct test_send send;
+    struct iovec iov;
+    int ret;
+
+    init_test_user(&user, 3);
+    user.defer_stall_timer = true;
+    init_test_send(&send, 10, 0);
+    list_add_tail(&send.send.list, &user.send_queue);
+    user.send_queue_len = 10;
+
+    // a fanout worker leaves the stall timer to the user's own thread
+    iov.iov_base = send.frame.buf;
+    iov.iov_len = 10;
+    sendv_available_ExpectAndReturn(user.fd, &iov, 1, 0, 10);
+    put_msg_frame_Expect(&send.frame);
+    os_free_Expect(&send);
+    ret = flush_user_sends(&user);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_TRUE(user.stall_update);
+    TEST_ASSERT_TRUE(user.stall_sent);
+}
+
+void test_flush_user_sends_pass_partial(void) {
+    struct user_info user;
+    struct test_send send1;
+    struct test_send send2;
+    struct iovec iov;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&send1, 10, 0);
+    init_test_send(&send2, 8, 0);
+    list_add_tail(&send1.send.list, &user.send_queue);
+    list_add_tail(&send2.send.list, &user.send_queue);
+    user.send_queue_len = 18;
+
+    iov.iov_base = send1.frame.buf;
+    iov.iov_len = 10;
+    sendv_available_ExpectAndReturn(user.fd, &iov, 2, 0, 4);
+    mod_timer_Expect(&user.stall_timer, USER_STALL_TIMEOUT_MS);
+    ret = flush_user_sends(&user);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&send1.send.list, user.send_queue.next);
+    TEST_ASSERT_EQUAL_INT(4, send1.send.off);
+    TEST_ASSERT_EQUAL_INT(14, user.send_queue_len);
+}
+
+void test_flush_user_sends_pass_partial_spanning(void) {
+    struct user_info user;
+    struct test_send send1;
+    struct test_send send2;
+    struct iovec iov;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&send1, 10, 6);
+    init_test_send(&send2, 8, 0);
+    list_add_tail(&send1.send.list, &user.send_queue);
+    list_add_tail(&send2.send.list, &user.send_queue);
+    user.send_queue_len = 12;
+
+    // the rest of the first frame and part of the second one are sent
+    iov.iov_base = &send1.frame.buf[6];
+    iov.iov_len = 4;
+    sendv_available_ExpectAndReturn(user.fd, &iov, 2, 0, 7);
+    put_msg_frame_Expect(&send1.frame);
+    os_free_Expect(&send1);
+    mod_timer_Expect(&user.stall_timer, USER_STALL_TIMEOUT_MS);
+    ret = flush_user_sends(&user);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&send2.send.list, user.send_queue.next);
+    TEST_ASSERT_EQUAL_INT(3, send2.send.off);
+    TEST_ASSERT_EQUAL_INT(5, user.send_queue_len);
+}
+
+void test_flush_user_sends_pass_stalled(void) {
+    struct user_info user;
+    struct test_send send;
+    struct iovec iov;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&send, 10, 0);
+    list_add_tail(&send.send.list, &user.send_queue);
+    user.send_queue_len = 10;
+    iov.iov_base = send.frame.buf;
+    iov.iov_len = 10;
+
+    // the stall timer keeps running while nothing is sent
+    sendv_available_ExpectAndReturn(user.fd, &iov, 1, 0, 0);
+    timer_pending_ExpectAndReturn(&user.stall_timer, true);
+    ret = flush_user_sends(&user);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+
+    sendv_available_ExpectAndReturn(user.fd, &iov, 1, 0, 0);
+    timer_pending_ExpectAndReturn(&user.stall_timer, false);
+    mod_timer_Expect(&user.stall_timer, USER_STALL_TIMEOUT_MS);
+    ret = flush_user_sends(&user);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_INT(10, user.send_queue_len);
+}
+
+void test_flush_user_sends_pass_zerocopy(void) {
+    struct user_info user;
+    struct test_send send1;
+    struct test_send send2;
+    struct iovec iov;
+    int ret;
+
+    init_test_user(&user, 3);
+    user.zc_threshold = 16;
+    user.zc_next_id = 5;
+    init_test_send(&send1, 10, 0);
+    init_test_send(&send2, 8, 0);
+    list_add_tail(&send1.send.list, &user.send_queue);
+    list_add_tail(&send2.send.list, &user.send_queue);
+    user.send_queue_len = 18;
+
+    // the sent frame waits for its completion instead of being freed
+    iov.iov_base = send1.frame.buf;
+    iov.iov_len = 10;
+    sendv_available_ExpectAndReturn(user.fd, &iov, 2, MSG_ZEROCOPY, 14);
+    add_stat_Expect(STAT_ZEROCOPY_SENDS, 1);
+    mod_timer_Expect(&user.stall_timer, USER_STALL_TIMEOUT_MS);
+    ret = flush_user_sends(&user);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&send1.send.list, user.zc_queue.next);
+    TEST_ASSERT_EQUAL_INT(10, user.zc_queue_len);
+    TEST_ASSERT_EQUAL_INT(1, send1.send.zc_pending);
+    TEST_ASSERT_EQUAL_INT(5, send1.send.zc_last);
+    TEST_ASSERT_EQUAL_PTR(&send2.send.list, user.send_queue.next);
+    TEST_ASSERT_EQUAL_INT(4, send2.send.off);
+    TEST_ASSERT_EQUAL_INT(1, send2.send.zc_pending);
+    TEST_ASSERT_EQUAL_INT(5, send2.send.zc_first);
+    TEST_ASSERT_EQUAL_INT(4, user.send_queue_len);
+    TEST_ASSERT_EQUAL_INT(6, user.zc_next_id);
+}
+
+void test_flush_user_sends_pass_zerocopy_enobufs(void) {
+    struct user_info user;
+    struct test_send send;
+    struct iovec iov;
+    int ret;
+
+    init_test_user(&user, 3);
+    user.zc_threshold = 8;
+    init_test_send(&send, 10, 0);
+    list_add_tail(&send.send.list, &user.send_queue);
+    user.send_queue_len = 10;
+
+    iov.iov_base = send.frame.buf;
+    iov.iov_len = 10;
+    sendv_available_ExpectAndReturn(user.fd, &iov, 1, MSG_ZEROCOPY, -1);
+    os_get_error_ExpectAndReturn(ENOBUFS);
+    sendv_available_ExpectAndReturn(user.fd, &iov, 1, 0, 10);
+    put_msg_frame_Expect(&send.frame);
+    os_free_Expect(&send);
+    del_timer_Expect(&user.stall_timer);
+    ret = flush_user_sends(&user);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_TRUE(list_empty(&user.zc_queue));
+    TEST_ASSERT_EQUAL_INT(0, user.zc_next_id);
+}
+
+void test_get_user_from_fd_fail(void) {
+    struct user_info *slots[8] = {NULL};
+    struct user_table table = {slots, 8};
+
+    TEST_ASSERT_NULL(get_user_from_fd(4, &table));
+    TEST_ASSERT_NULL(get_user_from_fd(8, &table));
+    TEST_ASSERT_NULL(get_user_from_fd(-1, &table));
 }
 
 void test_get_user_from_fd_pass(void) {
-    int fd_known = 3;
-    const char *name = "John Doe";
+    struct user_info *slots[8] = {NULL};
+    struct user_table table = {slots, 8};
     struct user_info user1;
-    struct list_head users;
     struct user_info *ret;
 
-    user1.fd = fd_known;
-    user1.remove_user = false;
-    user1.name = (char *)name;
-    INIT_LIST_HEAD(&users);
-    list_add(&user1.list, &users);
+    slots[3] = &user1;
 
-    ret = get_user_from_fd(fd_known, &users);
+    ret = get_user_from_fd(3, &table);
 
-    TEST_ASSERT_NOT_NULL(ret);
     TEST_ASSERT_EQUAL_PTR(&user1, ret);
 }
 
@@ -280,18 +1063,468 @@ void test_init_list_head_pass(void) {
     TEST_ASSERT_EQUAL_PTR(&users, users.prev);
 }
 
+void test_queue_user_msg_fail_full(void) {
+    struct user_info user;
+    struct test_send frame;
+    int ret;
+
+    init_test_user(&user, 3);
+    user.send_queue_len = USER_SEND_QUEUE_MAX - 9;
+    frame.frame.len = 10;
+    frame.frame.prio = MSG_PRIO_CHAT;
+
+    add_stat_Expect(STAT_SLOW_DISCONNECTS, 1);
+    ret = queue_user_msg(&user, &frame.frame, &test_budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_queue_user_msg_fail_full_frames(void) {
+    struct user_info user;
+    struct test_send frame;
+    int ret;
+
+    init_test_user(&user, 3);
+    user.send_queue_len = 10;
+    user.send_queue_frames = USER_SEND_QUEUE_MAX_FRAMES;
+    frame.frame.len = 10;
+    frame.frame.prio = MSG_PRIO_CHAT;
+
+    add_stat_Expect(STAT_SLOW_DISCONNECTS, 1);
+    ret = queue_user_msg(&user, &frame.frame, &test_budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_queue_user_msg_fail_collapse(void) {
+    struct send_budget budget = {SEND_POLICY_COLLAPSE, 16, 16};
+    struct user_info user;
+    struct test_send partial;
+    struct test_send frame;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&partial, 16, 2);
+    list_add_tail(&partial.send.list, &user.send_queue);
+    user.send_queue_len = 14;
+    user.send_queue_frames = 1;
+    frame.frame.len = 10;
+    frame.frame.prio = MSG_PRIO_CHAT;
+
+    add_stat_Expect(STAT_SLOW_COLLAPSED, 1);
+    os_timestamp_ExpectAndReturn(0);
+    create_broadcast_frame_ExpectAnyArgsAndReturn(NULL);
+    ret = queue_user_msg(&user, &frame.frame, &budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+    TEST_ASSERT_EQUAL_INT(1, user.send_queue_frames);
+}
+
+void test_queue_user_msg_fail_malloc(void) {
+    struct user_info user;
+    struct test_send frame;
+    int ret;
+
+    init_test_user(&user, 3);
+    user.send_queue_len = 0;
+    frame.frame.len = 10;
+    frame.frame.prio = MSG_PRIO_CHAT;
+
+    os_malloc_ExpectAndReturn(sizeof(struct user_send), NULL);
+    ret = queue_user_msg(&user, &frame.frame, &test_budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, ret);
+}
+
+void test_queue_user_msg_pass_collapse(void) {
+    struct send_budget budget = {SEND_POLICY_COLLAPSE, 20, 16};
+    struct user_info user;
+    struct test_send partial;
+    struct test_send old_marker;
+    struct test_send old;
+    struct test_send marker;
+    struct test_send frame;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&partial, 8, 2);
+    init_test_send(&old_marker, 8, 0);
+    old_marker.send.missed = 3;
+    init_test_send(&old, 8, 0);
+    list_add_tail(&partial.send.list, &user.send_queue);
+    list_add_tail(&old_marker.send.list, &user.send_queue);
+    list_add_tail(&old.send.list, &user.send_queue);
+    user.send_queue_len = 22;
+    user.send_queue_frames = 3;
+    frame.frame.len = 10;
+    frame.frame.prio = MSG_PRIO_CHAT;
+    marker.frame.len = 12;
+    marker.frame.prio = MSG_PRIO_CHAT;
+    marker_frame = &marker.frame;
+    marker_text = "you missed 5 messages";
+
+    // the old marker's 3, the old message and the new one
+    put_msg_frame_Expect(&old_marker.frame);
+    os_free_Expect(&old_marker.send);
+    put_msg_frame_Expect(&old.frame);
+    os_free_Expect(&old.send);
+    add_stat_Expect(STAT_SLOW_COLLAPSED, 2);
+    os_timestamp_ExpectAndReturn(0);
+    create_broadcast_frame_StubWithCallback(
+        &create_broadcast_frame_check_marker);
+    os_malloc_ExpectAndReturn(sizeof(struct user_send), &marker.send);
+    get_msg_frame_ExpectAndReturn(&marker.frame, &marker.frame);
+    put_msg_frame_Expect(&marker.frame);
+    ret = queue_user_msg(&user, &frame.frame, &budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&partial.send.list, user.send_queue.next);
+    TEST_ASSERT_EQUAL_PTR(&marker.send.list, user.send_queue.prev);
+    TEST_ASSERT_EQUAL_INT(5, marker.send.missed);
+    TEST_ASSERT_EQUAL_INT(18, user.send_queue_len);
+    TEST_ASSERT_EQUAL_INT(2, user.send_queue_frames);
+}
+
+void test_queue_user_msg_pass_collapse_system(void) {
+    struct send_budget budget = {SEND_POLICY_COLLAPSE, 16, 16};
+    struct user_info user;
+    struct test_send old;
+    struct test_send marker;
+    struct test_send send;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&old, 8, 0);
+    list_add_tail(&old.send.list, &user.send_queue);
+    user.send_queue_len = 8;
+    user.send_queue_frames = 1;
+    send.frame.len = 10;
+    send.frame.prio = MSG_PRIO_SYSTEM;
+    marker.frame.len = 12;
+    marker.frame.prio = MSG_PRIO_CHAT;
+    marker_frame = &marker.frame;
+    marker_text = "you missed 1 messages";
+
+    // the system message isn't counted, it is queued ahead of the marker
+    put_msg_frame_Expect(&old.frame);
+    os_free_Expect(&old.send);
+    add_stat_Expect(STAT_SLOW_COLLAPSED, 1);
+    os_timestamp_ExpectAndReturn(0);
+    create_broadcast_frame_StubWithCallback(
+        &create_broadcast_frame_check_marker);
+    os_malloc_ExpectAndReturn(sizeof(struct user_send), &marker.send);
+    get_msg_frame_ExpectAndReturn(&marker.frame, &marker.frame);
+    put_msg_frame_Expect(&marker.frame);
+    os_malloc_ExpectAndReturn(sizeof(struct user_send), &send.send);
+    get_msg_frame_ExpectAndReturn(&send.frame, &send.frame);
+    ret = queue_user_msg(&user, &send.frame, &budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&send.send.list, user.send_queue.next);
+    TEST_ASSERT_EQUAL_PTR(&marker.send.list, user.send_queue.prev);
+    TEST_ASSERT_EQUAL_INT(1, marker.send.missed);
+    TEST_ASSERT_EQUAL_INT(22, user.send_queue_len);
+}
+
+void test_queue_user_msg_pass_collapse_system_no_chat(void) {
+    struct send_budget budget = {SEND_POLICY_COLLAPSE, 16, 16};
+    struct user_info user;
+    struct test_send old;
+    struct test_send frame;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&old, 8, 0);
+    old.frame.prio = MSG_PRIO_SYSTEM;
+    list_add_tail(&old.send.list, &user.send_queue);
+    user.send_queue_len = 8;
+    user.send_queue_frames = 1;
+    frame.frame.len = 10;
+    frame.frame.prio = MSG_PRIO_SYSTEM;
+
+    add_stat_Expect(STAT_SLOW_DROPPED_NEWEST, 1);
+    ret = queue_user_msg(&user, &frame.frame, &budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&old.send.list, user.send_queue.prev);
+    TEST_ASSERT_EQUAL_INT(8, user.send_queue_len);
+}
+
+void test_queue_user_msg_pass_drop_newest(void) {
+    struct send_budget budget = {SEND_POLICY_DROP_NEWEST, 16, 16};
+    struct user_info user;
+    struct test_send old;
+    struct test_send frame;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&old, 8, 0);
+    list_add_tail(&old.send.list, &user.send_queue);
+    user.send_queue_len = 8;
+    user.send_queue_frames = 1;
+    frame.frame.len = 10;
+    frame.frame.prio = MSG_PRIO_CHAT;
+
+    add_stat_Expect(STAT_SLOW_DROPPED_NEWEST, 1);
+    ret = queue_user_msg(&user, &frame.frame, &budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&old.send.list, user.send_queue.prev);
+    TEST_ASSERT_EQUAL_INT(8, user.send_queue_len);
+}
+
+void test_queue_user_msg_pass_drop_newest_system(void) {
+    struct send_budget budget = {SEND_POLICY_DROP_NEWEST, 20, 16};
+    struct user_info user;
+    struct test_send old1;
+    struct test_send old2;
+    struct test_send send;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&old1, 8, 0);
+    init_test_send(&old2, 8, 0);
+    list_add_tail(&old1.send.list, &user.send_queue);
+    list_add_tail(&old2.send.list, &user.send_queue);
+    user.send_queue_len = 16;
+    user.send_queue_frames = 2;
+    send.frame.len = 10;
+    send.frame.prio = MSG_PRIO_SYSTEM;
+
+    // the newest chat makes room, the system message passes the rest
+    put_msg_frame_Expect(&old2.frame);
+    os_free_Expect(&old2.send);
+    add_stat_Expect(STAT_SLOW_DROPPED_NEWEST, 1);
+    os_malloc_ExpectAndReturn(sizeof(struct user_send), &send.send);
+    get_msg_frame_ExpectAndReturn(&send.frame, &send.frame);
+    ret = queue_user_msg(&user, &send.frame, &budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&send.send.list, user.send_queue.next);
+    TEST_ASSERT_EQUAL_PTR(&old1.send.list, user.send_queue.prev);
+    TEST_ASSERT_EQUAL_INT(18, user.send_queue_len);
+    TEST_ASSERT_EQUAL_INT(2, user.send_queue_frames);
+}
+
+void test_queue_user_msg_pass_drop_oldest(void) {
+    struct send_budget budget = {SEND_POLICY_DROP_OLDEST, 20, 16};
+    struct user_info user;
+    struct test_send partial;
+    struct test_send old1;
+    struct test_send old2;
+    struct test_send send;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&partial, 8, 2);
+    init_test_send(&old1, 8, 0);
+    init_test_send(&old2, 8, 0);
+    list_add_tail(&partial.send.list, &user.send_queue);
+    list_add_tail(&old1.send.list, &user.send_queue);
+    list_add_tail(&old2.send.list, &user.send_queue);
+    user.send_queue_len = 22;
+    user.send_queue_frames = 3;
+    send.frame.len = 10;
+    send.frame.prio = MSG_PRIO_CHAT;
+
+    // the partly sent message stays, both old ones make room
+    put_msg_frame_Expect(&old1.frame);
+    os_free_Expect(&old1.send);
+    put_msg_frame_Expect(&old2.frame);
+    os_free_Expect(&old2.send);
+    add_stat_Expect(STAT_SLOW_DROPPED_OLDEST, 2);
+    os_malloc_ExpectAndReturn(sizeof(struct user_send), &send.send);
+    get_msg_frame_ExpectAndReturn(&send.frame, &send.frame);
+    ret = queue_user_msg(&user, &send.frame, &budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&partial.send.list, user.send_queue.next);
+    TEST_ASSERT_EQUAL_PTR(&send.send.list, user.send_queue.prev);
+    TEST_ASSERT_EQUAL_INT(16, user.send_queue_len);
+    TEST_ASSERT_EQUAL_INT(2, user.send_queue_frames);
+}
+
+void test_queue_user_msg_pass_drop_oldest_chat_first(void) {
+    struct send_budget budget = {SEND_POLICY_DROP_OLDEST, 20, 16};
+    struct user_info user;
+    struct test_send system;
+    struct test_send old;
+    struct test_send send;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&system, 8, 0);
+    system.frame.prio = MSG_PRIO_SYSTEM;
+    init_test_send(&old, 8, 0);
+    list_add_tail(&system.send.list, &user.send_queue);
+    list_add_tail(&old.send.list, &user.send_queue);
+    user.send_queue_len = 16;
+    user.send_queue_frames = 2;
+    send.frame.len = 10;
+    send.frame.prio = MSG_PRIO_CHAT;
+
+    // the older system message stays
+    put_msg_frame_Expect(&old.frame);
+    os_free_Expect(&old.send);
+    add_stat_Expect(STAT_SLOW_DROPPED_OLDEST, 1);
+    os_malloc_ExpectAndReturn(sizeof(struct user_send), &send.send);
+    get_msg_frame_ExpectAndReturn(&send.frame, &send.frame);
+    ret = queue_user_msg(&user, &send.frame, &budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&system.send.list, user.send_queue.next);
+    TEST_ASSERT_EQUAL_PTR(&send.send.list, user.send_queue.prev);
+    TEST_ASSERT_EQUAL_INT(18, user.send_queue_len);
+}
+
+void test_queue_user_msg_pass_drop_oldest_too_big(void) {
+    struct send_budget budget = {SEND_POLICY_DROP_OLDEST, 16, 16};
+    struct user_info user;
+    struct test_send partial;
+    struct test_send frame;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&partial, 16, 2);
+    list_add_tail(&partial.send.list, &user.send_queue);
+    user.send_queue_len = 14;
+    user.send_queue_frames = 1;
+    frame.frame.len = 10;
+    frame.frame.prio = MSG_PRIO_CHAT;
+
+    add_stat_Expect(STAT_SLOW_DROPPED_OLDEST, 1);
+    ret = queue_user_msg(&user, &frame.frame, &budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&partial.send.list, user.send_queue.prev);
+    TEST_ASSERT_EQUAL_INT(14, user.send_queue_len);
+}
+
+void test_queue_user_msg_pass_flush(void) {
+    struct user_info user;
+    struct test_send send;
+    struct iovec iov;
+    int ret;
+
+    init_test_user(&user, 3);
+    user.send_queue_len = 0;
+    send.frame.len = 10;
+    send.frame.prio = MSG_PRIO_CHAT;
+
+    os_malloc_ExpectAndReturn(sizeof(struct user_send), &send.send);
+    get_msg_frame_ExpectAndReturn(&send.frame, &send.frame);
+    iov.iov_base = send.frame.buf;
+    iov.iov_len = 10;
+    sendv_available_ExpectAndReturn(user.fd, &iov, 1, 0, 10);
+    put_msg_frame_Expect(&send.frame);
+    os_free_Expect(&send.send);
+    del_timer_Expect(&user.stall_timer);
+    ret = queue_user_msg(&user, &send.frame, &test_budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_TRUE(list_empty(&user.send_queue));
+    TEST_ASSERT_EQUAL_INT(0, user.send_queue_len);
+}
+
+void test_queue_user_msg_pass_queued(void) {
+    struct user_info user;
+    struct test_send pending;
+    struct test_send send;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&pending, 8, 2);
+    list_add_tail(&pending.send.list, &user.send_queue);
+    user.send_queue_len = 6;
+    send.frame.len = 10;
+    send.frame.prio = MSG_PRIO_CHAT;
+
+    os_malloc_ExpectAndReturn(sizeof(struct user_send), &send.send);
+    get_msg_frame_ExpectAndReturn(&send.frame, &send.frame);
+    ret = queue_user_msg(&user, &send.frame, &test_budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&send.send.list, user.send_queue.prev);
+    TEST_ASSERT_EQUAL_INT(16, user.send_queue_len);
+    TEST_ASSERT_EQUAL_PTR(&send.frame, send.send.frame);
+    TEST_ASSERT_EQUAL_INT(0, send.send.off);
+}
+
+void test_queue_user_msg_pass_system(void) {
+    struct user_info user;
+    struct test_send partial;
+    struct test_send old;
+    struct test_send send;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&partial, 8, 2);
+    init_test_send(&old, 8, 0);
+    list_add_tail(&partial.send.list, &user.send_queue);
+    list_add_tail(&old.send.list, &user.send_queue);
+    user.send_queue_len = 14;
+    user.send_queue_frames = 2;
+    send.frame.len = 10;
+    send.frame.prio = MSG_PRIO_SYSTEM;
+
+    // the partly sent message goes on, the unsent chat waits
+    os_malloc_ExpectAndReturn(sizeof(struct user_send), &send.send);
+    get_msg_frame_ExpectAndReturn(&send.frame, &send.frame);
+    ret = queue_user_msg(&user, &send.frame, &test_budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&send.send.list, partial.send.list.next);
+    TEST_ASSERT_EQUAL_PTR(&old.send.list, send.send.list.next);
+    TEST_ASSERT_EQUAL_INT(1, user.prio_jumps);
+}
+
+void test_queue_user_msg_pass_system_max_jumps(void) {
+    struct user_info user;
+    struct test_send old;
+    struct test_send send;
+    int ret;
+
+    init_test_user(&user, 3);
+    init_test_send(&old, 8, 0);
+    list_add_tail(&old.send.list, &user.send_queue);
+    user.send_queue_len = 8;
+    user.send_queue_frames = 1;
+    user.prio_jumps = USER_PRIO_MAX_JUMPS;
+    send.frame.len = 10;
+    send.frame.prio = MSG_PRIO_SYSTEM;
+
+    // the oldest chat message was passed often enough
+    os_malloc_ExpectAndReturn(sizeof(struct user_send), &send.send);
+    get_msg_frame_ExpectAndReturn(&send.frame, &send.frame);
+    ret = queue_user_msg(&user, &send.frame, &test_budget);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, ret);
+    TEST_ASSERT_EQUAL_PTR(&old.send.list, user.send_queue.next);
+    TEST_ASSERT_EQUAL_PTR(&send.send.list, user.send_queue.prev);
+    TEST_ASSERT_EQUAL_INT(USER_PRIO_MAX_JUMPS, user.prio_jumps);
+}
+
 void test_remove_flagged_users_pass(void) {
+    int epollfd = 5;
     int fd_user1 = 3;
     int fd_user2 = 4;
     const char *name1 = "John Doe";
     const char *name2 = "Jane Doe";
     struct user_info user1;
     struct user_info user2;
+    struct test_send send;
+    struct user_info *slots[8] = {NULL};
+    struct user_table table = {slots, 8};
     struct list_head users;
+    struct list_head read_backlog;
 
-    user1.fd = fd_user1;
+    init_test_user(&user1, fd_user1);
     user1.remove_user = true;
     user1.name = (char *)name1;
+    init_test_send(&send, 8, 2);
+    list_add_tail(&send.send.list, &user1.send_queue);
+    INIT_LIST_HEAD(&read_backlog);
+    list_add_tail(&user1.read_list, &read_backlog);
 
     user2.fd = fd_user2;
     user2.remove_user = false;
@@ -300,90 +1533,592 @@ void test_remove_flagged_users_pass(void) {
     INIT_LIST_HEAD(&users);
     list_add(&user1.list, &users);
     list_add(&user2.list, &users);
+    slots[fd_user1] = &user1;
+    slots[fd_user2] = &user2;
 
+    os_epoll_ctl_ExpectAndReturn(epollfd, EPOLL_CTL_DEL, user1.fd, NULL, 0);
     os_free_Expect(user1.name);
     os_close_ExpectAndReturn(user1.fd, 0);
+    del_timer_Expect(&user1.idle_timer);
+    del_timer_Expect(&user1.stall_timer);
+    exit_msg_reader_Expect(&user1.reader);
+    put_msg_frame_Expect(&send.frame);
+    os_free_Expect(&send);
     os_free_Expect(&user1);
 
-    remove_flagged_users(&users);
+    remove_flagged_users(epollfd, &users, &table, NULL);
 
     TEST_ASSERT_EQUAL_PTR(users.prev, &user2.list);
     TEST_ASSERT_EQUAL_PTR(user2.list.next, &users);
+    TEST_ASSERT_TRUE(list_empty(&read_backlog));
+    TEST_ASSERT_NULL(slots[fd_user1]);
+    TEST_ASSERT_EQUAL_PTR(&user2, slots[fd_user2]);
+}
+
+static int closed_fd;
+
+void test_close_user(int fd) {
+    closed_fd = fd;
+}
+
+void test_remove_flagged_users_pass_closer(void) {
+    struct user_info user;
+    struct user_info *slots[8] = {NULL};
+    struct user_table table = {slots, 8};
+    struct list_head users;
+
+    init_test_user(&user, 3);
+    user.remove_user = true;
+    user.name = NULL;
+    INIT_LIST_HEAD(&users);
+    list_add(&user.list, &users);
+    slots[user.fd] = &user;
+    closed_fd = -1;
+
+    // not registered with epoll, the closer cancels the loop's requests
+    os_close_ExpectAndReturn(user.fd, 0);
+    del_timer_Expect(&user.idle_timer);
+    del_timer_Expect(&user.stall_timer);
+    os_free_Expect(NULL);
+    exit_msg_reader_Expect(&user.reader);
+    os_free_Expect(&user);
+
+    remove_flagged_users(-1, &users, &table, &test_close_user);
+
+    TEST_ASSERT_EQUAL_INT(user.fd, closed_fd);
+    TEST_ASSERT_TRUE(list_empty(&users));
+}
+
+void test_remove_flagged_users_pass_zerocopy(void) {
+    int epollfd = 5;
+    struct user_info user;
+    struct test_send send;
+    struct linger reset = {.l_onoff = 1, .l_linger = 0};
+    struct user_info *slots[8] = {NULL};
+    struct user_table table = {slots, 8};
+    struct list_head users;
+
+    init_test_user(&user, 3);
+    user.remove_user = true;
+    user.name = NULL;
+    init_test_send(&send, 8, 8);
+    send.send.zc_pending = 1;
+    list_add_tail(&send.send.list, &user.zc_queue);
+
+    INIT_LIST_HEAD(&users);
+    list_add(&user.list, &users);
+    slots[user.fd] = &user;
+
+    // the kernel must not read the frames after they are freed
+    os_epoll_ctl_ExpectAndReturn(epollfd, EPOLL_CTL_DEL, user.fd, NULL, 0);
+    os_setsockopt_ExpectAndReturn(user.fd,
+                                  SOL_SOCKET,
+                                  SO_LINGER,
+                                  &reset,
+                                  sizeof(reset),
+                                  0);
+    os_close_ExpectAndReturn(user.fd, 0);
+    del_timer_Expect(&user.idle_timer);
+    del_timer_Expect(&user.stall_timer);
+    os_free_Expect(NULL);
+    exit_msg_reader_Expect(&user.reader);
+    put_msg_frame_Expect(&send.frame);
+    os_free_Expect(&send);
+    os_free_Expect(&user);
+
+    remove_flagged_users(epollfd, &users, &table, NULL);
+
+    TEST_ASSERT_TRUE(list_empty(&users));
+    TEST_ASSERT_NULL(slots[user.fd]);
+}
+
+void test_restore_user_state_fail_ring_init(void) {
+    uint8_t in_buf[4];
+    struct user_state state = {3, NULL, in_buf, 4, NULL, 0, false, 0, 0, 0, 0};
+    struct user_info user;
+
+    ring_init_ExpectAndReturn(&user.reader.ring, 4, EXIT_FAILURE);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_FAILURE, restore_user_state(&user, &state));
+}
+
+void test_restore_user_state_pass(void) {
+    uint8_t in_buf[4];
+    uint8_t out_buf[6];
+    struct user_state state = {
+        3, NULL, in_buf, 4, out_buf, 6, false, 0, 0, 0, 0,
+    };
+    struct user_info user;
+    uint8_t reader_buf[4];
+    struct ring ring = {.buf = reader_buf, .cap = 4096};
+    struct test_send send;
+
+    INIT_LIST_HEAD(&user.send_queue);
+    user.send_queue_len = 0;
+    send.frame.len = 6;
+    send.frame.prio = MSG_PRIO_CHAT;
+
+    ring_init_ExpectAndReturn(&user.reader.ring, 4, EXIT_SUCCESS);
+    ring_init_ReturnMemThruPtr_ring(&ring, sizeof(ring));
+    os_memcpy_ExpectAndReturn(reader_buf, in_buf, 4, reader_buf);
+    ring_produce_Expect(&user.reader.ring, 4);
+    os_malloc_ExpectAndReturn(sizeof(struct user_send), &send.send);
+    create_msg_frame_ExpectAndReturn(6, &send.frame);
+    os_memcpy_ExpectAndReturn(send.frame.buf, out_buf, 6, send.frame.buf);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, restore_user_state(&user, &state));
+    TEST_ASSERT_EQUAL_PTR(reader_buf, user.reader.ring.buf);
+    TEST_ASSERT_EQUAL_PTR(&send.send.list, user.send_queue.next);
+    TEST_ASSERT_EQUAL_PTR(&send.frame, send.send.frame);
+    TEST_ASSERT_EQUAL_INT(0, send.send.off);
+    TEST_ASSERT_EQUAL_INT(6, user.send_queue_len);
+    TEST_ASSERT_FALSE(user.reader.streaming);
+}
+
+void test_restore_user_state_pass_stream(void) {
+    uint8_t in_buf[4];
+    struct user_state state = {
+        3, NULL, in_buf, 4, NULL, 0, true, 2, 100000, 99996, 0,
+    };
+    struct user_info user;
+    uint8_t reader_buf[4];
+    struct ring ring = {.buf = reader_buf, .cap = 4096};
+
+    ring_init_ExpectAndReturn(&user.reader.ring, 4, EXIT_SUCCESS);
+    ring_init_ReturnMemThruPtr_ring(&ring, sizeof(ring));
+    os_memcpy_ExpectAndReturn(reader_buf, in_buf, 4, reader_buf);
+    ring_produce_Expect(&user.reader.ring, 4);
+
+    TEST_ASSERT_EQUAL_INT(EXIT_SUCCESS, restore_user_state(&user, &state));
+    TEST_ASSERT_TRUE(user.reader.streaming);
+    TEST_ASSERT_EQUAL_UINT32(2, user.reader.stream.id);
+    TEST_ASSERT_EQUAL_UINT32(100000, user.reader.stream.len);
+    TEST_ASSERT_EQUAL_UINT32(99996, user.reader.stream_left);
 }
 
 void test_send_broadcast_msg_to_users_fail(void) {
     int fd = 3;
-    const char *name = "John Doe";
     struct user_info user1;
     struct list_head users;
-    struct msg_broadcast msg;
+    struct msg_broadcast msg = {.prio = MSG_PRIO_CHAT};
+    struct msg_frame frame;
 
-    msg.name = (char *)name;
     user1.fd = fd;
     user1.remove_user = false;
     INIT_LIST_HEAD(&users);
     list_add(&user1.list, &users);
 
-    send_broadcast_msg_ExpectAndReturn(fd, &msg, EXIT_FAILURE);
-    send_broadcast_msg_to_users(&msg, &users);
+    create_broadcast_frame_ExpectAndReturn(&msg, &frame);
+    expect_test_send(fd, &frame, EXIT_FAILURE);
+    put_msg_frame_Expect(&frame);
+    send_broadcast_msg_to_users(&msg,
+                                &send_test_frame,
+                                &test_budget,
+                                NULL,
+                                NULL,
+                                &users);
 
     TEST_ASSERT_TRUE(user1.remove_user);
 }
 
+void test_send_broadcast_msg_to_users_fail_create_frame(void) {
+    struct user_info user1;
+    struct list_head users;
+    struct msg_broadcast msg = {.prio = MSG_PRIO_CHAT};
+
+    user1.fd = 3;
+    user1.remove_user = false;
+    INIT_LIST_HEAD(&users);
+    list_add(&user1.list, &users);
+
+    create_broadcast_frame_ExpectAndReturn(&msg, NULL);
+    send_broadcast_msg_to_users(&msg,
+                                &send_test_frame,
+                                &test_budget,
+                                NULL,
+                                NULL,
+                                &users);
+
+    TEST_ASSERT_FALSE(user1.remove_user);
+}
+
 void test_send_broadcast_msg_to_users_pass(void) {
-    int fd = 3;
-    const char *name = "John Doe";
     struct user_info user1;
+    struct user_info user2;
     struct list_head users;
-    struct msg_broadcast msg;
+    struct msg_broadcast msg = {.prio = MSG_PRIO_CHAT};
+    struct msg_frame frame;
 
-    msg.name = (char *)name;
-    user1.fd = fd;
+    user1.fd = 3;
     user1.remove_user = false;
+    user2.fd = 4;
+    user2.remove_user = false;
     INIT_LIST_HEAD(&users);
     list_add(&user1.list, &users);
+    list_add(&user2.list, &users);
 
-    send_broadcast_msg_ExpectAndReturn(fd, &msg, EXIT_SUCCESS);
-    send_broadcast_msg_to_users(&msg, &users);
+    // every user gets the same frame
+    create_broadcast_frame_ExpectAndReturn(&msg, &frame);
+    expect_test_send(4, &frame, EXIT_SUCCESS);
+    expect_test_send(3, &frame, EXIT_SUCCESS);
+    put_msg_frame_Expect(&frame);
+    send_broadcast_msg_to_users(&msg,
+                                &send_test_frame,
+                                &test_budget,
+                                NULL,
+                                NULL,
+                                &users);
 
     TEST_ASSERT_FALSE(user1.remove_user);
+    TEST_ASSERT_FALSE(user2.remove_user);
+}
+
+void test_send_broadcast_msg_to_users_pass_batch(void) {
+    struct broadcast_batch batch;
+    struct user_info reader;
+    struct list_head users;
+    struct msg_broadcast msg = {.prio = MSG_PRIO_CHAT};
+    struct msg_frame frame;
+
+    init_test_batch_users(&reader, &users);
+    batch.num_frames = 0;
+    batch.len = 0;
+    batch.max_len = 100;
+    batch.window_ms = 5;
+    frame.len = 10;
+
+    // the plain user gets the frame right away, the reader with the batch
+    create_broadcast_frame_ExpectAndReturn(&msg, &frame);
+    os_monotonic_ms_ExpectAndReturn(100);
+    get_msg_frame_ExpectAndReturn(&frame, &frame);
+    expect_test_send(4, &frame, EXIT_SUCCESS);
+    put_msg_frame_Expect(&frame);
+    send_broadcast_msg_to_users(&msg,
+                                &send_test_frame,
+                                &test_budget,
+                                &batch,
+                                NULL,
+                                &users);
+
+    TEST_ASSERT_EQUAL_INT(1, batch.num_frames);
+    TEST_ASSERT_EQUAL_PTR(&frame, batch.frames[0]);
+    TEST_ASSERT_EQUAL_INT(10, batch.len);
+    TEST_ASSERT_EQUAL_INT(105, batch.deadline);
+    TEST_ASSERT_FALSE(reader.remove_user);
+}
+
+void test_send_broadcast_msg_to_users_pass_batch_full(void) {
+    struct broadcast_batch batch;
+    struct user_info reader;
+    struct list_head users;
+    struct msg_broadcast msg = {.prio = MSG_PRIO_CHAT};
+    struct msg_frame old;
+    struct msg_frame frame;
+
+    init_test_batch_users(&reader, &users);
+    reader.remove_user = true;
+    batch.frames[0] = &old;
+    batch.num_frames = 1;
+    batch.len = 95;
+    batch.max_len = 100;
+    batch.window_ms = 5;
+    batch.deadline = 90;
+    frame.len = 10;
+
+    // the waiting broadcast goes out first, the new one fills the batch
+    create_broadcast_frame_ExpectAndReturn(&msg, &frame);
+    get_msg_frame_ExpectAndReturn(&old, &old);
+    put_msg_frame_Expect(&old);
+    put_msg_frame_Expect(&old);
+    os_monotonic_ms_ExpectAndReturn(100);
+    get_msg_frame_ExpectAndReturn(&frame, &frame);
+    expect_test_send(4, &frame, EXIT_SUCCESS);
+    put_msg_frame_Expect(&frame);
+    send_broadcast_msg_to_users(&msg,
+                                &send_test_frame,
+                                &test_budget,
+                                &batch,
+                                NULL,
+                                &users);
+
+    TEST_ASSERT_EQUAL_INT(1, batch.num_frames);
+    TEST_ASSERT_EQUAL_PTR(&frame, batch.frames[0]);
+    TEST_ASSERT_EQUAL_INT(10, batch.len);
+    TEST_ASSERT_EQUAL_INT(105, batch.deadline);
+}
+
+void test_send_broadcast_msg_to_users_pass_batch_system(void) {
+    struct broadcast_batch batch;
+    struct user_info reader;
+    struct list_head users;
+    struct msg_broadcast msg = {.prio = MSG_PRIO_SYSTEM};
+    struct msg_frame frame;
+
+    init_test_batch_users(&reader, &users);
+    batch.num_frames = 0;
+    batch.len = 0;
+    frame.len = 10;
+
+    // system messages don't wait for the batch
+    create_broadcast_frame_ExpectAndReturn(&msg, &frame);
+    expect_test_send(3, &frame, EXIT_SUCCESS);
+    expect_test_send(4, &frame, EXIT_SUCCESS);
+    put_msg_frame_Expect(&frame);
+    send_broadcast_msg_to_users(&msg,
+                                &send_test_frame,
+                                &test_budget,
+                                &batch,
+                                NULL,
+                                &users);
+
+    TEST_ASSERT_EQUAL_INT(0, batch.num_frames);
+}
+
+static void run_fanout_serially(void **items,
+                                int num_items,
+                                fanout_func func,
+                                void *arg,
+                                int num_calls) {
+    UNUSED_PARAMETER(num_calls);
+
+    TEST_ASSERT_EQUAL_INT(1, num_items);
+    for (int i = 0; i < num_items; i++) {
+        func(items[i], arg);
+    }
+}
+
+void test_send_broadcast_msg_to_users_pass_fanout(void) {
+    struct user_fanout fanout = {.users = NULL, .num_users = 0, .cap = 0};
+    void *table[FANOUT_CHUNK_LEN];
+    struct user_info user1;
+    struct user_info user2;
+    struct test_send send;
+    struct list_head users;
+    struct msg_broadcast msg = {.prio = MSG_PRIO_CHAT};
+    struct iovec iov;
+
+    init_test_user(&user1, 3);
+    user1.remove_user = false;
+    init_test_user(&user2, 4);
+    user2.remove_user = true;
+    INIT_LIST_HEAD(&users);
+    list_add_tail(&user1.list, &users);
+    list_add_tail(&user2.list, &users);
+    send.frame.len = 10;
+    send.frame.prio = MSG_PRIO_CHAT;
+
+    // the flagged user is left out, the stall timer is updated afterwards
+    create_broadcast_frame_ExpectAndReturn(&msg, &send.frame);
+    os_realloc_ExpectAndReturn(NULL, sizeof(table), table);
+    run_fanout_StubWithCallback(&run_fanout_serially);
+    os_malloc_ExpectAndReturn(sizeof(struct user_send), &send.send);
+    get_msg_frame_ExpectAndReturn(&send.frame, &send.frame);
+    iov.iov_base = send.frame.buf;
+    iov.iov_len = 10;
+    sendv_available_ExpectAndReturn(user1.fd, &iov, 1, 0, 10);
+    put_msg_frame_Expect(&send.frame);
+    os_free_Expect(&send.send);
+    del_timer_Expect(&user1.stall_timer);
+    put_msg_frame_Expect(&send.frame);
+    send_broadcast_msg_to_users(&msg,
+                                NULL,
+                                &test_budget,
+                                NULL,
+                                &fanout,
+                                &users);
+
+    TEST_ASSERT_EQUAL_INT(1, fanout.num_users);
+    TEST_ASSERT_EQUAL_INT(FANOUT_CHUNK_LEN, fanout.cap);
+    TEST_ASSERT_FALSE(user1.stall_update);
+    TEST_ASSERT_FALSE(user1.defer_stall_timer);
 }
 
 void test_send_broadcast_msg_to_users_pass_no_send(void) {
-    int fd = 3;
-    const char *name = "John Doe";
     struct user_info user1;
     struct list_head users;
-    struct msg_broadcast msg;
+    struct msg_broadcast msg = {.prio = MSG_PRIO_CHAT};
 
-    msg.name = (char *)name;
-    user1.fd = fd;
+    user1.fd = 3;
     user1.remove_user = true;
     INIT_LIST_HEAD(&users);
     list_add(&user1.list, &users);
 
-    send_broadcast_msg_Stub(send_broadcast_msg_dont_call);
-    send_broadcast_msg_to_users(&msg, &users);
+    // nothing is encoded without a recipient
+    send_broadcast_msg_to_users(&msg,
+                                &send_test_frame,
+                                &test_budget,
+                                NULL,
+                                NULL,
+                                &users);
+}
+
+void test_send_broadcast_msg_to_users_pass_queue(void) {
+    struct user_info user1;
+    struct list_head users;
+    struct msg_broadcast msg = {.prio = MSG_PRIO_CHAT};
+    struct msg_frame frame;
+
+    user1.fd = 3;
+    user1.remove_user = false;
+    INIT_LIST_HEAD(&user1.send_queue);
+    user1.send_queue_len = USER_SEND_QUEUE_MAX;
+    user1.send_queue_frames = 1;
+    INIT_LIST_HEAD(&users);
+    list_add(&user1.list, &users);
+    frame.len = 10;
+
+    create_broadcast_frame_ExpectAndReturn(&msg, &frame);
+    add_stat_Expect(STAT_SLOW_DISCONNECTS, 1);
+    put_msg_frame_Expect(&frame);
+    send_broadcast_msg_to_users(&msg,
+                                NULL,
+                                &test_budget,
+                                NULL,
+                                NULL,
+                                &users);
+
+    TEST_ASSERT_TRUE(user1.remove_user);
+}
+
+void test_send_broadcast_msg_to_users_pass_stream(void) {
+    struct broadcast_batch batch;
+    struct user_info reader;
+    struct list_head users;
+    struct msg_stream stream;
+    struct msg_broadcast msg = {.prio = MSG_PRIO_CHAT, .stream = &stream};
+    struct msg_frame frame;
+
+    init_test_batch_users(&reader, &users);
+    reader.caps |= MSG_FLAG_V2;
+    stream.off = 4096;
+    batch.num_frames = 0;
+
+    // parts skip the batch and only go to users that read v2 frames
+    create_broadcast_frame_ExpectAndReturn(&msg, &frame);
+    expect_test_send(3, &frame, EXIT_SUCCESS);
+    put_msg_frame_Expect(&frame);
+    send_broadcast_msg_to_users(&msg,
+                                &send_test_frame,
+                                &test_budget,
+                                &batch,
+                                NULL,
+                                &users);
+
+    TEST_ASSERT_EQUAL_INT(0, batch.num_frames);
+    TEST_ASSERT_FALSE(reader.remove_user);
+    TEST_ASSERT_FALSE(batch_plain_user.remove_user);
+}
+
+void test_send_broadcast_msg_to_users_pass_stream_start(void) {
+    struct user_info reader;
+    struct list_head users;
+    struct msg_stream stream;
+    struct msg_broadcast msg = {
+        .name = (char *)"John Doe",
+        .prio = MSG_PRIO_CHAT,
+        .stream = &stream,
+    };
+    struct msg_frame part;
+    struct msg_frame notice;
+
+    init_test_batch_users(&reader, &users);
+    reader.caps |= MSG_FLAG_V2;
+    stream.off = 0;
+    stream.len = 100000;
+
+    // the first part is encoded once more as a notice for v1 users
+    create_broadcast_frame_ExpectAndReturn(&msg, &part);
+    expect_test_send(3, &part, EXIT_SUCCESS);
+    create_broadcast_frame_ExpectAnyArgsAndReturn(&notice);
+    expect_test_send(4, &notice, EXIT_SUCCESS);
+    put_msg_frame_Expect(&notice);
+    put_msg_frame_Expect(&part);
+    send_broadcast_msg_to_users(&msg,
+                                &send_test_frame,
+                                &test_budget,
+                                NULL,
+                                NULL,
+                                &users);
+
+    TEST_ASSERT_FALSE(reader.remove_user);
+    TEST_ASSERT_FALSE(batch_plain_user.remove_user);
 }
 
 /* not needed when using generate_test_runner.rb */
 int main(void) {
     UNITY_BEGIN();
+    RUN_TEST(test_add_new_user_fail_copy_msg_view);
     RUN_TEST(test_add_new_user_fail_malloc);
     RUN_TEST(test_add_new_user_pass);
-    RUN_TEST(test_copy_user_fds_pass);
+    RUN_TEST(test_add_pending_user_fail_malloc);
+    RUN_TEST(test_add_pending_user_fail_realloc);
+    RUN_TEST(test_add_pending_user_pass);
+    RUN_TEST(test_add_pending_user_pass_grow);
+    RUN_TEST(test_clear_broadcast_batch_pass);
+    RUN_TEST(test_clear_user_fanout_pass);
+    RUN_TEST(test_clear_user_table_pass);
+    RUN_TEST(test_complete_zerocopy_sends_pass);
+    RUN_TEST(test_complete_zerocopy_sends_pass_wrap);
+    RUN_TEST(test_copy_user_sends_fail_malloc);
+    RUN_TEST(test_copy_user_sends_pass);
     RUN_TEST(test_count_num_users_pass_count_0);
     RUN_TEST(test_count_num_users_pass_count_2);
+    RUN_TEST(test_count_queued_bytes_pass);
     RUN_TEST(test_create_broadcast_msg_user_joined_fail_malloc);
     RUN_TEST(test_create_broadcast_msg_user_joined_pass);
     RUN_TEST(test_create_broadcast_msg_user_left_fail_malloc);
     RUN_TEST(test_create_broadcast_msg_user_left_pass);
+    RUN_TEST(test_enable_user_zerocopy_fail_setsockopt);
+    RUN_TEST(test_enable_user_zerocopy_pass);
+    RUN_TEST(test_flag_all_users_pass);
+    RUN_TEST(test_flush_broadcast_batch_fail_create);
+    RUN_TEST(test_flush_broadcast_batch_pass);
+    RUN_TEST(test_flush_broadcast_batch_pass_empty);
+    RUN_TEST(test_flush_broadcast_batch_pass_single);
+    RUN_TEST(test_flush_user_sends_fail_send);
+    RUN_TEST(test_flush_user_sends_pass);
+    RUN_TEST(test_flush_user_sends_pass_cork);
+    RUN_TEST(test_flush_user_sends_pass_deferred);
+    RUN_TEST(test_flush_user_sends_pass_partial);
+    RUN_TEST(test_flush_user_sends_pass_partial_spanning);
+    RUN_TEST(test_flush_user_sends_pass_stalled);
+    RUN_TEST(test_flush_user_sends_pass_zerocopy);
+    RUN_TEST(test_flush_user_sends_pass_zerocopy_enobufs);
     RUN_TEST(test_get_user_from_fd_fail);
     RUN_TEST(test_get_user_from_fd_pass);
     RUN_TEST(test_init_list_head_pass);
+    RUN_TEST(test_queue_user_msg_fail_full);
+    RUN_TEST(test_queue_user_msg_fail_full_frames);
+    RUN_TEST(test_queue_user_msg_fail_collapse);
+    RUN_TEST(test_queue_user_msg_fail_malloc);
+    RUN_TEST(test_queue_user_msg_pass_collapse);
+    RUN_TEST(test_queue_user_msg_pass_collapse_system);
+    RUN_TEST(test_queue_user_msg_pass_collapse_system_no_chat);
+    RUN_TEST(test_queue_user_msg_pass_drop_newest);
+    RUN_TEST(test_queue_user_msg_pass_drop_newest_system);
+    RUN_TEST(test_queue_user_msg_pass_drop_oldest);
+    RUN_TEST(test_queue_user_msg_pass_drop_oldest_chat_first);
+    RUN_TEST(test_queue_user_msg_pass_drop_oldest_too_big);
+    RUN_TEST(test_queue_user_msg_pass_flush);
+    RUN_TEST(test_queue_user_msg_pass_queued);
+    RUN_TEST(test_queue_user_msg_pass_system);
+    RUN_TEST(test_queue_user_msg_pass_system_max_jumps);
     RUN_TEST(test_remove_flagged_users_pass);
+    RUN_TEST(test_remove_flagged_users_pass_closer);
+    RUN_TEST(test_remove_flagged_users_pass_zerocopy);
+    RUN_TEST(test_restore_user_state_fail_ring_init);
+    RUN_TEST(test_restore_user_state_pass);
+    RUN_TEST(test_restore_user_state_pass_stream);
     RUN_TEST(test_send_broadcast_msg_to_users_fail);
+    RUN_TEST(test_send_broadcast_msg_to_users_fail_create_frame);
     RUN_TEST(test_send_broadcast_msg_to_users_pass);
+    RUN_TEST(test_send_broadcast_msg_to_users_pass_batch);
+    RUN_TEST(test_send_broadcast_msg_to_users_pass_batch_full);
+    RUN_TEST(test_send_broadcast_msg_to_users_pass_batch_system);
+    RUN_TEST(test_send_broadcast_msg_to_users_pass_fanout);
     RUN_TEST(test_send_broadcast_msg_to_users_pass_no_send);
+    RUN_TEST(test_send_broadcast_msg_to_users_pass_queue);
+    RUN_TEST(test_send_broadcast_msg_to_users_pass_stream);
+    RUN_TEST(test_send_broadcast_msg_to_users_pass_stream_start);
     return UNITY_END();
 }